@@ -7,8 +7,22 @@
 -- NAND controller writes into (byte-at-a-time from rd_valid) and the PS
 -- reads from (word-at-a-time via AXI).
 --
+-- The page buffer has two banks (ping-pong). Each operation fills the bank
+-- selected by CTRL[5] when it is started, and the PAGE_BUF window shows the
+-- bank selected by BUF_BANK, so the PS can drain one page while the NAND
+-- engine reads the next into the other bank. With both bits left at 0 the
+-- behaviour is that of a single buffer.
+--
+-- While a bank fills, the capture path also keeps per-bank page statistics:
+-- the CRC-32 of the bytes (as nand_frame.h computes it), the bytes other
+-- than 0xFF and the 0 bits. The PS can then tell an erased page, checksum a
+-- page or count the bit flips in an erased one without reading the buffer.
+--
 -- Register Map (active address bits [14:0], byte-addressed):
---   0x0000  CTRL      [W]  bit 0: start, bits [3:1]: op_type (nand_op_t)
+--   0x0000  CTRL      [W]  bit 0: start, bits [6,3:1]: op_type (nand_op_t),
+--                          bit 5: bank the operation fills (latched on start)
+--                          (op_type 6/7: READ CACHE SEQUENTIAL / END, see
+--                          nand_flash_ctrl; 8: SET FEATURES)
 --   0x0004  STATUS    [R]  bit 0: busy, bit 1: done (sticky, W1C via CTRL[4]),
 --                          bit 2: rb_n state
 --   0x0008  ADDR_COL  [RW] Column address [15:0]
@@ -17,8 +31,22 @@
 --   0x0014  ID_LO     [R]  NAND ID bytes 0-3
 --   0x0018  ID_HI     [R]  NAND ID byte 4 [7:0]
 --   0x001C  NAND_STAT [R]  NAND status register byte
---   0x0020  PAGE_IDX  [R]  Number of bytes written into page buffer (last op)
+--   0x0020  PAGE_IDX  [R]  Number of bytes written into the BUF_BANK bank
+--                          (by the last op that filled it)
 --   0x0024  VERSION   [R]  Design version (0x4E414E44 = "NAND")
+--   0x0028  BUF_BANK  [RW] bit 0: bank shown in PAGE_BUF and PAGE_IDX
+--   0x002C  TIMING    [RW] Bus cycle timing in clocks, each phase lasting
+--                          its value plus one: [3:0] CLE/ALE/data setup,
+--                          [7:4] WE# low, [11:8] WE# high, [15:12] RE# low,
+--                          [19:16] RE# high, [23:20] RE# fall to data
+--                          sample (may reach the next fall: EDO). Resets to
+--                          the nand_pkg values (ONFI Mode 0); change only
+--                          while idle.
+--   0x0030  FEATURE   [RW] SET FEATURES P1 [7:0] .. P4 [31:24]; the feature
+--                          address is ADDR_COL[7:0]
+--   0x0034  PAGE_CRC  [R]  CRC-32 of the PAGE_IDX bytes in the BUF_BANK bank
+--   0x0038  NON_FF    [R]  Bytes of them other than 0xFF
+--   0x003C  ZEROS     [R]  0 bits in them
 --
 --   0x4000 - 0xBFFF  PAGE_BUF [R] Page buffer (up to 32 KB, 32-bit aligned)
 --     Read word at 0x4000 + 4*N to get page bytes [4N+3 : 4N]
@@ -82,9 +110,10 @@ end entity axi_nand_ctrl;
 
 architecture rtl of axi_nand_ctrl is
 
-    -- Page buffer: byte-addressable BRAM
+    -- Page buffer: byte-addressable BRAM, two banks of BUF_WORDS words
+    -- (bank 1 at word BUF_WORDS)
     constant BUF_WORDS : integer := (PAGE_BUF_DEPTH + 3) / 4;
-    type buf_array_t is array (0 to BUF_WORDS-1)
+    type buf_array_t is array (0 to 2*BUF_WORDS-1)
         of std_logic_vector(31 downto 0);
     signal page_buf    : buf_array_t := (others => (others => '0'));
 
@@ -100,13 +129,34 @@ architecture rtl of axi_nand_ctrl is
     signal ctrl_rd_valid  : std_logic;
     signal ctrl_id        : std_logic_vector(39 downto 0);
     signal ctrl_status    : std_logic_vector(7 downto 0);
+    signal ctrl_feat      : std_logic_vector(31 downto 0) := (others => '0');
+
+    -- TIMING register and its reset value
+    constant TIMING_RESET : std_logic_vector(23 downto 0) := std_logic_vector(
+        to_unsigned(T_REA, 4) & to_unsigned(T_REH, 4) & to_unsigned(T_RP, 4) &
+        to_unsigned(T_WH, 4) & to_unsigned(T_WP, 4) & to_unsigned(T_SETUP, 4));
+    signal reg_timing     : std_logic_vector(23 downto 0) := TIMING_RESET;
 
     -- Page buffer write pointer (byte index)
     signal buf_wr_idx     : unsigned(15 downto 0) := (others => '0');
 
+    -- Ping-pong bank selection and the byte count captured in each bank
+    type buf_len_t is array (0 to 1) of unsigned(15 downto 0);
+    signal buf_len        : buf_len_t := (others => (others => '0'));
+    signal fill_bank      : std_logic := '0';  -- bank the current op writes
+    signal rd_bank        : std_logic := '0';  -- bank visible to AXI reads
+
+    -- Page statistics of each bank, updated with every byte stored
+    type buf_crc_t is array (0 to 1) of std_logic_vector(31 downto 0);
+    type buf_cnt_t is array (0 to 1) of unsigned(19 downto 0);
+    signal buf_crc        : buf_crc_t := (others => (others => '1'));
+    signal buf_non_ff     : buf_len_t := (others => (others => '0'));
+    signal buf_zeros      : buf_cnt_t := (others => (others => '0'));
+
     -- Status register
     signal reg_busy       : std_logic := '0';
     signal reg_done       : std_logic := '0';
+    signal clr_done       : std_logic := '0';  -- CTRL[4] written (one cycle)
 
     -- AXI handshake
     signal axi_awready_r  : std_logic := '0';
@@ -141,6 +191,13 @@ begin
             addr_col    => ctrl_addr_col,
             addr_row    => ctrl_addr_row,
             rd_byte_cnt => ctrl_rd_cnt,
+            feat_data   => ctrl_feat,
+            tim_setup   => unsigned(reg_timing(3 downto 0)),
+            tim_wp      => unsigned(reg_timing(7 downto 4)),
+            tim_wh      => unsigned(reg_timing(11 downto 8)),
+            tim_rp      => unsigned(reg_timing(15 downto 12)),
+            tim_reh     => unsigned(reg_timing(19 downto 16)),
+            tim_rea     => unsigned(reg_timing(23 downto 20)),
             rd_data     => ctrl_rd_data,
             rd_valid    => ctrl_rd_valid,
             id_data     => ctrl_id,
@@ -159,20 +216,38 @@ begin
 
     ---------------------------------------------------------------------------
     -- Page buffer write logic: capture bytes from NAND into BRAM
-    -- Bytes are packed into 32-bit words, little-endian.
+    -- Bytes are packed into 32-bit words, little-endian. The bank's CRC and
+    -- counters take each byte in the same cycle (bytes arrive at most every
+    -- other clock, so the CRC needs no pipelining).
     ---------------------------------------------------------------------------
     process(s_axi_aclk)
         variable word_idx : integer;
         variable byte_pos : integer;  -- 0..3 within word
+        variable bank     : integer;  -- 0..1
         variable cur_word : std_logic_vector(31 downto 0);
     begin
         if rising_edge(s_axi_aclk) then
             if rst = '1' then
                 buf_wr_idx <= (others => '0');
+                buf_len    <= (others => (others => '0'));
+                buf_crc    <= (others => (others => '1'));
+                buf_non_ff <= (others => (others => '0'));
+                buf_zeros  <= (others => (others => '0'));
             else
+                if fill_bank = '1' then
+                    bank := 1;
+                else
+                    bank := 0;
+                end if;
+
                 -- Reset write pointer on new operation start
+                -- (fill_bank is latched in the same cycle as ctrl_start)
                 if ctrl_start = '1' then
-                    buf_wr_idx <= (others => '0');
+                    buf_wr_idx       <= (others => '0');
+                    buf_len(bank)    <= (others => '0');
+                    buf_crc(bank)    <= (others => '1');
+                    buf_non_ff(bank) <= (others => '0');
+                    buf_zeros(bank)  <= (others => '0');
                 end if;
 
                 -- Store incoming bytes
@@ -181,6 +256,7 @@ begin
                     byte_pos := to_integer(buf_wr_idx(1 downto 0));
 
                     if word_idx < BUF_WORDS then
+                        word_idx := word_idx + bank * BUF_WORDS;
                         cur_word := page_buf(word_idx);
                         case byte_pos is
                             when 0 => cur_word( 7 downto  0) := ctrl_rd_data;
@@ -192,7 +268,15 @@ begin
                         page_buf(word_idx) <= cur_word;
                     end if;
 
-                    buf_wr_idx <= buf_wr_idx + 1;
+                    buf_wr_idx    <= buf_wr_idx + 1;
+                    buf_len(bank) <= buf_wr_idx + 1;
+
+                    buf_crc(bank) <= crc32_byte(buf_crc(bank), ctrl_rd_data);
+                    if ctrl_rd_data /= x"FF" then
+                        buf_non_ff(bank) <= buf_non_ff(bank) + 1;
+                    end if;
+                    buf_zeros(bank) <= buf_zeros(bank) +
+                                       resize(zero_bits(ctrl_rd_data), 20);
                 end if;
             end if;
         end if;
@@ -211,8 +295,9 @@ begin
                 reg_busy <= ctrl_busy;
                 if ctrl_done = '1' then
                     reg_done <= '1';
+                elsif clr_done = '1' then
+                    reg_done <= '0';  -- W1C via CTRL[4] (pulse from write logic)
                 end if;
-                -- W1C: clear done when CTRL[4] written (handled in write logic)
             end if;
         end if;
     end process;
@@ -233,8 +318,13 @@ begin
                 axi_wready_r  <= '0';
                 axi_bvalid_r  <= '0';
                 ctrl_start    <= '0';
+                clr_done      <= '0';
+                fill_bank     <= '0';
+                rd_bank       <= '0';
+                reg_timing    <= TIMING_RESET;
             else
-                ctrl_start <= '0';  -- one-cycle pulse
+                ctrl_start <= '0';  -- one-cycle pulses
+                clr_done   <= '0';
 
                 -- Accept write address
                 if s_axi_awvalid = '1' and axi_awready_r = '0'
@@ -260,11 +350,13 @@ begin
                     case to_integer(unsigned(aw_latched(5 downto 0))) is
                         when 16#00# =>  -- CTRL register
                             if s_axi_wdata(0) = '1' and ctrl_busy = '0' then
-                                ctrl_op    <= op_decode(s_axi_wdata(3 downto 1));
+                                ctrl_op    <= op_decode(s_axi_wdata(6) &
+                                                        s_axi_wdata(3 downto 1));
+                                fill_bank  <= s_axi_wdata(5);
                                 ctrl_start <= '1';
                             end if;
                             if s_axi_wdata(4) = '1' then
-                                reg_done <= '0';  -- W1C done flag
+                                clr_done <= '1';  -- W1C done flag
                             end if;
 
                         when 16#08# =>  -- ADDR_COL
@@ -276,6 +368,15 @@ begin
                         when 16#10# =>  -- RD_COUNT
                             ctrl_rd_cnt <= unsigned(s_axi_wdata(15 downto 0));
 
+                        when 16#28# =>  -- BUF_BANK
+                            rd_bank <= s_axi_wdata(0);
+
+                        when 16#2C# =>  -- TIMING
+                            reg_timing <= s_axi_wdata(23 downto 0);
+
+                        when 16#30# =>  -- FEATURE
+                            ctrl_feat <= s_axi_wdata;
+
                         when others =>
                             null;  -- ignore writes to read-only / reserved
                     end case;
@@ -323,6 +424,9 @@ begin
                         buf_word_addr := to_integer(
                             unsigned(ar_latched(14 downto 2)) - 16#1000#);
                         if buf_word_addr >= 0 and buf_word_addr < BUF_WORDS then
+                            if rd_bank = '1' then
+                                buf_word_addr := buf_word_addr + BUF_WORDS;
+                            end if;
                             axi_rdata_r <= page_buf(buf_word_addr);
                         else
                             axi_rdata_r <= x"DEADBEEF";
@@ -333,7 +437,8 @@ begin
                             when 16#00# =>  -- CTRL (read back op type)
                                 axi_rdata_r <= (others => '0');
                                 axi_rdata_r(3 downto 1) <=
-                                    op_encode(ctrl_op);
+                                    op_encode(ctrl_op)(2 downto 0);
+                                axi_rdata_r(6) <= op_encode(ctrl_op)(3);
 
                             when 16#04# =>  -- STATUS
                                 axi_rdata_r <= (others => '0');
@@ -361,13 +466,53 @@ begin
                             when 16#1C# =>  -- NAND_STATUS
                                 axi_rdata_r <= x"000000" & ctrl_status;
 
-                            when 16#20# =>  -- PAGE_IDX
-                                axi_rdata_r <= x"0000" &
-                                    std_logic_vector(buf_wr_idx);
+                            when 16#20# =>  -- PAGE_IDX (BUF_BANK bank)
+                                if rd_bank = '1' then
+                                    axi_rdata_r <= x"0000" &
+                                        std_logic_vector(buf_len(1));
+                                else
+                                    axi_rdata_r <= x"0000" &
+                                        std_logic_vector(buf_len(0));
+                                end if;
 
                             when 16#24# =>  -- VERSION
                                 axi_rdata_r <= x"4E414E44";  -- "NAND"
 
+                            when 16#28# =>  -- BUF_BANK
+                                axi_rdata_r <= (others => '0');
+                                axi_rdata_r(0) <= rd_bank;
+
+                            when 16#2C# =>  -- TIMING
+                                axi_rdata_r <= x"00" & reg_timing;
+
+                            when 16#30# =>  -- FEATURE
+                                axi_rdata_r <= ctrl_feat;
+
+                            when 16#34# =>  -- PAGE_CRC (BUF_BANK bank)
+                                if rd_bank = '1' then
+                                    axi_rdata_r <= not buf_crc(1);
+                                else
+                                    axi_rdata_r <= not buf_crc(0);
+                                end if;
+
+                            when 16#38# =>  -- NON_FF (BUF_BANK bank)
+                                if rd_bank = '1' then
+                                    axi_rdata_r <= x"0000" &
+                                        std_logic_vector(buf_non_ff(1));
+                                else
+                                    axi_rdata_r <= x"0000" &
+                                        std_logic_vector(buf_non_ff(0));
+                                end if;
+
+                            when 16#3C# =>  -- ZEROS (BUF_BANK bank)
+                                if rd_bank = '1' then
+                                    axi_rdata_r <= x"000" &
+                                        std_logic_vector(buf_zeros(1));
+                                else
+                                    axi_rdata_r <= x"000" &
+                                        std_logic_vector(buf_zeros(0));
+                                end if;
+
                             when others =>
                                 axi_rdata_r <= (others => '0');
                         end case;
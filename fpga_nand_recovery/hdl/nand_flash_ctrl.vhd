@@ -2,8 +2,25 @@
 -- nand_flash_ctrl.vhd
 -- ONFI NAND Flash Controller — Low-level bus protocol engine
 --
--- Implements READ PAGE, READ ID, READ STATUS, READ PARAMETER PAGE, and RESET
--- operations with proper ONFI async Mode 0 timing.
+-- Implements READ PAGE, READ CACHE SEQUENTIAL / END, READ ID, READ STATUS,
+-- READ PARAMETER PAGE, SET FEATURES and RESET operations with ONFI async
+-- timing. The WE#/RE# cycle timings are inputs (reset values from nand_pkg,
+-- ONFI Mode 0); faster settings are meant to go with a SET FEATURES of the
+-- matching timing mode. Read cycles run back to back: a byte takes
+-- tim_rp + tim_reh + 2 clocks, or tim_rea + 1 if that is longer. The data is
+-- sampled tim_rea + 1 clocks after RE# falls, independently of when RE# rises:
+-- in the slow modes while RE# is still low, in the fast ones after it rises
+-- (the NAND holds its output tRHOH) or on the next fall (EDO, tRLOH).
+--
+-- Cache reads stream a run of consecutive pages without paying tR for each:
+--   OP_READ_PAGE with rd_byte_cnt = 0   00h-addr-30h, tR; page N is loaded
+--   OP_CACHE_SEQ (repeat)               31h, tRCBSY; page N moves to the
+--                                       cache register and is read out while
+--                                       the array loads page N+1
+--   OP_CACHE_END                        3Fh; the last page is read out and
+--                                       nothing more is loaded
+-- Every cache op reads from column 0. The run should be ended with
+-- OP_CACHE_END before any other operation, and not cross a block boundary.
 --
 -- Architecture: Two-level FSM
 --   seq_state : Operation sequencer (which phase of the operation)
@@ -41,6 +58,18 @@ entity nand_flash_ctrl is
         -- Number of bytes to read back (latched on cmd_start)
         rd_byte_cnt   : in  unsigned(15 downto 0);
 
+        -- SET FEATURES parameters P1 (bits 7:0) to P4 (latched on cmd_start);
+        -- the feature address is addr_col(7:0)
+        feat_data     : in  std_logic_vector(31 downto 0) := (others => '0');
+
+        -- Bus cycle timing in clocks; each phase lasts its value plus one
+        tim_setup     : in  unsigned(3 downto 0) := to_unsigned(T_SETUP, 4);
+        tim_wp        : in  unsigned(3 downto 0) := to_unsigned(T_WP, 4);
+        tim_wh        : in  unsigned(3 downto 0) := to_unsigned(T_WH, 4);
+        tim_rp        : in  unsigned(3 downto 0) := to_unsigned(T_RP, 4);
+        tim_reh       : in  unsigned(3 downto 0) := to_unsigned(T_REH, 4);
+        tim_rea       : in  unsigned(3 downto 0) := to_unsigned(T_REA, 4);
+
         -- Read data output
         rd_data       : out std_logic_vector(7 downto 0);
         rd_valid      : out std_logic;
@@ -73,7 +102,10 @@ architecture rtl of nand_flash_ctrl is
         SEQ_CE_ON,         -- Assert CE#, brief setup
         SEQ_CMD1,          -- Send first command byte (CLE cycle)
         SEQ_ADDR,          -- Send address bytes (ALE cycles, loop)
+        SEQ_ADL,           -- tADL before data input
+        SEQ_WRITE,         -- Send data bytes (SET FEATURES P1-P4, loop)
         SEQ_CMD2,          -- Send second command byte (READ PAGE confirm)
+        SEQ_WB,            -- tWB: let R/B# fall and pass the synchroniser
         SEQ_WAIT_RB,       -- Wait for R/B# to go high
         SEQ_POST_WAIT,     -- tRR / tWHR delay after ready
         SEQ_READ,          -- Read data bytes (RE# cycles, loop)
@@ -86,25 +118,32 @@ architecture rtl of nand_flash_ctrl is
     ---------------------------------------------------------------------------
     type bus_state_t is (
         BUS_IDLE,
-        BUS_WR_SETUP,     -- CLE/ALE + data driven; wait T_SETUP
-        BUS_WR_WE_LO,     -- WE# asserted low; wait T_WP
-        BUS_WR_WE_HI,     -- WE# released high; wait T_WH
-        BUS_RD_RE_LO,     -- RE# asserted low; wait T_RP
-        BUS_RD_CAPTURE     -- RE# released high; data captured; wait T_REH
+        BUS_WR_SETUP,     -- CLE/ALE + data driven; wait tim_setup
+        BUS_WR_WE_LO,     -- WE# asserted low; wait tim_wp
+        BUS_WR_WE_HI,     -- WE# released high; wait tim_wh
+        BUS_RD_RE_LO,     -- RE# asserted low; wait tim_rp
+        BUS_RD_CAPTURE     -- RE# released high; wait tim_reh and the sample
     );
 
     -- FSM registers
     signal seq         : seq_state_t := SEQ_IDLE;
-    signal bus         : bus_state_t := BUS_IDLE;
+    signal bus_state   : bus_state_t := BUS_IDLE;
 
-    -- Timing counter (shared by bus engine)
+    -- Timing counters: one for the bus engine, one for the sequencer's own
+    -- delays (each is driven by a single process)
     signal timer       : unsigned(17 downto 0) := (others => '0');
+    signal seq_timer   : unsigned(17 downto 0) := (others => '0');
+
+    -- Read data sample: tim_rea + 1 clocks after each RE# fall
+    signal rea_timer   : unsigned(3 downto 0) := (others => '0');
+    signal rd_sampling : std_logic := '0';  -- a sample is pending
 
     -- Latched operation parameters
     signal cur_op      : nand_op_t := OP_NOP;
     signal lat_col     : std_logic_vector(15 downto 0);
     signal lat_row     : std_logic_vector(23 downto 0);
     signal lat_rd_cnt  : unsigned(15 downto 0);
+    signal lat_feat    : std_logic_vector(31 downto 0);
 
     -- Address byte tracking
     signal addr_packed : std_logic_vector(39 downto 0);  -- 5 bytes
@@ -115,9 +154,13 @@ architecture rtl of nand_flash_ctrl is
     signal rd_idx      : unsigned(15 downto 0);
     signal rd_total    : unsigned(15 downto 0);
 
+    -- Data input byte tracking (SET FEATURES)
+    signal wr_idx      : unsigned(1 downto 0);
+
     -- Bus cycle control
     signal bus_go_wr   : std_logic;  -- start a write cycle
     signal bus_go_rd   : std_logic;  -- start a read cycle
+    signal bus_rd_more : std_logic;  -- another read follows this one
     signal bus_wr_byte : std_logic_vector(7 downto 0);  -- data to write
     signal bus_cle     : std_logic;  -- CLE value during write
     signal bus_ale     : std_logic;  -- ALE value during write
@@ -147,6 +190,7 @@ architecture rtl of nand_flash_ctrl is
     signal op_has_cmd2 : std_logic;
     signal op_has_wait : std_logic;
     signal op_has_read : std_logic;
+    signal op_has_wdata : std_logic;
 
 begin
 
@@ -167,6 +211,9 @@ begin
 
     rb_safe <= rb_sync(2);
 
+    -- The bus engine starts the next read itself while bytes remain
+    bus_rd_more <= '1' when seq = SEQ_READ and rd_idx + 1 < rd_total else '0';
+
     ---------------------------------------------------------------------------
     -- R/B# synchroniser (three-stage for metastability protection)
     ---------------------------------------------------------------------------
@@ -182,6 +229,7 @@ begin
     ---------------------------------------------------------------------------
     process(cur_op)
     begin
+        op_has_wdata <= '0';
         case cur_op is
             when OP_READ_PAGE =>
                 op_has_addr <= '1'; op_has_cmd2 <= '1';
@@ -198,6 +246,13 @@ begin
             when OP_READ_PARAM =>
                 op_has_addr <= '1'; op_has_cmd2 <= '0';
                 op_has_wait <= '1'; op_has_read <= '1';
+            when OP_CACHE_SEQ | OP_CACHE_END =>
+                op_has_addr <= '0'; op_has_cmd2 <= '0';
+                op_has_wait <= '1'; op_has_read <= '1';
+            when OP_SET_FEATURES =>
+                op_has_addr <= '1'; op_has_cmd2 <= '0';
+                op_has_wait <= '1'; op_has_read <= '0';
+                op_has_wdata <= '1';
             when others =>
                 op_has_addr <= '0'; op_has_cmd2 <= '0';
                 op_has_wait <= '0'; op_has_read <= '0';
@@ -212,9 +267,10 @@ begin
     begin
         if rising_edge(clk) then
             if rst = '1' then
-                bus      <= BUS_IDLE;
+                bus_state <= BUS_IDLE;
                 timer    <= (others => '0');
                 bus_done <= '0';
+                rd_sampling <= '0';
                 r_we_n   <= '1';
                 r_re_n   <= '1';
                 r_cle    <= '0';
@@ -224,7 +280,18 @@ begin
             else
                 bus_done <= '0';
 
-                case bus is
+                -- Read data sample, which may fall in the next byte's cycle
+                -- (the case below starts that cycle after this)
+                if rd_sampling = '1' then
+                    if rea_timer = 0 then
+                        bus_rd_byte <= nand_io_i;  -- capture data
+                        rd_sampling <= '0';
+                    else
+                        rea_timer <= rea_timer - 1;
+                    end if;
+                end if;
+
+                case bus_state is
                     --------------------------------------------------------
                     when BUS_IDLE =>
                         if bus_go_wr = '1' then
@@ -233,16 +300,18 @@ begin
                             r_ale   <= bus_ale;
                             r_io_o  <= bus_wr_byte;
                             r_io_t  <= '0';       -- drive bus
-                            timer   <= to_unsigned(T_SETUP, timer'length);
-                            bus     <= BUS_WR_SETUP;
+                            timer   <= resize(tim_setup, timer'length);
+                            bus_state <= BUS_WR_SETUP;
                         elsif bus_go_rd = '1' then
                             -- Begin read cycle: tristate bus, assert RE#
                             r_io_t  <= '1';       -- tristate
                             r_cle   <= '0';
                             r_ale   <= '0';
-                            timer   <= to_unsigned(T_RP, timer'length);
+                            timer   <= resize(tim_rp, timer'length);
                             r_re_n  <= '0';
-                            bus     <= BUS_RD_RE_LO;
+                            rea_timer   <= tim_rea;
+                            rd_sampling <= '1';
+                            bus_state <= BUS_RD_RE_LO;
                         end if;
 
                     --------------------------------------------------------
@@ -251,8 +320,8 @@ begin
                     when BUS_WR_SETUP =>
                         if timer = 0 then
                             r_we_n <= '0';  -- assert WE#
-                            timer  <= to_unsigned(T_WP, timer'length);
-                            bus    <= BUS_WR_WE_LO;
+                            timer  <= resize(tim_wp, timer'length);
+                            bus_state <= BUS_WR_WE_LO;
                         else
                             timer <= timer - 1;
                         end if;
@@ -260,8 +329,8 @@ begin
                     when BUS_WR_WE_LO =>
                         if timer = 0 then
                             r_we_n <= '1';  -- release WE# (data latched on rising edge)
-                            timer  <= to_unsigned(T_WH, timer'length);
-                            bus    <= BUS_WR_WE_HI;
+                            timer  <= resize(tim_wh, timer'length);
+                            bus_state <= BUS_WR_WE_HI;
                         else
                             timer <= timer - 1;
                         end if;
@@ -272,7 +341,7 @@ begin
                             r_ale    <= '0';
                             r_io_t   <= '1';  -- tristate bus
                             bus_done <= '1';
-                            bus      <= BUS_IDLE;
+                            bus_state <= BUS_IDLE;
                         else
                             timer <= timer - 1;
                         end if;
@@ -282,20 +351,29 @@ begin
                     --------------------------------------------------------
                     when BUS_RD_RE_LO =>
                         if timer = 0 then
-                            bus_rd_byte <= nand_io_i;  -- capture data
                             r_re_n      <= '1';        -- release RE#
-                            timer       <= to_unsigned(T_REH, timer'length);
-                            bus         <= BUS_RD_CAPTURE;
+                            timer       <= resize(tim_reh, timer'length);
+                            bus_state   <= BUS_RD_CAPTURE;
                         else
                             timer <= timer - 1;
                         end if;
 
                     when BUS_RD_CAPTURE =>
-                        if timer = 0 then
-                            bus_done <= '1';
-                            bus      <= BUS_IDLE;
-                        else
+                        if timer /= 0 then
                             timer <= timer - 1;
+                        elsif rd_sampling = '0' or rea_timer = 0 then
+                            -- Sampled by now or on this edge
+                            bus_done <= '1';
+                            if bus_rd_more = '1' then
+                                -- Next byte straight away, as from BUS_IDLE
+                                timer  <= resize(tim_rp, timer'length);
+                                r_re_n <= '0';
+                                rea_timer   <= tim_rea;
+                                rd_sampling <= '1';
+                                bus_state <= BUS_RD_RE_LO;
+                            else
+                                bus_state <= BUS_IDLE;
+                            end if;
                         end if;
 
                 end case;
@@ -334,6 +412,7 @@ begin
                 when OP_READ_ID    => return to_unsigned(5, 16);
                 when OP_READ_STATUS => return to_unsigned(1, 16);
                 when OP_READ_PARAM => return cnt;   -- typically 256
+                when OP_CACHE_SEQ | OP_CACHE_END => return cnt;
                 when others        => return to_unsigned(0, 16);
             end case;
         end function;
@@ -345,6 +424,7 @@ begin
                 when OP_READ_PAGE  => return to_unsigned(5, 3);  -- 2 col + 3 row
                 when OP_READ_ID    => return to_unsigned(1, 3);  -- 1 byte (0x00)
                 when OP_READ_PARAM => return to_unsigned(1, 3);  -- 1 byte (0x00)
+                when OP_SET_FEATURES => return to_unsigned(1, 3);  -- feature address
                 when others        => return to_unsigned(0, 3);
             end case;
         end function;
@@ -359,6 +439,9 @@ begin
                 when OP_READ_STATUS => return CMD_READ_STATUS;
                 when OP_RESET       => return CMD_RESET;
                 when OP_READ_PARAM  => return CMD_READ_PARAM;
+                when OP_CACHE_SEQ   => return CMD_CACHE_SEQ;
+                when OP_CACHE_END   => return CMD_CACHE_END;
+                when OP_SET_FEATURES => return CMD_SET_FEATURES;
                 when others         => return x"00";
             end case;
         end function;
@@ -393,8 +476,9 @@ begin
                             lat_col   <= addr_col;
                             lat_row   <= addr_row;
                             lat_rd_cnt <= rd_byte_cnt;
+                            lat_feat  <= feat_data;
                             cmd_busy  <= '1';
-                            timer     <= to_unsigned(T_CE_SETUP, timer'length);
+                            seq_timer <= to_unsigned(T_CE_SETUP, seq_timer'length);
                             r_ce_n    <= '0';  -- assert CE#
                             seq       <= SEQ_CE_ON;
                         end if;
@@ -402,13 +486,14 @@ begin
                     ----------------------------------------------------
                     when SEQ_CE_ON =>
                         -- Wait a brief setup time after CE# assertion
-                        if timer = 0 then
+                        if seq_timer = 0 then
                             -- Pack address bytes: col_lo, col_hi, row0, row1, row2
                             addr_packed <= lat_row & lat_col;
                             addr_idx    <= (others => '0');
                             addr_total  <= get_addr_count(cur_op);
                             rd_total    <= get_rd_count(cur_op, lat_rd_cnt);
                             rd_idx      <= (others => '0');
+                            wr_idx      <= (others => '0');
 
                             -- Start CMD1 write cycle
                             bus_wr_byte <= get_cmd1(cur_op);
@@ -417,7 +502,7 @@ begin
                             bus_go_wr   <= '1';
                             seq         <= SEQ_CMD1;
                         else
-                            timer <= timer - 1;
+                            seq_timer <= seq_timer - 1;
                         end if;
 
                     ----------------------------------------------------
@@ -437,10 +522,11 @@ begin
                                 bus_go_wr   <= '1';
                                 seq         <= SEQ_CMD2;
                             elsif op_has_wait = '1' then
-                                seq <= SEQ_WAIT_RB;
+                                seq_timer <= to_unsigned(T_WB + rb_sync'length, seq_timer'length);
+                                seq       <= SEQ_WB;
                             elsif op_has_read = '1' then
-                                timer <= to_unsigned(T_WHR, timer'length);
-                                seq   <= SEQ_POST_WAIT;
+                                seq_timer <= to_unsigned(T_WHR, seq_timer'length);
+                                seq       <= SEQ_POST_WAIT;
                             else
                                 seq <= SEQ_CE_OFF;
                             end if;
@@ -455,6 +541,9 @@ begin
                                 bus_cle     <= '0';
                                 bus_ale     <= '1';
                                 bus_go_wr   <= '1';
+                            elsif op_has_wdata = '1' then
+                                seq_timer <= to_unsigned(T_ADL, seq_timer'length);
+                                seq       <= SEQ_ADL;
                             elsif op_has_cmd2 = '1' then
                                 bus_wr_byte <= CMD_PAGE_READ_2;
                                 bus_cle     <= '1';
@@ -462,35 +551,78 @@ begin
                                 bus_go_wr   <= '1';
                                 seq         <= SEQ_CMD2;
                             elsif op_has_wait = '1' then
-                                seq <= SEQ_WAIT_RB;
+                                seq_timer <= to_unsigned(T_WB + rb_sync'length, seq_timer'length);
+                                seq       <= SEQ_WB;
                             elsif op_has_read = '1' then
-                                timer <= to_unsigned(T_WHR, timer'length);
-                                seq   <= SEQ_POST_WAIT;
+                                seq_timer <= to_unsigned(T_WHR, seq_timer'length);
+                                seq       <= SEQ_POST_WAIT;
                             else
                                 seq <= SEQ_CE_OFF;
                             end if;
                         end if;
 
+                    ----------------------------------------------------
+                    when SEQ_ADL =>
+                        -- tADL, then the first data byte (CLE and ALE low)
+                        if seq_timer = 0 then
+                            bus_wr_byte <= lat_feat(7 downto 0);
+                            bus_cle     <= '0';
+                            bus_ale     <= '0';
+                            bus_go_wr   <= '1';
+                            seq         <= SEQ_WRITE;
+                        else
+                            seq_timer <= seq_timer - 1;
+                        end if;
+
+                    ----------------------------------------------------
+                    when SEQ_WRITE =>
+                        if bus_done = '1' then
+                            if wr_idx /= 3 then
+                                wr_idx      <= wr_idx + 1;
+                                bus_wr_byte <= get_addr_byte(x"00" & lat_feat,
+                                                             resize(wr_idx + 1, 3));
+                                bus_cle     <= '0';
+                                bus_ale     <= '0';
+                                bus_go_wr   <= '1';
+                            else
+                                -- tFEAT: busy while the feature is applied
+                                seq_timer <= to_unsigned(T_WB + rb_sync'length, seq_timer'length);
+                                seq       <= SEQ_WB;
+                            end if;
+                        end if;
+
                     ----------------------------------------------------
                     when SEQ_CMD2 =>
                         if bus_done = '1' then
                             if op_has_wait = '1' then
-                                seq <= SEQ_WAIT_RB;
+                                seq_timer <= to_unsigned(T_WB + rb_sync'length, seq_timer'length);
+                                seq       <= SEQ_WB;
                             elsif op_has_read = '1' then
-                                timer <= to_unsigned(T_WHR, timer'length);
-                                seq   <= SEQ_POST_WAIT;
+                                seq_timer <= to_unsigned(T_WHR, seq_timer'length);
+                                seq       <= SEQ_POST_WAIT;
                             else
                                 seq <= SEQ_CE_OFF;
                             end if;
                         end if;
 
+                    ----------------------------------------------------
+                    when SEQ_WB =>
+                        -- R/B# falls up to tWB after the last WE# rise and
+                        -- reaches rb_safe three cycles later; until then it
+                        -- still reads ready
+                        if seq_timer = 0 then
+                            seq <= SEQ_WAIT_RB;
+                        else
+                            seq_timer <= seq_timer - 1;
+                        end if;
+
                     ----------------------------------------------------
                     when SEQ_WAIT_RB =>
                         -- Wait for R/B# to go high (ready)
                         if rb_safe = '1' then
                             if op_has_read = '1' then
-                                timer <= to_unsigned(T_RR, timer'length);
-                                seq   <= SEQ_POST_WAIT;
+                                seq_timer <= to_unsigned(T_RR, seq_timer'length);
+                                seq       <= SEQ_POST_WAIT;
                             else
                                 seq <= SEQ_CE_OFF;
                             end if;
@@ -501,7 +633,7 @@ begin
                     ----------------------------------------------------
                     when SEQ_POST_WAIT =>
                         -- tRR or tWHR delay before first read
-                        if timer = 0 then
+                        if seq_timer = 0 then
                             if rd_total > 0 then
                                 bus_go_rd <= '1';
                                 seq       <= SEQ_READ;
@@ -509,7 +641,7 @@ begin
                                 seq <= SEQ_CE_OFF;
                             end if;
                         else
-                            timer <= timer - 1;
+                            seq_timer <= seq_timer - 1;
                         end if;
 
                     ----------------------------------------------------
@@ -536,10 +668,10 @@ begin
                                     null;
                             end case;
 
+                            -- While bytes remain the bus engine has already
+                            -- started the next read (bus_rd_more)
                             rd_idx <= rd_idx + 1;
-                            if rd_idx + 1 < rd_total then
-                                bus_go_rd <= '1';
-                            else
+                            if rd_idx + 1 >= rd_total then
                                 seq <= SEQ_CE_OFF;
                             end if;
                         end if;
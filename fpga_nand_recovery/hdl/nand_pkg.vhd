@@ -17,24 +17,36 @@ package nand_pkg is
     ---------------------------------------------------------------------------
     constant CMD_PAGE_READ_1   : std_logic_vector(7 downto 0) := x"00";
     constant CMD_PAGE_READ_2   : std_logic_vector(7 downto 0) := x"30";
+    constant CMD_CACHE_SEQ     : std_logic_vector(7 downto 0) := x"31";
+    constant CMD_CACHE_END     : std_logic_vector(7 downto 0) := x"3F";
     constant CMD_READ_ID       : std_logic_vector(7 downto 0) := x"90";
     constant CMD_READ_STATUS   : std_logic_vector(7 downto 0) := x"70";
     constant CMD_READ_PARAM    : std_logic_vector(7 downto 0) := x"EC";
+    constant CMD_SET_FEATURES  : std_logic_vector(7 downto 0) := x"EF";
     constant CMD_RESET         : std_logic_vector(7 downto 0) := x"FF";
 
     ---------------------------------------------------------------------------
     -- Timing constants (clock cycles at 100 MHz, 10 ns per cycle)
     -- Conservative values that exceed ONFI async Mode 0 minimums.
+    -- T_SETUP, T_WP, T_WH, T_RP, T_REH and T_REA are only the reset values
+    -- of the controller's timing inputs (AXI register TIMING); each of those
+    -- phases lasts its value plus one cycle. The read cycle is Mode 0's tRC.
     ---------------------------------------------------------------------------
     constant T_SETUP : natural := 2;   -- CLE/ALE/data setup (20 ns >= 12 ns)
     constant T_WP    : natural := 3;   -- WE# pulse low      (30 ns >= 12 ns)
     constant T_WH    : natural := 2;   -- WE# hold high      (20 ns >= 10 ns)
-    constant T_RP    : natural := 3;   -- RE# pulse low       (30 ns >= 12 ns)
-    constant T_REH   : natural := 2;   -- RE# hold high      (20 ns >= 10 ns)
+    constant T_RP    : natural := 5;   -- RE# pulse low      (60 ns >= 50 ns)
+    constant T_REH   : natural := 3;   -- RE# hold high      (40 ns >= 30 ns)
+    constant T_REA   : natural := 4;   -- RE# low to data sample (50 ns >= 40 ns)
     constant T_WHR   : natural := 8;   -- WE# high to RE# low (80 ns >= 60 ns)
+    constant T_WB    : natural := 10;  -- WE# high to R/B# low (100 ns max)
     constant T_RR    : natural := 3;   -- R/B# rise to RE# low (30 ns >= 20 ns)
     constant T_RST   : natural := 100000; -- Reset recovery (1 ms, worst case)
     constant T_CE_SETUP : natural := 2;  -- CE# assert to first bus op (20 ns)
+    constant T_ADL   : natural := 40;  -- ALE to data loading (400 ns, conservative)
+
+    -- SET FEATURES address of the timing mode (P1 = mode number)
+    constant FEAT_TIMING_MODE  : std_logic_vector(7 downto 0) := x"01";
 
     ---------------------------------------------------------------------------
     -- Maximum NAND page size including spare/OOB area (bytes).
@@ -51,39 +63,87 @@ package nand_pkg is
         OP_READ_ID,
         OP_READ_STATUS,
         OP_READ_PAGE,
-        OP_READ_PARAM
+        OP_READ_PARAM,
+        OP_CACHE_SEQ,   -- 31h: out the page in the data register, load the next
+        OP_CACHE_END,   -- 3Fh: out the page in the data register, load nothing
+        OP_SET_FEATURES -- EFh: feature address, then P1-P4
     );
 
-    -- Encode op type to 3-bit value for AXI register interface
+    -- Encode op type to 4-bit value for AXI register interface
     function op_encode(op : nand_op_t) return std_logic_vector;
-    function op_decode(v  : std_logic_vector(2 downto 0)) return nand_op_t;
+    function op_decode(v  : std_logic_vector(3 downto 0)) return nand_op_t;
+
+    -- Page statistics of the capture path (axi_nand_ctrl):
+    -- one byte into a CRC-32 (IEEE 802.3, reflected, as nand_frame.h), and
+    -- the number of 0 bits in a byte
+    function crc32_byte(crc : std_logic_vector(31 downto 0);
+                        d   : std_logic_vector(7 downto 0))
+        return std_logic_vector;
+    function zero_bits(d : std_logic_vector(7 downto 0)) return unsigned;
 
 end package nand_pkg;
 
 package body nand_pkg is
 
+    -- Returned through v so the result is (3 downto 0): a bare literal
+    -- would come back as (0 to 3) and op_encode(op)(2 downto 0) would fail
     function op_encode(op : nand_op_t) return std_logic_vector is
+        variable v : std_logic_vector(3 downto 0);
     begin
         case op is
-            when OP_NOP         => return "000";
-            when OP_RESET       => return "001";
-            when OP_READ_ID     => return "010";
-            when OP_READ_STATUS => return "011";
-            when OP_READ_PAGE   => return "100";
-            when OP_READ_PARAM  => return "101";
+            when OP_NOP          => v := "0000";
+            when OP_RESET        => v := "0001";
+            when OP_READ_ID      => v := "0010";
+            when OP_READ_STATUS  => v := "0011";
+            when OP_READ_PAGE    => v := "0100";
+            when OP_READ_PARAM   => v := "0101";
+            when OP_CACHE_SEQ    => v := "0110";
+            when OP_CACHE_END    => v := "0111";
+            when OP_SET_FEATURES => v := "1000";
         end case;
+        return v;
     end function;
 
-    function op_decode(v : std_logic_vector(2 downto 0)) return nand_op_t is
+    function op_decode(v : std_logic_vector(3 downto 0)) return nand_op_t is
     begin
         case v is
-            when "001"  => return OP_RESET;
-            when "010"  => return OP_READ_ID;
-            when "011"  => return OP_READ_STATUS;
-            when "100"  => return OP_READ_PAGE;
-            when "101"  => return OP_READ_PARAM;
+            when "0001" => return OP_RESET;
+            when "0010" => return OP_READ_ID;
+            when "0011" => return OP_READ_STATUS;
+            when "0100" => return OP_READ_PAGE;
+            when "0101" => return OP_READ_PARAM;
+            when "0110" => return OP_CACHE_SEQ;
+            when "0111" => return OP_CACHE_END;
+            when "1000" => return OP_SET_FEATURES;
             when others => return OP_NOP;
         end case;
     end function;
 
+    function crc32_byte(crc : std_logic_vector(31 downto 0);
+                        d   : std_logic_vector(7 downto 0))
+        return std_logic_vector is
+        variable c : std_logic_vector(31 downto 0);
+    begin
+        c := crc xor (x"000000" & d);
+        for i in 0 to 7 loop
+            if c(0) = '1' then
+                c := ('0' & c(31 downto 1)) xor x"EDB88320";
+            else
+                c := '0' & c(31 downto 1);
+            end if;
+        end loop;
+        return c;
+    end function;
+
+    function zero_bits(d : std_logic_vector(7 downto 0)) return unsigned is
+        variable n : unsigned(3 downto 0) := (others => '0');
+    begin
+        for i in 0 to 7 loop
+            if d(i) = '0' then
+                n := n + 1;
+            end if;
+        end loop;
+        return n;
+    end function;
+
 end package body nand_pkg;
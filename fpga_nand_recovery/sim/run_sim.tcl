@@ -8,20 +8,31 @@
 ##
 ## Or standalone with xsim:
 ##   cd fpga_nand_recovery/sim
-##   xvhdl ../hdl/nand_pkg.vhd
-##   xvhdl ../hdl/nand_flash_ctrl.vhd
-##   xvhdl tb_nand_flash_ctrl.vhd
+##   xvhdl --2008 ../hdl/nand_pkg.vhd
+##   xvhdl --2008 ../hdl/nand_flash_ctrl.vhd
+##   xvhdl --2008 ../hdl/axi_nand_ctrl.vhd
+##   xvhdl --2008 tb_nand_flash_ctrl.vhd
 ##   xelab tb_nand_flash_ctrl -debug typical
 ##   xsim tb_nand_flash_ctrl -runall
+##
+## Or with GHDL:
+##   cd fpga_nand_recovery/sim
+##   ghdl -a --std=08 ../hdl/nand_pkg.vhd ../hdl/nand_flash_ctrl.vhd \
+##       ../hdl/axi_nand_ctrl.vhd tb_nand_flash_ctrl.vhd
+##   ghdl -r --std=08 tb_nand_flash_ctrl
+##
+## The testbench is VHDL-2008 (to_hstring). Every check reports with
+## severity error; a clean run ends with "All tests passed" and no errors.
 ################################################################################
 
-# Compile sources in dependency order
+# Compile sources in dependency order (VHDL-2008)
 set sim_dir [file dirname [info script]]
 set hdl_dir [file normalize "$sim_dir/../hdl"]
 
-xvhdl "$hdl_dir/nand_pkg.vhd"
-xvhdl "$hdl_dir/nand_flash_ctrl.vhd"
-xvhdl "$sim_dir/tb_nand_flash_ctrl.vhd"
+xvhdl --2008 "$hdl_dir/nand_pkg.vhd"
+xvhdl --2008 "$hdl_dir/nand_flash_ctrl.vhd"
+xvhdl --2008 "$hdl_dir/axi_nand_ctrl.vhd"
+xvhdl --2008 "$sim_dir/tb_nand_flash_ctrl.vhd"
 
 # Elaborate
 xelab tb_nand_flash_ctrl -debug typical -s tb_sim
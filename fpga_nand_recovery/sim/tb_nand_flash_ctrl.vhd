@@ -3,8 +3,19 @@
 -- Testbench for nand_flash_ctrl
 --
 -- Includes a behavioral NAND flash model that responds to READ ID, RESET,
--- READ STATUS, and READ PAGE commands with known data patterns.
--- Verifies the controller's bus timing and protocol correctness.
+-- READ STATUS, READ PAGE, READ CACHE SEQUENTIAL / END and SET FEATURES
+-- commands with known data patterns. Verifies the controller's bus timing and protocol
+-- correctness.
+--
+-- The last tests drive axi_nand_ctrl through its AXI4-Lite port, as the PS
+-- would, and check that ping-pong page buffer reads run back to back (the
+-- drain of one bank is hidden behind the NAND read into the other), that
+-- cache reads hide tR behind the transfer of the previous page, that
+-- faster TIMING settings with SET FEATURES still read correct data (down to
+-- Mode 5 with EDO sampling, which a sample before tREA fails), and that
+-- the page statistics registers (CRC, non-0xFF bytes, 0 bits) follow the
+-- bytes captured into each bank, as nand_frame.h's CRC-32 sees them, and start
+-- over with each op that fills the bank.
 --
 -- Run in Vivado: source sim/run_sim.tcl
 --------------------------------------------------------------------------------
@@ -21,6 +32,16 @@ architecture sim of tb_nand_flash_ctrl is
 
     constant CLK_PERIOD : time := 10 ns;  -- 100 MHz
 
+    -- NAND model busy times (real parts: tR 25-100 us, tRST up to 1 ms)
+    constant T_R_MODEL   : time := 25 us;
+    constant T_RCBSY_MODEL : time := 3 us;   -- 31h/3Fh, array already idle
+    constant T_RST_MODEL : time := 5 us;
+    constant T_FEAT_MODEL : time := 1 us;
+
+    -- PS side of the AXI test: GP0 round trip beyond the slave's own
+    -- handshake cycles, per access
+    constant PS_GAP_CYCLES : natural := 10;
+
     -- DUT signals
     signal clk         : std_logic := '0';
     signal rst         : std_logic := '1';
@@ -36,7 +57,8 @@ architecture sim of tb_nand_flash_ctrl is
     signal id_data     : std_logic_vector(39 downto 0);
     signal status_data : std_logic_vector(7 downto 0);
 
-    -- NAND bus signals
+    -- NAND bus signals, as seen by the NAND model. They come from u_dut,
+    -- or from u_axi_dut while axi_owns_bus is set.
     signal nand_io_i   : std_logic_vector(7 downto 0);
     signal nand_io_o   : std_logic_vector(7 downto 0);
     signal nand_io_t   : std_logic;
@@ -51,16 +73,70 @@ architecture sim of tb_nand_flash_ctrl is
     -- Simulated bidirectional bus (directly resolved in testbench)
     signal nand_bus    : std_logic_vector(7 downto 0);
 
+    -- u_dut pins
+    signal core_io_o   : std_logic_vector(7 downto 0);
+    signal core_io_t   : std_logic;
+    signal core_cle    : std_logic;
+    signal core_ale    : std_logic;
+    signal core_ce_n   : std_logic;
+    signal core_we_n   : std_logic;
+    signal core_re_n   : std_logic;
+    signal core_wp_n   : std_logic;
+
+    -- u_axi_dut: AXI4-Lite port and NAND pins
+    signal rst_n       : std_logic;
+    signal axi_awaddr  : std_logic_vector(15 downto 0) := (others => '0');
+    signal axi_awvalid : std_logic := '0';
+    signal axi_awready : std_logic;
+    signal axi_wdata   : std_logic_vector(31 downto 0) := (others => '0');
+    signal axi_wvalid  : std_logic := '0';
+    signal axi_wready  : std_logic;
+    signal axi_bresp   : std_logic_vector(1 downto 0);
+    signal axi_bvalid  : std_logic;
+    signal axi_bready  : std_logic := '0';
+    signal axi_araddr  : std_logic_vector(15 downto 0) := (others => '0');
+    signal axi_arvalid : std_logic := '0';
+    signal axi_arready : std_logic;
+    signal axi_rdata   : std_logic_vector(31 downto 0);
+    signal axi_rresp   : std_logic_vector(1 downto 0);
+    signal axi_rvalid  : std_logic;
+    signal axi_rready  : std_logic := '0';
+
+    signal axi_io_o    : std_logic_vector(7 downto 0);
+    signal axi_io_t    : std_logic;
+    signal axi_cle     : std_logic;
+    signal axi_ale     : std_logic;
+    signal axi_ce_n    : std_logic;
+    signal axi_we_n    : std_logic;
+    signal axi_re_n    : std_logic;
+    signal axi_wp_n    : std_logic;
+
+    signal axi_owns_bus : boolean := false;
+
     -- NAND model internal state
     type nand_model_state_t is (
         NM_IDLE, NM_CMD, NM_ADDR, NM_WAIT_CMD2, NM_BUSY, NM_DATA_OUT
     );
     signal nm_state   : nand_model_state_t := NM_IDLE;
-    signal nm_cmd     : std_logic_vector(7 downto 0) := x"00";
-    signal nm_addr    : std_logic_vector(39 downto 0) := (others => '0');
     signal nm_addr_idx : integer := 0;
     signal nm_data_idx : integer := 0;
     signal nm_page_data : std_logic_vector(7 downto 0) := x"00";
+    signal nm_timing_mode : integer := 0;  -- set by SET FEATURES 01h
+    signal nm_next    : std_logic_vector(7 downto 0) := x"FF";  -- byte for the next RE# fall
+    signal nm_out_en  : boolean := false;  -- RE# falls output data
+
+    -- Data output timing of timing modes 0-5: tREA (max), tRLOH and tRHOH
+    -- (min). Until the next byte is valid the bus reads as X.
+    type mode_times_t is array (0 to 5) of time;
+    constant NM_T_REA  : mode_times_t := (40 ns, 30 ns, 25 ns, 20 ns, 20 ns, 16 ns);
+    constant NM_T_RLOH : mode_times_t := (0 ns, 0 ns, 0 ns, 0 ns, 5 ns, 5 ns);
+    constant NM_T_RHOH : mode_times_t := (0 ns, 0 ns, 0 ns, 15 ns, 15 ns, 15 ns);
+
+    -- Byte k of row r reads as row_pattern(r) xor (k mod 256)
+    function row_pattern(row : unsigned(23 downto 0)) return natural is
+    begin
+        return to_integer(row(7 downto 0) xor row(15 downto 8) xor row(23 downto 16));
+    end function;
 
     -- Test control
     signal test_done : boolean := false;
@@ -81,6 +157,16 @@ begin
     -- NAND model drives bus during data-out phase
     nand_io_i <= nand_bus;
 
+    -- One controller at a time talks to the NAND model
+    nand_io_o <= axi_io_o when axi_owns_bus else core_io_o;
+    nand_io_t <= axi_io_t when axi_owns_bus else core_io_t;
+    nand_cle  <= axi_cle  when axi_owns_bus else core_cle;
+    nand_ale  <= axi_ale  when axi_owns_bus else core_ale;
+    nand_ce_n <= axi_ce_n when axi_owns_bus else core_ce_n;
+    nand_we_n <= axi_we_n when axi_owns_bus else core_we_n;
+    nand_re_n <= axi_re_n when axi_owns_bus else core_re_n;
+    nand_wp_n <= axi_wp_n when axi_owns_bus else core_wp_n;
+
     ---------------------------------------------------------------------------
     -- DUT instantiation
     ---------------------------------------------------------------------------
@@ -100,25 +186,71 @@ begin
             id_data     => id_data,
             status_data => status_data,
             nand_io_i   => nand_io_i,
-            nand_io_o   => nand_io_o,
-            nand_io_t   => nand_io_t,
-            nand_cle    => nand_cle,
-            nand_ale    => nand_ale,
-            nand_ce_n   => nand_ce_n,
-            nand_we_n   => nand_we_n,
-            nand_re_n   => nand_re_n,
-            nand_wp_n   => nand_wp_n,
+            nand_io_o   => core_io_o,
+            nand_io_t   => core_io_t,
+            nand_cle    => core_cle,
+            nand_ale    => core_ale,
+            nand_ce_n   => core_ce_n,
+            nand_we_n   => core_we_n,
+            nand_re_n   => core_re_n,
+            nand_wp_n   => core_wp_n,
             nand_rb_n   => nand_rb_n
         );
 
+    rst_n <= not rst;
+
+    u_axi_dut : entity work.axi_nand_ctrl
+        port map (
+            s_axi_aclk    => clk,
+            s_axi_aresetn => rst_n,
+            s_axi_awaddr  => axi_awaddr,
+            s_axi_awvalid => axi_awvalid,
+            s_axi_awready => axi_awready,
+            s_axi_wdata   => axi_wdata,
+            s_axi_wstrb   => "1111",
+            s_axi_wvalid  => axi_wvalid,
+            s_axi_wready  => axi_wready,
+            s_axi_bresp   => axi_bresp,
+            s_axi_bvalid  => axi_bvalid,
+            s_axi_bready  => axi_bready,
+            s_axi_araddr  => axi_araddr,
+            s_axi_arvalid => axi_arvalid,
+            s_axi_arready => axi_arready,
+            s_axi_rdata   => axi_rdata,
+            s_axi_rresp   => axi_rresp,
+            s_axi_rvalid  => axi_rvalid,
+            s_axi_rready  => axi_rready,
+            nand_io_i     => nand_io_i,
+            nand_io_o     => axi_io_o,
+            nand_io_t     => axi_io_t,
+            nand_cle      => axi_cle,
+            nand_ale      => axi_ale,
+            nand_ce_n     => axi_ce_n,
+            nand_we_n     => axi_we_n,
+            nand_re_n     => axi_re_n,
+            nand_wp_n     => axi_wp_n,
+            nand_rb_n     => nand_rb_n
+        );
+
     ---------------------------------------------------------------------------
     -- Behavioral NAND flash model
     -- Responds to commands by driving the bus during read cycles.
     -- Simulates:
     --   READ ID:     Returns maker=0x98 (Toshiba), device=0xDE, etc.
     --   READ STATUS: Returns 0xE0 (ready, no error)
-    --   READ PAGE:   Returns incrementing byte pattern (row_lo XOR index)
-    --   RESET:       Goes busy for 100 ns, then ready
+    --   READ PAGE:   Busy for T_R_MODEL, then returns a byte pattern
+    --                (row_pattern of the row XOR index)
+    --   READ CACHE:  31h moves the loaded page to the cache register and
+    --                loads the next row (T_R_MODEL in the background); 3Fh
+    --                moves it without loading. Both wait for a load still
+    --                in progress, are busy T_RCBSY_MODEL, then return the
+    --                cache register
+    --   RESET:       Goes busy for T_RST_MODEL, then ready (timing mode 0)
+    --   SET FEATURES: Takes the feature address and P1-P4, busy for
+    --                T_FEAT_MODEL; address 01h sets nm_timing_mode to P1.
+    -- The bus is driven by nand_dout, with the timing of nm_timing_mode: a
+    -- byte is valid tREA after RE# falls and held tRHOH after RE# rises and
+    -- tRLOH after the next fall (EDO)
     ---------------------------------------------------------------------------
     nand_model : process
         -- ID bytes: Toshiba 64Gb TLC (example)
@@ -137,13 +269,17 @@ begin
         variable addr_cnt : integer := 0;
         variable data_cnt : integer := 0;
         variable state    : nand_model_state_t := NM_IDLE;
-        variable row_byte : std_logic_vector(7 downto 0) := x"00";
+        variable row      : unsigned(23 downto 0) := (others => '0');
+        variable data_row : unsigned(23 downto 0) := (others => '0');
+        variable out_row  : unsigned(23 downto 0) := (others => '0');
+        variable busy_until  : time := 0 ns;
+        variable array_until : time := 0 ns;  -- end of the array load
+        variable cache_open  : boolean := false;
+        variable feat_addr : std_logic_vector(7 downto 0) := x"00";
+        variable feat_cnt  : integer := 0;
     begin
         wait until rising_edge(clk);
 
-        -- Default: NAND model doesn't drive bus (high-Z)
-        -- Bus is driven by forcing nand_bus in the read section below
-
         if nand_ce_n = '1' then
             state := NM_IDLE;
             addr_cnt := 0;
@@ -162,7 +298,12 @@ begin
                         when CMD_RESET =>
                             -- Go busy for a while
                             nand_rb_n <= '0';
+                            busy_until := now + T_RST_MODEL;
+                            nm_timing_mode <= 0;
                             state := NM_BUSY;
+                        when CMD_SET_FEATURES =>
+                            feat_cnt := 0;
+                            state := NM_ADDR;
                         when CMD_READ_ID =>
                             state := NM_ADDR;
                         when CMD_READ_STATUS =>
@@ -171,8 +312,31 @@ begin
                         when CMD_PAGE_READ_1 =>
                             state := NM_ADDR;
                         when CMD_PAGE_READ_2 =>
-                            -- Second command for READ PAGE -> go busy briefly
+                            -- Second command for READ PAGE -> array read (tR)
                             nand_rb_n <= '0';
+                            data_row := row;
+                            out_row := row;
+                            busy_until := now + T_R_MODEL;
+                            array_until := busy_until;
+                            cache_open := true;
+                            state := NM_BUSY;
+                        when CMD_CACHE_SEQ | CMD_CACHE_END =>
+                            assert cache_open
+                                report "Cache read command without a loaded page"
+                                severity error;
+                            nand_rb_n <= '0';
+                            if array_until > now then
+                                busy_until := array_until + T_RCBSY_MODEL;
+                            else
+                                busy_until := now + T_RCBSY_MODEL;
+                            end if;
+                            out_row := data_row;
+                            if latched = CMD_CACHE_SEQ then
+                                data_row := data_row + 1;
+                                array_until := busy_until + T_R_MODEL;
+                            else
+                                cache_open := false;
+                            end if;
                             state := NM_BUSY;
                         when others =>
                             state := NM_IDLE;
@@ -180,54 +344,92 @@ begin
 
                 elsif nand_ale = '1' then
                     -- Address byte
-                    nm_addr(addr_cnt*8+7 downto addr_cnt*8) <= latched;
+                    if addr_cnt >= 2 and addr_cnt <= 4 then
+                        row((addr_cnt-2)*8+7 downto (addr_cnt-2)*8) := unsigned(latched);
+                    end if;
                     addr_cnt := addr_cnt + 1;
-                    row_byte := latched;
+                    -- READ ID has a single address byte, then data out
+                    if cmd_reg = CMD_READ_ID then
+                        state := NM_DATA_OUT;
+                        data_cnt := 0;
+                    end if;
+                    feat_addr := latched;
+
+                elsif cmd_reg = CMD_SET_FEATURES and state = NM_ADDR then
+                    -- Data input: P1-P4
+                    if feat_cnt = 0 and feat_addr = x"01" then
+                        nm_timing_mode <= to_integer(unsigned(latched));
+                    end if;
+                    feat_cnt := feat_cnt + 1;
+                    if feat_cnt = 4 then
+                        nand_rb_n <= '0';
+                        busy_until := now + T_FEAT_MODEL;
+                        state := NM_BUSY;
+                    end if;
                 end if;
             end if;
 
-            -- Detect RE# falling edge (data output point for model)
+            -- Detect RE# falling edge (nand_dout has output nm_next)
             if re_prev = '1' and nand_re_n = '0' then
                 if state = NM_DATA_OUT then
-                    case cmd_reg is
-                        when CMD_READ_ID =>
-                            if data_cnt < 5 then
-                                nand_bus <= ID_BYTES(data_cnt);
-                            else
-                                nand_bus <= x"00";
-                            end if;
-                        when CMD_READ_STATUS =>
-                            nand_bus <= x"E0";  -- ready, no error
-                        when CMD_PAGE_READ_2 | CMD_PAGE_READ_1 =>
-                            -- Return pattern: row_addr_byte0 XOR byte_index
-                            nand_bus <= std_logic_vector(
-                                unsigned(row_byte) xor
-                                to_unsigned(data_cnt mod 256, 8));
-                        when others =>
-                            nand_bus <= x"FF";
-                    end case;
                     data_cnt := data_cnt + 1;
                 end if;
-            elsif nand_re_n = '1' and nand_io_t = '1' then
-                -- Release bus when RE# is high and controller is in input mode
-                nand_bus <= (others => 'Z');
             end if;
 
             -- Busy -> Ready transition (simulate flash busy time)
-            if state = NM_BUSY then
-                -- Simple: go ready after a short delay (in real NAND this is us-ms)
-                nand_rb_n <= '1' after 200 ns;
-                if nand_rb_n = '1' then
-                    state := NM_DATA_OUT;
-                    data_cnt := 0;
-                end if;
+            if state = NM_BUSY and now >= busy_until then
+                nand_rb_n <= '1';
+                state := NM_DATA_OUT;
+                data_cnt := 0;
             end if;
         end if;
 
+        -- Byte for the next RE# fall
+        nm_out_en <= nand_ce_n = '0' and state = NM_DATA_OUT;
+        case cmd_reg is
+            when CMD_READ_ID =>
+                if data_cnt < 5 then
+                    nm_next <= ID_BYTES(data_cnt);
+                else
+                    nm_next <= x"00";
+                end if;
+            when CMD_READ_STATUS =>
+                nm_next <= x"E0";  -- ready, no error
+            when CMD_PAGE_READ_2 | CMD_CACHE_SEQ | CMD_CACHE_END =>
+                -- Return pattern: row_pattern XOR byte_index
+                nm_next <= std_logic_vector(
+                    to_unsigned(row_pattern(out_row), 8) xor
+                    to_unsigned(data_cnt mod 256, 8));
+            when others =>
+                nm_next <= x"FF";
+        end case;
+
         we_prev := nand_we_n;
         re_prev := nand_re_n;
     end process;
 
+    -- NAND data output: the previous byte turns to X tRLOH after RE# falls
+    -- and the next is valid tREA after it; after RE# rises the byte is held
+    -- tRHOH, then X and released
+    nand_dout : process
+        variable driving : boolean := false;
+    begin
+        nand_bus <= (others => 'Z');
+        loop
+            wait on nand_re_n;
+            if nand_re_n = '0' and nm_out_en then
+                nand_bus <= transport (others => 'X') after NM_T_RLOH(nm_timing_mode);
+                nand_bus <= transport nm_next after NM_T_REA(nm_timing_mode);
+                driving := true;
+            elsif nand_re_n = '1' and driving then
+                nand_bus <= transport (others => 'X') after NM_T_RHOH(nm_timing_mode);
+                nand_bus <= transport (others => 'Z')
+                    after NM_T_RHOH(nm_timing_mode) + CLK_PERIOD;
+                driving := false;
+            end if;
+        end loop;
+    end process;
+
     ---------------------------------------------------------------------------
     -- Main test sequence
     ---------------------------------------------------------------------------
@@ -260,6 +462,183 @@ begin
             assert cmd_done = '1'
                 report "Operation timed out!" severity error;
         end procedure;
+
+        -- AXI4-Lite single-beat accesses to u_axi_dut, as the PS issues them
+        procedure axi_write(addr : natural; data : std_logic_vector(31 downto 0)) is
+        begin
+            axi_awaddr  <= std_logic_vector(to_unsigned(addr, 16));
+            axi_wdata   <= data;
+            axi_awvalid <= '1';
+            axi_wvalid  <= '1';
+            axi_bready  <= '1';
+            loop
+                wait until rising_edge(clk);
+                exit when axi_awready = '1';
+            end loop;
+            axi_awvalid <= '0';
+            axi_wvalid  <= '0';
+            loop
+                wait until rising_edge(clk);
+                exit when axi_bvalid = '1';
+            end loop;
+            axi_bready <= '0';
+            wait_cycles(PS_GAP_CYCLES);
+        end procedure;
+
+        procedure axi_read(addr : natural; data : out std_logic_vector(31 downto 0)) is
+        begin
+            axi_araddr  <= std_logic_vector(to_unsigned(addr, 16));
+            axi_arvalid <= '1';
+            axi_rready  <= '1';
+            loop
+                wait until rising_edge(clk);
+                exit when axi_arready = '1';
+            end loop;
+            axi_arvalid <= '0';
+            loop
+                wait until rising_edge(clk);
+                exit when axi_rvalid = '1';
+            end loop;
+            data := axi_rdata;
+            axi_rready <= '0';
+            wait_cycles(PS_GAP_CYCLES);
+        end procedure;
+
+        -- CTRL value: START of op into bank 'bank', plus the W1C of DONE
+        function axi_start(op : nand_op_t; bank : natural) return std_logic_vector is
+            variable v : std_logic_vector(31 downto 0) := (others => '0');
+        begin
+            v(0)          := '1';
+            v(3 downto 1) := op_encode(op)(2 downto 0);
+            v(6)          := op_encode(op)(3);
+            v(4)          := '1';
+            if bank = 1 then
+                v(5) := '1';
+            end if;
+            return v;
+        end function;
+
+        procedure axi_wait_done is
+            variable st  : std_logic_vector(31 downto 0);
+            variable cnt : integer := 0;
+        begin
+            loop
+                axi_read(16#04#, st);
+                exit when st(1) = '1' or cnt = 20000;
+                cnt := cnt + 1;
+            end loop;
+            assert st(1) = '1'
+                report "AXI operation timed out!" severity error;
+        end procedure;
+
+        -- Drains the BUF_BANK bank and counts the bytes that differ from the
+        -- model's pattern for a row whose row_pattern is 'pat'
+        procedure axi_count_bad(pat : natural; bytes : natural; bad : out natural) is
+            variable w   : std_logic_vector(31 downto 0);
+            variable exp : std_logic_vector(7 downto 0);
+            variable n   : natural := 0;
+        begin
+            axi_read(16#20#, w);
+            assert to_integer(unsigned(w(15 downto 0))) = bytes
+                report "PAGE_IDX mismatch! Expected " & integer'image(bytes) &
+                       ", got " & integer'image(to_integer(unsigned(w(15 downto 0))))
+                severity error;
+            for i in 0 to bytes / 4 - 1 loop
+                axi_read(16#4000# + 4 * i, w);
+                for j in 0 to 3 loop
+                    exp := std_logic_vector(to_unsigned(pat, 8) xor
+                                            to_unsigned((4 * i + j) mod 256, 8));
+                    if w(8*j+7 downto 8*j) /= exp then
+                        n := n + 1;
+                    end if;
+                end loop;
+            end loop;
+            bad := n;
+        end procedure;
+
+        -- Drains the BUF_BANK bank and checks it against the model's pattern
+        procedure axi_check_page(pat : natural; bytes : natural) is
+            variable bad : natural;
+        begin
+            axi_count_bad(pat, bytes, bad);
+            assert bad = 0
+                report "Page data mismatch in " & integer'image(bad) &
+                       " bytes (row pattern " & integer'image(pat) & ")"
+                severity error;
+        end procedure;
+
+        -- CRC-32 of the model's page for a row whose row_pattern is 'pat',
+        -- computed as nand_frame.h does (table-driven) rather than with the
+        -- crc32_byte the hardware uses
+        function page_crc32(pat : natural; bytes : natural) return std_logic_vector is
+            type table_t is array (0 to 255) of unsigned(31 downto 0);
+            variable table : table_t;
+            variable c     : unsigned(31 downto 0);
+            variable crc   : unsigned(31 downto 0) := x"FFFFFFFF";
+            variable b     : unsigned(7 downto 0);
+        begin
+            for i in 0 to 255 loop
+                c := to_unsigned(i, 32);
+                for k in 0 to 7 loop
+                    if c(0) = '1' then
+                        c := shift_right(c, 1) xor x"EDB88320";
+                    else
+                        c := shift_right(c, 1);
+                    end if;
+                end loop;
+                table(i) := c;
+            end loop;
+            for i in 0 to bytes - 1 loop
+                b := to_unsigned(pat, 8) xor to_unsigned(i mod 256, 8);
+                crc := table(to_integer(crc(7 downto 0) xor b)) xor shift_right(crc, 8);
+            end loop;
+            return std_logic_vector(not crc);
+        end function;
+
+        -- Checks PAGE_CRC, NON_FF and ZEROS of the BUF_BANK bank against the
+        -- model's pattern for a row whose row_pattern is 'pat'
+        procedure axi_check_stats(pat : natural; bytes : natural) is
+            variable w      : std_logic_vector(31 downto 0);
+            variable b      : std_logic_vector(7 downto 0);
+            variable non_ff : natural := 0;
+            variable zeros  : natural := 0;
+        begin
+            for i in 0 to bytes - 1 loop
+                b := std_logic_vector(to_unsigned(pat, 8) xor to_unsigned(i mod 256, 8));
+                if b /= x"FF" then
+                    non_ff := non_ff + 1;
+                end if;
+                zeros := zeros + to_integer(zero_bits(b));
+            end loop;
+            axi_read(16#34#, w);
+            assert w = page_crc32(pat, bytes)
+                report "PAGE_CRC mismatch (row pattern " & integer'image(pat) & ")"
+                severity error;
+            axi_read(16#38#, w);
+            assert to_integer(unsigned(w)) = non_ff
+                report "NON_FF mismatch! Expected " & integer'image(non_ff) &
+                       ", got " & integer'image(to_integer(unsigned(w)))
+                severity error;
+            axi_read(16#3C#, w);
+            assert to_integer(unsigned(w)) = zeros
+                report "ZEROS mismatch! Expected " & integer'image(zeros) &
+                       ", got " & integer'image(to_integer(unsigned(w)))
+                severity error;
+        end procedure;
+
+        constant PP_PAGES : natural := 4;
+        constant PP_BYTES : natural := 512;
+        variable t0, t1   : time;
+        variable t_nand   : time;
+        variable t_drain  : time;
+        variable t_seq    : time;
+        variable t_pp     : time;
+        variable t_cache  : time;
+        variable t_fast   : time;
+        variable t_edo    : time;
+        variable bad      : natural;
+        variable kat_crc  : std_logic_vector(31 downto 0);
+        variable rd_word  : std_logic_vector(31 downto 0);
     begin
         -- Initial reset
         rst <= '1';
@@ -327,6 +706,209 @@ begin
             severity error;
         wait_cycles(10);
 
+        report "=== Test 6: AXI ping-pong page reads ===" severity note;
+        axi_owns_bus <= true;
+        axi_write(16#08#, x"00000000");
+        axi_write(16#10#, std_logic_vector(to_unsigned(PP_BYTES, 32)));
+
+        -- One bank: each page is read, then drained, then the next started
+        t0 := now;
+        for i in 0 to PP_PAGES - 1 loop
+            axi_write(16#0C#, std_logic_vector(to_unsigned((i + 1) * 16#10000#, 32)));
+            t1 := now;
+            axi_write(16#00#, axi_start(OP_READ_PAGE, 0));
+            axi_wait_done;
+            t_nand := now - t1;
+            t1 := now;
+            axi_write(16#28#, x"00000000");
+            axi_check_page(i + 1, PP_BYTES);
+            t_drain := now - t1;
+        end loop;
+        t_seq := now - t0;
+
+        -- Two banks: the next page is started into the other bank before
+        -- this one is drained
+        t0 := now;
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#10000#, 32)));
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 0));
+        for i in 0 to PP_PAGES - 1 loop
+            axi_wait_done;
+            if i + 1 < PP_PAGES then
+                axi_write(16#0C#, std_logic_vector(to_unsigned((i + 2) * 16#10000#, 32)));
+                axi_write(16#00#, axi_start(OP_READ_PAGE, (i + 1) mod 2));
+            end if;
+            axi_write(16#28#, std_logic_vector(to_unsigned(i mod 2, 32)));
+            axi_read(16#28#, rd_word);
+            assert to_integer(unsigned(rd_word(0 downto 0))) = i mod 2
+                report "BUF_BANK readback mismatch" severity error;
+            axi_check_page(i + 1, PP_BYTES);
+        end loop;
+        t_pp := now - t0;
+        axi_owns_bus <= false;
+
+        report "NAND read " & time'image(t_nand) & ", drain " & time'image(t_drain) &
+               "; " & integer'image(PP_PAGES) & " pages: one bank " &
+               time'image(t_seq) & ", ping-pong " & time'image(t_pp)
+            severity note;
+        assert t_pp < t_seq
+            report "Ping-pong pass is not faster than the one-bank pass" severity error;
+        assert t_pp <= PP_PAGES * (t_nand + 1 us) + t_drain
+            report "Ping-pong pass does not hide the drain behind the NAND read"
+            severity error;
+        wait_cycles(10);
+
+        report "=== Test 7: AXI cache read (00h-30h, 31h, 3Fh) ===" severity note;
+        axi_owns_bus <= true;
+
+        -- Rows 0x20.. : row_pattern is the row itself. The run is opened by
+        -- a READ PAGE with no data out, then each page comes out of a 31h
+        -- (the last of a 3Fh) while the NAND loads the next.
+        t0 := now;
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#20#, 32)));
+        axi_write(16#10#, x"00000000");
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 0));
+        axi_wait_done;
+        axi_write(16#10#, std_logic_vector(to_unsigned(PP_BYTES, 32)));
+        axi_write(16#00#, axi_start(OP_CACHE_SEQ, 0));
+        for i in 0 to PP_PAGES - 1 loop
+            axi_wait_done;
+            if i + 2 < PP_PAGES then
+                axi_write(16#00#, axi_start(OP_CACHE_SEQ, (i + 1) mod 2));
+            elsif i + 1 < PP_PAGES then
+                axi_write(16#00#, axi_start(OP_CACHE_END, (i + 1) mod 2));
+            end if;
+            axi_write(16#28#, std_logic_vector(to_unsigned(i mod 2, 32)));
+            axi_check_page(16#20# + i, PP_BYTES);
+        end loop;
+        t_cache := now - t0;
+        axi_owns_bus <= false;
+
+        report integer'image(PP_PAGES) & " pages: cache read " & time'image(t_cache) &
+               ", ping-pong page reads " & time'image(t_pp)
+            severity note;
+        assert t_cache + (PP_PAGES - 2) * T_R_MODEL / 2 < t_pp
+            report "Cache read does not hide tR behind the page transfer"
+            severity error;
+        wait_cycles(10);
+
+        report "=== Test 8: TIMING register and SET FEATURES ===" severity note;
+        axi_owns_bus <= true;
+
+        -- ONFI Mode 3 cycle: setup 2, WE# 2 low / 1 high, RE# 2 low / 2 high
+        -- clocks, i.e. 40 ns per byte read, sampled 30 ns after RE# falls
+        -- (10 ns after it rises, within tRHOH)
+        axi_write(16#30#, x"00000003");
+        axi_write(16#08#, x"00000001");
+        axi_write(16#00#, axi_start(OP_SET_FEATURES, 0));
+        axi_wait_done;
+        assert nm_timing_mode = 3
+            report "SET FEATURES timing mode not applied: " &
+                   integer'image(nm_timing_mode)
+            severity error;
+        axi_write(16#2C#, x"00211011");
+        axi_read(16#2C#, rd_word);
+        assert rd_word = x"00211011"
+            report "TIMING readback mismatch" severity error;
+
+        axi_write(16#08#, x"00000000");
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#30#, 32)));
+        t1 := now;
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 0));
+        axi_wait_done;
+        t_fast := now - t1;
+        axi_write(16#28#, x"00000000");
+        axi_check_page(16#30#, PP_BYTES);
+
+        -- ONFI Mode 5: RE# 1 low / 1 high clock, 20 ns per byte. The byte is
+        -- valid 16 ns after RE# falls, so it is sampled on the next fall
+        -- (EDO), within tRLOH; sampling it as RE# rises reads X.
+        axi_write(16#30#, x"00000005");
+        axi_write(16#08#, x"00000001");
+        axi_write(16#00#, axi_start(OP_SET_FEATURES, 1));
+        axi_wait_done;
+        axi_write(16#2C#, x"00100000");
+        axi_write(16#08#, x"00000000");
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#50#, 32)));
+        t1 := now;
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 1));
+        axi_wait_done;
+        t_edo := now - t1;
+        axi_write(16#28#, x"00000001");
+        axi_check_page(16#50#, PP_BYTES);
+
+        axi_write(16#2C#, x"00000000");
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 1));
+        axi_wait_done;
+        axi_count_bad(16#50#, PP_BYTES, bad);
+        assert bad > 0
+            report "Sampling before tREA read the page correctly" severity error;
+
+        -- Back to the reset (Mode 0) values
+        axi_write(16#2C#, x"00435232");
+        axi_write(16#30#, x"00000000");
+        axi_write(16#00#, axi_start(OP_SET_FEATURES, 1));
+        axi_wait_done;
+        axi_owns_bus <= false;
+
+        report "Page read at reset timing " & time'image(t_nand) &
+               ", at TIMING 0x211011 " & time'image(t_fast) &
+               ", at 0x100000 (EDO) " & time'image(t_edo) &
+               "; sampled at RE# rise: " & integer'image(bad) & " bad bytes"
+            severity note;
+        assert t_fast + PP_BYTES * 50 ns < t_nand
+            report "Faster TIMING did not shorten the page transfer" severity error;
+        assert t_edo + PP_BYTES * 15 ns < t_fast
+            report "EDO TIMING did not shorten the page transfer" severity error;
+        wait_cycles(10);
+
+        report "=== Test 9: page statistics registers ===" severity note;
+        -- Known answer: CRC-32 of "123456789" is CBF43926
+        kat_crc := (others => '1');
+        for i in 1 to 9 loop
+            kat_crc := crc32_byte(kat_crc, std_logic_vector(to_unsigned(16#30# + i, 8)));
+        end loop;
+        assert not kat_crc = x"CBF43926"
+            report "crc32_byte fails the CRC-32 check value" severity error;
+
+        -- The reference CRC is nand_frame.h's, which the receiver checks
+        -- frames with; pin it to zlib's CRC-32 of the pages read below
+        assert page_crc32(16#C0#, PP_BYTES) = x"E908582A" and
+               page_crc32(16#30#, PP_BYTES) = x"213B6E21" and
+               page_crc32(16#FF#, 100) = x"C29372BE"
+            report "page_crc32 differs from the CRC-32 of nand_frame.h" severity error;
+
+        -- Row 0xC0 (0xFF at bytes 0x3F and 0x13F) into bank 0 and row 0x30
+        -- into bank 1, both read before either is checked: each bank keeps
+        -- its own figures
+        axi_owns_bus <= true;
+        axi_write(16#10#, std_logic_vector(to_unsigned(PP_BYTES, 32)));
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#C0#, 32)));
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 0));
+        axi_wait_done;
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#30#, 32)));
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 1));
+        axi_wait_done;
+        axi_write(16#28#, x"00000000");
+        axi_check_stats(16#C0#, PP_BYTES);
+        axi_write(16#28#, x"00000001");
+        axi_check_stats(16#30#, PP_BYTES);
+
+        -- START clears the figures of the bank it fills: 100 bytes of row
+        -- 0xFF (0xFF at byte 0) over the 512 of row 0xC0 in bank 0, with
+        -- bank 1 left as it was
+        axi_write(16#10#, std_logic_vector(to_unsigned(100, 32)));
+        axi_write(16#0C#, std_logic_vector(to_unsigned(16#FF#, 32)));
+        axi_write(16#00#, axi_start(OP_READ_PAGE, 0));
+        axi_wait_done;
+        axi_write(16#28#, x"00000000");
+        axi_check_page(16#FF#, 100);
+        axi_check_stats(16#FF#, 100);
+        axi_write(16#28#, x"00000001");
+        axi_check_stats(16#30#, PP_BYTES);
+        axi_write(16#10#, std_logic_vector(to_unsigned(PP_BYTES, 32)));
+        axi_owns_bus <= false;
+        wait_cycles(10);
+
         report "=== All tests passed ===" severity note;
         test_done <= true;
         wait;
@@ -3,9 +3,12 @@
 host_receiver.py
 Host-side UART receiver for NAND flash dump
 
-Connects to the Arty Z7's USB-UART and captures the raw NAND dump stream
-to a binary file. The dump file contains every physical NAND page in
-sequential order, including spare/OOB areas.
+Connects to the Arty Z7's USB-UART for interactive sessions (--interactive).
+
+Full dumps use the framed, CRC-protected protocol in nand_frame.h, with
+re-requests of lost rows; capture them with the native receiver:
+    g++ -O2 -std=c++14 -o nand_receiver nand_receiver.cpp
+    ./nand_receiver --port /dev/ttyUSB1 --output nand_raw_dump.bin
 
 Usage:
     python3 host_receiver.py [OPTIONS]
@@ -15,22 +18,12 @@ Options:
     --baud BAUD       Baud rate (default: 921600)
     --output FILE     Output file (default: nand_raw_dump.bin)
     --interactive     Interactive mode (terminal, no dump capture)
-
-The dump protocol from the ARM firmware:
-    "DUMP_START\r\n"
-    For each page:
-        4 bytes: page_byte_count (uint32 LE)
-        3 bytes: row_address (uint24 LE)
-        N bytes: page data (N = page_byte_count)
-    "DUMP_END\r\n"
 """
 
 import argparse
 import serial
-import struct
 import sys
 import time
-import os
 
 
 def find_serial_port():
@@ -78,122 +71,12 @@ def interactive_mode(ser):
         print("\nExiting interactive mode.")
 
 
-def wait_for_line(ser, target, timeout=30):
-    """Read lines until one starts with 'target'. Return the full line."""
-    start = time.time()
-    buf = b""
-    while time.time() - start < timeout:
-        chunk = ser.read(256)
-        if chunk:
-            buf += chunk
-            while b"\n" in buf:
-                line, buf = buf.split(b"\n", 1)
-                line_str = line.decode("ascii", errors="replace").strip()
-                print(f"  < {line_str}")
-                if line_str.startswith(target):
-                    return line_str
-    return None
-
-
 def capture_dump(ser, output_path):
-    """Capture the full NAND dump stream to a binary file."""
-
-    print(f"Sending 'D' command to start dump...")
-    ser.write(b"D")
-
-    # Wait for DUMP_START
-    line = wait_for_line(ser, "DUMP_START", timeout=10)
-    if line is None:
-        print("ERROR: Did not receive DUMP_START. Is the NAND connected?")
-        return
-
-    # Read geometry info line
-    wait_for_line(ser, "  page_data=", timeout=5)
-
-    pages_captured = 0
-    bytes_captured = 0
-    start_time = time.time()
-
-    with open(output_path, "wb") as f:
-        print(f"Capturing dump to: {output_path}")
-
-        while True:
-            # Check for DUMP_END (text lines mixed into binary stream)
-            # The ARM firmware sends progress lines every 64 blocks
-            # We need to handle the mix of binary page data and text lines
-
-            # Read the 7-byte header: page_bytes(4) + row_addr(3)
-            hdr = ser.read(7)
-            if len(hdr) < 7:
-                # Check for text (DUMP_END or progress)
-                hdr += ser.read(64)
-                text = hdr.decode("ascii", errors="replace")
-                if "DUMP_END" in text:
-                    print("\nDUMP_END received.")
-                    break
-                if "BLK=" in text:
-                    # Progress update — extract and display
-                    for part in text.split("\n"):
-                        part = part.strip()
-                        if part.startswith("BLK="):
-                            blk = int(part[4:], 16)
-                            elapsed = time.time() - start_time
-                            rate = bytes_captured / elapsed if elapsed > 0 else 0
-                            print(f"\r  Block {blk} | "
-                                  f"{pages_captured} pages | "
-                                  f"{bytes_captured / (1024*1024):.1f} MB | "
-                                  f"{rate / 1024:.1f} KB/s",
-                                  end="", flush=True)
-                    continue
-                print(f"\nUnexpected data: {text[:80]}")
-                continue
-
-            # Check for error marker
-            if hdr[4:7] == b"ERR":
-                page_bytes = struct.unpack_from("<I", hdr, 0)[0]
-                print(f"\n  Page read error (row data = 0x{page_bytes:08X})")
-                continue
-
-            page_bytes = struct.unpack_from("<I", hdr, 0)[0]
-            row_addr = hdr[4] | (hdr[5] << 8) | (hdr[6] << 16)
-
-            if page_bytes == 0 or page_bytes > 32768:
-                print(f"\n  Invalid page_bytes={page_bytes}, skipping...")
-                continue
-
-            # Read the page data
-            page_data = b""
-            remaining = page_bytes
-            while remaining > 0:
-                chunk = ser.read(min(remaining, 4096))
-                if not chunk:
-                    time.sleep(0.001)
-                    continue
-                page_data += chunk
-                remaining -= len(chunk)
-
-            # Write to output file
-            f.write(page_data)
-            pages_captured += 1
-            bytes_captured += len(page_data)
-
-            # Print progress every 100 pages
-            if pages_captured % 100 == 0:
-                elapsed = time.time() - start_time
-                rate = bytes_captured / elapsed if elapsed > 0 else 0
-                print(f"\r  Row 0x{row_addr:06X} | "
-                      f"{pages_captured} pages | "
-                      f"{bytes_captured / (1024*1024):.1f} MB | "
-                      f"{rate / 1024:.1f} KB/s",
-                      end="", flush=True)
-
-    elapsed = time.time() - start_time
-    print(f"\n\nDump complete:")
-    print(f"  Pages:    {pages_captured}")
-    print(f"  Size:     {bytes_captured / (1024*1024):.1f} MB")
-    print(f"  Time:     {elapsed:.1f} seconds")
-    print(f"  Rate:     {bytes_captured / elapsed / 1024:.1f} KB/s")
-    print(f"  Output:   {os.path.abspath(output_path)}")
+    """The dump stream is framed (see nand_frame.h); point at nand_receiver."""
+    print("The 'D' dump uses the framed protocol in nand_frame.h, which this")
+    print("script does not decode. Capture it with the native receiver:")
+    print("    g++ -O2 -std=c++14 -o nand_receiver nand_receiver.cpp")
+    print(f"    ./nand_receiver --port {ser.port} --output {output_path}")
 
 
 def main():
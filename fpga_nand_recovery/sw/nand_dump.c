@@ -10,8 +10,10 @@
  *     'R' - NAND Reset
  *     'I' - Read ID (returns 5 bytes)
  *     'S' - Read Status (returns 1 byte)
- *     'P' - Read Parameter Page (returns 256 bytes)
- *     'D' - Dump all pages (streams raw NAND content)
+ *     'P' - Read Parameter Page (decodes the ONFI geometry)
+ *     'D' - Dump all blocks worth reading (framed stream, see nand_frame.h)
+ *     'K' - Toggle cache reads (31h/3Fh) for 'D'
+ *     'T' - Calibrate bus timing on the page at the 'A' address
  *     'G' - Read single page (address set by 'A' command)
  *     'A' - Set address: followed by 5 bytes (col_lo, col_hi, row0, row1, row2)
  *     'C' - Set read count: followed by 2 bytes (count_lo, count_hi)
@@ -23,10 +25,12 @@
  ******************************************************************************/
 
 #include <stdint.h>
+#include <string.h>        /* memcpy */
 #include "xil_io.h"        /* Xil_In32, Xil_Out32 */
 #include "xparameters.h"   /* XPAR_ base addresses */
 #include "xuartps.h"       /* PS UART driver */
 #include "sleep.h"         /* usleep */
+#include "nand_frame.h"    /* dump frame format, CRC-32 */
 
 /*---------------------------------------------------------------------------
  * AXI register base address (Zynq GP0 default: 0x40000000 or as configured)
@@ -36,6 +40,22 @@
 #define NAND_BASE  0x40000000U
 #endif
 
+/* Blocks covered by the 'D' dump when the die has no ONFI parameter page
+ * (see do_dump_all) */
+#ifndef DUMP_TOTAL_BLOCKS
+#define DUMP_TOTAL_BLOCKS  4096
+#endif
+
+/* Most blocks the dump plan can hold (one byte each) */
+#ifndef DUMP_MAX_BLOCKS
+#define DUMP_MAX_BLOCKS  65536
+#endif
+
+/* 1: 'D' reads each block as an ONFI cache read run; 'K' toggles it */
+#ifndef DUMP_CACHE_READ
+#define DUMP_CACHE_READ  0
+#endif
+
 /* Register offsets */
 #define REG_CTRL       0x0000
 #define REG_STATUS     0x0004
@@ -47,18 +67,28 @@
 #define REG_NAND_STAT  0x001C
 #define REG_PAGE_IDX   0x0020
 #define REG_VERSION    0x0024
+#define REG_BUF_BANK   0x0028  /* bank shown at PAGE_BUF / PAGE_IDX */
+#define REG_TIMING     0x002C  /* bus cycle timing, see TIMING() */
+#define REG_FEATURE    0x0030  /* SET FEATURES P1-P4 */
+#define REG_PAGE_CRC   0x0034  /* CRC-32 of the BUF_BANK page */
+#define REG_NON_FF     0x0038  /* its bytes other than 0xFF */
+#define REG_ZEROS      0x003C  /* its 0 bits */
 #define REG_PAGE_BUF   0x4000  /* page buffer base */
 
-/* Operation codes (bits [3:1] of CTRL register) */
+/* Operation codes (bits [3:1] of CTRL register, op_type bit 3 in CTRL[6]) */
 #define OP_RESET       (1 << 1)
 #define OP_READ_ID     (2 << 1)
 #define OP_READ_STATUS (3 << 1)
 #define OP_READ_PAGE   (4 << 1)
 #define OP_READ_PARAM  (5 << 1)
+#define OP_CACHE_SEQ   (6 << 1)   /* 31h: page in the data register out, next in */
+#define OP_CACHE_END   (7 << 1)   /* 3Fh: page in the data register out */
+#define OP_SET_FEATURES (1 << 6)  /* op_type 8; address ADDR_COL[7:0] */
 
 /* CTRL register bits */
 #define CTRL_START     (1 << 0)
 #define CTRL_CLR_DONE  (1 << 4)
+#define CTRL_BANK(b)   ((b) << 5)  /* page buffer bank the op fills */
 
 /* STATUS register bits */
 #define STATUS_BUSY    (1 << 0)
@@ -85,6 +115,9 @@ static void nand_start_op(uint32_t op_bits)
     nand_write(REG_CTRL, op_bits | CTRL_START);
 }
 
+static void uart_tx_pump(void);
+
+/* Polls for DONE, keeping the UART TX FIFO fed while the NAND is busy. */
 static int nand_wait_done(uint32_t timeout_ms)
 {
     uint32_t elapsed = 0;
@@ -92,40 +125,159 @@ static int nand_wait_done(uint32_t timeout_ms)
         uint32_t st = nand_read(REG_STATUS);
         if (st & STATUS_DONE)
             return 0;  /* success */
+        uart_tx_pump();
         usleep(100);
         elapsed++;
     }
     return -1;  /* timeout */
 }
 
+/*
+ * Copies the page buffer to DDR. The controller is an AXI4-Lite slave, so
+ * every access is a single beat whatever the master does (a DMA descriptor
+ * would be split the same way); what this saves over nand_read() per word is
+ * the call and the byte unpacking, and the page can then be checked, CRC'd
+ * and queued for the UART from cached memory. The copy reads the bank
+ * selected by REG_BUF_BANK while the NAND may be filling the other one.
+ */
+static uint32_t page_copy[FRAME_MAX_PAYLOAD / 4];    /* DDR copy of the last page read */
+
+static void nand_copy_page_buf(uint32_t *dst, uint32_t bytes)
+{
+    const volatile uint32_t *src = (const volatile uint32_t *)(NAND_BASE + REG_PAGE_BUF);
+    uint32_t words = (bytes + 3) / 4;
+    uint32_t i = 0;
+    for (; i + 8 <= words; i += 8) {
+        uint32_t w0 = src[i + 0], w1 = src[i + 1], w2 = src[i + 2], w3 = src[i + 3];
+        uint32_t w4 = src[i + 4], w5 = src[i + 5], w6 = src[i + 6], w7 = src[i + 7];
+        dst[i + 0] = w0; dst[i + 1] = w1; dst[i + 2] = w2; dst[i + 3] = w3;
+        dst[i + 4] = w4; dst[i + 5] = w5; dst[i + 6] = w6; dst[i + 7] = w7;
+    }
+    for (; i < words; i++)
+        dst[i] = src[i];
+}
+
 /*---------------------------------------------------------------------------
  * UART I/O (PS UART, directly via register access for bare-metal)
  *---------------------------------------------------------------------------*/
 static XUartPs uart;
 
+/*
+ * Transmit path: senders append to a ring in DDR and uart_tx_pump() moves
+ * bytes into the 64-byte TX FIFO a burst at a time. The FIFO level is read
+ * once per burst (TXEMPTY: 64 free, below the trigger level: at least
+ * 64 - UART_TX_TRIGGER free) instead of once per byte, and every wait in
+ * the firmware pumps, so the line keeps running while the NAND is busy.
+ */
+#define UART_FIFO_BYTES   64
+#define UART_TX_TRIGGER   16
+#define TX_RING_BYTES     65536     /* power of two; several pages */
+
+static uint8_t tx_ring[TX_RING_BYTES];
+static uint32_t tx_head;            /* next byte to queue */
+static uint32_t tx_tail;            /* next byte to the FIFO */
+
+/*
+ * Receive path: the 64-byte RX FIFO fills in ~0.7 ms at 921600 baud, and a
+ * page can take ~23 ms to leave, so every pump also moves whatever has
+ * arrived into a ring in DDR. The console and the frame parser read from
+ * the ring; the FIFO is only read here. A dump session keeps a few
+ * hundred bytes in flight from the host at most (see nand_frame.h).
+ */
+#define RX_RING_BYTES     4096      /* power of two */
+
+static uint8_t rx_ring[RX_RING_BYTES];
+static uint32_t rx_head;            /* next byte from the FIFO */
+static uint32_t rx_tail;            /* next byte to the reader */
+
+static void uart_rx_drain(void)
+{
+    uint32_t base = uart.Config.BaseAddress;
+    while (XUartPs_IsReceiveData(base)) {
+        uint8_t b = XUartPs_RecvByte(base);
+        if (rx_head - rx_tail < RX_RING_BYTES)
+            rx_ring[rx_head++ & (RX_RING_BYTES - 1)] = b;
+    }
+}
+
+/* Next received byte without blocking; 0 when there is none */
+static int uart_rx_take(uint8_t *b)
+{
+    if (rx_tail == rx_head)
+        uart_rx_drain();
+    if (rx_tail == rx_head)
+        return 0;
+    *b = rx_ring[rx_tail++ & (RX_RING_BYTES - 1)];
+    return 1;
+}
+
 static void uart_init(void)
 {
     XUartPs_Config *cfg = XUartPs_LookupConfig(XPAR_XUARTPS_0_DEVICE_ID);
     XUartPs_CfgInitialize(&uart, cfg, cfg->BaseAddress);
     XUartPs_SetBaudRate(&uart, 921600);
+    XUartPs_WriteReg(cfg->BaseAddress, XUARTPS_TXWM_OFFSET, UART_TX_TRIGGER);
 }
 
-static void uart_send_byte(uint8_t b)
+static void uart_tx_pump(void)
+{
+    uint32_t base = uart.Config.BaseAddress;
+    for (;;) {
+        uint32_t sr = XUartPs_ReadReg(base, XUARTPS_SR_OFFSET);
+        if (!(sr & XUARTPS_SR_RXEMPTY))
+            uart_rx_drain();
+        if (tx_tail == tx_head)
+            return;
+        uint32_t room;
+        if (sr & XUARTPS_SR_TXEMPTY)
+            room = UART_FIFO_BYTES;
+        else if (!(sr & XUARTPS_SR_TTRIG))
+            room = UART_FIFO_BYTES - UART_TX_TRIGGER;
+        else
+            return;
+        while (room-- > 0 && tx_tail != tx_head)
+            XUartPs_WriteReg(base, XUARTPS_FIFO_OFFSET, tx_ring[tx_tail++ & (TX_RING_BYTES - 1)]);
+    }
+}
+
+static void uart_tx_flush(void)
 {
-    while (XUartPs_IsTransmitFull(uart.Config.BaseAddress))
-        ;
-    XUartPs_SendByte(uart.Config.BaseAddress, b);
+    while (tx_tail != tx_head)
+        uart_tx_pump();
 }
 
 static void uart_send_buf(const uint8_t *buf, uint32_t len)
 {
-    for (uint32_t i = 0; i < len; i++)
-        uart_send_byte(buf[i]);
+    while (len > 0) {
+        uint32_t space = TX_RING_BYTES - (tx_head - tx_tail);
+        if (space == 0) {
+            uart_tx_pump();
+            continue;
+        }
+        uint32_t at = tx_head & (TX_RING_BYTES - 1);
+        uint32_t n = len < space ? len : space;
+        if (n > TX_RING_BYTES - at)
+            n = TX_RING_BYTES - at;
+        memcpy(tx_ring + at, buf, n);
+        tx_head += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void uart_send_byte(uint8_t b)
+{
+    uart_send_buf(&b, 1);
+    uart_tx_pump();
 }
 
 static uint8_t uart_recv_byte(void)
 {
-    return XUartPs_RecvByte(uart.Config.BaseAddress);
+    /* Everything queued goes out before blocking on the host */
+    uint8_t b;
+    while (!uart_rx_take(&b))
+        uart_tx_pump();
+    return b;
 }
 
 static void uart_send_str(const char *s)
@@ -141,16 +293,71 @@ static void uart_send_hex32(uint32_t val)
         uart_send_byte(hex[(val >> i) & 0xF]);
 }
 
+/*---------------------------------------------------------------------------
+ * Bus timing
+ *
+ * TIMING holds the clocks (at 100 MHz) of each bus cycle phase, minus one;
+ * rea is the clocks from RE# falling to the data sample, minus one. The
+ * steps below go from the reset values to the fastest the controller can
+ * do, each with the ONFI timing mode the NAND is switched to for it. Every
+ * sample is at least 10 ns past tREA; up to Mode 2 the NAND may drop its
+ * output as RE# rises, from Mode 3 it holds it tRHOH (15 ns) after the
+ * rise and, from Mode 4, tRLOH (5 ns) after the next fall (EDO).
+ *---------------------------------------------------------------------------*/
+#define TIMING(setup, wp, wh, rp, reh, rea) \
+    ((setup) | (wp) << 4 | (wh) << 8 | (rp) << 12 | (reh) << 16 | (rea) << 20)
+
+#define FEAT_TIMING_MODE  0x01
+
+static const struct {
+    uint8_t mode;
+    uint32_t timing;
+} timing_steps[] = {
+    { 0, TIMING(2, 3, 2, 5, 3, 4) },    /* reset values, 100 ns read cycle */
+    { 1, TIMING(1, 2, 1, 3, 1, 3) },    /* 60 ns, sampled as RE# rises; Mode 2 does no better */
+    { 3, TIMING(1, 1, 0, 1, 1, 2) },    /* 40 ns, sampled 10 ns after RE# rises */
+    { 4, TIMING(1, 1, 0, 1, 0, 2) },    /* 30 ns, sampled at the next RE# fall */
+    { 5, TIMING(0, 0, 0, 0, 0, 1) },    /* 20 ns, sampled at the next RE# fall */
+};
+#define TIMING_STEPS  (sizeof(timing_steps) / sizeof(timing_steps[0]))
+
+static uint32_t timing_step;        /* index in use */
+
+/* Switches the NAND to the step's timing mode, then the controller to its
+ * timing. SET FEATURES itself goes out at the reset timing, which every
+ * mode accepts. ADDR_COL is left as it was. */
+static int timing_apply(uint32_t step)
+{
+    uint32_t col = nand_read(REG_ADDR_COL);
+    nand_write(REG_TIMING, timing_steps[0].timing);
+    nand_write(REG_ADDR_COL, FEAT_TIMING_MODE);
+    nand_write(REG_FEATURE, timing_steps[step].mode);
+    nand_start_op(OP_SET_FEATURES);
+    int r = nand_wait_done(1000);
+    nand_write(REG_ADDR_COL, col);
+    if (r != 0)
+        return -1;
+    nand_write(REG_TIMING, timing_steps[step].timing);
+    timing_step = step;
+    return 0;
+}
+
 /*---------------------------------------------------------------------------
  * NAND operations
  *---------------------------------------------------------------------------*/
 static void do_reset(void)
 {
     nand_start_op(OP_RESET);
-    if (nand_wait_done(2000) == 0)
+    if (nand_wait_done(2000) == 0) {
+        /* RESET puts the NAND back in timing mode 0 */
+        if (timing_step != 0 && timing_apply(timing_step) != 0) {
+            nand_write(REG_TIMING, timing_steps[0].timing);
+            timing_step = 0;
+        }
         uart_send_str("OK:RESET\r\n");
-    else
+    } else {
         uart_send_str("ERR:RESET_TIMEOUT\r\n");
+    }
 }
 
 static void do_read_id(void)
@@ -208,12 +415,17 @@ static void do_read_status(void)
 
 static void do_read_page(void)
 {
-    uint32_t rd_count = nand_read(REG_RD_COUNT);
     nand_start_op(OP_READ_PAGE);
     if (nand_wait_done(5000) == 0) {
         uint32_t bytes_read = nand_read(REG_PAGE_IDX);
         uart_send_str("PAGE_OK bytes=");
         uart_send_hex32(bytes_read);
+        uart_send_str(" crc=");
+        uart_send_hex32(nand_read(REG_PAGE_CRC));
+        uart_send_str(" non_ff=");
+        uart_send_hex32(nand_read(REG_NON_FF));
+        uart_send_str(" zeros=");
+        uart_send_hex32(nand_read(REG_ZEROS));
         uart_send_str("\r\n");
 
         /* Send raw page data as binary (prefixed with 4-byte length) */
@@ -224,141 +436,829 @@ static void do_read_page(void)
         hdr[3] = (bytes_read >> 24) & 0xFF;
         uart_send_buf(hdr, 4);
 
-        /* Stream page buffer words */
-        uint32_t words = (bytes_read + 3) / 4;
-        for (uint32_t i = 0; i < words; i++) {
-            uint32_t w = nand_read(REG_PAGE_BUF + i * 4);
-            uint8_t b[4];
-            b[0] = (w >>  0) & 0xFF;
-            b[1] = (w >>  8) & 0xFF;
-            b[2] = (w >> 16) & 0xFF;
-            b[3] = (w >> 24) & 0xFF;
-            /* Only send the valid bytes in the last word */
-            uint32_t remaining = bytes_read - i * 4;
-            uint32_t send_cnt = remaining >= 4 ? 4 : remaining;
-            uart_send_buf(b, send_cnt);
-        }
+        /* Page goes to DDR in one pass, then out through the TX ring */
+        if (bytes_read > sizeof(page_copy))
+            bytes_read = sizeof(page_copy);
+        nand_copy_page_buf(page_copy, bytes_read);
+        uart_send_buf((const uint8_t *)page_copy, bytes_read);
     } else {
         uart_send_str("ERR:PAGE_TIMEOUT\r\n");
     }
 }
 
+/*---------------------------------------------------------------------------
+ * Geometry
+ *
+ * The ONFI parameter page describes the whole die. READ ID byte 3 gives only
+ * the page and block size, so without a valid parameter page the block
+ * count falls back to DUMP_TOTAL_BLOCKS.
+ *---------------------------------------------------------------------------*/
+#define ONFI_PARAM_BYTES   256
+#define ONFI_PARAM_COPIES  3       /* redundant copies, read back to back */
+
+typedef struct {
+    uint32_t page_data;         /* data bytes per page */
+    uint32_t spare;             /* spare bytes per page */
+    uint32_t pages_per_block;   /* row stride of a block, a power of two */
+    uint32_t blocks;            /* over all LUNs */
+    int onfi;                   /* 1: from the parameter page */
+} nand_geometry_t;
+
+/* ONFI CRC-16: polynomial 0x8005, initial value 0x4F4E, MSB first */
+static uint16_t onfi_crc16(const uint8_t *p, uint32_t len)
+{
+    uint16_t crc = 0x4F4E;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(p[i] << 8);
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+static uint32_t pow2_ceil(uint32_t v)
+{
+    uint32_t p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+/* Decodes the first parameter page copy with the signature and a good CRC.
+ * Returns -1 on timeout or if there is none. The row address gives the page
+ * and block fields whole powers of two, so odd counts are rounded up to the
+ * row stride. */
+static int onfi_read_geometry(nand_geometry_t *g)
+{
+    nand_write(REG_ADDR_COL, 0x0000);  /* address byte = 0x00 */
+    nand_write(REG_RD_COUNT, ONFI_PARAM_BYTES * ONFI_PARAM_COPIES);
+    nand_write(REG_BUF_BANK, 0);
+    nand_start_op(OP_READ_PARAM);
+    if (nand_wait_done(1000) != 0)
+        return -1;
+    uint32_t bytes = nand_read(REG_PAGE_IDX);
+    if (bytes > ONFI_PARAM_BYTES * ONFI_PARAM_COPIES)
+        bytes = ONFI_PARAM_BYTES * ONFI_PARAM_COPIES;
+    nand_copy_page_buf(page_copy, bytes);
+
+    const uint8_t *pp = (const uint8_t *)page_copy;
+    for (uint32_t at = 0; at + ONFI_PARAM_BYTES <= bytes; at += ONFI_PARAM_BYTES) {
+        const uint8_t *p = pp + at;
+        if (p[0] != 'O' || p[1] != 'N' || p[2] != 'F' || p[3] != 'I')
+            continue;
+        if (onfi_crc16(p, 254) != (p[254] | p[255] << 8))
+            continue;
+        uint32_t page_data = frame_get_u32(p + 80);
+        uint32_t spare = p[84] | p[85] << 8;
+        uint32_t ppb = frame_get_u32(p + 92);
+        uint32_t blocks_per_lun = frame_get_u32(p + 96);
+        uint32_t luns = p[100] ? p[100] : 1;
+        if (page_data == 0 || page_data + spare > sizeof(page_copy) || ppb == 0 || blocks_per_lun == 0)
+            continue;
+        g->page_data = page_data;
+        g->spare = spare;
+        g->pages_per_block = pow2_ceil(ppb);
+        /* The LUN bits sit above the block bits */
+        g->blocks = luns > 1 ? pow2_ceil(blocks_per_lun) * luns : blocks_per_lun;
+        g->onfi = 1;
+        return 0;
+    }
+    return -1;
+}
+
+/* Page and block size from READ ID byte 3 (ONFI convention) */
+static int id_read_geometry(nand_geometry_t *g)
+{
+    nand_write(REG_ADDR_COL, 0x0000);
+    nand_write(REG_RD_COUNT, 5);
+    nand_start_op(OP_READ_ID);
+    if (nand_wait_done(1000) != 0)
+        return -1;
+
+    uint8_t byte3 = (nand_read(REG_ID_LO) >> 24) & 0xFF;
+    uint32_t spare_per_512 = (byte3 & 0x04) ? 16 : 8;
+    g->page_data = 1024U << (byte3 & 0x03);
+    g->spare = (g->page_data / 512) * spare_per_512;
+    g->pages_per_block = 64U << ((byte3 >> 4) & 0x03);
+    g->blocks = DUMP_TOTAL_BLOCKS;
+    g->onfi = 0;
+    return 0;
+}
+
+static void do_read_param(void)
+{
+    nand_geometry_t g;
+    if (onfi_read_geometry(&g) != 0) {
+        uart_send_str("ERR:PARAM_INVALID (no ONFI parameter page)\r\n");
+        return;
+    }
+    uart_send_str("ONFI: PageSize=");
+    uart_send_hex32(g.page_data);
+    uart_send_str(" Spare=");
+    uart_send_hex32(g.spare);
+    uart_send_str(" BlockPages=");
+    uart_send_hex32(g.pages_per_block);
+    uart_send_str(" Blocks=");
+    uart_send_hex32(g.blocks);
+    uart_send_str("\r\n");
+}
+
+/*---------------------------------------------------------------------------
+ * Framed dump session (frame format in nand_frame.h)
+ *---------------------------------------------------------------------------*/
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    uint32_t batch;                 /* NACK frame it came in */
+    int last;                       /* last range of that frame */
+} nack_range_t;
+
+static uint32_t tx_seq;
+static uint32_t dump_rows;          /* rows in this dump, for NACK checks */
+static uint32_t dump_ppb;           /* pages per block */
+static int dump_cache = DUMP_CACHE_READ;
+static uint32_t dump_errors;
+static uint32_t erased_pages;       /* pages of the pass that read as erased */
+static uint32_t erased_zero_bits;   /* and the 0 bits among them */
+
+/* 0 bits a page may hold and still be taken for an erased page with raw
+ * bit errors: one per 64 bytes, a BER of ~0.2% */
+#define ERASED_MAX_ZEROS(bytes)  ((bytes) / 64)
+
+static nack_range_t nack_queue[FRAME_NACK_QUEUE];
+static uint32_t nack_head;
+static uint32_t nack_count;
+static int host_done;
+
+static uint8_t rx_frame[FRAME_HEADER_BYTES + 4 + 8 * FRAME_NACK_RANGES + FRAME_CRC_BYTES];
+static uint32_t rx_len;
+
+static void frame_send(uint8_t type, uint32_t row, const uint8_t *payload, uint32_t len)
+{
+    uint8_t hdr[FRAME_HEADER_BYTES];
+    uint8_t tail[FRAME_CRC_BYTES];
+    frame_build_header(hdr, type, tx_seq++, row, len);
+    uint32_t crc = frame_crc32_update(FRAME_CRC_INIT, hdr, sizeof(hdr));
+    crc = frame_crc32_update(crc, payload, len);
+    frame_put_u32(tail, frame_crc32_final(crc));
+    uart_send_buf(hdr, sizeof(hdr));
+    uart_send_buf(payload, len);
+    uart_send_buf(tail, sizeof(tail));
+}
+
+static void frame_send_u32(uint8_t type, uint32_t row, const uint32_t *values, uint32_t n)
+{
+    uint8_t payload[16];
+    for (uint32_t i = 0; i < n && i < 4; i++)
+        frame_put_u32(payload + i * 4, values[i]);
+    frame_send(type, row, payload, n * 4);
+}
+
+/*
+ * Statistics the controller keeps of the page in the BUF_BANK bank as it is
+ * captured (see axi_nand_ctrl.vhd), read by page_drain(). They tell an
+ * erased or zeroed page without reading it, count the bit flips in an
+ * erased one, and give the CRC-32 of the page for its PAGE frame.
+ */
+static uint32_t page_crc;
+static uint32_t page_non_ff;
+static uint32_t page_zeros;
+
+/* a(x) * b(x) modulo the CRC-32 polynomial, in its reflected bit order */
+static uint32_t crc32_mulmod(uint32_t a, uint32_t b)
+{
+    uint32_t p = 0;
+    for (uint32_t m = 1U << 31; m != 0; m >>= 1) {
+        if (a & m)
+            p ^= b;
+        b = (b & 1) ? (b >> 1) ^ 0xEDB88320U : b >> 1;
+    }
+    return p;
+}
+
+/* x^(8 * len) modulo the polynomial, cached for the last length asked */
+static uint32_t crc32_shift_len = 0xFFFFFFFFU;
+static uint32_t crc32_shift;
+
+static uint32_t crc32_x8n(uint32_t len)
+{
+    if (len != crc32_shift_len) {
+        uint32_t r = 1U << 31;          /* x^0 */
+        uint32_t sq = 1U << 23;         /* x^8 */
+        for (uint32_t n = len; n != 0; n >>= 1) {
+            if (n & 1)
+                r = crc32_mulmod(r, sq);
+            sq = crc32_mulmod(sq, sq);
+        }
+        crc32_shift = r;
+        crc32_shift_len = len;
+    }
+    return crc32_shift;
+}
+
+/* Sends page_copy as a PAGE frame. The Cortex-A9 is little-endian, so the
+ * words copied from the page buffer are already in NAND byte order. The
+ * frame CRC is that of the header carried over the payload length and
+ * combined with PAGE_CRC, so the page never goes through the CRC table
+ * here; a copy that differs from what the controller captured fails the
+ * CRC at the host and is re-requested. */
+static void frame_send_page(uint32_t row, uint32_t bytes)
+{
+    uint8_t hdr[FRAME_HEADER_BYTES];
+    uint8_t tail[FRAME_CRC_BYTES];
+    frame_build_header(hdr, FRAME_PAGE, tx_seq++, row, bytes);
+    uint32_t crc = frame_crc32_final(frame_crc32_update(FRAME_CRC_INIT, hdr, sizeof(hdr)));
+    frame_put_u32(tail, crc32_mulmod(crc32_x8n(bytes), crc) ^ page_crc);
+    uart_send_buf(hdr, sizeof(hdr));
+    uart_send_buf((const uint8_t *)page_copy, bytes);
+    uart_send_buf(tail, sizeof(tail));
+}
+
+static void handle_host_frame(const uint8_t *f)
+{
+    uint8_t type = f[2];
+    uint32_t len = frame_get_u32(f + 12);
+
+    if (type == FRAME_HOST_DONE) {
+        host_done = 1;
+    } else if (type == FRAME_NACK && len >= 12 && (len - 4) % 8 == 0) {
+        const uint8_t *p = f + FRAME_HEADER_BYTES;
+        uint32_t batch = frame_get_u32(p);
+        uint32_t ranges = (len - 4) / 8;
+        if (FRAME_NACK_QUEUE - nack_count < ranges) {
+            /* Taken whole or not at all; the host sends it again */
+            frame_send_u32(FRAME_NACK_BUSY, 0, &batch, 1);
+            return;
+        }
+        nack_range_t *r = 0;
+        for (uint32_t i = 0; i < ranges; i++) {
+            uint32_t first = frame_get_u32(p + 4 + i * 8);
+            uint32_t count = frame_get_u32(p + 8 + i * 8);
+            if (first >= dump_rows || count == 0)
+                continue;
+            if (count > dump_rows - first)
+                count = dump_rows - first;
+            r = &nack_queue[(nack_head + nack_count) % FRAME_NACK_QUEUE];
+            r->first = first;
+            r->count = count;
+            r->batch = batch;
+            r->last = 0;
+            nack_count++;
+        }
+        if (r)
+            r->last = 1;
+        else
+            frame_send_u32(FRAME_RESEND_DONE, 0, &batch, 1);  /* nothing to resend */
+    }
+}
+
+/* Parses whatever the host has sent without blocking. Frames with a bad
+ * CRC are dropped; the host repeats any request that goes unanswered. */
+static void frame_poll_host(void)
+{
+    uint8_t b;
+    while (uart_rx_take(&b)) {
+        if (rx_len == 0 && b != FRAME_MAGIC0)
+            continue;
+        if (rx_len == 1 && b != FRAME_MAGIC1) {
+            rx_len = (b == FRAME_MAGIC0) ? 1 : 0;
+            continue;
+        }
+        rx_frame[rx_len++] = b;
+        if (rx_len < FRAME_HEADER_BYTES)
+            continue;
+
+        uint32_t len = frame_get_u32(rx_frame + 12);
+        if (len > sizeof(rx_frame) - FRAME_HEADER_BYTES - FRAME_CRC_BYTES) {
+            rx_len = 0;
+            continue;
+        }
+        if (rx_len < FRAME_HEADER_BYTES + len + FRAME_CRC_BYTES)
+            continue;
+
+        uint32_t crc = frame_crc32_final(frame_crc32_update(FRAME_CRC_INIT, rx_frame, FRAME_HEADER_BYTES + len));
+        if (crc == frame_get_u32(rx_frame + FRAME_HEADER_BYTES + len))
+            handle_host_frame(rx_frame);
+        rx_len = 0;
+    }
+}
+
+/* Pending run of uniform pages (every byte equal), sent as one UNIFORM
+ * frame instead of one PAGE frame each. After a TRIM most of the die reads
+ * as erased 0xFF, so this is where most of the line time goes. */
+static uint32_t run_first;
+static uint32_t run_count;
+static uint32_t run_fill;
+static uint32_t run_bytes;
+
+static void dump_flush_run(void)
+{
+    if (run_count == 0)
+        return;
+    uint32_t token[3] = { run_count, run_fill, run_bytes };
+    frame_send_u32(FRAME_UNIFORM, run_first, token, 3);
+    run_count = 0;
+}
+
+/* Checks page_copy for a single repeated byte. Non-uniform pages almost
+ * always differ within the first word or two. */
+static int page_uniform(uint32_t bytes, uint32_t *fill)
+{
+    if (bytes == 0)
+        return 0;
+    uint32_t pattern = (page_copy[0] & 0xFF) * 0x01010101U;
+    uint32_t full_words = bytes / 4;
+    for (uint32_t i = 0; i < full_words; i++) {
+        if (page_copy[i] != pattern)
+            return 0;
+    }
+    uint32_t tail = bytes % 4;
+    if (tail) {
+        uint32_t mask = (1U << (tail * 8)) - 1;
+        if ((page_copy[full_words] & mask) != (pattern & mask))
+            return 0;
+    }
+    *fill = pattern & 0xFF;
+    return 1;
+}
+
+/* Starts reading 'row' into page buffer bank 'bank' (0 or 1) */
+static void page_read_start(uint32_t row, uint32_t bank)
+{
+    nand_write(REG_ADDR_COL, 0x0000);
+    nand_write(REG_ADDR_ROW, row & 0x00FFFFFF);
+    nand_start_op(OP_READ_PAGE | CTRL_BANK(bank));
+}
+
+/*
+ * Cache reads (31h/3Fh). A run is opened with 00h-30h and no data out, which
+ * loads the first row into the NAND data register; each 31h then hands that
+ * page out while the array loads the next row, so tR overlaps the transfer.
+ * cache_row is the row in the data register while a run is open.
+ */
+#define CACHE_NONE  0xFFFFFFFFU
+
+static uint32_t cache_row = CACHE_NONE;
+
+/* Runs one op with RD_COUNT 0 (no data out), restoring RD_COUNT after */
+static int nand_op_no_data(uint32_t op_bits)
+{
+    uint32_t count = nand_read(REG_RD_COUNT);
+    nand_write(REG_RD_COUNT, 0);
+    nand_start_op(op_bits);
+    int r = nand_wait_done(10000);
+    nand_write(REG_RD_COUNT, count);
+    return r;
+}
+
+/* Ends an open run: 3Fh lets the array finish the load that 31h began. Other
+ * commands must not be issued into an open run. */
+static void cache_close(void)
+{
+    if (cache_row == CACHE_NONE)
+        return;
+    nand_op_no_data(OP_CACHE_END);
+    cache_row = CACHE_NONE;
+}
+
+/* Starts the cache op that delivers 'row' into bank 'bank', opening a run at
+ * 'row' first unless the data register already holds it. A run ends with
+ * 3Fh at the last page of a block or of the dump. */
+static void cache_read_start(uint32_t row, uint32_t bank)
+{
+    if (cache_row != row) {
+        cache_close();
+        nand_write(REG_ADDR_COL, 0x0000);
+        nand_write(REG_ADDR_ROW, row & 0x00FFFFFF);
+        /* Fills nothing, but zeroes PAGE_IDX of its bank: not the one draining */
+        if (nand_op_no_data(OP_READ_PAGE | CTRL_BANK(bank)) != 0) {
+            page_read_start(row, bank);     /* reports the timeout as usual */
+            return;
+        }
+        cache_row = row;
+    }
+    if ((row + 1) % dump_ppb == 0 || row + 1 == dump_rows) {
+        nand_start_op(OP_CACHE_END | CTRL_BANK(bank));
+        cache_row = CACHE_NONE;
+    } else {
+        nand_start_op(OP_CACHE_SEQ | CTRL_BANK(bank));
+        cache_row = row + 1;
+    }
+}
+
+/* Starts the next read of the dump pass */
+static void dump_read_start(uint32_t row, uint32_t bank)
+{
+    if (dump_cache)
+        cache_read_start(row, bank);
+    else
+        page_read_start(row, bank);
+}
+
+/* Takes the statistics of a finished page in bank 'bank' and copies the
+ * page into page_copy, unless the statistics show it all 0xFF or all 0x00;
+ * the other bank may be filling meanwhile. Returns the byte count. */
+static int32_t page_drain(uint32_t bank)
+{
+    nand_write(REG_BUF_BANK, bank);
+    uint32_t bytes = nand_read(REG_PAGE_IDX);
+    if (bytes > sizeof(page_copy))
+        bytes = sizeof(page_copy);
+    page_crc = nand_read(REG_PAGE_CRC);
+    page_non_ff = nand_read(REG_NON_FF);
+    page_zeros = nand_read(REG_ZEROS);
+    if (page_non_ff != 0 && page_zeros != bytes * 8)
+        nand_copy_page_buf(page_copy, bytes);
+    return (int32_t)bytes;
+}
+
+/* page_uniform() for the page page_drain() took: 0xFF and 0x00 pages from
+ * the statistics (they were not copied), other fills from page_copy */
+static int page_drained_uniform(uint32_t bytes, uint32_t *fill)
+{
+    if (bytes == 0)
+        return 0;
+    if (page_non_ff == 0) {
+        *fill = 0xFF;
+        return 1;
+    }
+    if (page_zeros == bytes * 8) {
+        *fill = 0x00;
+        return 1;
+    }
+    return page_uniform(bytes, fill);
+}
+
+/* Waits for the read begun by page_read_start() (the UART keeps draining)
+ * and copies the page to page_copy. Returns the byte count, -1 on timeout. */
+static int32_t page_read_finish(uint32_t bank)
+{
+    if (nand_wait_done(10000) != 0)
+        return -1;
+    return page_drain(bank);
+}
+
+/* Queues the frame(s) for a page in page_copy (or a failed read). */
+static void dump_emit_page(uint32_t row, int32_t bytes)
+{
+    if (bytes < 0) {
+        uint32_t code = FRAME_ERR_TIMEOUT;
+        dump_flush_run();
+        frame_send_u32(FRAME_PAGE_ERR, row, &code, 1);
+        dump_errors++;
+        return;
+    }
+
+    uint32_t fill;
+    if (page_drained_uniform((uint32_t)bytes, &fill)) {
+        if (run_count > 0 && run_first + run_count == row && run_fill == fill && run_bytes == (uint32_t)bytes) {
+            run_count++;
+            return;
+        }
+        dump_flush_run();
+        run_first = row;
+        run_count = 1;
+        run_fill = fill;
+        run_bytes = (uint32_t)bytes;
+        return;
+    }
+    dump_flush_run();
+    frame_send_page(row, (uint32_t)bytes);
+}
+
+static void dump_send_row(uint32_t row)
+{
+    cache_close();
+    page_read_start(row, 0);
+    dump_emit_page(row, page_read_finish(0));
+}
+
+/* Serves queued re-requests, answering each NACK frame with RESEND_DONE
+ * once its last range is out; returns the number of rows resent. */
+static uint32_t dump_serve_nacks(void)
+{
+    uint32_t resent = 0;
+    if (nack_count == 0)
+        return 0;
+    dump_flush_run();
+    while (nack_count > 0 && !host_done) {
+        nack_range_t r = nack_queue[nack_head];
+        nack_head = (nack_head + 1) % FRAME_NACK_QUEUE;
+        nack_count--;
+        for (uint32_t i = 0; i < r.count && !host_done; i++) {
+            dump_send_row(r.first + i);
+            frame_poll_host();
+            resent++;
+        }
+        if (r.last && !host_done) {
+            dump_flush_run();
+            frame_send_u32(FRAME_RESEND_DONE, 0, &r.batch, 1);
+        }
+    }
+    dump_flush_run();
+    return resent;
+}
+
+/*
+ * Dump plan. Before the pass each block is classified from its first and
+ * last pages, and only DATA blocks are then read in full:
+ *   BAD     the first spare byte of either page is not 0xFF and the data
+ *           area of that page is blank 0xFF, or the whole page is 00h.
+ *           Factory-bad blocks are never programmed, so a page holding
+ *           data (even a run of one byte, which its ECC in the spare area
+ *           may follow) is not taken for a bad-block marker.
+ *   ERASED  both pages are 0xFF throughout. Pages are programmed in order
+ *           from the first, so a blank first page means a blank block.
+ *   DATA    anything else, including a sample that fails to read.
+ * The map goes to the host, which fills ERASED blocks with 0xFF and can ask
+ * for the rows of ERASED or BAD blocks like missing ones to check them in
+ * full.
+ */
+static uint8_t block_class[DUMP_MAX_BLOCKS];
+static uint32_t plan_counts[3];     /* blocks per FRAME_BLOCK_* class */
+
+static uint8_t plan_classify(uint32_t block, uint32_t page_data, uint32_t page_total)
+{
+    uint32_t first = block * dump_ppb;
+    uint32_t rows[2] = { first, first + dump_ppb - 1 };
+    const uint8_t *page = (const uint8_t *)page_copy;
+    for (int i = 0; i < 2; i++) {
+        page_read_start(rows[i], 0);
+        int32_t bytes = page_read_finish(0);
+        if (bytes < (int32_t)page_total)
+            return FRAME_BLOCK_DATA;
+        if (page_non_ff == 0)
+            continue;                   /* blank, and not copied */
+        if (page_zeros == page_total * 8)
+            return FRAME_BLOCK_BAD;     /* all 00h, marker included */
+        uint32_t fill;
+        if (page_total > page_data && page[page_data] != 0xFF
+            && page_uniform(page_data, &fill) && fill == 0xFF)
+            return FRAME_BLOCK_BAD;
+        return FRAME_BLOCK_DATA;
+    }
+    return FRAME_BLOCK_ERASED;
+}
+
+/* Classifies every block, sending the map a FRAME_MAP_BLOCKS chunk at a
+ * time so the host sees the planning progress. Stops on HOST_DONE. */
+static void dump_plan(uint32_t blocks, uint32_t page_data, uint32_t page_total)
+{
+    static uint8_t map[4 + FRAME_MAP_BLOCKS];
+    memset(plan_counts, 0, sizeof(plan_counts));
+    for (uint32_t first = 0; first < blocks && !host_done; first += FRAME_MAP_BLOCKS) {
+        uint32_t n = blocks - first < FRAME_MAP_BLOCKS ? blocks - first : FRAME_MAP_BLOCKS;
+        for (uint32_t b = first; b < first + n && !host_done; b++) {
+            block_class[b] = plan_classify(b, page_data, page_total);
+            plan_counts[block_class[b]]++;
+            frame_poll_host();
+        }
+        frame_put_u32(map, first);
+        memcpy(map + 4, block_class + first, n);
+        frame_send(FRAME_BLOCK_MAP, first * dump_ppb, map, 4 + n);
+    }
+}
+
+/* First row at or after 'row' in a block the pass reads */
+static uint32_t dump_skip_to_data(uint32_t row)
+{
+    while (row < dump_rows && block_class[row / dump_ppb] != FRAME_BLOCK_DATA)
+        row = (row / dump_ppb + 1) * dump_ppb;
+    return row;
+}
+
 static void do_dump_all(void)
 {
     /*
-     * Full NAND dump: iterate over all pages and stream data.
+     * Full NAND dump: plan the pass, then stream the planned pages as
+     * frames.
      *
-     * First, read the NAND ID to determine geometry. Then loop over all
-     * blocks and pages, reading each page and sending the raw data over UART.
+     * The geometry comes from the ONFI parameter page, or from READ ID and
+     * DUMP_TOTAL_BLOCKS on a die without one. The planning pass samples
+     * every block (see dump_plan) and sends the host the block map; then
+     * the pass reads every page of the DATA blocks, sending each as a
+     * CRC-protected PAGE frame (or PAGE_ERR on a read timeout) and a
+     * PROGRESS frame per block. Runs of uniform pages within a block go out
+     * as one UNIFORM frame.
      *
-     * The host receiver script should be ready to capture the binary stream.
+     * Between pages the host may NACK row ranges it lost; those are resent
+     * before the pass continues, each NACK answered with RESEND_DONE (or
+     * NACK_BUSY when the queue has no room for it). After DUMP_END the
+     * board keeps serving NACKs until the host sends HOST_DONE or stays
+     * silent for a minute. HOST_DONE during the
+     * pass ends the dump early.
      *
-     * Protocol for dump:
-     *   ARM sends "DUMP_START\r\n"
-     *   For each page:
-     *     ARM sends 4 bytes: page_bytes (little-endian uint32)
-     *     ARM sends 3 bytes: row address (little-endian uint24)
-     *     ARM sends page_bytes of raw data
-     *   ARM sends "DUMP_END\r\n" when complete
+     * Use sw/nand_receiver on the host.
      */
 
-    /* Read ID to determine geometry */
-    nand_write(REG_ADDR_COL, 0x0000);
-    nand_write(REG_RD_COUNT, 5);
-    nand_start_op(OP_READ_ID);
-    if (nand_wait_done(1000) != 0) {
-        uart_send_str("ERR:DUMP_ID_FAIL\r\n");
-        return;
+    nand_geometry_t geo;
+    if (onfi_read_geometry(&geo) != 0) {
+        if (id_read_geometry(&geo) != 0) {
+            uart_send_str("ERR:DUMP_ID_FAIL\r\n");
+            return;
+        }
+        uart_send_str("WARN:NO_ONFI_PARAM (block count from DUMP_TOTAL_BLOCKS)\r\n");
     }
+    uint32_t page_total = geo.page_data + geo.spare;
+    uint32_t pages_per_block = geo.pages_per_block;
+    uint32_t total_blocks = geo.blocks;
 
-    uint32_t id_lo = nand_read(REG_ID_LO);
-    uint8_t byte3 = (id_lo >> 24) & 0xFF;
-    uint8_t byte4 = nand_read(REG_ID_HI) & 0xFF;
-
-    /* Decode geometry from ID bytes (ONFI convention) */
-    uint32_t page_data_size = 1024U << (byte3 & 0x03);
-    uint32_t spare_per_512  = (byte3 & 0x04) ? 16 : 8;
-    uint32_t spare_total    = (page_data_size / 512) * spare_per_512;
-    uint32_t page_total     = page_data_size + spare_total;
-    uint32_t pages_per_block = 64U << ((byte3 >> 4) & 0x03);
-
-    /* Plane count and die info from byte4 */
-    uint32_t plane_count = 1U << ((byte4 >> 2) & 0x03);
-
-    /* Estimate total blocks — for a 64 GB die, typical configurations:
-     * 8KB page, 256 pages/block = 2MB/block, 32768 blocks
-     * This needs to be adjusted for the actual NAND. The user should
-     * override via the 'A' and 'C' commands or modify this code. */
-    uint32_t total_blocks = 4096;  /* CONSERVATIVE DEFAULT — adjust! */
-
-    uart_send_str("DUMP_START\r\n");
-    uart_send_str("  page_data=");
-    uart_send_hex32(page_data_size);
-    uart_send_str(" spare=");
-    uart_send_hex32(spare_total);
-    uart_send_str(" pages/blk=");
-    uart_send_hex32(pages_per_block);
-    uart_send_str(" blocks=");
-    uart_send_hex32(total_blocks);
-    uart_send_str("\r\n");
+    /* The plan holds DUMP_MAX_BLOCKS and ADDR_ROW 24 bits */
+    uint32_t max_blocks = (1U << 24) / pages_per_block;
+    if (max_blocks > DUMP_MAX_BLOCKS)
+        max_blocks = DUMP_MAX_BLOCKS;
+    if (total_blocks > max_blocks) {
+        uart_send_str("WARN:DUMP_BLOCKS_CLAMPED blocks=");
+        uart_send_hex32(max_blocks);
+        uart_send_str("\r\n");
+        total_blocks = max_blocks;
+    }
+
+    frame_crc32_init();
+    tx_seq = 0;
+    dump_rows = total_blocks * pages_per_block;
+    dump_ppb = pages_per_block;
+    cache_row = CACHE_NONE;
+    dump_errors = 0;
+    erased_pages = 0;
+    erased_zero_bits = 0;
+    nack_head = 0;
+    nack_count = 0;
+    host_done = 0;
+    rx_len = 0;
+    run_count = 0;
+
+    uint32_t geometry[4] = { geo.page_data, geo.spare, pages_per_block, total_blocks };
+    frame_send_u32(FRAME_DUMP_START, 0, geometry, 4);
 
     /* Set read count for full page + spare */
     nand_write(REG_RD_COUNT, page_total);
 
-    for (uint32_t block = 0; block < total_blocks; block++) {
-        for (uint32_t page = 0; page < pages_per_block; page++) {
-            uint32_t row = block * pages_per_block + page;
-
-            /* Set address: column = 0 (read from start of page) */
-            nand_write(REG_ADDR_COL, 0x0000);
-            nand_write(REG_ADDR_ROW, row & 0x00FFFFFF);
+    dump_plan(total_blocks, geo.page_data, page_total);
 
-            nand_start_op(OP_READ_PAGE);
+    /*
+     * Pipelined pass over the two page buffer banks: as soon as a read is
+     * done the next one starts into the other bank, and the finished page
+     * is drained to DDR, checked and queued while the NAND works and the
+     * UART drains. NACKed rows are read through bank 0 one at a time, so
+     * when any are queued the next read waits until they have been served.
+     * With cache reads on, each block is one 00h-30h / 31h... / 3Fh run, so
+     * the array load of a page also overlaps the transfer of the one before.
+     * Blocks the plan left out are stepped over.
+     */
+    uint32_t pages_sent = 0;
+    int in_flight = 0;
+    uint32_t bank = 0;
+    uint32_t next;
+    uint32_t row = dump_skip_to_data(0);
+    if (row < dump_rows && !host_done) {
+        dump_read_start(row, bank);
+        in_flight = 1;
+    }
+    for (; row < dump_rows && !host_done; row = next) {
+        int ok = nand_wait_done(10000) == 0;
+        uint32_t done_bank = bank;
+        in_flight = 0;
+        next = dump_skip_to_data(row + 1);
+        frame_poll_host();
+        int serve = nack_count > 0;
+        if (!serve && next < dump_rows) {
+            bank ^= 1;
+            dump_read_start(next, bank);
+            in_flight = 1;
+        }
 
-            if (nand_wait_done(10000) != 0) {
-                /* Timeout — send error marker and continue */
-                uint8_t marker[7] = {0xFF, 0xFF, 0xFF, 0xFF, 'E', 'R', 'R'};
-                uart_send_buf(marker, 7);
-                continue;
-            }
+        int32_t bytes = ok ? page_drain(done_bank) : -1;
+        dump_emit_page(row, bytes);
+        pages_sent++;
+        if (bytes > 0 && page_zeros <= ERASED_MAX_ZEROS((uint32_t)bytes)) {
+            erased_pages++;
+            erased_zero_bits += page_zeros;
+        }
+        if ((row + 1) % pages_per_block == 0) {
+            uint32_t block = row / pages_per_block;
+            dump_flush_run();
+            frame_send_u32(FRAME_PROGRESS, block * pages_per_block, &block, 1);
+        }
 
-            uint32_t bytes_read = nand_read(REG_PAGE_IDX);
-
-            /* Send header: page_bytes (4) + row_addr (3) */
-            uint8_t hdr[7];
-            hdr[0] = (bytes_read >>  0) & 0xFF;
-            hdr[1] = (bytes_read >>  8) & 0xFF;
-            hdr[2] = (bytes_read >> 16) & 0xFF;
-            hdr[3] = (bytes_read >> 24) & 0xFF;
-            hdr[4] = (row >>  0) & 0xFF;
-            hdr[5] = (row >>  8) & 0xFF;
-            hdr[6] = (row >> 16) & 0xFF;
-            uart_send_buf(hdr, 7);
-
-            /* Stream page data */
-            uint32_t words = (bytes_read + 3) / 4;
-            for (uint32_t i = 0; i < words; i++) {
-                uint32_t w = nand_read(REG_PAGE_BUF + i * 4);
-                uint8_t b[4];
-                b[0] = (w >>  0) & 0xFF;
-                b[1] = (w >>  8) & 0xFF;
-                b[2] = (w >> 16) & 0xFF;
-                b[3] = (w >> 24) & 0xFF;
-                uint32_t remaining = bytes_read - i * 4;
-                uint32_t send_cnt = remaining >= 4 ? 4 : remaining;
-                uart_send_buf(b, send_cnt);
+        if (serve) {
+            pages_sent += dump_serve_nacks();
+            if (next < dump_rows && !host_done) {
+                dump_read_start(next, bank);
+                in_flight = 1;
             }
         }
+    }
+    if (in_flight)
+        nand_wait_done(10000);   /* the controller ignores START while busy */
+    cache_close();               /* a run left open by HOST_DONE */
+    nand_write(REG_BUF_BANK, 0);  /* the single-page commands use bank 0 */
 
-        /* Progress: send block number on a separate line every 64 blocks */
-        if ((block & 0x3F) == 0) {
-            uart_send_str("\r\nBLK=");
-            uart_send_hex32(block);
-            uart_send_str("\r\n");
+    dump_flush_run();
+    uint32_t summary[4] = { pages_sent, dump_errors, erased_pages, erased_zero_bits };
+    frame_send_u32(FRAME_DUMP_END, 0, summary, 4);
+
+    /* Re-request phase: ~60 s of host silence ends it */
+    uint32_t idle_ms = 0;
+    while (!host_done && idle_ms < 60000) {
+        frame_poll_host();
+        if (nack_count > 0) {
+            dump_serve_nacks();
+            idle_ms = 0;
+        } else if (tx_tail != tx_head) {
+            /* The end of the pass is still queued; the FIFO holds < 1 ms */
+            uart_tx_pump();
+            usleep(100);
+        } else {
+            usleep(1000);
+            idle_ms++;
         }
     }
+    uart_tx_flush();
+}
+
+/*---------------------------------------------------------------------------
+ * Bus timing calibration ('T')
+ *
+ * Reads the page at ADDR_ROW (RD_COUNT bytes) at the reset timing as the
+ * reference, then at each faster step until its CRC-32 stops matching. The
+ * last step that matched is checked again with more reads and kept, or the
+ * sweep backs off a step at a time until one holds. Pick a programmed page
+ * with 'A': an erased one hides most read errors.
+ *---------------------------------------------------------------------------*/
+#define CAL_READS         4     /* per step during the sweep */
+#define CAL_VERIFY_READS  16    /* on the step that is kept */
 
-    uart_send_str("DUMP_END\r\n");
+/* Reads the page through bank 0 and returns the controller's CRC-32 of it
+ * in *crc; the page itself is never copied out */
+static int cal_read_crc(uint32_t *crc, uint32_t *bytes)
+{
+    nand_write(REG_BUF_BANK, 0);
+    nand_start_op(OP_READ_PAGE);
+    if (nand_wait_done(1000) != 0)
+        return -1;
+    *crc = nand_read(REG_PAGE_CRC);
+    *bytes = nand_read(REG_PAGE_IDX);
+    return 0;
+}
+
+/* Returns 1 if 'reads' reads of the page all give 'ref' */
+static int cal_check(uint32_t ref, uint32_t reads)
+{
+    for (uint32_t i = 0; i < reads; i++) {
+        uint32_t crc, bytes;
+        if (cal_read_crc(&crc, &bytes) != 0 || crc != ref)
+            return 0;
+    }
+    return 1;
+}
+
+static void cal_report(const char *what, uint32_t step)
+{
+    uart_send_str(what);
+    uart_send_str(" mode=");
+    uart_send_hex32(timing_steps[step].mode);
+    uart_send_str(" TIMING=0x");
+    uart_send_hex32(timing_steps[step].timing);
+    uart_send_str("\r\n");
+}
+
+static void do_calibrate(void)
+{
+    if (timing_apply(0) != 0) {
+        uart_send_str("ERR:CAL_SET_FEATURES_TIMEOUT\r\n");
+        return;
+    }
+
+    uint32_t ref, bytes;
+    if (cal_read_crc(&ref, &bytes) != 0 || bytes == 0) {
+        uart_send_str("ERR:CAL_READ_FAIL\r\n");
+        return;
+    }
+    if (!cal_check(ref, CAL_READS)) {
+        uart_send_str("ERR:CAL_UNSTABLE (reads differ at the reset timing)\r\n");
+        return;
+    }
+    if (nand_read(REG_NON_FF) == 0 || nand_read(REG_ZEROS) == bytes * 8)
+        uart_send_str("WARN:CAL_PAGE_UNIFORM (pick a programmed page with 'A')\r\n");
+
+    uint32_t good = 0;
+    for (uint32_t step = 1; step < TIMING_STEPS; step++) {
+        int ok = timing_apply(step) == 0 && cal_check(ref, CAL_READS);
+        cal_report(ok ? "CAL:PASS" : "CAL:FAIL", step);
+        if (!ok)
+            break;
+        good = step;
+    }
+
+    /* Back off until a step holds up to the longer check */
+    while (good > 0 && (timing_apply(good) != 0 || !cal_check(ref, CAL_VERIFY_READS))) {
+        cal_report("CAL:VERIFY_FAIL", good);
+        good--;
+    }
+    if (good == 0)
+        timing_apply(0);
+    cal_report("OK:TIMING", good);
 }
 
 /*---------------------------------------------------------------------------
@@ -389,7 +1289,7 @@ int main(void)
     uart_send_str("Resetting NAND...\r\n");
     do_reset();
 
-    uart_send_str("Ready. Commands: R=Reset I=ID S=Status G=GetPage D=DumpAll V=Version\r\n");
+    uart_send_str("Ready. Commands: R=Reset I=ID S=Status P=Param G=GetPage D=DumpAll K=CacheRead T=CalTiming V=Version\r\n");
     uart_send_str("> ");
 
     while (1) {
@@ -410,6 +1310,10 @@ int main(void)
             do_read_status();
             break;
 
+        case 'P': case 'p':
+            do_read_param();
+            break;
+
         case 'G': case 'g':
             do_read_page();
             break;
@@ -419,6 +1323,15 @@ int main(void)
             do_dump_all();
             break;
 
+        case 'K': case 'k':
+            dump_cache = !dump_cache;
+            uart_send_str(dump_cache ? "CACHE_READ=ON\r\n" : "CACHE_READ=OFF\r\n");
+            break;
+
+        case 'T': case 't':
+            do_calibrate();
+            break;
+
         case 'A': case 'a': {
             /* Set address: receive 5 bytes */
             uart_send_str("Send 5 addr bytes (col_lo col_hi row0 row1 row2): ");
@@ -458,7 +1371,7 @@ int main(void)
             break;
 
         default:
-            uart_send_str("Unknown command. R=Reset I=ID S=Status G=GetPage D=DumpAll A=SetAddr C=SetCount V=Version\r\n");
+            uart_send_str("Unknown command. R=Reset I=ID S=Status P=Param G=GetPage D=DumpAll K=CacheRead T=CalTiming A=SetAddr C=SetCount V=Version\r\n");
             break;
         }
 
@@ -0,0 +1,143 @@
+/*******************************************************************************
+ * nand_frame.h
+ * Framed dump protocol shared by nand_dump.c (board) and nand_receiver.cpp
+ * (host)
+ *
+ * Every message in a dump session, in both directions, is one frame:
+ *
+ *   offset  size  field
+ *   0       2     magic   0xA5 0x5A
+ *   2       1     type    FRAME_*
+ *   3       1     flags   reserved, 0
+ *   4       4     seq     per-direction sequence number (LE)
+ *   8       4     row     NAND row address the frame refers to (LE)
+ *   12      4     length  payload bytes (LE), at most FRAME_MAX_PAYLOAD
+ *   16      N     payload
+ *   16+N    4     crc     CRC-32 (IEEE, reflected) of bytes 0 .. 16+N-1
+ *
+ * The CRC trails the payload so the board can compute it while streaming
+ * the page buffer. A receiver that finds a bad CRC cannot trust the length
+ * either, so it resumes the magic search one byte further on rather than
+ * skipping the frame. Multi-byte payload fields are little-endian u32.
+ *
+ * Board -> host:
+ *   DUMP_START   payload: page_data, spare, pages_per_block, blocks
+ *   BLOCK_MAP    row = first row of the first block, payload: first block,
+ *                then one FRAME_BLOCK_* byte per block (up to
+ *                FRAME_MAP_BLOCKS). Only DATA blocks follow as pages; the
+ *                pass skips ERASED and BAD ones. Sent in chunks as the
+ *                planning pass classifies the die, before the first PAGE.
+ *   PAGE         payload: the page (data + spare)
+ *   UNIFORM      row = first row, payload: count, fill byte, page bytes.
+ *                Stands for 'count' PAGE frames whose every byte is 'fill'
+ *                (erased 0xFF, mostly); never spans a PROGRESS frame.
+ *   PAGE_ERR     payload: error code (FRAME_ERR_*)
+ *   PROGRESS     payload: block just finished; row = its first row
+ *   DUMP_END     payload: pages sent, page errors, pages of the pass that
+ *                read as erased, 0 bits in those (raw bit errors)
+ *   RESEND_DONE  payload: batch; every row the NACK of that batch asked for
+ *                has been resent
+ *   NACK_BUSY    payload: batch; the queue had no room for that NACK's
+ *                ranges, none was taken and nothing was resent
+ *
+ * Host -> board:
+ *   NACK         payload: batch (a host-chosen id echoed in the answer),
+ *                then up to FRAME_NACK_RANGES (first row, row count) pairs.
+ *                Queued (up to FRAME_NACK_QUEUE ranges) and served between
+ *                pages, and answered with RESEND_DONE or NACK_BUSY. The
+ *                host keeps at most FRAME_NACK_QUEUE ranges unanswered, so
+ *                a frame fits the board's 64-byte RX FIFO and the ranges
+ *                in flight fit its queue.
+ *   HOST_DONE    payload: none; ends the session after DUMP_END.
+ ******************************************************************************/
+
+#ifndef NAND_FRAME_H
+#define NAND_FRAME_H
+
+#include <stdint.h>
+
+#define FRAME_MAGIC0        0xA5
+#define FRAME_MAGIC1        0x5A
+#define FRAME_HEADER_BYTES  16
+#define FRAME_CRC_BYTES     4
+#define FRAME_MAX_PAYLOAD   32768
+
+#define FRAME_DUMP_START    0x01
+#define FRAME_PAGE          0x02
+#define FRAME_PAGE_ERR      0x03
+#define FRAME_PROGRESS      0x04
+#define FRAME_DUMP_END      0x05
+#define FRAME_RESEND_DONE   0x06
+#define FRAME_UNIFORM       0x07
+#define FRAME_BLOCK_MAP     0x08
+#define FRAME_NACK_BUSY     0x09
+#define FRAME_NACK          0x10
+#define FRAME_HOST_DONE     0x11
+
+#define FRAME_ERR_TIMEOUT   1
+
+/* BLOCK_MAP classes */
+#define FRAME_BLOCK_DATA    0   /* dumped in full */
+#define FRAME_BLOCK_ERASED  1   /* first and last pages read as all 0xFF */
+#define FRAME_BLOCK_BAD     2   /* bad-block marker in the spare area */
+
+#define FRAME_MAP_BLOCKS    8192
+
+#define FRAME_NACK_QUEUE    16  /* ranges the board holds */
+#define FRAME_NACK_RANGES   4   /* ranges per NACK frame: 56 bytes */
+
+/* Table-driven CRC-32 (polynomial 0xEDB88320). frame_crc32_init() fills
+ * the table once; frame_crc32_update() may be fed in pieces, starting from
+ * FRAME_CRC_INIT and finished with frame_crc32_final(). */
+#define FRAME_CRC_INIT      0xFFFFFFFFU
+
+static uint32_t frame_crc_table[256];
+
+static inline void frame_crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320U : c >> 1;
+        frame_crc_table[i] = c;
+    }
+}
+
+static inline uint32_t frame_crc32_update(uint32_t crc, const uint8_t *p, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+        crc = frame_crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static inline uint32_t frame_crc32_final(uint32_t crc)
+{
+    return crc ^ 0xFFFFFFFFU;
+}
+
+static inline void frame_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >>  0);
+    p[1] = (uint8_t)(v >>  8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t frame_get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Writes a frame header; the caller sends the payload and the CRC. */
+static inline void frame_build_header(uint8_t *hdr, uint8_t type, uint32_t seq, uint32_t row, uint32_t length)
+{
+    hdr[0] = FRAME_MAGIC0;
+    hdr[1] = FRAME_MAGIC1;
+    hdr[2] = type;
+    hdr[3] = 0;
+    frame_put_u32(hdr + 4, seq);
+    frame_put_u32(hdr + 8, row);
+    frame_put_u32(hdr + 12, length);
+}
+
+#endif /* NAND_FRAME_H */
@@ -0,0 +1,963 @@
+/*******************************************************************************
+ * nand_receiver.cpp
+ * Native host receiver for the NAND dump stream (replaces host_receiver.py
+ * for long dumps)
+ *
+ * Reads the framed stream produced by do_dump_all() in nand_dump.c (format
+ * in nand_frame.h) through a raw termios port into a large ring buffer. The
+ * frame parser works on the buffer in place: the CRC is computed over the
+ * ring and page payloads go straight to pwrite() at row * page_bytes.
+ * UNIFORM frames (runs of pages holding one repeated byte, usually erased
+ * 0xFF) are expanded back into full pages, so the output is always the raw
+ * dump.
+ *
+ * The BLOCK_MAP frames sent before the pages say which blocks the board
+ * skips: ERASED blocks are written as 0xFF (what their sampled pages read),
+ * BAD blocks are left as holes, and both are listed in <output>.blockmap
+ * rather than as missing. With --recheck-erased the rows of ERASED blocks
+ * are asked for after DUMP_END like missing ones, so they are read in full;
+ * --recheck-bad does the same for BAD blocks.
+ *
+ * A frame that fails its CRC is dropped and the magic search resumes one
+ * byte later, so a line glitch costs only the frames it touches. Rows that
+ * went missing (skipped rows, lost frames, PAGE_ERR) are NACKed back to the
+ * board, during the pass as gaps show up and again after DUMP_END until
+ * every row has arrived or kMaxAttempts resends of it have been answered
+ * without it. Each NACK frame carries a batch id that the board echoes in
+ * RESEND_DONE (or NACK_BUSY when its queue is full), so an attempt counts
+ * only once its own batch is answered or overdue, and HOST_DONE waits for
+ * every batch. Rows still missing at exit are listed in <output>.missing.
+ *
+ * Works on any tty, including the slave side of a pty, so the receiver can
+ * be exercised against a simulated board.
+ *
+ * Build (Linux/macOS): g++ -O2 -std=c++14 -o nand_receiver nand_receiver.cpp
+ *
+ * Usage:
+ *   nand_receiver [--port PORT] [--baud BAUD] [--output FILE] [--no-command]
+ *                 [--recheck-erased] [--recheck-bad]
+ *     --no-command      do not send 'D' (the dump was started by other means)
+ *     --recheck-erased  read ERASED blocks in full after the pass
+ *     --recheck-bad     read BAD blocks in full after the pass
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nand_frame.h"
+
+/*---------------------------------------------------------------------------
+ * Serial port
+ *---------------------------------------------------------------------------*/
+static speed_t BaudConstant(unsigned baud)
+{
+    switch (baud) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+    case 3000000: return B3000000;
+#endif
+    default:      return 0;
+    }
+}
+
+static int OpenSerialPort(const char* path, unsigned baud)
+{
+    const int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+        return -1;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    const speed_t speed = BaudConstant(baud);
+    if (speed == 0) {
+        fprintf(stderr, "Unsupported baud rate %u\n", baud);
+        close(fd);
+        return -1;
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+static const char* FindSerialPort()
+{
+    static const char* const candidates[] = {
+        "/dev/ttyUSB1",   /* second FTDI interface (UART) */
+        "/dev/ttyUSB0",
+        "/dev/ttyACM0",
+    };
+    for (const char* port : candidates) {
+        if (access(port, R_OK | W_OK) == 0)
+            return port;
+    }
+    return nullptr;
+}
+
+static double NowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile sig_atomic_t g_interrupted = 0;
+
+static void OnSignal(int)
+{
+    g_interrupted = 1;
+}
+
+static bool WriteFully(int fd, const uint8_t* p, size_t len)
+{
+    while (len > 0) {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/*---------------------------------------------------------------------------
+ * Ring buffer: the serial port writes at the tail, the parser consumes at
+ * the head. Headers are peeked into small locals; payloads are read in
+ * place, in two pieces when they wrap.
+ *---------------------------------------------------------------------------*/
+class RingBuffer {
+    std::vector<uint8_t> m_data;
+    size_t m_mask;
+    uint64_t m_head = 0;
+    uint64_t m_tail = 0;
+public:
+    explicit RingBuffer(size_t capacityPow2) : m_data(capacityPow2), m_mask(capacityPow2 - 1) {}
+
+    size_t size() const { return static_cast<size_t>(m_tail - m_head); }
+    size_t space() const { return m_data.size() - size(); }
+    uint8_t at(size_t i) const { return m_data[(m_head + i) & m_mask]; }
+
+    void peek(size_t offset, void* dst, size_t len) const
+    {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        for (size_t i = 0; i < len; ++i)
+            out[i] = at(offset + i);
+    }
+
+    void consume(size_t n) { m_head += n; }
+
+    // Contiguous run of buffered bytes starting 'offset' past the head, at
+    // most 'len'.
+    const uint8_t* segment(size_t offset, size_t len, size_t& got) const
+    {
+        const size_t start = static_cast<size_t>((m_head + offset) & m_mask);
+        got = std::min(len, std::min(size() - offset, m_data.size() - start));
+        return m_data.data() + start;
+    }
+
+    // Reads whatever the fd has into the free space; returns read()'s result.
+    ssize_t fill(int fd)
+    {
+        const size_t start = static_cast<size_t>(m_tail & m_mask);
+        const size_t contiguous = std::min(space(), m_data.size() - start);
+        if (contiguous == 0)
+            return 0;
+        const ssize_t n = read(fd, m_data.data() + start, contiguous);
+        if (n > 0)
+            m_tail += static_cast<uint64_t>(n);
+        return n;
+    }
+};
+
+/*---------------------------------------------------------------------------
+ * Frame parser and re-request bookkeeping
+ *---------------------------------------------------------------------------*/
+enum class RxState { WaitStart, Pass, Retry, Done, Failed };
+
+struct DumpGeometry {
+    uint32_t pageData = 0;
+    uint32_t spare = 0;
+    uint32_t pagesPerBlock = 0;
+    uint32_t blocks = 0;
+    uint32_t pageBytes() const { return pageData + spare; }
+    uint32_t rows() const { return pagesPerBlock * blocks; }
+};
+
+class DumpReceiver {
+    int m_out;
+    int m_port;
+    unsigned m_baud;
+    RxState m_state = RxState::WaitStart;
+    DumpGeometry m_geo;
+    uint32_t m_pageBytes = 0;          // from DUMP_START, else the first PAGE
+    std::vector<bool> m_received;
+    std::vector<uint8_t> m_attempts;   // answered NACKs per row
+    std::vector<bool> m_asked;         // queued or in an unanswered NACK
+    std::vector<uint8_t> m_blockClass; // FRAME_BLOCK_* per block, from BLOCK_MAP
+    bool m_recheckErased;
+    bool m_recheckBad;
+    std::deque<std::pair<uint32_t, uint32_t>> m_nacks;    // to send (first, count)
+
+    struct NackBatch {
+        uint32_t id;
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        uint64_t rows;
+        double deadline;
+    };
+    std::vector<NackBatch> m_batches;  // sent and not yet answered
+    uint32_t m_nextBatch = 0;
+    size_t m_rangesOut = 0;            // ranges in m_batches, at most FRAME_NACK_QUEUE
+    uint64_t m_rowsOut = 0;            // and their rows
+
+    uint32_t m_nextRow = 0;            // next row of the sequential pass
+    uint32_t m_rxSeq = 0;
+    bool m_haveSeq = false;
+    uint32_t m_txSeq = 0;
+    bool m_lost = false;
+    std::string m_text;                // text line before the first frame
+    std::vector<uint8_t> m_fill;       // rows of one fill byte, for UNIFORM
+    uint8_t m_fillValue = 0;
+
+    static const uint8_t kMaxAttempts = 6;
+
+    void sendFrame(uint8_t type, uint32_t row, const uint8_t* payload, uint32_t len)
+    {
+        uint8_t frame[FRAME_HEADER_BYTES + 4 + 8 * FRAME_NACK_RANGES + FRAME_CRC_BYTES];
+        frame_build_header(frame, type, m_txSeq++, row, len);
+        if (len)
+            memcpy(frame + FRAME_HEADER_BYTES, payload, len);
+        const uint32_t crc = frame_crc32_final(frame_crc32_update(FRAME_CRC_INIT, frame, FRAME_HEADER_BYTES + len));
+        frame_put_u32(frame + FRAME_HEADER_BYTES + len, crc);
+        if (!WriteFully(m_port, frame, FRAME_HEADER_BYTES + len + FRAME_CRC_BYTES))
+            perror("write");
+    }
+
+    void trackRow(uint32_t row)
+    {
+        if (row >= m_received.size() && m_geo.rows() == 0) {
+            m_received.resize(row + 1, false);
+            m_attempts.resize(row + 1, 0);
+            m_asked.resize(row + 1, false);
+        }
+    }
+
+    uint8_t blockClass(uint32_t row) const
+    {
+        if (m_geo.pagesPerBlock == 0 || row / m_geo.pagesPerBlock >= m_blockClass.size())
+            return FRAME_BLOCK_DATA;
+        return m_blockClass[row / m_geo.pagesPerBlock];
+    }
+
+    // ERASED and BAD rows are wanted only when rechecking, and only after
+    // the pass (the board does not send them in it).
+    bool wanted(uint32_t row) const
+    {
+        if (row >= m_received.size() || m_received[row] || m_asked[row] || m_attempts[row] >= kMaxAttempts)
+            return false;
+        switch (blockClass(row)) {
+        case FRAME_BLOCK_DATA:
+            return true;
+        case FRAME_BLOCK_ERASED:
+            return m_recheckErased && m_state == RxState::Retry;
+        case FRAME_BLOCK_BAD:
+            return m_recheckBad && m_state == RxState::Retry;
+        default:
+            return false;
+        }
+    }
+
+    // Queues a NACK for the rows in [first, end) still wanted, coalescing
+    // with the previous range where they touch.
+    void queueNack(uint32_t first, uint32_t end)
+    {
+        for (uint32_t row = first; row < end; ++row) {
+            if (!wanted(row))
+                continue;
+            m_asked[row] = true;
+            if (!m_nacks.empty() && m_nacks.back().first + m_nacks.back().second == row)
+                ++m_nacks.back().second;
+            else
+                m_nacks.emplace_back(row, 1);
+        }
+    }
+
+    // Everything before 'row' in the pass should have arrived by now.
+    void passReached(uint32_t row)
+    {
+        if (row > m_nextRow) {
+            queueNack(m_nextRow, row);
+            m_nextRow = row;
+        }
+    }
+
+    void markLost()
+    {
+        if (!m_lost)
+            ++resyncs;
+        m_lost = true;
+    }
+
+    uint32_t crcAt(const RingBuffer& rx, size_t len) const
+    {
+        uint32_t crc = FRAME_CRC_INIT;
+        for (size_t done = 0; done < len; ) {
+            size_t got;
+            const uint8_t* p = rx.segment(done, len - done, got);
+            crc = frame_crc32_update(crc, p, static_cast<uint32_t>(got));
+            done += got;
+        }
+        return frame_crc32_final(crc);
+    }
+
+    bool writePage(const RingBuffer& rx, uint32_t row, uint32_t len)
+    {
+        const off_t base = static_cast<off_t>(row) * m_pageBytes;
+        for (size_t done = 0; done < len; ) {
+            size_t got;
+            const uint8_t* p = rx.segment(FRAME_HEADER_BYTES + done, len - done, got);
+            const ssize_t n = pwrite(m_out, p, got, base + static_cast<off_t>(done));
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("pwrite");
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Expands a UNIFORM frame: 'count' pages of 'fill', written in runs of
+    // up to kFillRows rows from one prepared buffer.
+    bool writeUniform(uint32_t first, uint32_t count, uint8_t fill)
+    {
+        static const uint32_t kFillRows = 256;
+        const size_t need = static_cast<size_t>(kFillRows) * m_pageBytes;
+        if (m_fill.size() != need || m_fillValue != fill) {
+            m_fill.assign(need, fill);
+            m_fillValue = fill;
+        }
+        for (uint32_t done = 0; done < count; ) {
+            const uint32_t n = std::min(kFillRows, count - done);
+            const size_t len = static_cast<size_t>(n) * m_pageBytes;
+            const off_t base = static_cast<off_t>(first + done) * m_pageBytes;
+            for (size_t w = 0; w < len; ) {
+                const ssize_t k = pwrite(m_out, m_fill.data() + w, len - w, base + static_cast<off_t>(w));
+                if (k < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    perror("pwrite");
+                    return false;
+                }
+                w += static_cast<size_t>(k);
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    void pageArrived(uint32_t row, uint32_t len)
+    {
+        if (row >= m_received.size())
+            return;
+        if (!m_received[row]) {
+            m_received[row] = true;
+            ++pages;
+            bytes += len;
+        } else {
+            ++duplicates;
+        }
+        if (row < m_nextRow)
+            ++resent;
+    }
+
+    bool handleFrame(const RingBuffer& rx, uint8_t type, uint32_t row, uint32_t len)
+    {
+        uint8_t payload[16] = {};
+        if (type != FRAME_PAGE)
+            rx.peek(FRAME_HEADER_BYTES, payload, std::min<uint32_t>(len, sizeof(payload)));
+
+        switch (type) {
+        case FRAME_DUMP_START:
+            if (len < 16)
+                break;
+            m_geo.pageData = frame_get_u32(payload);
+            m_geo.spare = frame_get_u32(payload + 4);
+            m_geo.pagesPerBlock = frame_get_u32(payload + 8);
+            m_geo.blocks = frame_get_u32(payload + 12);
+            m_pageBytes = m_geo.pageBytes();
+            m_received.assign(m_geo.rows(), false);
+            m_attempts.assign(m_geo.rows(), 0);
+            m_asked.assign(m_geo.rows(), false);
+            m_blockClass.assign(m_geo.blocks, FRAME_BLOCK_DATA);
+            // The image is exactly the chip, whatever the file held before.
+            if (ftruncate(m_out, static_cast<off_t>(m_geo.rows()) * m_pageBytes) != 0) {
+                perror("ftruncate");
+                return false;
+            }
+            printf("  Geometry: page_data=%u spare=%u pages/blk=%u blocks=%u (%u rows)\n", m_geo.pageData,
+                m_geo.spare, m_geo.pagesPerBlock, m_geo.blocks, m_geo.rows());
+            break;
+
+        case FRAME_PAGE:
+            if (m_pageBytes == 0)
+                m_pageBytes = len;
+            trackRow(row);
+            if (row < m_received.size() && !writePage(rx, row, std::min(len, m_pageBytes)))
+                return false;
+            pageArrived(row, len);
+            passReached(row);
+            m_nextRow = std::max(m_nextRow, row + 1);
+            lastRow = row;
+            break;
+
+        case FRAME_UNIFORM: {
+            const uint32_t count = frame_get_u32(payload);
+            const uint32_t pageLen = frame_get_u32(payload + 8);
+            if (len < 12 || count == 0 || pageLen == 0)
+                break;
+            if (m_pageBytes == 0)
+                m_pageBytes = pageLen;
+            trackRow(row + count - 1);
+            const uint32_t end = std::min<uint64_t>(static_cast<uint64_t>(row) + count, m_received.size());
+            if (row < end && !writeUniform(row, end - row, static_cast<uint8_t>(frame_get_u32(payload + 4))))
+                return false;
+            for (uint32_t r = row; r < end; ++r)
+                pageArrived(r, pageLen);
+            uniformPages += count;
+            passReached(row);
+            m_nextRow = std::max(m_nextRow, end);
+            lastRow = end - 1;
+            break;
+        }
+
+        case FRAME_BLOCK_MAP: {
+            if (len < 4 || m_geo.pagesPerBlock == 0)
+                break;
+            const uint32_t first = frame_get_u32(payload);
+            std::vector<uint8_t> map(len - 4);
+            rx.peek(FRAME_HEADER_BYTES + 4, map.data(), len - 4);
+            for (uint32_t i = 0; i < map.size() && first + i < m_blockClass.size(); ++i) {
+                const uint32_t block = first + i;
+                m_blockClass[block] = map[i];
+                if (map[i] == FRAME_BLOCK_ERASED) {
+                    ++erasedBlocks;
+                    if (!writeUniform(block * m_geo.pagesPerBlock, m_geo.pagesPerBlock, 0xFF))
+                        return false;
+                } else if (map[i] == FRAME_BLOCK_BAD) {
+                    ++badBlocks;
+                }
+            }
+            lastBlock = first + static_cast<uint32_t>(map.size()) - 1;
+            break;
+        }
+
+        case FRAME_PAGE_ERR:
+            ++errors;
+            trackRow(row);
+            passReached(row);
+            m_nextRow = std::max(m_nextRow, row + 1);
+            queueNack(row, row + 1);
+            break;
+
+        case FRAME_PROGRESS:
+            lastBlock = frame_get_u32(payload);
+            if (m_geo.pagesPerBlock)
+                passReached(row + m_geo.pagesPerBlock);
+            break;
+
+        case FRAME_DUMP_END:
+            printf("\n  DUMP_END: board sent %u pages, %u read errors\n", frame_get_u32(payload),
+                frame_get_u32(payload + 4));
+            if (len >= 16 && frame_get_u32(payload + 8) && m_pageBytes) {
+                // Flipped bits in erased pages: the raw error rate of the cells
+                const uint32_t pages = frame_get_u32(payload + 8);
+                const uint32_t bits = frame_get_u32(payload + 12);
+                printf("  Erased pages: %u, %u bits read as 0, raw BER ~%.2e\n", pages, bits,
+                    bits / (8.0 * pages * m_pageBytes));
+            }
+            m_state = RxState::Retry;
+            break;
+
+        case FRAME_RESEND_DONE:
+        case FRAME_NACK_BUSY: {
+            // An id no batch in flight has is a stale answer: ignore it
+            const uint32_t id = len >= 4 ? frame_get_u32(payload) : 0;
+            for (size_t i = 0; i < m_batches.size(); ++i) {
+                if (len >= 4 && m_batches[i].id == id) {
+                    closeBatch(i, type == FRAME_RESEND_DONE);
+                    break;
+                }
+            }
+            break;
+        }
+        }
+        return true;
+    }
+
+    // Text before the first frame: the command echo, or an ERR: line if the
+    // board could not start the dump.
+    void takeText(uint8_t c)
+    {
+        if (c == '\r')
+            return;
+        if (c != '\n') {
+            if (m_text.size() < 256)
+                m_text.push_back(static_cast<char>(c));
+            return;
+        }
+        if (!m_text.empty())
+            printf("  < %s\n", m_text.c_str());
+        if (m_text.compare(0, 4, "ERR:") == 0)
+            m_state = RxState::Failed;
+        m_text.clear();
+    }
+
+public:
+    uint64_t pages = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t uniformPages = 0;
+    uint64_t resent = 0;
+    uint64_t duplicates = 0;
+    uint64_t crcErrors = 0;
+    uint64_t lostFrames = 0;
+    uint64_t resyncs = 0;
+    uint64_t skippedBytes = 0;
+    uint64_t erasedBlocks = 0;
+    uint64_t badBlocks = 0;
+    uint32_t lastBlock = 0;
+    uint32_t lastRow = 0;
+
+    DumpReceiver(int outFd, int portFd, unsigned baud, bool recheckErased, bool recheckBad)
+        : m_out(outFd), m_port(portFd), m_baud(baud), m_recheckErased(recheckErased), m_recheckBad(recheckBad) {}
+
+    RxState state() const { return m_state; }
+    const std::vector<bool>& received() const { return m_received; }
+    const std::vector<uint8_t>& blockMap() const { return m_blockClass; }
+
+    // Rows the board left out on purpose and that are not being rechecked
+    bool skipped(uint32_t row) const
+    {
+        const uint8_t c = blockClass(row);
+        return (c == FRAME_BLOCK_BAD && !m_recheckBad) || (c == FRAME_BLOCK_ERASED && !m_recheckErased);
+    }
+
+    // Consumes every complete frame in the buffer.
+    bool process(RingBuffer& rx)
+    {
+        while (m_state != RxState::Done && m_state != RxState::Failed) {
+            if (rx.size() < 2)
+                return true;
+            if (rx.at(0) != FRAME_MAGIC0 || rx.at(1) != FRAME_MAGIC1) {
+                if (m_state == RxState::WaitStart)
+                    takeText(rx.at(0));
+                else {
+                    markLost();
+                    ++skippedBytes;
+                }
+                rx.consume(1);
+                continue;
+            }
+            if (m_state == RxState::WaitStart)
+                m_state = RxState::Pass;
+            if (rx.size() < FRAME_HEADER_BYTES)
+                return true;
+
+            uint8_t hdr[FRAME_HEADER_BYTES];
+            rx.peek(0, hdr, sizeof(hdr));
+            const uint32_t seq = frame_get_u32(hdr + 4);
+            const uint32_t row = frame_get_u32(hdr + 8);
+            const uint32_t len = frame_get_u32(hdr + 12);
+            if (len > FRAME_MAX_PAYLOAD) {
+                markLost();
+                ++skippedBytes;
+                rx.consume(1);
+                continue;
+            }
+            if (rx.size() < FRAME_HEADER_BYTES + len + FRAME_CRC_BYTES)
+                return true;
+
+            uint8_t tail[FRAME_CRC_BYTES];
+            rx.peek(FRAME_HEADER_BYTES + len, tail, sizeof(tail));
+            if (crcAt(rx, FRAME_HEADER_BYTES + len) != frame_get_u32(tail)) {
+                // The length may be what got corrupted: look for the next
+                // magic from the following byte, not past this "frame".
+                ++crcErrors;
+                markLost();
+                ++skippedBytes;
+                rx.consume(1);
+                continue;
+            }
+
+            if (m_haveSeq && seq != m_rxSeq)
+                lostFrames += seq - m_rxSeq;
+            m_rxSeq = seq + 1;
+            m_haveSeq = true;
+            m_lost = false;
+            if (!handleFrame(rx, hdr[2], row, len))
+                return false;
+            rx.consume(FRAME_HEADER_BYTES + len + FRAME_CRC_BYTES);
+        }
+        return true;
+    }
+
+    // Ends a NACK batch. Its rows may be asked for again, and when the board
+    // resent them ('served') each one still missing has used an attempt.
+    void closeBatch(size_t i, bool served)
+    {
+        const NackBatch b = m_batches[i];
+        m_batches.erase(m_batches.begin() + static_cast<std::ptrdiff_t>(i));
+        m_rangesOut -= b.ranges.size();
+        m_rowsOut -= b.rows;
+        for (const auto& r : b.ranges) {
+            for (uint32_t row = r.first; row < r.first + r.second; ++row) {
+                m_asked[row] = false;
+                if (served && !m_received[row])
+                    ++m_attempts[row];
+            }
+            queueNack(r.first, r.first + r.second);
+        }
+    }
+
+    // Sends the NACKs collected while parsing, FRAME_NACK_RANGES ranges to a
+    // frame, keeping no more ranges unanswered than the board's queue holds;
+    // the rest wait for an answer. Rows that arrived meanwhile are left out.
+    void flushNacks(double now)
+    {
+        while (!m_nacks.empty() && m_rangesOut < FRAME_NACK_QUEUE) {
+            NackBatch b;
+            b.rows = 0;
+            while (!m_nacks.empty() && b.ranges.size() < FRAME_NACK_RANGES
+                && m_rangesOut + b.ranges.size() < FRAME_NACK_QUEUE) {
+                auto& r = m_nacks.front();
+                while (r.second > 0 && m_received[r.first]) {
+                    m_asked[r.first++] = false;
+                    --r.second;
+                }
+                uint32_t n = 0;
+                while (n < r.second && !m_received[r.first + n])
+                    ++n;
+                if (n > 0) {
+                    b.ranges.emplace_back(r.first, n);
+                    b.rows += n;
+                    r.first += n;
+                    r.second -= n;
+                }
+                if (r.second == 0)
+                    m_nacks.pop_front();
+            }
+            if (b.ranges.empty())
+                continue;
+
+            b.id = m_nextBatch++;
+            uint8_t payload[4 + 8 * FRAME_NACK_RANGES];
+            frame_put_u32(payload, b.id);
+            for (size_t k = 0; k < b.ranges.size(); ++k) {
+                frame_put_u32(payload + 4 + k * 8, b.ranges[k].first);
+                frame_put_u32(payload + 8 + k * 8, b.ranges[k].second);
+            }
+            sendFrame(FRAME_NACK, 0, payload, static_cast<uint32_t>(4 + 8 * b.ranges.size()));
+
+            // The board serves its queue in order: allow twice the line time
+            // of every row asked for so far, plus a margin for page reads and
+            // the pass still queued ahead of them.
+            m_rangesOut += b.ranges.size();
+            m_rowsOut += b.rows;
+            const double lineSeconds = m_rowsOut * (m_pageBytes + FRAME_HEADER_BYTES + FRAME_CRC_BYTES) * 10.0 / m_baud;
+            b.deadline = now + 2 * lineSeconds + 10.0;
+            m_batches.push_back(std::move(b));
+        }
+    }
+
+    // Batches left unanswered past their deadline (the NACK or its answer
+    // was lost) count as served, so a lost row is not asked for forever.
+    void expireNacks(double now)
+    {
+        for (size_t i = 0; i < m_batches.size();) {
+            if (now >= m_batches[i].deadline)
+                closeBatch(i, true);
+            else
+                ++i;
+        }
+    }
+
+    // After DUMP_END: once every batch is answered, asks for the missing rows
+    // a queue-full at a time, and ends the session once nothing is left
+    // worth asking for.
+    void retryStep(double now)
+    {
+        if (m_state != RxState::Retry || !m_batches.empty() || !m_nacks.empty())
+            return;
+
+        for (uint32_t row = 0; row < m_received.size() && m_nacks.size() < FRAME_NACK_QUEUE; ++row) {
+            if (wanted(row))
+                queueNack(row, row + 1);
+        }
+        if (m_nacks.empty()) {
+            sendFrame(FRAME_HOST_DONE, 0, nullptr, 0);
+            m_state = RxState::Done;
+            return;
+        }
+        flushNacks(now);
+    }
+
+    // Ends the session early (Ctrl-C): the board stops the pass.
+    void abort()
+    {
+        if (m_state != RxState::WaitStart)
+            sendFrame(FRAME_HOST_DONE, 0, nullptr, 0);
+    }
+};
+
+/*---------------------------------------------------------------------------
+ * Main
+ *---------------------------------------------------------------------------*/
+static void PrintProgress(const DumpReceiver& rx, double start)
+{
+    const double elapsed = NowSeconds() - start;
+    printf("\r  Row 0x%06X | Block %u | %llu pages | %.1f MB | %.1f KB/s | %llu err | %llu crc | %llu resent   ",
+        rx.lastRow, rx.lastBlock, static_cast<unsigned long long>(rx.pages), rx.bytes / (1024.0 * 1024.0),
+        elapsed > 0 ? rx.bytes / elapsed / 1024.0 : 0.0, static_cast<unsigned long long>(rx.errors),
+        static_cast<unsigned long long>(rx.crcErrors), static_cast<unsigned long long>(rx.resent));
+    fflush(stdout);
+}
+
+// Missing rows as "first-last" ranges, one per line.
+static size_t WriteMissingRows(const DumpReceiver& rx, const std::string& path)
+{
+    const std::vector<bool>& got = rx.received();
+    FILE* f = fopen(path.c_str(), "w");
+    size_t ranges = 0, rows = 0;
+    for (size_t r = 0; r < got.size(); ) {
+        if (got[r] || rx.skipped(static_cast<uint32_t>(r))) {
+            ++r;
+            continue;
+        }
+        size_t e = r;
+        while (e < got.size() && !got[e] && !rx.skipped(static_cast<uint32_t>(e)))
+            ++e;
+        if (f)
+            fprintf(f, "%06zX-%06zX\n", r, e - 1);
+        if (ranges < 20)
+            printf("  missing rows 0x%06zX - 0x%06zX (%zu)\n", r, e - 1, e - r);
+        ++ranges;
+        rows += e - r;
+        r = e;
+    }
+    if (ranges > 20)
+        printf("  ... %zu more range(s)\n", ranges - 20);
+    if (f)
+        fclose(f);
+    return rows;
+}
+
+// Runs of ERASED and BAD blocks as "first-last class", one per line.
+static void WriteBlockMap(const DumpReceiver& rx, const std::string& path)
+{
+    const std::vector<uint8_t>& map = rx.blockMap();
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        perror(path.c_str());
+        return;
+    }
+    for (size_t b = 0; b < map.size(); ) {
+        size_t e = b;
+        while (e < map.size() && map[e] == map[b])
+            ++e;
+        if (map[b] != FRAME_BLOCK_DATA)
+            fprintf(f, "%05zX-%05zX %s\n", b, e - 1, map[b] == FRAME_BLOCK_ERASED ? "erased" : "bad");
+        b = e;
+    }
+    fclose(f);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* port = nullptr;
+    unsigned baud = 921600;
+    std::string output = "nand_raw_dump.bin";
+    bool sendCommand = true;
+    bool recheckErased = false;
+    bool recheckBad = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        if (a == "--port" && i + 1 < argc)
+            port = argv[++i];
+        else if (a == "--baud" && i + 1 < argc)
+            baud = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        else if (a == "--output" && i + 1 < argc)
+            output = argv[++i];
+        else if (a == "--no-command")
+            sendCommand = false;
+        else if (a == "--recheck-erased")
+            recheckErased = true;
+        else if (a == "--recheck-bad")
+            recheckBad = true;
+        else {
+            fprintf(stderr, "Usage: %s [--port PORT] [--baud BAUD] [--output FILE] [--no-command] [--recheck-erased]"
+                " [--recheck-bad]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!port) {
+        port = FindSerialPort();
+        if (!port) {
+            fprintf(stderr, "ERROR: Could not auto-detect serial port. Use --port.\n");
+            return 1;
+        }
+        printf("Auto-detected serial port: %s\n", port);
+    }
+
+    printf("Opening %s at %u baud...\n", port, baud);
+    const int fd = OpenSerialPort(port, baud);
+    if (fd < 0) {
+        perror(port);
+        return 1;
+    }
+    const int out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        perror(output.c_str());
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSignal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    frame_crc32_init();
+    if (sendCommand) {
+        printf("Sending 'D' command to start dump...\n");
+        if (write(fd, "D", 1) != 1)
+            perror("write");
+    }
+
+    RingBuffer ring(64u << 20);
+    DumpReceiver rx(out, fd, baud, recheckErased, recheckBad);
+    const double start = NowSeconds();
+    double lastProgress = start, lastData = start;
+    bool ok = true, hangup = false;
+    while (!g_interrupted && ok && rx.state() != RxState::Done && rx.state() != RxState::Failed) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        const int r = poll(&pfd, 1, 200);
+        if (r < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (r > 0) {
+            // A pty reports POLLHUP (and read() fails with EIO) once the
+            // board side closes.
+            const ssize_t n = ring.fill(fd);
+            if (n > 0)
+                lastData = NowSeconds();
+            else if ((n == 0 || (errno != EAGAIN && errno != EINTR)) && (pfd.revents & (POLLHUP | POLLERR))) {
+                hangup = true;
+                ok = rx.process(ring);
+                break;
+            }
+        }
+        ok = rx.process(ring);
+
+        const double now = NowSeconds();
+        rx.expireNacks(now);
+        rx.flushNacks(now);
+        rx.retryStep(now);
+        if (rx.state() == RxState::Pass || rx.state() == RxState::Retry) {
+            if (now - lastProgress >= 1.0) {
+                PrintProgress(rx, start);
+                lastProgress = now;
+            }
+            if (now - lastData >= 60.0) {
+                printf("\n  WARNING: no data for %.0f seconds\n", now - lastData);
+                lastData = now;
+            }
+        }
+    }
+    if (g_interrupted)
+        rx.abort();
+
+    fsync(out);
+    const double elapsed = NowSeconds() - start;
+    PrintProgress(rx, start);
+    printf("\n\n%s\n", rx.state() == RxState::Done ? "Dump complete:" : rx.state() == RxState::Failed ? "Dump failed:"
+        : g_interrupted ? "Interrupted:" : hangup ? "Port closed before the dump ended:" : "Stopped:");
+    printf("  Pages:     %llu\n", static_cast<unsigned long long>(rx.pages));
+    printf("  Size:      %.1f MB\n", rx.bytes / (1024.0 * 1024.0));
+    printf("  Time:      %.1f seconds\n", elapsed);
+    printf("  Rate:      %.1f KB/s\n", elapsed > 0 ? rx.bytes / elapsed / 1024.0 : 0.0);
+    printf("  Uniform:   %llu page(s) received as run-length tokens\n", static_cast<unsigned long long>(rx.uniformPages));
+    printf("  ERR pages: %llu\n", static_cast<unsigned long long>(rx.errors));
+    printf("  Resent:    %llu (%llu duplicate)\n", static_cast<unsigned long long>(rx.resent),
+        static_cast<unsigned long long>(rx.duplicates));
+    printf("  CRC fails: %llu, %llu frame(s) lost by sequence, %llu resync(s), %llu bytes skipped\n",
+        static_cast<unsigned long long>(rx.crcErrors), static_cast<unsigned long long>(rx.lostFrames),
+        static_cast<unsigned long long>(rx.resyncs), static_cast<unsigned long long>(rx.skippedBytes));
+    if (!rx.blockMap().empty()) {
+        WriteBlockMap(rx, output + ".blockmap");
+        printf("  Blocks:    %zu, %llu erased%s, %llu bad%s, listed in %s.blockmap\n", rx.blockMap().size(),
+            static_cast<unsigned long long>(rx.erasedBlocks), recheckErased ? " (rechecked)" : " (filled with 0xFF)",
+            static_cast<unsigned long long>(rx.badBlocks), recheckBad ? " (rechecked)" : " (skipped)", output.c_str());
+    }
+    if (!rx.received().empty()) {
+        const size_t missing = WriteMissingRows(rx, output + ".missing");
+        printf("  Missing:   %zu row(s), listed in %s.missing\n", missing, output.c_str());
+    }
+    printf("  Output:    %s\n", output.c_str());
+
+    close(out);
+    close(fd);
+    return rx.state() == RxState::Done ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+/*******************************************************************************
+ * bench_page.c
+ * Per-page cost of the dump path on the simulated hardware (see sim_hw.h)
+ *
+ * Builds nand_dump.c into the host program (its main() renamed) and measures
+ * the page path of do_dump_all() against the pre-burst path, kept below as
+ * the baseline: one Xil_In32 per page-buffer word and one TX-full poll plus
+ * one FIFO write per byte.
+ *
+ *   CPU   NAND reads complete at once and the TX FIFO drains instantly, so
+ *         what is left is the firmware's own work: host cycles per page and
+ *         the register accesses per page. On the Zynq each of those is an
+ *         AXI GP or APB round trip of ~100 ns or more, which host cycles do
+ *         not show, so the access counts are the number to compare.
+ *   Line  tR plus the bus transfer and the UART at 921600 baud are
+ *         simulated; simulated time per page shows how much of each NAND
+ *         read is hidden under the transmit of the previous page.
+ *
+ * Usage: bench_page [pages]
+ ******************************************************************************/
+
+#define main nand_dump_main
+#include "../nand_dump.c"
+#undef main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;   /* ns, not cycles */
+#endif
+}
+
+/*---------------------------------------------------------------------------
+ * Page model and line sink
+ *---------------------------------------------------------------------------*/
+static int bench_erased;
+
+static int bench_read_page(uint32_t row, uint32_t col, uint8_t *dst, uint32_t bytes)
+{
+    (void)col;
+    if (!dst)
+        return 0;
+    uint32_t x = row * 2654435761U + 1;
+    for (uint32_t i = 0; i < bytes; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        dst[i] = bench_erased ? 0xFF : (uint8_t)x;
+    }
+    return 0;
+}
+
+/* Follows the frame stream to note when DUMP_END goes out */
+static uint8_t sink_hdr[FRAME_HEADER_BYTES];
+static uint32_t sink_hdr_len;
+static uint64_t sink_skip;
+static uint64_t sink_dump_end_ns;
+
+static void bench_tx(const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        if (sink_skip > 0) {
+            sink_skip--;
+            continue;
+        }
+        if (sink_hdr_len == 0 && data[i] != FRAME_MAGIC0)
+            continue;   /* text before the first frame */
+        sink_hdr[sink_hdr_len++] = data[i];
+        if (sink_hdr_len < FRAME_HEADER_BYTES)
+            continue;
+        if (sink_hdr[2] == FRAME_DUMP_END && sink_dump_end_ns == 0)
+            sink_dump_end_ns = sim_now_ns;
+        sink_skip = frame_get_u32(sink_hdr + 12) + FRAME_CRC_BYTES;
+        sink_hdr_len = 0;
+    }
+}
+
+static void bench_setup(uint32_t baud, uint32_t t_read_ns, uint32_t t_reg_ns)
+{
+    sim_reset();
+    memset(&sim_cfg, 0, sizeof(sim_cfg));
+    /* 8 KB + 16 B/512 spare (8448-byte pages), 256 pages per block */
+    sim_cfg.id[0] = 0x98;
+    sim_cfg.id[1] = 0xDE;
+    sim_cfg.id[3] = 0x27;
+    sim_cfg.t_read_ns = t_read_ns;
+    sim_cfg.t_array_ns = t_read_ns ? 50000 : 0;
+    sim_cfg.t_op_ns = t_read_ns;
+    sim_cfg.t_reg_ns = t_reg_ns;
+    sim_cfg.baud = baud;
+    sim_cfg.read_page = bench_read_page;
+    sim_cfg.tx = bench_tx;
+    sink_hdr_len = 0;
+    sink_skip = 0;
+    sink_dump_end_ns = 0;
+    uart_init();
+    tx_head = tx_tail = 0;
+    nand_write(REG_RD_COUNT, 8448);
+}
+
+/*---------------------------------------------------------------------------
+ * Baseline: the page loop of do_dump_all() before the TX ring and the DDR
+ * copy
+ *---------------------------------------------------------------------------*/
+static void legacy_send_byte(uint8_t b)
+{
+    while (XUartPs_IsTransmitFull(uart.Config.BaseAddress))
+        ;
+    XUartPs_SendByte(uart.Config.BaseAddress, b);
+}
+
+static void legacy_send_buf(const uint8_t *buf, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+        legacy_send_byte(buf[i]);
+}
+
+static void legacy_send_row(uint32_t row)
+{
+    nand_write(REG_ADDR_COL, 0x0000);
+    nand_write(REG_ADDR_ROW, row & 0x00FFFFFF);
+    nand_start_op(OP_READ_PAGE);
+    if (nand_wait_done(10000) != 0)
+        return;
+
+    uint32_t bytes_read = nand_read(REG_PAGE_IDX);
+    uint8_t hdr[7];
+    frame_put_u32(hdr, bytes_read);
+    hdr[4] = row & 0xFF;
+    hdr[5] = (row >> 8) & 0xFF;
+    hdr[6] = (row >> 16) & 0xFF;
+    legacy_send_buf(hdr, 7);
+
+    uint32_t words = (bytes_read + 3) / 4;
+    for (uint32_t i = 0; i < words; i++) {
+        uint8_t b[4];
+        frame_put_u32(b, nand_read(REG_PAGE_BUF + i * 4));
+        uint32_t remaining = bytes_read - i * 4;
+        legacy_send_buf(b, remaining >= 4 ? 4 : remaining);
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * Measurements
+ *---------------------------------------------------------------------------*/
+static void report(const char *name, uint32_t pages, uint64_t cycles)
+{
+    printf("  %-22s %10.0f %10.1f %10.1f %10.1f %10.1f\n", name, (double)cycles / pages,
+        (double)sim_count.axi_reads / pages, (double)sim_count.uart_reads / pages,
+        (double)sim_count.uart_writes / pages, (double)sim_count.tx_bytes / pages);
+}
+
+static void bench_cpu(uint32_t pages, int erased)
+{
+    bench_erased = erased;
+
+    bench_setup(0, 0, 0);
+    uint64_t t0 = bench_cycles();
+    for (uint32_t row = 0; row < pages; row++)
+        legacy_send_row(row);
+    uint64_t t1 = bench_cycles();
+    report("per-word / per-byte", pages, t1 - t0);
+
+    bench_setup(0, 0, 0);
+    frame_crc32_init();
+    tx_seq = 0;
+    run_count = 0;
+    dump_rows = pages;
+    t0 = bench_cycles();
+    for (uint32_t row = 0; row < pages; row++) {
+        page_read_start(row, 0);
+        dump_emit_page(row, page_read_finish(0));
+    }
+    dump_flush_run();
+    uart_tx_flush();
+    t1 = bench_cycles();
+    report("DDR copy + TX bursts", pages, t1 - t0);
+}
+
+static void bench_line(uint32_t pages)
+{
+    /* tR ~50 us plus 8448 bytes at 100 ns (the reset TIMING) on the bus */
+    const uint32_t t_read_ns = 50000 + 8448 * 100;
+    bench_erased = 0;
+
+    bench_setup(921600, t_read_ns, 100);
+    for (uint32_t row = 0; row < pages; row++)
+        legacy_send_row(row);
+    sim_uart_drain();
+    double legacy_ms = sim_now_ns / 1e6 / pages;
+
+    bench_setup(921600, t_read_ns, 100);
+    dump_cache = 0;
+    do_dump_all();
+    uint32_t rows = (uint32_t)DUMP_TOTAL_BLOCKS * 256;
+    double pipelined_ms = sink_dump_end_ns / 1e6 / rows;
+
+    bench_setup(921600, t_read_ns, 100);
+    dump_cache = 1;
+    do_dump_all();
+    double cache_ms = sink_dump_end_ns / 1e6 / rows;
+
+    double line_ms = 8448 * 10.0 / 921600 * 1000;
+    printf("  NAND read (tR + bus):  %8.3f ms/page\n", t_read_ns / 1e6);
+    printf("  Line time, page only:  %8.3f ms/page\n", line_ms);
+    printf("  Read, then transmit:   %8.3f ms/page (%u pages)\n", legacy_ms, pages);
+    printf("  Pipelined dump pass:   %8.3f ms/page (%u pages, framed)\n", pipelined_ms, rows);
+    printf("  ... with cache reads:  %8.3f ms/page\n", cache_ms);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t pages = argc > 1 ? (uint32_t)strtoul(argv[1], 0, 0) : 2048;
+    if (pages == 0)
+        pages = 1;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
+    printf("CPU cost per 8448-byte page (%u pages, instant NAND and line)\n", pages);
+    printf("  %-22s %10s %10s %10s %10s %10s\n", "", unit, "AXI rd", "UART rd", "UART wr", "line B");
+    printf(" data pages:\n");
+    bench_cpu(pages, 0);
+    printf(" erased pages:\n");
+    bench_cpu(pages, 1);
+    printf("  (the DDR copy reads the page buffer with plain loads, which are not counted;\n"
+           "   on the board they are the same 2112 single-beat AXI reads as before. Erased\n"
+           "   pages are told by the NON_FF register and not copied at all; host cycles\n"
+           "   include the simulated controller filling the page and its statistics)\n");
+
+    printf("\nLine time at 921600 baud\n");
+    bench_line(pages < 256 ? pages : 256);
+    return 0;
+}
@@ -0,0 +1,502 @@
+/*******************************************************************************
+ * nand_sim.c
+ * nand_dump.c running on Linux against the simulated board (see sim_hw.h)
+ *
+ * The firmware is built unchanged into this program; its UART is the master
+ * side of a pseudo-terminal, and the NAND serves pages from an image file
+ * laid out as the dump itself is (row * page_bytes, data + spare), so
+ * nand_receiver or a terminal can be pointed at the pty slave exactly as at
+ * the Arty Z7's USB-UART:
+ *
+ *   ./nand_sim --image die.bin --geometry 2048+64/64 --link /tmp/nand_tty &
+ *   ../nand_receiver --port /tmp/nand_tty --output dump.bin
+ *   cmp die.bin dump.bin
+ *
+ * Rows past the end of the image read as erased (0xFF). READ PARAMETER
+ * PAGE returns an ONFI parameter page for the geometry and block count, so
+ * 'D' dumps the whole simulated die; with --no-onfi it is all zeros and 'D'
+ * falls back to the firmware's DUMP_TOTAL_BLOCKS (make BLOCKS=...).
+ *
+ * Simulated time never runs ahead of the wall clock: bytes leave the pty at
+ * the configured baud rate and usleep() really sleeps, so the firmware's
+ * timeouts (the one-minute re-request window, read timeouts) behave as on
+ * the board. While the firmware spins waiting for a command, the simulator
+ * blocks on the pty instead.
+ *
+ * Usage: nand_sim --image FILE [options]
+ *   --geometry D+S/P  page data bytes, spare bytes, pages per block
+ *                     (default 8192+256/256); with --no-onfi it must be
+ *                     expressible in the READ ID byte 3 the firmware decodes
+ *   --blocks N        blocks in the parameter page (default: enough for
+ *                     the image)
+ *   --no-onfi         no parameter page
+ *   --baud N          line rate (default 921600; 0 = unpaced, instant)
+ *   --tr-us N         array read time tR (default 50); the bus transfer
+ *                     adds 100 ns per byte at the reset TIMING, as in
+ *                     nand_flash_ctrl.vhd, and less after 'T'
+ *   --bus-min-ns N    shortest read cycle that reads correctly; faster
+ *                     TIMING settings return bit errors (default 0: none)
+ *   --cache-read 0|1  whether 'D' starts with cache reads on (default: the
+ *                     firmware's DUMP_CACHE_READ; 'K' toggles it)
+ *   --jitter-us N     up to N us of random extra latency per read
+ *   --delay ROW:US    extra latency for one row; US = -1 hangs the
+ *                     controller (R/B# never returns). Repeatable.
+ *   --link PATH       symlink PATH to the pty slave
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+/* System headers first: sleep.h turns usleep() into a macro */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define main nand_dump_main
+#include "../nand_dump.c"
+#undef main
+
+#define SIM_MAX_DELAYS  64
+
+static struct {
+    const uint8_t *image;
+    uint64_t image_bytes;
+    uint32_t page_bytes;
+    uint8_t param[256];         /* ONFI parameter page */
+    int onfi;
+    uint32_t tr_us;
+    uint32_t jitter_us;
+    uint32_t delay_row[SIM_MAX_DELAYS];
+    int delay_us[SIM_MAX_DELAYS];
+    uint32_t delays;
+    int pace;
+} model;
+
+static int pty_master = -1;
+static uint64_t clock_anchor_ns;    /* wall clock at simulated time 0 */
+static uint64_t rx_empty_polls;
+static uint64_t rx_last_poll_ns;
+static uint64_t rx_last_read_ns;
+static uint64_t pages_read;
+static uint64_t tx_dropped;
+static int tx_blocked;
+static volatile sig_atomic_t stop;
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sim_exit(void)
+{
+    fprintf(stderr, "\nnand_sim: %llu page reads, %llu bytes sent, %llu dropped (no reader), "
+        "%llu received bytes lost (RX FIFO full), %.1f s simulated\n",
+        (unsigned long long)pages_read, (unsigned long long)sim_count.tx_bytes,
+        (unsigned long long)tx_dropped, (unsigned long long)sim_count.rx_dropped, sim_now_ns / 1e9);
+    exit(0);
+}
+
+/*---------------------------------------------------------------------------
+ * Pacing
+ *---------------------------------------------------------------------------*/
+
+/* Sleeps until the wall clock reaches simulated time 'ns'. Simulated time
+ * that falls behind (a slow host) is not made up later: the anchor moves,
+ * so a sleep always lasts as long as the firmware asked for. */
+static void pace_to(uint64_t ns)
+{
+    if (stop)
+        sim_exit();
+    if (!model.pace)
+        return;
+    uint64_t wall = wall_ns() - clock_anchor_ns;
+    if (ns > wall) {
+        uint64_t d = ns - wall;
+        if (d < 200000)
+            return;     /* not worth a system call yet */
+        struct timespec ts = { (time_t)(d / 1000000000ULL), (long)(d % 1000000000ULL) };
+        nanosleep(&ts, 0);
+    } else if (wall - ns > 10000000) {
+        clock_anchor_ns += wall - ns;
+    }
+}
+
+static void pty_flush(void);
+static uint32_t tx_out_len;
+
+static void sim_idle(uint64_t ns)
+{
+    if (tx_out_len > 0)
+        pty_flush();
+    pace_to(sim_now_ns + ns);
+}
+
+/*---------------------------------------------------------------------------
+ * NAND model
+ *---------------------------------------------------------------------------*/
+static int model_read_page(uint32_t row, uint32_t col, uint8_t *dst, uint32_t bytes)
+{
+    if (!dst) {
+        pages_read++;
+        for (uint32_t i = 0; i < model.delays; i++) {
+            if (model.delay_row[i] == row)
+                return model.delay_us[i];
+        }
+        return model.jitter_us ? (int)(rand() % (model.jitter_us + 1)) : 0;
+    }
+
+    uint64_t at = (uint64_t)row * model.page_bytes + col;
+    uint64_t n = 0;
+    if (at < model.image_bytes) {
+        n = model.image_bytes - at;
+        if (n > bytes)
+            n = bytes;
+        memcpy(dst, model.image + at, n);
+    }
+    memset(dst + n, 0xFF, bytes - n);
+    return 0;
+}
+
+/* The parameter page repeats every 256 bytes, as the redundant copies do */
+static int model_read_param(uint32_t row, uint32_t col, uint8_t *dst, uint32_t bytes)
+{
+    (void)row;
+    for (uint32_t i = 0; i < bytes; i++)
+        dst[i] = model.onfi ? model.param[(col + i) % sizeof(model.param)] : 0x00;
+    return 0;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (i * 8));
+}
+
+/* The fields nand_dump.c decodes, plus enough to look like a real die */
+static void build_param_page(uint32_t data, uint32_t spare, uint32_t ppb, uint32_t blocks)
+{
+    uint8_t *p = model.param;
+    memset(p, 0, sizeof(model.param));
+    memcpy(p, "ONFI", 4);
+    p[4] = 0x02;                            /* ONFI 1.0 */
+    memcpy(p + 32, "TOSHIBA     ", 12);
+    memcpy(p + 44, "NAND_SIM            ", 20);
+    p[64] = 0x98;
+    put_u32(p + 80, data);
+    p[84] = (uint8_t)spare;
+    p[85] = (uint8_t)(spare >> 8);
+    put_u32(p + 92, ppb);
+    put_u32(p + 96, blocks);
+    p[100] = 1;                             /* LUNs */
+    p[101] = 0x23;                          /* 3 row, 2 column address cycles */
+    p[102] = 1;                             /* bits per cell */
+    uint16_t crc = onfi_crc16(p, 254);
+    p[254] = (uint8_t)crc;
+    p[255] = (uint8_t)(crc >> 8);
+}
+
+/*---------------------------------------------------------------------------
+ * UART on a pty
+ *---------------------------------------------------------------------------*/
+/* Line bytes are collected and written a few hundred at a time: a system
+ * call per byte would leave the simulator slower than the line it models. */
+static uint8_t tx_out[512];
+static uint64_t tx_out_since;
+
+static void pty_flush(void)
+{
+    const uint8_t *data = tx_out;
+    uint32_t len = tx_out_len;
+    tx_out_len = 0;
+    pace_to(sim_now_ns);
+    while (len > 0) {
+        /* Nobody reading: drop, as the line would, rather than stall */
+        struct pollfd p = { pty_master, POLLOUT, 0 };
+        if (poll(&p, 1, tx_blocked ? 0 : 1000) <= 0) {
+            tx_blocked = 1;
+            tx_dropped += len;
+            return;
+        }
+        ssize_t n = write(pty_master, data, len);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            tx_dropped += len;
+            return;
+        }
+        tx_blocked = 0;
+        data += n;
+        len -= (uint32_t)n;
+    }
+}
+
+static void pty_tx(const uint8_t *data, uint32_t len)
+{
+    if (tx_out_len == 0)
+        tx_out_since = sim_now_ns;
+    while (len > 0) {
+        uint32_t n = sizeof(tx_out) - tx_out_len;
+        if (n > len)
+            n = len;
+        memcpy(tx_out + tx_out_len, data, n);
+        tx_out_len += n;
+        data += n;
+        len -= n;
+        if (tx_out_len == sizeof(tx_out))
+            pty_flush();
+    }
+    if (tx_out_len > 0 && sim_now_ns - tx_out_since >= 1000000)
+        pty_flush();
+}
+
+/* What the host has written, read from the pty in chunks; sim_hw puts it
+ * on the line a character at a time. The pty buffer stands in for the host
+ * side of the link, so nothing waits there for the firmware. */
+static uint8_t rx_in[256];
+static uint32_t rx_in_head;
+static uint32_t rx_in_len;
+
+static int pty_rx(uint8_t *byte)
+{
+    if (rx_in_head == rx_in_len) {
+        /* Idle line: looking every 50 us is well inside a 64-byte FIFO */
+        if (sim_now_ns - rx_last_read_ns < 50000)
+            return 0;
+        rx_last_read_ns = sim_now_ns;
+        ssize_t n = read(pty_master, rx_in, sizeof(rx_in));
+        if (n <= 0)
+            return 0;
+        rx_in_head = 0;
+        rx_in_len = (uint32_t)n;
+    }
+    *byte = rx_in[rx_in_head++];
+    return 1;
+}
+
+static void pty_rx_wait(void)
+{
+    /* Back-to-back SR polls finding RX empty, with nothing queued for TX,
+     * mean the firmware is waiting for a command: block on the pty then and
+     * let simulated time follow the wall clock. Polls between pages, or
+     * while the TX ring drains, never block. */
+    if (sim_now_ns - rx_last_poll_ns < 10000 && tx_tail == tx_head)
+        rx_empty_polls++;
+    else
+        rx_empty_polls = 0;
+    rx_last_poll_ns = sim_now_ns;
+    if (rx_empty_polls < 1000 || rx_in_head != rx_in_len)
+        return;
+
+    if (stop)
+        sim_exit();
+    if (tx_out_len > 0)
+        pty_flush();
+    uint64_t t0 = wall_ns();
+    struct pollfd p = { pty_master, POLLIN, 0 };
+    if (poll(&p, 1, 10) > 0)
+        rx_empty_polls = 0;
+    sim_now_ns += wall_ns() - t0;
+    rx_last_poll_ns = sim_now_ns;
+    rx_last_read_ns = 0;    /* read at the next line slot */
+}
+
+static int open_pty(const char *link_path)
+{
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_master < 0 || grantpt(pty_master) != 0 || unlockpt(pty_master) != 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    const char *slave = ptsname(pty_master);
+
+    /* Keep one slave fd open so the master does not see a hangup between
+     * receiver runs, and make the line raw before anyone else opens it. */
+    int sfd = open(slave, O_RDWR | O_NOCTTY);
+    if (sfd < 0) {
+        perror(slave);
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(sfd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(sfd, TCSANOW, &tio);
+
+    fcntl(pty_master, F_SETFL, fcntl(pty_master, F_GETFL) | O_NONBLOCK);
+
+    if (link_path) {
+        unlink(link_path);
+        if (symlink(slave, link_path) != 0) {
+            perror(link_path);
+            return -1;
+        }
+    }
+    fprintf(stderr, "nand_sim: UART on %s%s%s\n", slave, link_path ? " -> " : "", link_path ? link_path : "");
+    return 0;
+}
+
+/*---------------------------------------------------------------------------
+ * Main
+ *---------------------------------------------------------------------------*/
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* READ ID byte 3 as decoded by id_read_geometry(), or -1 if not expressible */
+static int id_byte3(uint32_t data, uint32_t spare, uint32_t ppb)
+{
+    int b = -1;
+    for (int i = 0; i < 4; i++) {
+        if (data == 1024U << i)
+            b = i;
+    }
+    if (b < 0)
+        return -1;
+    if (spare == data / 512 * 16)
+        b |= 0x04;
+    else if (spare != data / 512 * 8)
+        return -1;
+    for (int i = 0; i < 4; i++) {
+        if (ppb == 64U << i)
+            return b | (i << 4);
+    }
+    return -1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Usage: nand_sim --image FILE [--geometry D+S/P] [--blocks N] [--no-onfi]\n"
+        "                [--baud N] [--tr-us N] [--cache-read 0|1] [--bus-min-ns N]\n"
+        "                [--jitter-us N] [--delay ROW:US]... [--link PATH]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *image_path = 0;
+    const char *link_path = 0;
+    uint32_t data = 8192, spare = 256, ppb = 256;
+    uint32_t baud = 921600;
+    uint32_t bus_min_ns = 0;
+    uint32_t blocks = 0;
+    model.tr_us = 50;
+    model.onfi = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : 0;
+        if (!strcmp(a, "--no-onfi")) {
+            model.onfi = 0;
+            continue;
+        }
+        if (!v)
+            usage();
+        if (!strcmp(a, "--image"))
+            image_path = v;
+        else if (!strcmp(a, "--geometry")) {
+            if (sscanf(v, "%u+%u/%u", &data, &spare, &ppb) != 3)
+                usage();
+        } else if (!strcmp(a, "--blocks"))
+            blocks = (uint32_t)strtoul(v, 0, 0);
+        else if (!strcmp(a, "--baud"))
+            baud = (uint32_t)strtoul(v, 0, 0);
+        else if (!strcmp(a, "--tr-us"))
+            model.tr_us = (uint32_t)strtoul(v, 0, 0);
+        else if (!strcmp(a, "--cache-read"))
+            dump_cache = atoi(v) != 0;
+        else if (!strcmp(a, "--bus-min-ns"))
+            bus_min_ns = (uint32_t)strtoul(v, 0, 0);
+        else if (!strcmp(a, "--jitter-us"))
+            model.jitter_us = (uint32_t)strtoul(v, 0, 0);
+        else if (!strcmp(a, "--delay")) {
+            if (model.delays == SIM_MAX_DELAYS
+                || sscanf(v, "%u:%d", &model.delay_row[model.delays], &model.delay_us[model.delays]) != 2)
+                usage();
+            model.delays++;
+        } else if (!strcmp(a, "--link"))
+            link_path = v;
+        else
+            usage();
+        i++;
+    }
+    if (!image_path)
+        usage();
+
+    /* Only the fallback without a parameter page decodes READ ID */
+    int byte3 = id_byte3(data, spare, ppb);
+    if (byte3 < 0 && model.onfi)
+        byte3 = 0;
+    if (byte3 < 0) {
+        fprintf(stderr, "nand_sim: geometry %u+%u/%u cannot be encoded in READ ID byte 3\n", data, spare, ppb);
+        return 2;
+    }
+
+    int fd = open(image_path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(image_path);
+        return 1;
+    }
+    model.image_bytes = (uint64_t)st.st_size;
+    if (model.image_bytes > 0) {
+        model.image = mmap(0, model.image_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (model.image == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+    }
+    model.page_bytes = data + spare;
+    if (blocks == 0) {
+        uint64_t block_bytes = (uint64_t)model.page_bytes * ppb;
+        blocks = (uint32_t)((model.image_bytes + block_bytes - 1) / block_bytes);
+        if (blocks == 0)
+            blocks = 1;
+    }
+    build_param_page(data, spare, ppb, blocks);
+    model.pace = baud != 0;
+
+    if (open_pty(link_path) != 0)
+        return 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    sim_reset();
+    sim_cfg.id[0] = 0x98;
+    sim_cfg.id[1] = 0xDE;
+    sim_cfg.id[2] = 0x94;
+    sim_cfg.id[3] = (uint8_t)byte3;
+    sim_cfg.id[4] = 0x76;
+    sim_cfg.status = 0xE0;      /* ready, not write-protected */
+    sim_cfg.t_read_ns = model.tr_us * 1000 + model.page_bytes * 100;
+    sim_cfg.t_array_ns = model.tr_us * 1000;
+    sim_cfg.t_op_ns = 5000;
+    sim_cfg.t_reg_ns = 100;
+    sim_cfg.bus_min_ns = bus_min_ns;
+    sim_cfg.baud = baud;
+    sim_cfg.read_page = model_read_page;
+    sim_cfg.read_param = model_read_param;
+    sim_cfg.tx = pty_tx;
+    sim_cfg.rx = pty_rx;
+    sim_cfg.rx_wait = pty_rx_wait;
+    sim_cfg.idle = sim_idle;
+    clock_anchor_ns = wall_ns();
+
+    fprintf(stderr, "nand_sim: %s, %u+%u bytes/page, %u pages/block, %u blocks%s, %u baud%s\n",
+        image_path, data, spare, ppb, model.onfi ? blocks : (unsigned)DUMP_TOTAL_BLOCKS,
+        model.onfi ? "" : " (DUMP_TOTAL_BLOCKS, no ONFI)", baud, dump_cache ? ", cache reads" : "");
+    return nand_dump_main();
+}
@@ -0,0 +1,438 @@
+/*******************************************************************************
+ * sim_hw.c
+ * Simulated AXI NAND controller and PS UART for host builds of nand_dump.c
+ * (see sim_hw.h)
+ ******************************************************************************/
+
+#include <string.h>
+#include "sim_hw.h"
+#include "xuartps.h"
+#include "nand_frame.h"     /* CRC-32, as the capture path computes it */
+
+uint32_t sim_axi_window[SIM_AXI_BYTES / 4];
+struct sim_config sim_cfg;
+struct sim_counters sim_count;
+uint64_t sim_now_ns;
+
+/* Register offsets and bits, as in axi_nand_ctrl.vhd */
+#define AXI_CTRL        0x00
+#define AXI_STATUS      0x04
+#define AXI_ADDR_COL    0x08
+#define AXI_ADDR_ROW    0x0C
+#define AXI_RD_COUNT    0x10
+#define AXI_ID_LO       0x14
+#define AXI_ID_HI       0x18
+#define AXI_NAND_STAT   0x1C
+#define AXI_PAGE_IDX    0x20
+#define AXI_VERSION     0x24
+#define AXI_BUF_BANK    0x28
+#define AXI_TIMING      0x2C
+#define AXI_FEATURE     0x30
+#define AXI_PAGE_CRC    0x34
+#define AXI_NON_FF      0x38
+#define AXI_ZEROS       0x3C
+#define AXI_PAGE_BUF    0x4000
+
+#define OP_RESET        1
+#define OP_READ_ID      2
+#define OP_READ_STATUS  3
+#define OP_READ_PAGE    4
+#define OP_READ_PARAM   5
+#define OP_CACHE_SEQ    6
+#define OP_CACHE_END    7
+#define OP_SET_FEATURES 8
+
+#define TIMING_RESET    0x435232    /* TIMING_RESET of axi_nand_ctrl */
+
+#define UART_FIFO_DEPTH 64
+
+static struct {
+    uint32_t op;
+    int busy;
+    int done;
+    int hung;
+    uint64_t done_at;
+    uint32_t addr_col;
+    uint32_t addr_row;
+    uint32_t rd_count;
+    uint32_t fill_bank;         /* CTRL[5] latched at START */
+    uint32_t rd_bank;           /* BUF_BANK */
+    uint32_t len[2];            /* PAGE_IDX of each bank */
+    uint32_t crc[2];            /* PAGE_CRC, NON_FF and ZEROS of each bank */
+    uint32_t non_ff[2];
+    uint32_t zeros[2];
+    uint32_t out_row;           /* row the current read hands out */
+    uint32_t data_row;          /* row in the NAND data register (cache reads) */
+    uint64_t array_at;          /* when the array load of data_row ends */
+    uint32_t timing;            /* TIMING */
+    uint32_t feature;           /* FEATURE */
+    int garbled;                /* read cycle under bus_min_ns at START */
+    uint8_t id[5];
+    uint8_t status;
+} nand;
+
+static struct {
+    uint8_t tx[UART_FIFO_DEPTH];
+    uint32_t tx_head;
+    uint32_t tx_count;
+    uint64_t tx_done_at;        /* when the byte at tx_head leaves the line */
+    uint8_t rx[UART_FIFO_DEPTH];
+    uint32_t rx_head;
+    uint32_t rx_count;
+    uint64_t rx_next_at;        /* when the next host byte can land */
+    int rx_idle;                /* the host had nothing at rx_next_at */
+    uint32_t txwm;
+} uart;
+
+/* The two page buffer banks; the PAGE_BUF window holds a copy of rd_bank */
+static uint8_t bank_mem[2][SIM_PAGE_BUF_DEPTH];
+
+static void page_buf_show(uint32_t bank)
+{
+    nand.rd_bank = bank;
+    memcpy((uint8_t *)sim_axi_window + AXI_PAGE_BUF, bank_mem[bank], SIM_PAGE_BUF_DEPTH);
+}
+
+void sim_reset(void)
+{
+    memset(&nand, 0, sizeof(nand));
+    memset(&uart, 0, sizeof(uart));
+    memset(&sim_count, 0, sizeof(sim_count));
+    memset(sim_axi_window, 0, sizeof(sim_axi_window));
+    memset(bank_mem, 0, sizeof(bank_mem));
+    nand.timing = TIMING_RESET;
+    uart.txwm = 32;
+    sim_now_ns = 0;
+    frame_crc32_init();
+}
+
+/* Read cycle of the bus engine, RE# low plus RE# high, or RE# fall to the
+ * data sample if that is longer, in ns at 100 MHz */
+static uint32_t read_cycle_ns(void)
+{
+    uint32_t re = ((nand.timing >> 12) & 0xF) + ((nand.timing >> 16) & 0xF) + 2;
+    uint32_t rea = ((nand.timing >> 20) & 0xF) + 1;
+    return (re > rea ? re : rea) * 10;
+}
+
+/* Bus transfer time of a read, from the configured time at the 100 ns reset
+ * cycle */
+static uint64_t transfer_ns(void)
+{
+    return (uint64_t)(sim_cfg.t_read_ns - sim_cfg.t_array_ns) * read_cycle_ns() / 100;
+}
+
+/* Bytes the controller captures into the page buffer for the current op */
+static void nand_complete(void)
+{
+    uint8_t *buf = bank_mem[nand.fill_bank];
+    uint32_t n = nand.rd_count;
+    if (n > SIM_PAGE_BUF_DEPTH)
+        n = SIM_PAGE_BUF_DEPTH;
+
+    switch (nand.op) {
+    case OP_READ_ID:
+        if (n > 5)
+            n = 5;
+        memcpy(nand.id, sim_cfg.id, sizeof(nand.id));
+        memcpy(buf, sim_cfg.id, n);
+        break;
+    case OP_READ_STATUS:
+        nand.status = sim_cfg.status;
+        n = 1;
+        buf[0] = nand.status;
+        break;
+    case OP_READ_PAGE:
+    case OP_CACHE_SEQ:
+    case OP_CACHE_END:
+        if (sim_cfg.read_page)
+            sim_cfg.read_page(nand.out_row, nand.op == OP_READ_PAGE ? nand.addr_col : 0, buf, n);
+        else
+            memset(buf, 0xFF, n);
+        if (nand.garbled) {
+            /* Data sampled before it is valid: a fixed scatter of bit errors */
+            for (uint32_t i = nand.out_row % 61; i < n; i += 61)
+                buf[i] ^= (uint8_t)(1u << (i % 8));
+        }
+        break;
+    case OP_READ_PARAM:
+        if (sim_cfg.read_param)
+            sim_cfg.read_param(0, nand.addr_col, buf, n);
+        else
+            memset(buf, 0x00, n);
+        break;
+    default:
+        n = 0;
+        break;
+    }
+    nand.len[nand.fill_bank] = n;
+    nand.crc[nand.fill_bank] = frame_crc32_final(frame_crc32_update(FRAME_CRC_INIT, buf, n));
+    uint32_t non_ff = 0, zeros = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        non_ff += buf[i] != 0xFF;
+        zeros += 8 - __builtin_popcount(buf[i]);
+    }
+    nand.non_ff[nand.fill_bank] = non_ff;
+    nand.zeros[nand.fill_bank] = zeros;
+    if (nand.fill_bank == nand.rd_bank)
+        page_buf_show(nand.rd_bank);
+    nand.busy = 0;
+    nand.done = 1;
+}
+
+static void uart_shift_out(void)
+{
+    uint8_t out[UART_FIFO_DEPTH];
+    uint32_t n = 0;
+    uint64_t byte_ns = sim_cfg.baud ? 10000000000ULL / sim_cfg.baud : 0;
+    while (uart.tx_count > 0 && (byte_ns == 0 || sim_now_ns >= uart.tx_done_at)) {
+        out[n++] = uart.tx[uart.tx_head];
+        uart.tx_head = (uart.tx_head + 1) % UART_FIFO_DEPTH;
+        uart.tx_count--;
+        uart.tx_done_at += byte_ns;
+    }
+    if (n > 0) {
+        sim_count.tx_bytes += n;
+        if (sim_cfg.tx)
+            sim_cfg.tx(out, n);
+    }
+}
+
+/* Host bytes come off the line one character time apart, however long
+ * the firmware goes without reading RX; one that finds the FIFO full is
+ * lost. After an idle line the first byte lands when it is seen. */
+static void uart_shift_in(void)
+{
+    uint64_t char_ns = 10000000000ULL / (sim_cfg.baud ? sim_cfg.baud : SIM_RX_BAUD);
+    uint8_t b;
+    while (sim_cfg.rx && sim_now_ns >= uart.rx_next_at) {
+        if (!sim_cfg.rx(&b)) {
+            uart.rx_idle = 1;
+            uart.rx_next_at = sim_now_ns + char_ns;
+            return;
+        }
+        if (uart.rx_idle) {
+            uart.rx_idle = 0;
+            uart.rx_next_at = sim_now_ns;
+        }
+        if (uart.rx_count < UART_FIFO_DEPTH) {
+            uart.rx[(uart.rx_head + uart.rx_count) % UART_FIFO_DEPTH] = b;
+            uart.rx_count++;
+        } else {
+            sim_count.rx_dropped++;
+        }
+        uart.rx_next_at += char_ns;
+    }
+}
+
+static void sim_advance(uint64_t ns)
+{
+    sim_now_ns += ns;
+    if (nand.busy && !nand.hung && sim_now_ns >= nand.done_at)
+        nand_complete();
+    uart_shift_out();
+    uart_shift_in();
+}
+
+/*---------------------------------------------------------------------------
+ * AXI NAND controller
+ *---------------------------------------------------------------------------*/
+uint32_t sim_axi_read32(uintptr_t addr)
+{
+    uint32_t off = (uint32_t)(addr - (uintptr_t)sim_axi_window);
+    sim_count.axi_reads++;
+    sim_advance(sim_cfg.t_reg_ns);
+
+    if (off >= AXI_PAGE_BUF)
+        return off < SIM_AXI_BYTES ? sim_axi_window[off / 4] : 0xDEADBEEF;
+
+    switch (off & 0x3F) {
+    case AXI_CTRL:      return (nand.op & 7) << 1 | (nand.op & 8) << 3;
+    case AXI_STATUS:    return (nand.busy ? 1u : 0u) | (nand.done ? 2u : 0u) | (nand.busy ? 0u : 4u);
+    case AXI_ADDR_COL:  return nand.addr_col;
+    case AXI_ADDR_ROW:  return nand.addr_row;
+    case AXI_RD_COUNT:  return nand.rd_count;
+    case AXI_ID_LO:     return nand.id[0] | (nand.id[1] << 8) | (nand.id[2] << 16) | ((uint32_t)nand.id[3] << 24);
+    case AXI_ID_HI:     return nand.id[4];
+    case AXI_NAND_STAT: return nand.status;
+    case AXI_PAGE_IDX:  return nand.len[nand.rd_bank];
+    case AXI_VERSION:   return 0x4E414E44;
+    case AXI_BUF_BANK:  return nand.rd_bank;
+    case AXI_TIMING:    return nand.timing;
+    case AXI_FEATURE:   return nand.feature;
+    case AXI_PAGE_CRC:  return nand.crc[nand.rd_bank];
+    case AXI_NON_FF:    return nand.non_ff[nand.rd_bank];
+    case AXI_ZEROS:     return nand.zeros[nand.rd_bank];
+    default:            return 0;
+    }
+}
+
+void sim_axi_write32(uintptr_t addr, uint32_t value)
+{
+    uint32_t off = (uint32_t)(addr - (uintptr_t)sim_axi_window);
+    sim_count.axi_writes++;
+    sim_advance(sim_cfg.t_reg_ns);
+
+    switch (off & 0x3F) {
+    case AXI_CTRL:
+        if ((value & 1) && !nand.busy) {
+            nand.op = ((value >> 1) & 7) | ((value >> 3) & 8);
+            nand.fill_bank = (value >> 5) & 1;
+            nand.busy = 1;
+            nand.hung = 0;
+            nand.len[nand.fill_bank] = 0;
+            nand.crc[nand.fill_bank] = 0;
+            nand.non_ff[nand.fill_bank] = 0;
+            nand.zeros[nand.fill_bank] = 0;
+            nand.done_at = sim_now_ns + sim_cfg.t_op_ns;
+            nand.garbled = read_cycle_ns() < sim_cfg.bus_min_ns;
+            sim_count.ops++;
+            int page_out = 0;
+            if (nand.op == OP_READ_PAGE) {
+                nand.out_row = nand.data_row = nand.addr_row;
+                nand.array_at = sim_now_ns + sim_cfg.t_array_ns;
+                /* RD_COUNT 0 (opening a cache read) stops after tR */
+                nand.done_at = nand.rd_count ? nand.array_at + transfer_ns() : nand.array_at;
+                page_out = nand.rd_count > 0;
+            } else if (nand.op == OP_CACHE_SEQ || nand.op == OP_CACHE_END) {
+                /* Waits for the load in progress, then only the transfer;
+                 * 31h starts loading the next row alongside it */
+                uint64_t t = nand.array_at > sim_now_ns ? nand.array_at : sim_now_ns;
+                nand.out_row = nand.data_row;
+                nand.done_at = nand.rd_count ? t + transfer_ns() : t;
+                if (nand.op == OP_CACHE_SEQ) {
+                    nand.data_row++;
+                    nand.array_at = t + sim_cfg.t_array_ns;
+                }
+                page_out = nand.rd_count > 0;
+            }
+            if (page_out && sim_cfg.read_page) {
+                /* Ask the model now whether this read is slow or hangs */
+                int r = sim_cfg.read_page(nand.out_row, nand.addr_col, 0, 0);
+                if (r < 0)
+                    nand.hung = 1;
+                else
+                    nand.done_at += (uint64_t)r * 1000;
+            }
+        }
+        if (value & (1 << 4))
+            nand.done = 0;
+        break;
+    case AXI_ADDR_COL:  nand.addr_col = value & 0xFFFF; break;
+    case AXI_ADDR_ROW:  nand.addr_row = value & 0xFFFFFF; break;
+    case AXI_RD_COUNT:  nand.rd_count = value & 0xFFFF; break;
+    case AXI_BUF_BANK:  page_buf_show(value & 1); break;
+    case AXI_TIMING:    nand.timing = value & 0xFFFFFF; break;
+    case AXI_FEATURE:   nand.feature = value; break;
+    default:            break;
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * PS UART
+ *---------------------------------------------------------------------------*/
+uint32_t sim_uart_read32(uintptr_t addr)
+{
+    uint32_t off = (uint32_t)(addr - SIM_UART_BASE);
+    sim_count.uart_reads++;
+    sim_advance(sim_cfg.t_reg_ns);
+
+    if (off == XUARTPS_SR_OFFSET) {
+        if (uart.rx_count == 0 && sim_cfg.rx_wait) {
+            sim_cfg.rx_wait();
+            uart_shift_in();
+        }
+        uint32_t sr = 0;
+        if (uart.rx_count == 0)
+            sr |= XUARTPS_SR_RXEMPTY;
+        if (uart.tx_count == 0)
+            sr |= XUARTPS_SR_TXEMPTY;
+        if (uart.tx_count == UART_FIFO_DEPTH)
+            sr |= XUARTPS_SR_TXFULL;
+        if (uart.tx_count >= uart.txwm)
+            sr |= XUARTPS_SR_TTRIG;
+        return sr;
+    }
+    if (off == XUARTPS_FIFO_OFFSET) {
+        if (uart.rx_count == 0)
+            return 0;
+        uint8_t b = uart.rx[uart.rx_head];
+        uart.rx_head = (uart.rx_head + 1) % UART_FIFO_DEPTH;
+        uart.rx_count--;
+        return b;
+    }
+    if (off == XUARTPS_TXWM_OFFSET)
+        return uart.txwm;
+    return 0;
+}
+
+void sim_uart_write32(uintptr_t addr, uint32_t value)
+{
+    uint32_t off = (uint32_t)(addr - SIM_UART_BASE);
+    sim_count.uart_writes++;
+    sim_advance(sim_cfg.t_reg_ns);
+
+    if (off == XUARTPS_FIFO_OFFSET) {
+        if (uart.tx_count == UART_FIFO_DEPTH)
+            return;     /* overflow: the byte is lost, as on the real FIFO */
+        if (uart.tx_count == 0)
+            uart.tx_done_at = sim_now_ns + (sim_cfg.baud ? 10000000000ULL / sim_cfg.baud : 0);
+        uart.tx[(uart.tx_head + uart.tx_count) % UART_FIFO_DEPTH] = (uint8_t)value;
+        uart.tx_count++;
+        uart_shift_out();
+    } else if (off == XUARTPS_TXWM_OFFSET) {
+        uart.txwm = value & 0x3F;
+    }
+}
+
+void sim_usleep(unsigned long us)
+{
+    if (sim_cfg.idle)
+        sim_cfg.idle((uint64_t)us * 1000);
+    sim_advance((uint64_t)us * 1000);
+}
+
+void sim_uart_drain(void)
+{
+    while (uart.tx_count > 0)
+        sim_advance(uart.tx_done_at > sim_now_ns ? uart.tx_done_at - sim_now_ns : 1);
+}
+
+/*---------------------------------------------------------------------------
+ * XUartPs driver entry points
+ *---------------------------------------------------------------------------*/
+static XUartPs_Config uart_config = { 0, SIM_UART_BASE };
+
+XUartPs_Config *XUartPs_LookupConfig(uint16_t device_id)
+{
+    (void)device_id;
+    return &uart_config;
+}
+
+int XUartPs_CfgInitialize(XUartPs *inst, XUartPs_Config *cfg, uint32_t effective_addr)
+{
+    inst->Config = *cfg;
+    inst->Config.BaseAddress = effective_addr;
+    return 0;
+}
+
+int XUartPs_SetBaudRate(XUartPs *inst, uint32_t baud)
+{
+    (void)inst;
+    (void)baud;     /* the line rate is sim_cfg.baud */
+    return 0;
+}
+
+void XUartPs_SendByte(uint32_t base, uint8_t data)
+{
+    while (XUartPs_IsTransmitFull(base))
+        ;
+    XUartPs_WriteReg(base, XUARTPS_FIFO_OFFSET, data);
+}
+
+uint8_t XUartPs_RecvByte(uint32_t base)
+{
+    while (!XUartPs_IsReceiveData(base))
+        ;
+    return (uint8_t)XUartPs_ReadReg(base, XUARTPS_FIFO_OFFSET);
+}
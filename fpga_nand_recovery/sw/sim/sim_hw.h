@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * sim_hw.h
+ * Simulated Zynq hardware for host builds of nand_dump.c
+ *
+ * The mock BSP headers in this directory (xil_io.h, xuartps.h, sleep.h,
+ * xparameters.h) route every register access here:
+ *
+ *   - an AXI register file that behaves like axi_nand_ctrl.vhd (START is
+ *     ignored while busy, DONE is sticky until CTRL[4], PAGE_IDX counts the
+ *     bytes captured), with the BUF_BANK bank of the ping-pong page buffer
+ *     as plain memory at NAND_BASE + 0x4000 so the firmware's direct loads
+ *     work unchanged, TIMING scaling the page transfer time, and the page
+ *     statistics (PAGE_CRC, NON_FF, ZEROS) of each bank;
+ *   - a PS UART with a 64-byte TX FIFO that drains at the configured baud
+ *     rate, and a 64-byte RX FIFO that the host's bytes reach one character
+ *     time apart whether or not the firmware is reading; a byte that finds
+ *     it full is lost, as on the real FIFO.
+ *
+ * Time is simulated: it advances by t_reg_ns per register access and by the
+ * requested amount in usleep(), so a NAND read "takes" t_read_ns however
+ * fast the host is, and line time is modelled without waiting for it.
+ ******************************************************************************/
+
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+#include <stdint.h>
+
+#define SIM_AXI_BYTES       0xC000      /* registers + 32 KB page buffer window */
+#define SIM_PAGE_BUF_DEPTH  18432       /* PAGE_BUF_DEPTH generic of axi_nand_ctrl */
+#define SIM_UART_BASE       0xE0001000U
+#define SIM_RX_BAUD         921600      /* RX line rate when baud is 0 */
+
+extern uint32_t sim_axi_window[SIM_AXI_BYTES / 4];
+
+/* nand_dump.c takes NAND_BASE from here when it is not set on the command line */
+#ifndef NAND_BASE
+#define NAND_BASE ((uintptr_t)sim_axi_window)
+#endif
+
+/* Page source, called twice per READ PAGE: at START with dst == 0, where it
+ * returns extra latency in microseconds (or -1: R/B# never rises and the
+ * controller stays busy, as the RTL has no timeout), and on completion to
+ * fill 'dst' with 'bytes' of row 'row' from column 'col'. */
+typedef int (*sim_page_fn)(uint32_t row, uint32_t col, uint8_t *dst, uint32_t bytes);
+/* Bytes leaving the TX shift register, in line order */
+typedef void (*sim_tx_fn)(const uint8_t *data, uint32_t len);
+/* Returns 1 and sets *byte if the host has sent something; called once per
+ * character time while the line is busy */
+typedef int (*sim_rx_fn)(uint8_t *byte);
+
+struct sim_config {
+    uint8_t id[5];              /* READ ID bytes */
+    uint8_t status;             /* READ STATUS byte */
+    uint32_t t_read_ns;         /* READ PAGE: tR plus the bus transfer at the
+                                   reset TIMING (100 ns read cycle); the
+                                   transfer scales with the TIMING in use */
+    uint32_t t_array_ns;        /* the tR part; 31h/3Fh overlap it with the
+                                   transfer of the page before */
+    uint32_t t_op_ns;           /* every other op */
+    uint32_t t_reg_ns;          /* one register access */
+    uint32_t bus_min_ns;        /* page reads with a shorter read cycle come
+                                   back with bit errors; 0: none do */
+    uint32_t baud;              /* 0: the TX FIFO drains instantly, and RX
+                                   runs at SIM_RX_BAUD */
+    sim_page_fn read_page;
+    sim_page_fn read_param;     /* READ PARAMETER PAGE (row ignored) */
+    sim_tx_fn tx;
+    sim_rx_fn rx;
+    void (*rx_wait)(void);      /* the firmware found RX empty; may block
+                                   until the host sends something */
+    void (*idle)(uint64_t ns);  /* called from usleep(); may pace real time */
+};
+
+struct sim_counters {
+    uint64_t axi_reads;         /* Xil_In32 */
+    uint64_t axi_writes;        /* Xil_Out32 */
+    uint64_t uart_reads;        /* UART register reads (SR polls, RX) */
+    uint64_t uart_writes;       /* UART register writes (TX FIFO, config) */
+    uint64_t tx_bytes;          /* bytes put on the line */
+    uint64_t rx_dropped;        /* bytes lost to a full RX FIFO */
+    uint64_t ops;               /* NAND operations started */
+};
+
+extern struct sim_config sim_cfg;
+extern struct sim_counters sim_count;
+extern uint64_t sim_now_ns;
+
+void sim_reset(void);
+
+/* Register access, used by the mock BSP headers */
+uint32_t sim_axi_read32(uintptr_t addr);
+void sim_axi_write32(uintptr_t addr, uint32_t value);
+uint32_t sim_uart_read32(uintptr_t addr);
+void sim_uart_write32(uintptr_t addr, uint32_t value);
+void sim_usleep(unsigned long us);
+
+/* Runs the clock until the TX FIFO is empty */
+void sim_uart_drain(void);
+
+#endif /* SIM_HW_H */
@@ -0,0 +1,9 @@
+/* Host build stand-in for the Xilinx BSP sleep.h (see sim_hw.h) */
+#ifndef SLEEP_H
+#define SLEEP_H
+
+#include "sim_hw.h"
+
+#define usleep(us)  sim_usleep(us)
+
+#endif /* SLEEP_H */
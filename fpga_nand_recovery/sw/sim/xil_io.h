@@ -0,0 +1,10 @@
+/* Host build stand-in for the Xilinx BSP xil_io.h (see sim_hw.h) */
+#ifndef XIL_IO_H
+#define XIL_IO_H
+
+#include "sim_hw.h"
+
+#define Xil_In32(addr)          sim_axi_read32((uintptr_t)(addr))
+#define Xil_Out32(addr, value)  sim_axi_write32((uintptr_t)(addr), (value))
+
+#endif /* XIL_IO_H */
@@ -0,0 +1,8 @@
+/* Host build stand-in for the generated xparameters.h (see sim_hw.h) */
+#ifndef XPARAMETERS_H
+#define XPARAMETERS_H
+
+#define XPAR_XUARTPS_0_DEVICE_ID    0
+#define XPAR_XUARTPS_0_BASEADDR     SIM_UART_BASE
+
+#endif /* XPARAMETERS_H */
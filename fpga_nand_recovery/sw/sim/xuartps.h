@@ -0,0 +1,41 @@
+/* Host build stand-in for the Xilinx BSP xuartps.h / xuartps_hw.h: the
+ * register offsets, status bits and access macros the firmware uses, on top
+ * of the UART model in sim_hw.c. */
+#ifndef XUARTPS_H
+#define XUARTPS_H
+
+#include "sim_hw.h"
+
+#define XUARTPS_SR_OFFSET       0x2CU   /* Channel status */
+#define XUARTPS_FIFO_OFFSET     0x30U   /* TX/RX FIFO */
+#define XUARTPS_TXWM_OFFSET     0x44U   /* TX FIFO trigger level */
+
+#define XUARTPS_SR_TTRIG        0x00002000U /* TX FIFO level >= trigger */
+#define XUARTPS_SR_TXFULL       0x00000010U
+#define XUARTPS_SR_TXEMPTY      0x00000008U
+#define XUARTPS_SR_RXEMPTY      0x00000002U
+
+typedef struct {
+    uint16_t DeviceId;
+    uint32_t BaseAddress;
+} XUartPs_Config;
+
+typedef struct {
+    XUartPs_Config Config;
+} XUartPs;
+
+#define XUartPs_ReadReg(base, offset)           sim_uart_read32((base) + (offset))
+#define XUartPs_WriteReg(base, offset, value)   sim_uart_write32((base) + (offset), (value))
+
+#define XUartPs_IsTransmitFull(base) \
+    ((XUartPs_ReadReg(base, XUARTPS_SR_OFFSET) & XUARTPS_SR_TXFULL) == XUARTPS_SR_TXFULL)
+#define XUartPs_IsReceiveData(base) \
+    (!((XUartPs_ReadReg(base, XUARTPS_SR_OFFSET) & XUARTPS_SR_RXEMPTY) == XUARTPS_SR_RXEMPTY))
+
+XUartPs_Config *XUartPs_LookupConfig(uint16_t device_id);
+int XUartPs_CfgInitialize(XUartPs *inst, XUartPs_Config *cfg, uint32_t effective_addr);
+int XUartPs_SetBaudRate(XUartPs *inst, uint32_t baud);
+void XUartPs_SendByte(uint32_t base, uint8_t data);
+uint8_t XUartPs_RecvByte(uint32_t base);
+
+#endif /* XUARTPS_H */
@@ -4,13 +4,22 @@
 #include <initguid.h>
 #include <devpkey.h>
 #include <cfgmgr32.h>
+#include <emmintrin.h>
+#include <intrin.h>
 #include <cstdio>
 #include <cstdlib>
+#include <cstdarg>
 #include <cctype>
+#include <cmath>
 #include <string>
 #include <vector>
 #include <memory>
+#include <list>
+#include <unordered_map>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #pragma comment(lib, "setupapi.lib")
 
@@ -2357,6 +2366,8729 @@ static void PrintDriveInfo(const PhysicalDriveInfo& info)
     }
 }
 
+// ============================================================
+// Raw image access (read-only memory mapping)
+// ============================================================
+
+// Maps an entire image file read-only. Parsers handed a MappedImage work
+// directly on the mapped bytes, so nothing is copied out of the page cache.
+// Mapping a multi-GB image requires a 64-bit build.
+class MappedImage {
+    HandleGuard m_file;
+    HandleGuard m_mapping;
+    const BYTE* m_data = nullptr;
+    ULONGLONG m_size = 0;
+public:
+    explicit MappedImage(const wchar_t* path)
+    {
+        m_file = HandleGuard(CreateFileW(path, GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr));
+        if (!m_file.valid())
+        {
+            char msg[512];
+            sprintf_s(msg, "Failed to open image %ls", path);
+            FatalError(msg);
+        }
+
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(m_file.get(), &size))
+            FatalError("GetFileSizeEx failed on image");
+        if (size.QuadPart <= 0)
+            FatalErrorMsg("Image file is empty.");
+        if (static_cast<ULONGLONG>(size.QuadPart) > static_cast<ULONGLONG>(SIZE_MAX))
+            FatalErrorMsg("Image is larger than the address space — use the x64 build.");
+        m_size = static_cast<ULONGLONG>(size.QuadPart);
+
+        HANDLE hMap = CreateFileMappingW(m_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMap == nullptr)
+            FatalError("CreateFileMappingW failed on image");
+        m_mapping = HandleGuard(hMap);
+
+        m_data = static_cast<const BYTE*>(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0, 0));
+        if (!m_data)
+            FatalError("MapViewOfFile failed on image");
+    }
+    ~MappedImage() { if (m_data) UnmapViewOfFile(m_data); }
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    const BYTE* data() const { return m_data; }
+    ULONGLONG size() const { return m_size; }
+
+    // Returns a pointer to [offset, offset + len) or nullptr if out of range.
+    const BYTE* at(ULONGLONG offset, ULONGLONG len) const
+    {
+        if (offset > m_size || len > m_size - offset)
+            return nullptr;
+        return m_data + offset;
+    }
+};
+
+// ============================================================
+// Random-access image reader (block cache, devices, sparse images)
+// ============================================================
+
+// One read path for anything that is not a plain image file. A raw image
+// is still mapped and served zero-copy; a device (\\.\PhysicalDriveN) or a
+// sparse extent list goes through a sharded LRU cache of aligned blocks
+// that any number of threads may share. Sequential walkers announce what
+// they will read next with prefetch(), which a background thread services.
+//
+// The partition, FAT and exFAT parsers read through it. The carvers and
+// whole-image scanners still take a MappedImage: they hand pointers into
+// the mapping to other threads and stream objects, and rely on sequential
+// reads of a file the OS already caches.
+//
+// Extent list (*.extents), one directive per line, '#' starts a comment:
+//     size <image-bytes>
+//     <image-offset> <length> <file> [file-offset]
+// Numbers may be decimal or 0x-prefixed; relative file names are taken
+// from the list's directory; bytes no extent covers read as zero.
+
+class ImageSource {
+public:
+    virtual ~ImageSource() {}
+    virtual ULONGLONG size() const = 0;
+    virtual const char* kind() const = 0;
+    // Fills dst with [offset, offset + len); offset and len are block
+    // aligned except where the range ends at the end of the image.
+    virtual bool readBlock(ULONGLONG offset, BYTE* dst, size_t len) = 0;
+    // Zero-copy pointer to [offset, offset + len), if the source is mapped.
+    virtual const BYTE* view(ULONGLONG, size_t) const { return nullptr; }
+};
+
+class MappedImageSource : public ImageSource {
+    MappedImage m_img;
+public:
+    explicit MappedImageSource(const wchar_t* path) : m_img(path) {}
+    ULONGLONG size() const override { return m_img.size(); }
+    const char* kind() const override { return "mapped image file"; }
+    bool readBlock(ULONGLONG offset, BYTE* dst, size_t len) override
+    {
+        const BYTE* p = m_img.at(offset, len);
+        if (!p)
+            return false;
+        memcpy(dst, p, len);
+        return true;
+    }
+    const BYTE* view(ULONGLONG offset, size_t len) const override { return m_img.at(offset, len); }
+};
+
+// Positioned ReadFile into a block buffer; ranges past the end of a short
+// file or device read back as zero.
+static bool ReadAt(HANDLE h, ULONGLONG offset, BYTE* dst, size_t len)
+{
+    for (size_t done = 0; done < len; )
+    {
+        OVERLAPPED ov = {};
+        ov.Offset = static_cast<DWORD>(offset + done);
+        ov.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+        const DWORD piece = static_cast<DWORD>(std::min<size_t>(len - done, 64 * 1024 * 1024));
+        DWORD got = 0;
+        if (!ReadFile(h, dst + done, piece, &got, &ov))
+            return false;
+        if (got == 0)
+        {
+            memset(dst + done, 0, len - done);
+            break;
+        }
+        done += got;
+    }
+    return true;
+}
+
+class DeviceImageSource : public ImageSource {
+    HandleGuard m_device;
+    ULONGLONG m_size = 0;
+public:
+    explicit DeviceImageSource(const wchar_t* path)
+    {
+        // Unbuffered: the block cache is the only cache. Block buffers come
+        // from VirtualAlloc, so they meet any sector alignment.
+        m_device = HandleGuard(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_RANDOM_ACCESS, nullptr));
+        if (!m_device.valid())
+        {
+            char msg[512];
+            sprintf_s(msg, "Failed to open device %ls", path);
+            FatalError(msg);
+        }
+        DISK_GEOMETRY_EX dgex = {};
+        DWORD bytesReturned = 0;
+        if (!DeviceIoControl(m_device.get(), IOCTL_DISK_GET_DRIVE_GEOMETRY_EX, nullptr, 0, &dgex, sizeof(dgex),
+            &bytesReturned, nullptr))
+            FatalError("IOCTL_DISK_GET_DRIVE_GEOMETRY_EX failed on device");
+        m_size = static_cast<ULONGLONG>(dgex.DiskSize.QuadPart);
+    }
+    ULONGLONG size() const override { return m_size; }
+    const char* kind() const override { return "raw device (unbuffered)"; }
+    bool readBlock(ULONGLONG offset, BYTE* dst, size_t len) override
+    {
+        return ReadAt(m_device.get(), offset, dst, len);
+    }
+};
+
+class SparseImageSource : public ImageSource {
+    struct Extent {
+        ULONGLONG offset = 0;
+        ULONGLONG length = 0;
+        size_t file = 0;
+        ULONGLONG fileOffset = 0;
+    };
+    std::vector<HandleGuard> m_files;
+    std::vector<Extent> m_extents;         // sorted, non-overlapping
+    ULONGLONG m_size = 0;
+
+    [[noreturn]] static void BadLine(size_t line, const char* what)
+    {
+        char msg[256];
+        sprintf_s(msg, "Extent list line %zu: %s", line, what);
+        FatalErrorMsg(msg);
+    }
+
+public:
+    explicit SparseImageSource(const wchar_t* listPath)
+    {
+        MappedImage list(listPath);
+        const std::string text(reinterpret_cast<const char*>(list.data()), static_cast<size_t>(list.size()));
+        std::wstring dir(listPath);
+        const size_t slash = dir.find_last_of(L"\\/");
+        dir = slash == std::wstring::npos ? std::wstring() : dir.substr(0, slash + 1);
+
+        std::vector<std::wstring> names;
+        size_t lineNo = 0;
+        for (size_t pos = 0; pos < text.size(); )
+        {
+            size_t eol = text.find('\n', pos);
+            if (eol == std::string::npos)
+                eol = text.size();
+            std::string line = text.substr(pos, eol - pos);
+            pos = eol + 1;
+            ++lineNo;
+            line = line.substr(0, line.find('#'));
+            while (!line.empty() && isspace(static_cast<unsigned char>(line.back())))
+                line.pop_back();
+            const char* p = line.c_str();
+            while (isspace(static_cast<unsigned char>(*p)))
+                ++p;
+            if (!*p)
+                continue;
+
+            char* next;
+            if (strncmp(p, "size", 4) == 0 && isspace(static_cast<unsigned char>(p[4])))
+            {
+                m_size = _strtoui64(p + 4, &next, 0);
+                continue;
+            }
+            Extent e;
+            e.offset = _strtoui64(p, &next, 0);
+            if (next == p)
+                BadLine(lineNo, "expected <image-offset> <length> <file> [file-offset]");
+            p = next;
+            e.length = _strtoui64(p, &next, 0);
+            if (next == p || !isspace(static_cast<unsigned char>(*next)))
+                BadLine(lineNo, "expected <image-offset> <length> <file> [file-offset]");
+            p = next;
+            while (isspace(static_cast<unsigned char>(*p)))
+                ++p;
+            const char* nameEnd = p;
+            while (*nameEnd && !isspace(static_cast<unsigned char>(*nameEnd)))
+                ++nameEnd;
+            const std::string name(p, nameEnd);
+            e.fileOffset = *nameEnd ? _strtoui64(nameEnd, nullptr, 0) : 0;
+
+            std::wstring wname(name.size() + 1, L'\0');
+            wname.resize(static_cast<size_t>(std::max(0, MultiByteToWideChar(CP_UTF8, 0, name.c_str(),
+                static_cast<int>(name.size()), &wname[0], static_cast<int>(wname.size())))));
+            const bool absolute = wname.size() > 1 && (wname[1] == L':' || wname[0] == L'\\' || wname[0] == L'/');
+            if (!absolute)
+                wname = dir + wname;
+            auto it = std::find(names.begin(), names.end(), wname);
+            e.file = static_cast<size_t>(it - names.begin());
+            if (it == names.end())
+            {
+                HandleGuard h(CreateFileW(wname.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                    OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr));
+                if (!h.valid())
+                {
+                    char msg[512];
+                    sprintf_s(msg, "Failed to open extent file %s", name.c_str());
+                    FatalError(msg);
+                }
+                names.push_back(wname);
+                m_files.push_back(std::move(h));
+            }
+            if (e.length)
+                m_extents.push_back(e);
+        }
+
+        std::sort(m_extents.begin(), m_extents.end(), [](const Extent& a, const Extent& b) { return a.offset < b.offset; });
+        for (size_t i = 0; i < m_extents.size(); ++i)
+        {
+            if (i && m_extents[i].offset < m_extents[i - 1].offset + m_extents[i - 1].length)
+                FatalErrorMsg("Extent list has overlapping extents.");
+            m_size = std::max(m_size, m_extents[i].offset + m_extents[i].length);
+        }
+        if (m_size == 0)
+            FatalErrorMsg("Extent list describes an empty image.");
+    }
+
+    ULONGLONG size() const override { return m_size; }
+    const char* kind() const override { return "sparse extent list"; }
+    size_t extentCount() const { return m_extents.size(); }
+
+    bool readBlock(ULONGLONG offset, BYTE* dst, size_t len) override
+    {
+        memset(dst, 0, len);
+        auto it = std::upper_bound(m_extents.begin(), m_extents.end(), offset,
+            [](ULONGLONG o, const Extent& e) { return o < e.offset; });
+        if (it != m_extents.begin())
+            --it;
+        for (; it != m_extents.end() && it->offset < offset + len; ++it)
+        {
+            const ULONGLONG from = std::max(offset, it->offset);
+            const ULONGLONG to = std::min(offset + len, it->offset + it->length);
+            if (from >= to)
+                continue;
+            if (!ReadAt(m_files[it->file].get(), it->fileOffset + (from - it->offset), dst + (from - offset),
+                static_cast<size_t>(to - from)))
+                return false;
+        }
+        return true;
+    }
+};
+
+// Block buffers are VirtualAlloc'ed so unbuffered device reads can land in
+// them directly.
+struct CachedBlock {
+    ULONGLONG offset = 0;
+    size_t length = 0;
+    BYTE* data = nullptr;
+
+    explicit CachedBlock(size_t capacity)
+    {
+        data = static_cast<BYTE*>(VirtualAlloc(nullptr, capacity, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (!data)
+            FatalError("VirtualAlloc failed for cache block");
+    }
+    ~CachedBlock() { VirtualFree(data, 0, MEM_RELEASE); }
+    CachedBlock(const CachedBlock&) = delete;
+    CachedBlock& operator=(const CachedBlock&) = delete;
+};
+
+typedef std::shared_ptr<const CachedBlock> BlockRef;
+
+// LRU per shard, shards picked by block index, so threads walking
+// different parts of the image rarely meet on a lock. Readers hold a
+// BlockRef, so eviction never frees a block that is still being read.
+class ShardedBlockCache {
+    static const size_t kShards = 16;
+    struct Shard {
+        std::mutex lock;
+        std::list<std::pair<ULONGLONG, BlockRef>> lru;     // front = most recent
+        std::unordered_map<ULONGLONG, std::list<std::pair<ULONGLONG, BlockRef>>::iterator> index;
+        ULONGLONG hits = 0;
+        ULONGLONG misses = 0;
+    };
+    Shard m_shards[kShards];
+    size_t m_blocksPerShard;
+
+    Shard& shard(ULONGLONG block) { return m_shards[(block ^ (block >> 7)) % kShards]; }
+
+public:
+    explicit ShardedBlockCache(size_t capacityBlocks)
+        : m_blocksPerShard(std::max<size_t>(1, capacityBlocks / kShards)) {}
+
+    BlockRef find(ULONGLONG block)
+    {
+        Shard& s = shard(block);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto it = s.index.find(block);
+        if (it == s.index.end())
+        {
+            ++s.misses;
+            return BlockRef();
+        }
+        ++s.hits;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return it->second->second;
+    }
+
+    // Returns the cached block if another thread inserted it first.
+    BlockRef insert(ULONGLONG block, BlockRef data)
+    {
+        Shard& s = shard(block);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto it = s.index.find(block);
+        if (it != s.index.end())
+            return it->second->second;
+        s.lru.emplace_front(block, data);
+        s.index[block] = s.lru.begin();
+        while (s.lru.size() > m_blocksPerShard)
+        {
+            s.index.erase(s.lru.back().first);
+            s.lru.pop_back();
+        }
+        return data;
+    }
+
+    void stats(ULONGLONG& hits, ULONGLONG& misses)
+    {
+        hits = misses = 0;
+        for (auto& s : m_shards)
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            hits += s.hits;
+            misses += s.misses;
+        }
+    }
+};
+
+class ImageReader {
+    std::unique_ptr<ImageSource> m_source;
+    size_t m_blockSize;
+    ShardedBlockCache m_cache;
+
+    std::thread m_prefetcher;
+    std::mutex m_queueLock;
+    std::condition_variable m_queueReady;
+    std::vector<ULONGLONG> m_queue;        // block indices, serviced oldest first
+    size_t m_queueHead = 0;
+    bool m_stop = false;
+
+    void prefetchLoop()
+    {
+        for (;;)
+        {
+            ULONGLONG blk;
+            {
+                std::unique_lock<std::mutex> guard(m_queueLock);
+                m_queueReady.wait(guard, [&] { return m_stop || m_queueHead < m_queue.size(); });
+                if (m_stop)
+                    return;
+                blk = m_queue[m_queueHead++];
+                if (m_queueHead == m_queue.size())
+                {
+                    m_queue.clear();
+                    m_queueHead = 0;
+                }
+            }
+            const ULONGLONG offset = blk * m_blockSize;
+            const size_t len = static_cast<size_t>(std::min<ULONGLONG>(m_blockSize, size() - offset));
+            if (const BYTE* p = m_source->view(offset, len))
+            {
+                // Mapped: fault the pages in here rather than on the caller.
+                volatile BYTE sink = 0;
+                for (size_t i = 0; i < len; i += 4096)
+                    sink ^= p[i];
+                (void)sink;
+            }
+            else
+                block(offset);
+        }
+    }
+
+public:
+    ImageReader(std::unique_ptr<ImageSource> source, size_t blockSize, size_t cacheBytes)
+        : m_source(std::move(source)), m_blockSize(blockSize),
+          m_cache(std::max<size_t>(cacheBytes / blockSize, 16))
+    {
+        m_prefetcher = std::thread([this] { prefetchLoop(); });
+    }
+
+    ~ImageReader()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_queueLock);
+            m_stop = true;
+        }
+        m_queueReady.notify_all();
+        m_prefetcher.join();
+    }
+
+    ImageReader(const ImageReader&) = delete;
+    ImageReader& operator=(const ImageReader&) = delete;
+
+    // "\\.\..." opens a device, "*.extents" a sparse extent list, anything
+    // else is mapped as an image file.
+    static std::unique_ptr<ImageReader> Open(const wchar_t* path, size_t blockSize = 256 * 1024,
+        size_t cacheBytes = 256 * 1024 * 1024)
+    {
+        const std::wstring p(path);
+        std::unique_ptr<ImageSource> source;
+        if (p.compare(0, 4, L"\\\\.\\") == 0)
+            source.reset(new DeviceImageSource(path));
+        else if (p.size() > 8 && _wcsicmp(p.c_str() + p.size() - 8, L".extents") == 0)
+            source.reset(new SparseImageSource(path));
+        else
+            source.reset(new MappedImageSource(path));
+        return std::unique_ptr<ImageReader>(new ImageReader(std::move(source), blockSize, cacheBytes));
+    }
+
+    ULONGLONG size() const { return m_source->size(); }
+    size_t blockSize() const { return m_blockSize; }
+    const ImageSource& source() const { return *m_source; }
+
+    // Zero-copy view when the source is mapped; nullptr otherwise.
+    const BYTE* view(ULONGLONG offset, size_t len) const { return m_source->view(offset, len); }
+
+    // [offset, offset + len) in one piece: the mapping itself when there is
+    // one, otherwise read into 'copy'. nullptr if the range leaves the image
+    // or the read fails.
+    const BYTE* span(ULONGLONG offset, ULONGLONG len, std::vector<BYTE>& copy)
+    {
+        if (offset > size() || len > size() - offset)
+            return nullptr;
+        if (const BYTE* p = view(offset, static_cast<size_t>(len)))
+            return p;
+        copy.resize(static_cast<size_t>(len));
+        return read(offset, copy.data(), copy.size()) == copy.size() ? copy.data() : nullptr;
+    }
+
+    // The cached block holding 'offset' (read on a miss). Empty past the
+    // end of the image or on a read error.
+    BlockRef block(ULONGLONG offset)
+    {
+        if (offset >= size())
+            return BlockRef();
+        const ULONGLONG index = offset / m_blockSize;
+        BlockRef b = m_cache.find(index);
+        if (b)
+            return b;
+        std::shared_ptr<CachedBlock> fresh = std::make_shared<CachedBlock>(m_blockSize);
+        fresh->offset = index * m_blockSize;
+        fresh->length = static_cast<size_t>(std::min<ULONGLONG>(m_blockSize, size() - fresh->offset));
+        if (!m_source->readBlock(fresh->offset, fresh->data, fresh->length))
+            return BlockRef();
+        return m_cache.insert(index, fresh);
+    }
+
+    // Copies [offset, offset + len) clipped to the image; returns the byte
+    // count copied (short only at the end of the image or on a read error).
+    size_t read(ULONGLONG offset, void* dst, size_t len)
+    {
+        if (offset >= size())
+            return 0;
+        len = static_cast<size_t>(std::min<ULONGLONG>(len, size() - offset));
+        if (const BYTE* p = view(offset, len))
+        {
+            memcpy(dst, p, len);
+            return len;
+        }
+        BYTE* out = static_cast<BYTE*>(dst);
+        size_t done = 0;
+        while (done < len)
+        {
+            const BlockRef b = block(offset + done);
+            if (!b)
+                break;
+            const size_t within = static_cast<size_t>(offset + done - b->offset);
+            const size_t n = std::min(len - done, b->length - within);
+            memcpy(out + done, b->data + within, n);
+            done += n;
+        }
+        return done;
+    }
+
+    // Hint that [offset, offset + len) will be read soon. Bounded: hints
+    // beyond 64 queued blocks are dropped rather than delaying the caller.
+    void prefetch(ULONGLONG offset, ULONGLONG len)
+    {
+        if (offset >= size() || len == 0)
+            return;
+        const ULONGLONG first = offset / m_blockSize;
+        const ULONGLONG last = (std::min(size(), offset + len) - 1) / m_blockSize;
+        {
+            std::lock_guard<std::mutex> guard(m_queueLock);
+            for (ULONGLONG b = first; b <= last && m_queue.size() - m_queueHead < 64; ++b)
+                m_queue.push_back(b);
+        }
+        m_queueReady.notify_one();
+    }
+
+    void cacheStats(ULONGLONG& hits, ULONGLONG& misses) { m_cache.stats(hits, misses); }
+};
+
+static int CmdHexDump(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: hexdump <image|\\\\.\\PhysicalDriveN|list.extents> <offset> [length]");
+
+    std::unique_ptr<ImageReader> reader = ImageReader::Open(argv[0]);
+    const ULONGLONG offset = _wcstoui64(argv[1], nullptr, 0);
+    const ULONGLONG length = argc >= 3 ? _wcstoui64(argv[2], nullptr, 0) : 512;
+    if (offset >= reader->size())
+        FatalErrorMsg("Offset is past the end of the image.");
+
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(reader->size()), sizeBuf, sizeof(sizeBuf));
+    printf("Source:             %ls (%s, %s)\n\n", argv[0], reader->source().kind(), sizeBuf);
+
+    // Identical lines collapse to '*', as in the Unix hexdump.
+    const ULONGLONG end = std::min(reader->size(), offset + length);
+    BYTE line[16], previous[16];
+    bool havePrevious = false, starred = false;
+    for (ULONGLONG pos = offset; pos < end; pos += 16)
+    {
+        if ((pos - offset) % (4 * 1024 * 1024) == 0)
+            reader->prefetch(pos + 4 * 1024 * 1024, 4 * 1024 * 1024);
+        const size_t n = reader->read(pos, line, static_cast<size_t>(std::min<ULONGLONG>(16, end - pos)));
+        if (n == 0)
+            FatalErrorMsg("Read failed.");
+        if (n == 16 && havePrevious && memcmp(line, previous, 16) == 0 && pos + 16 < end)
+        {
+            if (!starred)
+                printf("*\n");
+            starred = true;
+            continue;
+        }
+        starred = false;
+        memcpy(previous, line, 16);
+        havePrevious = n == 16;
+
+        printf("%012llX  ", pos);
+        for (size_t i = 0; i < 16; ++i)
+        {
+            if (i < n)
+                printf("%02X ", line[i]);
+            else
+                printf("   ");
+            if (i == 7)
+                printf(" ");
+        }
+        printf(" |");
+        for (size_t i = 0; i < n; ++i)
+            printf("%c", line[i] >= 0x20 && line[i] <= 0x7E ? line[i] : '.');
+        printf("|\n");
+    }
+
+    ULONGLONG hits, misses;
+    reader->cacheStats(hits, misses);
+    if (hits + misses)
+        printf("\n  Block cache:        %llu hit(s), %llu miss(es)\n", hits, misses);
+    return 0;
+}
+
+// ============================================================
+// Little-endian field access and CRC32 for on-disk structures
+// ============================================================
+
+static WORD LoadLE16(const BYTE* p)
+{
+    return static_cast<WORD>(p[0] | (p[1] << 8));
+}
+
+static DWORD LoadLE32(const BYTE* p)
+{
+    return static_cast<DWORD>(p[0]) | (static_cast<DWORD>(p[1]) << 8)
+        | (static_cast<DWORD>(p[2]) << 16) | (static_cast<DWORD>(p[3]) << 24);
+}
+
+static ULONGLONG LoadLE64(const BYTE* p)
+{
+    return static_cast<ULONGLONG>(LoadLE32(p)) | (static_cast<ULONGLONG>(LoadLE32(p + 4)) << 32);
+}
+
+static WORD LoadBE16(const BYTE* p)
+{
+    return static_cast<WORD>((p[0] << 8) | p[1]);
+}
+
+static DWORD LoadBE32(const BYTE* p)
+{
+    return (static_cast<DWORD>(p[0]) << 24) | (static_cast<DWORD>(p[1]) << 16)
+        | (static_cast<DWORD>(p[2]) << 8) | static_cast<DWORD>(p[3]);
+}
+
+static ULONGLONG LoadBE64(const BYTE* p)
+{
+    return (static_cast<ULONGLONG>(LoadBE32(p)) << 32) | LoadBE32(p + 4);
+}
+
+// Standard CRC-32 (IEEE 802.3, reflected, as used by GPT and zlib).
+static DWORD Crc32Update(DWORD crc, const BYTE* data, size_t len)
+{
+    static const struct Crc32Table {
+        DWORD entries[256];
+        Crc32Table()
+        {
+            for (DWORD i = 0; i < 256; ++i)
+            {
+                DWORD c = i;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+                entries[i] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i)
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static DWORD Crc32(const BYTE* data, size_t len)
+{
+    return Crc32Update(0, data, len);
+}
+
+// ============================================================
+// Worker threads
+// ============================================================
+
+static DWORD WorkerThreadCount()
+{
+    const unsigned n = std::thread::hardware_concurrency();
+    return n ? static_cast<DWORD>(n) : 4;
+}
+
+// Splits [0, count) into one contiguous range per worker and runs
+// fn(begin, end, workerIndex) on each range concurrently.
+template <typename Fn>
+static void ParallelForRanges(ULONGLONG count, Fn fn)
+{
+    const DWORD workers = static_cast<DWORD>(
+        std::min<ULONGLONG>(WorkerThreadCount(), std::max<ULONGLONG>(count, 1)));
+    if (workers <= 1)
+    {
+        fn(0ULL, count, 0u);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers);
+    const ULONGLONG per = (count + workers - 1) / workers;
+    for (DWORD w = 0; w < workers; ++w)
+    {
+        const ULONGLONG begin = std::min<ULONGLONG>(count, per * w);
+        const ULONGLONG end = std::min<ULONGLONG>(count, begin + per);
+        threads.emplace_back([=, &fn]() { fn(begin, end, w); });
+    }
+    for (auto& t : threads)
+        t.join();
+}
+
+// ============================================================
+// Boot sector (VBR) classification: exFAT, NTFS, FAT12/16/32
+// ============================================================
+
+enum class BootSectorKind { None, ExFat, Ntfs, Fat12, Fat16, Fat32 };
+
+static const char* BootSectorKindName(BootSectorKind k)
+{
+    switch (k) {
+    case BootSectorKind::ExFat: return "exFAT";
+    case BootSectorKind::Ntfs:  return "NTFS";
+    case BootSectorKind::Fat12: return "FAT12";
+    case BootSectorKind::Fat16: return "FAT16";
+    case BootSectorKind::Fat32: return "FAT32";
+    default:                    return "None";
+    }
+}
+
+struct BootSectorInfo {
+    BootSectorKind kind = BootSectorKind::None;
+    DWORD bytesPerSector = 0;
+    DWORD sectorsPerCluster = 0;
+    ULONGLONG partitionOffsetSectors = 0;  // exFAT PartitionOffset / FAT+NTFS HiddenSectors
+    ULONGLONG volumeSectors = 0;
+    DWORD serialNumber = 0;
+    char label[12] = {};                   // FAT only (exFAT keeps its label in the root dir)
+    DWORD backupSector = 0;                // relative sector of the backup VBR (0 = none)
+};
+
+static bool IsPowerOfTwo(ULONGLONG v)
+{
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+// Recognizes a volume boot record from its BPB. Only sectors that carry the
+// 0x55AA signature and a self-consistent BPB are accepted, so the same routine
+// can be used to hunt for stale boot sectors anywhere in an image.
+static bool ParseBootSector(const BYTE* s, BootSectorInfo& out)
+{
+    out = BootSectorInfo();
+    if (s[510] != 0x55 || s[511] != 0xAA)
+        return false;
+
+    if (memcmp(s + 3, "EXFAT   ", 8) == 0)
+    {
+        const BYTE bpsShift = s[0x6C];
+        const BYTE spcShift = s[0x6D];
+        if (bpsShift < 9 || bpsShift > 12 || bpsShift + spcShift > 25)
+            return false;
+        out.kind = BootSectorKind::ExFat;
+        out.bytesPerSector = 1u << bpsShift;
+        out.sectorsPerCluster = 1u << spcShift;
+        out.partitionOffsetSectors = LoadLE64(s + 0x40);
+        out.volumeSectors = LoadLE64(s + 0x48);
+        out.serialNumber = LoadLE32(s + 0x64);
+        out.backupSector = 12;
+        return true;
+    }
+
+    const DWORD bps = LoadLE16(s + 0x0B);
+    const DWORD spc = s[0x0D];
+    if ((bps != 512 && bps != 1024 && bps != 2048 && bps != 4096) || !IsPowerOfTwo(spc))
+        return false;
+
+    if (memcmp(s + 3, "NTFS    ", 8) == 0)
+    {
+        out.kind = BootSectorKind::Ntfs;
+        out.bytesPerSector = bps;
+        out.sectorsPerCluster = spc;
+        out.partitionOffsetSectors = LoadLE32(s + 0x1C);
+        out.volumeSectors = LoadLE64(s + 0x28) + 1;  // backup VBR sits in the extra last sector
+        out.serialNumber = LoadLE32(s + 0x48);
+        return true;
+    }
+
+    // FAT: jump instruction, reserved sectors, FAT count and media byte must be sane.
+    if (!(s[0] == 0xEB && s[2] == 0x90) && s[0] != 0xE9)
+        return false;
+    const DWORD reserved = LoadLE16(s + 0x0E);
+    const DWORD numFats = s[0x10];
+    const DWORD rootEntries = LoadLE16(s + 0x11);
+    const DWORD media = s[0x15];
+    if (reserved == 0 || numFats == 0 || numFats > 2 || (media != 0xF0 && media < 0xF8))
+        return false;
+
+    const DWORD totalSectors = LoadLE16(s + 0x13) ? LoadLE16(s + 0x13) : LoadLE32(s + 0x20);
+    const DWORD fatSize = LoadLE16(s + 0x16) ? LoadLE16(s + 0x16) : LoadLE32(s + 0x24);
+    if (totalSectors == 0 || fatSize == 0)
+        return false;
+
+    const DWORD rootDirSectors = (rootEntries * 32 + bps - 1) / bps;
+    const ULONGLONG metaSectors = static_cast<ULONGLONG>(reserved) + numFats * static_cast<ULONGLONG>(fatSize) + rootDirSectors;
+    if (metaSectors >= totalSectors)
+        return false;
+
+    // Microsoft's rule: the FAT type is determined solely by the cluster count.
+    const DWORD clusters = static_cast<DWORD>((totalSectors - metaSectors) / spc);
+    const bool fat32Layout = rootEntries == 0 && LoadLE16(s + 0x16) == 0;
+    if (clusters < 4085)
+        out.kind = BootSectorKind::Fat12;
+    else if (clusters < 65525)
+        out.kind = BootSectorKind::Fat16;
+    else
+        out.kind = BootSectorKind::Fat32;
+    if ((out.kind == BootSectorKind::Fat32) != fat32Layout)
+        return false;
+
+    out.bytesPerSector = bps;
+    out.sectorsPerCluster = spc;
+    out.partitionOffsetSectors = LoadLE32(s + 0x1C);
+    out.volumeSectors = totalSectors;
+
+    const BYTE* ext = fat32Layout ? s + 0x40 : s + 0x24;  // extended BPB (drive number onwards)
+    if (ext[2] == 0x29)
+    {
+        out.serialNumber = LoadLE32(ext + 3);
+        memcpy(out.label, ext + 7, 11);
+        for (int i = 10; i >= 0 && out.label[i] == ' '; --i)
+            out.label[i] = '\0';
+    }
+    if (fat32Layout)
+        out.backupSector = LoadLE16(s + 0x32);
+    return true;
+}
+
+// ============================================================
+// Raw partition table engine (MBR, EBR chains, GPT primary/backup)
+// ============================================================
+
+// Reads partitioning structures straight from an image instead of going through
+// IOCTL_DISK_GET_DRIVE_LAYOUT_EX, so stale, overwritten or internally
+// inconsistent tables are reported rather than silently ignored.
+
+enum class RawPartitionSource { Mbr, Ebr, GptPrimary, GptBackup };
+
+static const char* RawPartitionSourceName(RawPartitionSource s)
+{
+    switch (s) {
+    case RawPartitionSource::Mbr:        return "MBR";
+    case RawPartitionSource::Ebr:        return "EBR";
+    case RawPartitionSource::GptPrimary: return "GPT (primary)";
+    case RawPartitionSource::GptBackup:  return "GPT (backup)";
+    default:                             return "Unknown";
+    }
+}
+
+struct RawPartition {
+    RawPartitionSource source = RawPartitionSource::Mbr;
+    DWORD index = 0;               // slot number within its table
+    ULONGLONG tableLba = 0;        // LBA of the sector holding the entry
+    ULONGLONG firstLba = 0;
+    ULONGLONG sectorCount = 0;
+    BYTE mbrType = 0;
+    BYTE mbrStatus = 0;
+    BYTE chsStart[3] = {};
+    BYTE chsEnd[3] = {};
+    GUID gptType = {};
+    GUID gptId = {};
+    ULONGLONG gptAttributes = 0;
+    std::wstring gptName;
+};
+
+struct GptHeaderInfo {
+    bool present = false;
+    bool headerCrcValid = false;
+    bool entriesCrcValid = false;
+    ULONGLONG headerLba = 0;
+    DWORD revision = 0;
+    DWORD headerSize = 0;
+    ULONGLONG myLba = 0;
+    ULONGLONG alternateLba = 0;
+    ULONGLONG firstUsableLba = 0;
+    ULONGLONG lastUsableLba = 0;
+    GUID diskId = {};
+    ULONGLONG entriesLba = 0;
+    DWORD entryCount = 0;
+    DWORD entrySize = 0;
+    DWORD entriesCrc = 0;
+    DWORD computedEntriesCrc = 0;
+};
+
+struct BootSectorHit {
+    ULONGLONG offset = 0;                 // byte offset of the VBR in the image
+    BootSectorInfo info;
+    bool isBackupCopy = false;            // matches the backup slot of another hit
+    bool matchesCurrentTable = false;     // starts a partition in the current MBR/GPT
+};
+
+struct RawPartitionTable {
+    DWORD sectorSize = 512;
+    ULONGLONG imageSectors = 0;
+    bool mbrSignatureValid = false;
+    bool mbrBootCodeEmpty = false;
+    bool protectiveMbr = false;
+    DWORD mbrDiskSignature = 0;
+    std::vector<ULONGLONG> ebrChain;
+    GptHeaderInfo gptPrimary;
+    GptHeaderInfo gptBackup;
+    bool gptCopiesMatch = false;
+    std::vector<RawPartition> partitions;
+    std::vector<BootSectorHit> bootSectors;
+    std::vector<std::string> warnings;
+};
+
+static bool IsExtendedMbrType(BYTE type)
+{
+    return type == 0x05 || type == 0x0F || type == 0x85;
+}
+
+static void AddPartitionWarning(RawPartitionTable& table, const char* fmt, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    table.warnings.push_back(buf);
+}
+
+static void DecodeMbrEntry(const BYTE* e, RawPartition& p)
+{
+    p.mbrStatus = e[0];
+    memcpy(p.chsStart, e + 1, 3);
+    p.mbrType = e[4];
+    memcpy(p.chsEnd, e + 5, 3);
+    p.firstLba = LoadLE32(e + 8);
+    p.sectorCount = LoadLE32(e + 12);
+}
+
+// Follows the logical-partition chain of an extended partition. Each EBR holds
+// the logical partition (relative to the EBR itself) in slot 0 and the link to
+// the next EBR (relative to the start of the extended partition) in slot 1.
+static void WalkEbrChain(ImageReader& img, RawPartitionTable& table, ULONGLONG extendedLba)
+{
+    const DWORD ss = table.sectorSize;
+    ULONGLONG ebrLba = extendedLba;
+    DWORD logicalIndex = 5;
+    std::vector<BYTE> copy;
+
+    for (int hops = 0; hops < 256; ++hops)
+    {
+        if (std::find(table.ebrChain.begin(), table.ebrChain.end(), ebrLba) != table.ebrChain.end())
+        {
+            AddPartitionWarning(table, "EBR chain loops back to LBA %llu — chain truncated", ebrLba);
+            return;
+        }
+
+        const BYTE* ebr = img.span(ebrLba * ss, ss, copy);
+        if (!ebr)
+        {
+            AddPartitionWarning(table, "EBR at LBA %llu lies beyond the end of the image", ebrLba);
+            return;
+        }
+        if (ebr[510] != 0x55 || ebr[511] != 0xAA)
+        {
+            AddPartitionWarning(table, "EBR at LBA %llu has no 55 AA signature — chain ends here", ebrLba);
+            return;
+        }
+        table.ebrChain.push_back(ebrLba);
+
+        RawPartition logical;
+        DecodeMbrEntry(ebr + 446, logical);
+        if (logical.mbrType != 0 && logical.sectorCount != 0)
+        {
+            logical.source = RawPartitionSource::Ebr;
+            logical.index = logicalIndex++;
+            logical.tableLba = ebrLba;
+            logical.firstLba += ebrLba;
+            table.partitions.push_back(logical);
+        }
+
+        RawPartition link;
+        DecodeMbrEntry(ebr + 446 + 16, link);
+        if (!IsExtendedMbrType(link.mbrType) || link.firstLba == 0)
+            return;
+        ebrLba = extendedLba + link.firstLba;
+    }
+    AddPartitionWarning(table, "EBR chain exceeds 256 entries — chain truncated");
+}
+
+static void ParseMbr(ImageReader& img, RawPartitionTable& table)
+{
+    std::vector<BYTE> copy;
+    const BYTE* mbr = img.span(0, 512, copy);
+    if (!mbr)
+    {
+        AddPartitionWarning(table, "Image is smaller than one sector");
+        return;
+    }
+
+    table.mbrSignatureValid = mbr[510] == 0x55 && mbr[511] == 0xAA;
+    table.mbrDiskSignature = LoadLE32(mbr + 440);
+    table.mbrBootCodeEmpty = std::all_of(mbr, mbr + 446, [](BYTE b) { return b == 0; });
+    if (!table.mbrSignatureValid)
+    {
+        AddPartitionWarning(table, "Sector 0 has no 55 AA signature — no MBR present");
+        return;
+    }
+
+    for (DWORD i = 0; i < 4; ++i)
+    {
+        RawPartition p;
+        DecodeMbrEntry(mbr + 446 + i * 16, p);
+        if (p.mbrType == 0 || p.sectorCount == 0)
+            continue;
+        if (p.mbrStatus != 0x00 && p.mbrStatus != 0x80)
+            AddPartitionWarning(table, "MBR slot %lu has invalid status byte 0x%02X", i + 1, p.mbrStatus);
+
+        p.source = RawPartitionSource::Mbr;
+        p.index = i + 1;
+        table.partitions.push_back(p);
+
+        if (p.mbrType == 0xEE)
+            table.protectiveMbr = true;
+        else if (IsExtendedMbrType(p.mbrType))
+            WalkEbrChain(img, table, p.firstLba);
+    }
+}
+
+static void ParseGptHeader(ImageReader& img, RawPartitionTable& table,
+    ULONGLONG lba, RawPartitionSource source, GptHeaderInfo& hdr)
+{
+    const DWORD ss = table.sectorSize;
+    hdr = GptHeaderInfo();
+    hdr.headerLba = lba;
+
+    std::vector<BYTE> headerCopy;
+    const BYTE* h = img.span(lba * ss, ss, headerCopy);
+    if (!h || memcmp(h, "EFI PART", 8) != 0)
+        return;
+    hdr.present = true;
+
+    hdr.revision = LoadLE32(h + 8);
+    hdr.headerSize = LoadLE32(h + 12);
+    if (hdr.headerSize < 92 || hdr.headerSize > ss)
+    {
+        AddPartitionWarning(table, "%s header at LBA %llu has invalid size %lu",
+            RawPartitionSourceName(source), lba, hdr.headerSize);
+        return;
+    }
+
+    // The header CRC covers headerSize bytes with the CRC field itself zeroed.
+    std::vector<BYTE> copy(h, h + hdr.headerSize);
+    memset(copy.data() + 16, 0, 4);
+    hdr.headerCrcValid = Crc32(copy.data(), copy.size()) == LoadLE32(h + 16);
+
+    hdr.myLba = LoadLE64(h + 24);
+    hdr.alternateLba = LoadLE64(h + 32);
+    hdr.firstUsableLba = LoadLE64(h + 40);
+    hdr.lastUsableLba = LoadLE64(h + 48);
+    memcpy(&hdr.diskId, h + 56, sizeof(GUID));
+    hdr.entriesLba = LoadLE64(h + 72);
+    hdr.entryCount = LoadLE32(h + 80);
+    hdr.entrySize = LoadLE32(h + 84);
+    hdr.entriesCrc = LoadLE32(h + 88);
+
+    if (hdr.myLba != lba)
+        AddPartitionWarning(table, "%s header at LBA %llu claims to live at LBA %llu",
+            RawPartitionSourceName(source), lba, hdr.myLba);
+    if (!hdr.headerCrcValid)
+        AddPartitionWarning(table, "%s header CRC32 mismatch", RawPartitionSourceName(source));
+
+    if (hdr.entrySize < 128 || (hdr.entrySize % 8) != 0 || hdr.entryCount == 0 || hdr.entryCount > 16384)
+    {
+        AddPartitionWarning(table, "%s header has implausible entry array (%lu x %lu bytes)",
+            RawPartitionSourceName(source), hdr.entryCount, hdr.entrySize);
+        return;
+    }
+
+    const ULONGLONG arrayBytes = static_cast<ULONGLONG>(hdr.entryCount) * hdr.entrySize;
+    std::vector<BYTE> entriesCopy;
+    const BYTE* entries = img.span(hdr.entriesLba * ss, arrayBytes, entriesCopy);
+    if (!entries)
+    {
+        AddPartitionWarning(table, "%s entry array at LBA %llu lies beyond the end of the image",
+            RawPartitionSourceName(source), hdr.entriesLba);
+        return;
+    }
+    hdr.computedEntriesCrc = Crc32(entries, static_cast<size_t>(arrayBytes));
+    hdr.entriesCrcValid = hdr.computedEntriesCrc == hdr.entriesCrc;
+    if (!hdr.entriesCrcValid)
+        AddPartitionWarning(table, "%s partition entry array CRC32 mismatch", RawPartitionSourceName(source));
+
+    static const GUID zeroGuid = {};
+    for (DWORD i = 0; i < hdr.entryCount; ++i)
+    {
+        const BYTE* e = entries + static_cast<size_t>(i) * hdr.entrySize;
+        RawPartition p;
+        memcpy(&p.gptType, e, sizeof(GUID));
+        if (memcmp(&p.gptType, &zeroGuid, sizeof(GUID)) == 0)
+            continue;
+
+        p.source = source;
+        p.index = i + 1;
+        p.tableLba = hdr.entriesLba + (static_cast<ULONGLONG>(i) * hdr.entrySize) / ss;
+        memcpy(&p.gptId, e + 16, sizeof(GUID));
+        p.firstLba = LoadLE64(e + 32);
+        const ULONGLONG lastLba = LoadLE64(e + 40);
+        p.sectorCount = lastLba >= p.firstLba ? lastLba - p.firstLba + 1 : 0;
+        p.gptAttributes = LoadLE64(e + 48);
+        for (int c = 0; c < 36; ++c)
+        {
+            const WORD ch = LoadLE16(e + 56 + c * 2);
+            if (ch == 0)
+                break;
+            p.gptName.push_back(static_cast<wchar_t>(ch));
+        }
+        if (p.sectorCount == 0)
+            AddPartitionWarning(table, "%s entry %lu ends before it starts", RawPartitionSourceName(source), i + 1);
+        table.partitions.push_back(p);
+    }
+}
+
+static void ParseGpt(ImageReader& img, RawPartitionTable& table)
+{
+    // GPT on 4Kn media keeps its header at byte 4096 instead of 512.
+    for (DWORD ss : { 512u, 4096u })
+    {
+        BYTE h[8];
+        if (img.read(ss, h, sizeof(h)) == sizeof(h) && memcmp(h, "EFI PART", 8) == 0)
+        {
+            table.sectorSize = ss;
+            break;
+        }
+    }
+    table.imageSectors = img.size() / table.sectorSize;
+    if (table.imageSectors < 3)
+        return;
+
+    ParseGptHeader(img, table, 1, RawPartitionSource::GptPrimary, table.gptPrimary);
+
+    // Prefer the location the primary points at, but fall back to the last
+    // sector so a backup survives a wiped primary (and vice versa).
+    ULONGLONG backupLba = table.imageSectors - 1;
+    if (table.gptPrimary.headerCrcValid && table.gptPrimary.alternateLba < table.imageSectors)
+        backupLba = table.gptPrimary.alternateLba;
+    ParseGptHeader(img, table, backupLba, RawPartitionSource::GptBackup, table.gptBackup);
+    if (!table.gptBackup.present && backupLba != table.imageSectors - 1)
+        ParseGptHeader(img, table, table.imageSectors - 1, RawPartitionSource::GptBackup, table.gptBackup);
+
+    if (table.gptPrimary.present && table.gptBackup.present)
+    {
+        const GptHeaderInfo& a = table.gptPrimary;
+        const GptHeaderInfo& b = table.gptBackup;
+        table.gptCopiesMatch = a.computedEntriesCrc == b.computedEntriesCrc
+            && memcmp(&a.diskId, &b.diskId, sizeof(GUID)) == 0
+            && a.firstUsableLba == b.firstUsableLba && a.lastUsableLba == b.lastUsableLba;
+        if (!table.gptCopiesMatch)
+            AddPartitionWarning(table, "Primary and backup GPT disagree (disk GUID, usable range or entry array)");
+
+        // Identical copies would only list every entry twice.
+        if (table.gptCopiesMatch)
+        {
+            table.partitions.erase(std::remove_if(table.partitions.begin(), table.partitions.end(),
+                [](const RawPartition& p) { return p.source == RawPartitionSource::GptBackup; }),
+                table.partitions.end());
+        }
+    }
+    else if (table.gptPrimary.present != table.gptBackup.present)
+    {
+        AddPartitionWarning(table, "Only the %s GPT header is present",
+            table.gptPrimary.present ? "primary" : "backup");
+    }
+
+    if ((table.gptPrimary.present || table.gptBackup.present) && !table.protectiveMbr)
+        AddPartitionWarning(table, "GPT header found but the MBR has no 0xEE protective entry — hybrid or stale GPT");
+    if (table.protectiveMbr && !table.gptPrimary.present && !table.gptBackup.present)
+        AddPartitionWarning(table, "Protective MBR present but neither GPT header was found");
+}
+
+// Marks each boot sector in table.bootSectors (sorted by offset) as a backup
+// copy of another hit and/or the start of a current MBR/GPT partition.
+static void ClassifyBootSectors(RawPartitionTable& table)
+{
+    for (auto& hit : table.bootSectors)
+    {
+        const ULONGLONG bps = hit.info.bytesPerSector;
+        for (const auto& other : table.bootSectors)
+        {
+            if (other.info.kind == hit.info.kind && other.info.backupSector != 0
+                && other.offset + other.info.backupSector * bps == hit.offset)
+            {
+                hit.isBackupCopy = true;
+            }
+        }
+        for (const auto& part : table.partitions)
+        {
+            if (part.firstLba * table.sectorSize == hit.offset)
+                hit.matchesCurrentTable = true;
+        }
+    }
+}
+
+// Hunts for volume boot records that no longer belong to any partition — for
+// instance the FAT32/exFAT layout written by a camera before a phone reformatted
+// the card. Every sector in the first scanLimitBytes is checked (formatters
+// place volumes at 63, 2048, 8192 or 32768 sectors), and beyond that every
+// 1 MiB boundary plus the matching backup-VBR slots.
+static void ScanStaleBootSectors(ImageReader& img, RawPartitionTable& table, ULONGLONG scanLimitBytes)
+{
+    const ULONGLONG step = 512;
+    const ULONGLONG denseEnd = std::min<ULONGLONG>(scanLimitBytes, img.size()) / step;
+    const ULONGLONG mib = 1024 * 1024;
+    const ULONGLONG denseBytes = denseEnd * step;
+    const ULONGLONG sparseCount = img.size() > denseBytes ? (img.size() - denseBytes) / mib + 1 : 0;
+
+    std::mutex hitsLock;
+    ParallelForRanges(denseEnd + sparseCount, [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+        std::vector<BootSectorHit> local;
+        auto probe = [&](ULONGLONG offset) {
+            BYTE s[512];
+            BootSectorHit hit;
+            if (img.read(offset, s, sizeof(s)) == sizeof(s) && ParseBootSector(s, hit.info))
+            {
+                hit.offset = offset;
+                local.push_back(hit);
+            }
+        };
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            if (i < denseEnd)
+            {
+                if ((i - begin) % 2048 == 0)
+                    img.prefetch((i + 2048) * step, 2048 * step);
+                probe(i * step);
+                continue;
+            }
+            const ULONGLONG base = denseBytes + (i - denseEnd) * mib;
+            probe(base);
+            probe(base + 6 * 512);    // FAT32 backup boot sector
+            probe(base + 12 * 512);   // exFAT backup boot region
+        }
+        std::lock_guard<std::mutex> guard(hitsLock);
+        table.bootSectors.insert(table.bootSectors.end(), local.begin(), local.end());
+    });
+
+    std::sort(table.bootSectors.begin(), table.bootSectors.end(),
+        [](const BootSectorHit& a, const BootSectorHit& b) { return a.offset < b.offset; });
+    table.bootSectors.erase(std::unique(table.bootSectors.begin(), table.bootSectors.end(),
+        [](const BootSectorHit& a, const BootSectorHit& b) { return a.offset == b.offset; }),
+        table.bootSectors.end());
+    ClassifyBootSectors(table);
+}
+
+// MBR/EBR/GPT structures and their consistency checks, without the boot
+// sector hunt (the case report takes boot sectors from the streaming scan).
+static void ParsePartitionStructures(ImageReader& img, RawPartitionTable& table)
+{
+    ParseMbr(img, table);
+    ParseGpt(img, table);
+
+    for (const auto& p : table.partitions)
+    {
+        if (p.mbrType == 0xEE || IsExtendedMbrType(p.mbrType))
+            continue;
+        if ((p.firstLba + p.sectorCount) > table.imageSectors)
+            AddPartitionWarning(table, "%s partition %lu extends past the end of the image (%llu > %llu sectors)",
+                RawPartitionSourceName(p.source), p.index, p.firstLba + p.sectorCount, table.imageSectors);
+    }
+}
+
+static void ParseRawPartitionTable(ImageReader& img, RawPartitionTable& table, ULONGLONG scanLimitBytes)
+{
+    ParsePartitionStructures(img, table);
+    ScanStaleBootSectors(img, table, scanLimitBytes);
+}
+
+static void FormatChs(const BYTE chs[3], char* buf, size_t bufLen)
+{
+    const DWORD head = chs[0];
+    const DWORD sector = chs[1] & 0x3F;
+    const DWORD cylinder = ((chs[1] & 0xC0u) << 2) | chs[2];
+    sprintf_s(buf, bufLen, "%lu/%lu/%lu", cylinder, head, sector);
+}
+
+static void PrintRawPartitionTable(const RawPartitionTable& table)
+{
+    printf("\n  --- Protective / Legacy MBR ---\n");
+    printf("  Signature 55 AA:    %s\n", table.mbrSignatureValid ? "Present" : "Missing");
+    printf("  Disk Signature:     0x%08lX\n", table.mbrDiskSignature);
+    printf("  Boot Code:          %s\n", table.mbrBootCodeEmpty ? "All zeros" : "Present");
+    printf("  Protective (0xEE):  %s\n", table.protectiveMbr ? "Yes" : "No");
+    if (!table.ebrChain.empty())
+    {
+        printf("  EBR Chain:          ");
+        for (size_t i = 0; i < table.ebrChain.size(); ++i)
+            printf("%s%llu", i ? " -> " : "", table.ebrChain[i]);
+        printf("\n");
+    }
+
+    const GptHeaderInfo* headers[2] = { &table.gptPrimary, &table.gptBackup };
+    const char* headerNames[2] = { "Primary GPT Header", "Backup GPT Header" };
+    for (int h = 0; h < 2; ++h)
+    {
+        const GptHeaderInfo& g = *headers[h];
+        printf("\n  --- %s (LBA %llu) ---\n", headerNames[h], g.headerLba);
+        if (!g.present)
+        {
+            printf("  (No \"EFI PART\" signature)\n");
+            continue;
+        }
+        char guidBuf[64];
+        FormatGUID(g.diskId, guidBuf, sizeof(guidBuf));
+        printf("  Revision:           %lu.%lu\n", g.revision >> 16, g.revision & 0xFFFF);
+        printf("  Header CRC32:       %s\n", g.headerCrcValid ? "Valid" : "INVALID");
+        printf("  Entries CRC32:      %s (0x%08lX)\n", g.entriesCrcValid ? "Valid" : "INVALID", g.entriesCrc);
+        printf("  My / Alternate LBA: %llu / %llu\n", g.myLba, g.alternateLba);
+        printf("  Usable LBAs:        %llu - %llu\n", g.firstUsableLba, g.lastUsableLba);
+        printf("  Disk GUID:          %s\n", guidBuf);
+        printf("  Entry Array:        LBA %llu, %lu x %lu bytes\n", g.entriesLba, g.entryCount, g.entrySize);
+    }
+    if (table.gptPrimary.present && table.gptBackup.present)
+        printf("  Primary == Backup:  %s\n", table.gptCopiesMatch ? "Yes" : "NO");
+
+    printf("\n  --- Partition Entries (sector size %lu) ---\n", table.sectorSize);
+    if (table.partitions.empty())
+        printf("  (No partition entries)\n");
+    for (const auto& p : table.partitions)
+    {
+        char offsetBuf[128], sizeBuf[128];
+        FormatBytes(static_cast<LONGLONG>(p.firstLba * table.sectorSize), offsetBuf, sizeof(offsetBuf));
+        FormatBytes(static_cast<LONGLONG>(p.sectorCount * table.sectorSize), sizeBuf, sizeof(sizeBuf));
+
+        printf("\n  %s #%lu (table at LBA %llu):\n", RawPartitionSourceName(p.source), p.index, p.tableLba);
+        printf("    Start LBA:        %llu (%s)\n", p.firstLba, offsetBuf);
+        printf("    Sectors:          %llu (%s)\n", p.sectorCount, sizeBuf);
+        if (p.source == RawPartitionSource::Mbr || p.source == RawPartitionSource::Ebr)
+        {
+            char chsStart[32], chsEnd[32];
+            FormatChs(p.chsStart, chsStart, sizeof(chsStart));
+            FormatChs(p.chsEnd, chsEnd, sizeof(chsEnd));
+            printf("    MBR Type:         0x%02X (%s)\n", p.mbrType, MbrPartitionTypeName(p.mbrType));
+            printf("    Boot Indicator:   %s (0x%02X)\n", p.mbrStatus == 0x80 ? "Active" : "Inactive", p.mbrStatus);
+            printf("    CHS Start / End:  %s / %s\n", chsStart, chsEnd);
+        }
+        else
+        {
+            char guidBuf[64];
+            FormatGUID(p.gptType, guidBuf, sizeof(guidBuf));
+            printf("    GPT Type:         %s\n", guidBuf);
+            FormatGUID(p.gptId, guidBuf, sizeof(guidBuf));
+            printf("    GPT Partition ID: %s\n", guidBuf);
+            printf("    Attributes:       0x%016llX\n", p.gptAttributes);
+            if (!p.gptName.empty())
+            {
+                std::string narrow(p.gptName.begin(), p.gptName.end());
+                printf("    GPT Name:         \"%s\"\n", narrow.c_str());
+            }
+        }
+    }
+
+    printf("\n  --- Boot Sectors Found by Signature Scan ---\n");
+    if (table.bootSectors.empty())
+        printf("  (None)\n");
+    for (const auto& hit : table.bootSectors)
+    {
+        char sizeBuf[128];
+        FormatBytes(static_cast<LONGLONG>(hit.info.volumeSectors * hit.info.bytesPerSector), sizeBuf, sizeof(sizeBuf));
+        const char* status = hit.matchesCurrentTable ? "current"
+            : hit.isBackupCopy ? "backup copy"
+            : "STALE (not referenced by any table)";
+        printf("  0x%012llX (LBA %llu): %-5s  %s, cluster %lu B, serial %04lX-%04lX",
+            hit.offset, hit.offset / 512, BootSectorKindName(hit.info.kind), sizeBuf,
+            hit.info.bytesPerSector * hit.info.sectorsPerCluster,
+            (hit.info.serialNumber >> 16) & 0xFFFF, hit.info.serialNumber & 0xFFFF);
+        if (hit.info.label[0])
+            printf(", label \"%s\"", hit.info.label);
+        printf("\n    partition offset field %llu sectors -> %s\n", hit.info.partitionOffsetSectors, status);
+    }
+
+    printf("\n  --- Consistency Warnings ---\n");
+    if (table.warnings.empty())
+        printf("  (None)\n");
+    for (const auto& w : table.warnings)
+        printf("  ! %s\n", w.c_str());
+}
+
+static int CmdPartitions(int argc, wchar_t* argv[])
+{
+    if (argc < 1)
+        FatalErrorMsg("Usage: partitions <image> [scan-limit-MiB]");
+
+    ULONGLONG scanLimitMiB = 64;
+    if (argc >= 2)
+        scanLimitMiB = _wcstoui64(argv[1], nullptr, 10);
+
+    std::unique_ptr<ImageReader> img = ImageReader::Open(argv[0]);
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(img->size()), sizeBuf, sizeof(sizeBuf));
+    printf("Image:              %ls\n", argv[0]);
+    printf("Image Size:         %s\n", sizeBuf);
+
+    RawPartitionTable table;
+    ParseRawPartitionTable(*img, table, scanLimitMiB * 1024 * 1024);
+    PrintRawPartitionTable(table);
+    return 0;
+}
+
+// ============================================================
+// FAT12/16/32 volume parser (zero-copy when the image is mapped)
+// ============================================================
+
+struct FatVolume {
+    ImageReader* img = nullptr;
+    ULONGLONG volumeOffset = 0;        // byte offset of the VBR in the image
+    BootSectorInfo boot;
+    DWORD bytesPerSector = 0;
+    DWORD clusterSize = 0;
+    DWORD reservedSectors = 0;
+    DWORD numFats = 0;
+    DWORD fatSizeSectors = 0;
+    DWORD rootEntryCount = 0;          // FAT12/16 fixed root directory
+    DWORD rootCluster = 0;             // FAT32 root directory chain
+    DWORD clusterCount = 0;            // data clusters, numbered 2 .. clusterCount+1
+    ULONGLONG fatOffset = 0;           // absolute byte offset of FAT #1
+    ULONGLONG rootDirOffset = 0;       // absolute byte offset of the FAT12/16 root
+    ULONGLONG dataOffset = 0;          // absolute byte offset of cluster 2
+    const BYTE* fat = nullptr;
+    std::shared_ptr<std::vector<BYTE>> fatCopy;   // backs 'fat' when the image is not mapped
+};
+
+static bool OpenFatVolume(ImageReader& img, ULONGLONG offset, FatVolume& vol)
+{
+    BYTE s[512];
+    if (img.read(offset, s, sizeof(s)) != sizeof(s) || !ParseBootSector(s, vol.boot))
+        return false;
+    if (vol.boot.kind != BootSectorKind::Fat12 && vol.boot.kind != BootSectorKind::Fat16
+        && vol.boot.kind != BootSectorKind::Fat32)
+        return false;
+
+    vol.img = &img;
+    vol.volumeOffset = offset;
+    vol.bytesPerSector = vol.boot.bytesPerSector;
+    vol.clusterSize = vol.boot.bytesPerSector * vol.boot.sectorsPerCluster;
+    vol.reservedSectors = LoadLE16(s + 0x0E);
+    vol.numFats = s[0x10];
+    vol.rootEntryCount = LoadLE16(s + 0x11);
+    vol.fatSizeSectors = LoadLE16(s + 0x16) ? LoadLE16(s + 0x16) : LoadLE32(s + 0x24);
+    vol.rootCluster = vol.boot.kind == BootSectorKind::Fat32 ? LoadLE32(s + 0x2C) : 0;
+
+    const ULONGLONG bps = vol.bytesPerSector;
+    const DWORD rootDirSectors = (vol.rootEntryCount * 32 + vol.bytesPerSector - 1) / vol.bytesPerSector;
+    const ULONGLONG firstDataSector = vol.reservedSectors
+        + static_cast<ULONGLONG>(vol.numFats) * vol.fatSizeSectors + rootDirSectors;
+    vol.fatOffset = offset + vol.reservedSectors * bps;
+    vol.rootDirOffset = vol.fatOffset + static_cast<ULONGLONG>(vol.numFats) * vol.fatSizeSectors * bps;
+    vol.dataOffset = offset + firstDataSector * bps;
+    vol.clusterCount = static_cast<DWORD>((vol.boot.volumeSectors - firstDataSector) / vol.boot.sectorsPerCluster);
+
+    vol.fatCopy = std::make_shared<std::vector<BYTE>>();
+    vol.fat = img.span(vol.fatOffset, static_cast<ULONGLONG>(vol.fatSizeSectors) * bps, *vol.fatCopy);
+    if (!vol.fat)
+        return false;
+
+    // A truncated image may end inside the data region; clamp so cluster
+    // lookups never leave the image.
+    if (vol.dataOffset >= img.size())
+        vol.clusterCount = 0;
+    else
+        vol.clusterCount = static_cast<DWORD>(std::min<ULONGLONG>(vol.clusterCount,
+            (img.size() - vol.dataOffset) / vol.clusterSize));
+
+    // The FAT itself bounds the addressable clusters as well.
+    const ULONGLONG fatBytes = static_cast<ULONGLONG>(vol.fatSizeSectors) * bps;
+    const ULONGLONG fatEntries = vol.boot.kind == BootSectorKind::Fat12 ? fatBytes * 2 / 3
+        : vol.boot.kind == BootSectorKind::Fat16 ? fatBytes / 2 : fatBytes / 4;
+    if (fatEntries < static_cast<ULONGLONG>(vol.clusterCount) + 2)
+        vol.clusterCount = static_cast<DWORD>(fatEntries - 2);
+    return true;
+}
+
+static DWORD FatEntry(const FatVolume& vol, DWORD cluster)
+{
+    switch (vol.boot.kind) {
+    case BootSectorKind::Fat12: {
+        const DWORD v = LoadLE16(vol.fat + cluster + cluster / 2);
+        return (cluster & 1) ? (v >> 4) : (v & 0xFFF);
+    }
+    case BootSectorKind::Fat16:
+        return LoadLE16(vol.fat + cluster * 2);
+    default:
+        return LoadLE32(vol.fat + cluster * 4) & 0x0FFFFFFF;
+    }
+}
+
+static DWORD FatBadClusterMark(const FatVolume& vol)
+{
+    return vol.boot.kind == BootSectorKind::Fat12 ? 0xFF7
+        : vol.boot.kind == BootSectorKind::Fat16 ? 0xFFF7 : 0x0FFFFFF7;
+}
+
+static bool IsFatDataCluster(const FatVolume& vol, DWORD cluster)
+{
+    return cluster >= 2 && cluster < static_cast<ULONGLONG>(vol.clusterCount) + 2;
+}
+
+static ULONGLONG FatClusterOffset(const FatVolume& vol, DWORD cluster)
+{
+    return vol.dataOffset + static_cast<ULONGLONG>(cluster - 2) * vol.clusterSize;
+}
+
+// Appends a Unicode code point to a UTF-8 string.
+static void AppendUtf8(std::string& out, DWORD cp)
+{
+    if (cp < 0x80)
+        out.push_back(static_cast<char>(cp));
+    else if (cp < 0x800)
+    {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000)
+    {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+    else
+    {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Converts UTF-16LE code units (FAT LFN, exFAT names) to UTF-8, pairing
+// surrogates and substituting U+FFFD for unpaired halves.
+static std::string Utf16ToUtf8(const WORD* units, size_t count)
+{
+    std::string out;
+    for (size_t i = 0; i < count; ++i)
+    {
+        DWORD cp = units[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < count && units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF)
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (units[++i] - 0xDC00);
+        else if (cp >= 0xD800 && cp <= 0xDFFF)
+            cp = 0xFFFD;
+        AppendUtf8(out, cp);
+    }
+    return out;
+}
+
+static void FormatFatTimestamp(WORD date, WORD time, char* buf, size_t bufLen)
+{
+    if (date == 0)
+    {
+        sprintf_s(buf, bufLen, "----------------- ---");
+        return;
+    }
+    sprintf_s(buf, bufLen, "%04u-%02u-%02u %02u:%02u:%02u",
+        1980 + (date >> 9), (date >> 5) & 0x0F, date & 0x1F,
+        time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2);
+}
+
+struct FatFileRecord {
+    std::string path;              // UTF-8, '/'-separated
+    std::string shortName;
+    BYTE attributes = 0;
+    DWORD firstCluster = 0;
+    DWORD size = 0;
+    WORD createDate = 0, createTime = 0;
+    WORD writeDate = 0, writeTime = 0;
+    WORD accessDate = 0;
+    ULONGLONG entryOffset = 0;     // absolute image offset of the 8.3 entry
+    bool deleted = false;
+    bool lfnChecksumValid = true;
+    bool underDeletedParent = false;
+    bool orphan = false;           // reached only through the orphan-directory scan
+};
+
+struct FatScanResult {
+    std::vector<FatFileRecord> files;
+    std::vector<DWORD> orphanDirClusters;
+    DWORD freeClusters = 0;
+    DWORD usedClusters = 0;
+    DWORD badClusters = 0;
+    DWORD fatCopiesDiffer = 0;     // clusters whose FAT #1 and FAT #2 entries disagree
+};
+
+static BYTE LfnChecksum(const BYTE* shortName)
+{
+    BYTE sum = 0;
+    for (int i = 0; i < 11; ++i)
+        sum = static_cast<BYTE>(((sum & 1) << 7) + (sum >> 1) + shortName[i]);
+    return sum;
+}
+
+// First byte of the 8.3 name an LFN implies: its first character after
+// leading spaces and periods, uppercased, '_' where 8.3 names cannot hold it.
+// 0 for characters outside ASCII, whose byte depends on the OEM code page.
+static BYTE LfnImpliedFirstChar(const WORD* lfn, size_t n)
+{
+    size_t i = 0;
+    while (i < n && (lfn[i] == ' ' || lfn[i] == '.'))
+        ++i;
+    if (i == n || lfn[i] >= 0x80)
+        return 0;
+    const char c = static_cast<char>(lfn[i]);
+    if (strchr("+,;=[]", c))
+        return '_';
+    return static_cast<BYTE>(toupper(static_cast<unsigned char>(c)));
+}
+
+static std::string FatShortName(const BYTE* e, bool deleted)
+{
+    std::string name;
+    for (int i = 0; i < 8 && e[i] != ' '; ++i)
+    {
+        char c = static_cast<char>(e[i]);
+        if (i == 0 && deleted) c = '?';
+        else if (i == 0 && e[0] == 0x05) c = static_cast<char>(0xE5);
+        if (e[12] & 0x08) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        name.push_back(c);
+    }
+    if (e[8] != ' ')
+    {
+        name.push_back('.');
+        for (int i = 8; i < 11 && e[i] != ' '; ++i)
+            name.push_back(static_cast<char>((e[12] & 0x10) ? tolower(e[i]) : e[i]));
+    }
+    return name;
+}
+
+// A cluster is treated as the head of a directory if it starts with the
+// mandatory "." and ".." entries, both marked as directories.
+static bool LooksLikeFatDirectoryHead(const BYTE* c)
+{
+    return memcmp(c, ".          ", 11) == 0 && (c[11] & 0x10)
+        && memcmp(c + 32, "..         ", 11) == 0 && (c[32 + 11] & 0x10);
+}
+
+static bool IsFatDirectoryHeadCluster(const FatVolume& vol, DWORD cluster)
+{
+    BYTE head[64];
+    return vol.img->read(FatClusterOffset(vol, cluster), head, sizeof(head)) == sizeof(head)
+        && LooksLikeFatDirectoryHead(head);
+}
+
+struct FatDirTask {
+    DWORD cluster = 0;             // 0 = FAT12/16 fixed root
+    std::string path;
+    bool followChain = true;       // false for deleted dirs: FAT chain is gone, read one cluster
+    bool deletedParent = false;
+    bool orphan = false;
+};
+
+// Parses one directory and returns its records; subdirectories are appended
+// to 'children' so the caller can schedule them on other workers.
+static void ParseFatDirectory(const FatVolume& vol, const FatDirTask& task,
+    std::vector<FatFileRecord>& out, std::vector<FatDirTask>& children)
+{
+    std::vector<ULONGLONG> regions;  // absolute offsets
+    if (task.cluster == 0)
+        regions.push_back(vol.rootDirOffset);
+    else
+    {
+        DWORD c = task.cluster;
+        for (DWORD hops = 0; IsFatDataCluster(vol, c) && hops <= vol.clusterCount; ++hops)
+        {
+            regions.push_back(FatClusterOffset(vol, c));
+            if (!task.followChain)
+                break;
+            c = FatEntry(vol, c);
+        }
+    }
+
+    std::vector<WORD> lfn;
+    BYTE lfnSum = 0;
+    bool lfnValid = false;
+    const size_t regionLen = task.cluster == 0 ? static_cast<size_t>(vol.rootEntryCount) * 32 : vol.clusterSize;
+    std::vector<BYTE> copy;
+    for (size_t r = 0; r < regions.size(); ++r)
+    {
+        const BYTE* region = vol.img->span(regions[r], regionLen, copy);
+        if (!region)
+            return;
+        for (size_t off = 0; off + 32 <= regionLen; off += 32)
+        {
+            const BYTE* e = region + off;
+            if (e[0] == 0x00)
+                return;  // end-of-directory marker
+
+            const bool deleted = e[0] == 0xE5;
+            const BYTE attr = e[11];
+            if ((attr & 0x3F) == 0x0F)
+            {
+                // LFN fragment: 13 UTF-16 units spread over three fields. Fragments
+                // precede the 8.3 entry in reverse order, so prepend each one.
+                WORD part[13];
+                for (int i = 0; i < 5; ++i) part[i] = LoadLE16(e + 1 + i * 2);
+                for (int i = 0; i < 6; ++i) part[5 + i] = LoadLE16(e + 14 + i * 2);
+                for (int i = 0; i < 2; ++i) part[11 + i] = LoadLE16(e + 28 + i * 2);
+                if (!deleted && (e[0] & 0x40))
+                    lfn.clear();
+                if (lfn.empty())
+                {
+                    lfnSum = e[13];
+                    lfnValid = true;
+                }
+                else if (e[13] != lfnSum)
+                    lfnValid = false;
+                lfn.insert(lfn.begin(), part, part + 13);
+                continue;
+            }
+
+            if ((attr & 0x08) || (e[0] == '.' && (attr & 0x10)))
+            {
+                lfn.clear();  // volume label or dot entry
+                continue;
+            }
+
+            FatFileRecord rec;
+            rec.shortName = FatShortName(e, deleted);
+            rec.attributes = attr;
+            rec.deleted = deleted;
+            rec.underDeletedParent = task.deletedParent;
+            rec.orphan = task.orphan;
+            rec.firstCluster = (vol.boot.kind == BootSectorKind::Fat32 ? (static_cast<DWORD>(LoadLE16(e + 20)) << 16) : 0)
+                | LoadLE16(e + 26);
+            rec.size = LoadLE32(e + 28);
+            rec.createTime = LoadLE16(e + 14);
+            rec.createDate = LoadLE16(e + 16);
+            rec.accessDate = LoadLE16(e + 18);
+            rec.writeTime = LoadLE16(e + 22);
+            rec.writeDate = LoadLE16(e + 24);
+            rec.entryOffset = regions[r] + off;
+
+            std::string name = rec.shortName;
+            if (!lfn.empty())
+            {
+                size_t n = 0;
+                while (n < lfn.size() && lfn[n] != 0x0000 && lfn[n] != 0xFFFF)
+                    ++n;
+                // For deleted entries the first 8.3 byte is lost. Only the one
+                // the LFN implies is tried: with an 8-bit checksum, trying them
+                // all would let almost any stray LFN pass.
+                bool sumOk = lfnValid && LfnChecksum(e) == lfnSum;
+                if (!sumOk && deleted && lfnValid)
+                {
+                    BYTE probe[11];
+                    memcpy(probe, e, 11);
+                    probe[0] = LfnImpliedFirstChar(lfn.data(), n);
+                    sumOk = probe[0] != 0 && LfnChecksum(probe) == lfnSum;
+                }
+                rec.lfnChecksumValid = sumOk;
+                if (sumOk)
+                    name = Utf16ToUtf8(lfn.data(), n);
+            }
+            lfn.clear();
+
+            rec.path = task.path + "/" + name;
+            if ((attr & 0x10) && IsFatDataCluster(vol, rec.firstCluster))
+            {
+                FatDirTask child;
+                child.cluster = rec.firstCluster;
+                child.path = rec.path;
+                child.followChain = !deleted && !task.deletedParent;
+                child.deletedParent = deleted || task.deletedParent;
+                child.orphan = task.orphan;
+                // A deleted directory's cluster may have been reused; only descend
+                // if it still carries the "." / ".." header.
+                if (child.followChain || IsFatDirectoryHeadCluster(vol, child.cluster))
+                    children.push_back(child);
+            }
+            out.push_back(std::move(rec));
+        }
+    }
+}
+
+// Walks the directory tree with a shared work queue so independent
+// subdirectories are parsed concurrently, then scans every cluster in parallel
+// for directory headers that the tree walk never reached (orphaned directories
+// whose parent entry was overwritten).
+static void ScanFatVolume(const FatVolume& vol, FatScanResult& result)
+{
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<FatDirTask> queue;
+    std::vector<BYTE> visited(static_cast<size_t>(vol.clusterCount) + 2, 0);
+    DWORD active = 0;
+
+    auto enqueue = [&](const FatDirTask& t) {
+        if (t.cluster != 0)
+        {
+            if (visited[t.cluster])
+                return;
+            visited[t.cluster] = 1;
+        }
+        queue.push_back(t);
+    };
+
+    auto runQueue = [&]() {
+        std::vector<std::thread> threads;
+        for (DWORD w = 0; w < WorkerThreadCount(); ++w)
+        {
+            threads.emplace_back([&]() {
+                std::vector<FatFileRecord> local;
+                for (;;)
+                {
+                    FatDirTask task;
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        wake.wait(guard, [&]() { return !queue.empty() || active == 0; });
+                        if (queue.empty())
+                            break;
+                        task = queue.back();
+                        queue.pop_back();
+                        ++active;
+                    }
+
+                    std::vector<FatDirTask> children;
+                    ParseFatDirectory(vol, task, local, children);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    for (const auto& c : children)
+                        enqueue(c);
+                    --active;
+                    wake.notify_all();
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                result.files.insert(result.files.end(),
+                    std::make_move_iterator(local.begin()), std::make_move_iterator(local.end()));
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+    };
+
+    FatDirTask root;
+    root.cluster = vol.boot.kind == BootSectorKind::Fat32 ? vol.rootCluster : 0;
+    if (root.cluster == 0 || IsFatDataCluster(vol, root.cluster))
+        enqueue(root);
+    runQueue();
+
+    // FAT statistics and orphan-directory detection in one parallel sweep.
+    const DWORD bad = FatBadClusterMark(vol);
+    const ULONGLONG fatBytes = static_cast<ULONGLONG>(vol.fatSizeSectors) * vol.bytesPerSector;
+    std::vector<BYTE> fat2Copy;
+    const BYTE* fat2 = vol.numFats > 1 ? vol.img->span(vol.fatOffset + fatBytes, fatBytes, fat2Copy) : nullptr;
+    FatVolume mirror = vol;
+    mirror.fat = fat2;
+
+    std::mutex statLock;
+    ParallelForRanges(vol.clusterCount, [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+        DWORD freeCount = 0, usedCount = 0, badCount = 0, differ = 0;
+        std::vector<DWORD> orphans;
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            const DWORD c = static_cast<DWORD>(i + 2);
+            if ((i - begin) % 256 == 0)
+                vol.img->prefetch(FatClusterOffset(vol, c + 256), 256ULL * vol.clusterSize);
+            const DWORD v = FatEntry(vol, c);
+            if (v == 0) ++freeCount;
+            else if (v == bad) ++badCount;
+            else ++usedCount;
+            if (fat2 && FatEntry(mirror, c) != v)
+                ++differ;
+            if (!visited[c] && IsFatDirectoryHeadCluster(vol, c))
+                orphans.push_back(c);
+        }
+        std::lock_guard<std::mutex> guard(statLock);
+        result.freeClusters += freeCount;
+        result.usedClusters += usedCount;
+        result.badClusters += badCount;
+        result.fatCopiesDiffer += differ;
+        result.orphanDirClusters.insert(result.orphanDirClusters.end(), orphans.begin(), orphans.end());
+    });
+
+    // Orphans nested inside other orphans are reached by the walk below and
+    // marked visited, so each is reported under its outermost surviving parent.
+    std::sort(result.orphanDirClusters.begin(), result.orphanDirClusters.end());
+    for (DWORD c : result.orphanDirClusters)
+    {
+        if (visited[c])
+            continue;
+        FatDirTask t;
+        t.cluster = c;
+        char name[64];
+        sprintf_s(name, "/<orphan@%lu>", c);
+        t.path = name;
+        t.orphan = true;
+        t.followChain = FatEntry(vol, c) != 0;
+        t.deletedParent = !t.followChain;
+        enqueue(t);
+    }
+    runQueue();
+
+    std::sort(result.files.begin(), result.files.end(),
+        [](const FatFileRecord& a, const FatFileRecord& b) { return a.path < b.path; });
+}
+
+static void PrintFatScan(const FatVolume& vol, const FatScanResult& result)
+{
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(vol.boot.volumeSectors * vol.bytesPerSector), sizeBuf, sizeof(sizeBuf));
+
+    printf("\n  --- %s Volume at 0x%llX ---\n", BootSectorKindName(vol.boot.kind), vol.volumeOffset);
+    printf("  Volume Size:        %s\n", sizeBuf);
+    printf("  Label / Serial:     \"%s\" / %04lX-%04lX\n", vol.boot.label,
+        (vol.boot.serialNumber >> 16) & 0xFFFF, vol.boot.serialNumber & 0xFFFF);
+    printf("  Bytes/Sector:       %lu\n", vol.bytesPerSector);
+    printf("  Cluster Size:       %lu bytes\n", vol.clusterSize);
+    printf("  Reserved Sectors:   %lu\n", vol.reservedSectors);
+    printf("  FATs:               %lu x %lu sectors at 0x%llX\n", vol.numFats, vol.fatSizeSectors, vol.fatOffset);
+    if (vol.boot.kind == BootSectorKind::Fat32)
+        printf("  Root Cluster:       %lu\n", vol.rootCluster);
+    else
+        printf("  Root Directory:     %lu entries at 0x%llX\n", vol.rootEntryCount, vol.rootDirOffset);
+    printf("  Data Region:        0x%llX, %lu clusters\n", vol.dataOffset, vol.clusterCount);
+    printf("  Clusters Used/Free/Bad: %lu / %lu / %lu\n",
+        result.usedClusters, result.freeClusters, result.badClusters);
+    if (vol.numFats > 1)
+        printf("  FAT #1 vs #2:       %lu differing entries\n", result.fatCopiesDiffer);
+    printf("  Orphan Directories: %zu\n", result.orphanDirClusters.size());
+
+    size_t deletedCount = 0;
+    for (const auto& f : result.files)
+        deletedCount += f.deleted || f.underDeletedParent ? 1 : 0;
+    printf("\n  --- Directory Entries (%zu, %zu deleted) ---\n", result.files.size(), deletedCount);
+    printf("  Flags: D=directory X=deleted P=under deleted parent O=orphan !=LFN checksum mismatch\n");
+    for (const auto& f : result.files)
+    {
+        char ts[32];
+        FormatFatTimestamp(f.writeDate, f.writeTime, ts, sizeof(ts));
+        printf("  %c%c%c%c%c %s %12lu  clu %-8lu @0x%010llX  %s\n",
+            (f.attributes & 0x10) ? 'D' : '-',
+            f.deleted ? 'X' : '-',
+            f.underDeletedParent ? 'P' : '-',
+            f.orphan ? 'O' : '-',
+            f.lfnChecksumValid ? ' ' : '!',
+            ts, f.size, f.firstCluster, f.entryOffset, f.path.c_str());
+    }
+}
+
+// Picks the first FAT volume: current partition entries first, then any
+// stale boot sector found by the signature scan.
+static bool FindFatVolume(ImageReader& img, FatVolume& vol)
+{
+    RawPartitionTable table;
+    ParseRawPartitionTable(img, table, 64ULL * 1024 * 1024);
+    for (const auto& p : table.partitions)
+    {
+        if (OpenFatVolume(img, p.firstLba * table.sectorSize, vol))
+            return true;
+    }
+    for (const auto& hit : table.bootSectors)
+    {
+        if (!hit.isBackupCopy && OpenFatVolume(img, hit.offset, vol))
+            return true;
+    }
+    return OpenFatVolume(img, 0, vol);  // superfloppy: no partition table
+}
+
+static int CmdFat(int argc, wchar_t* argv[])
+{
+    if (argc < 1)
+        FatalErrorMsg("Usage: fat <image> [volume-offset-bytes]");
+
+    std::unique_ptr<ImageReader> img = ImageReader::Open(argv[0]);
+    FatVolume vol;
+    if (argc >= 2)
+    {
+        const ULONGLONG offset = _wcstoui64(argv[1], nullptr, 0);
+        if (!OpenFatVolume(*img, offset, vol))
+        {
+            char msg[256];
+            sprintf_s(msg, "No valid FAT12/16/32 boot sector at offset 0x%llX", offset);
+            FatalErrorMsg(msg);
+        }
+    }
+    else if (!FindFatVolume(*img, vol))
+    {
+        FatalErrorMsg("No FAT12/16/32 volume found in the image.");
+    }
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    FatScanResult result;
+    ScanFatVolume(vol, result);
+
+    QueryPerformanceCounter(&now);
+    PrintFatScan(vol, result);
+    printf("\n  Scan time: %.2f seconds\n", (double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// ============================================================
+// ISO-BMFF (MP4/MOV) carver
+// ============================================================
+
+static DWORD FourCC(const char* s)
+{
+    return LoadBE32(reinterpret_cast<const BYTE*>(s));
+}
+
+static bool IsPrintableFourCC(DWORD t)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        const BYTE c = static_cast<BYTE>(t >> (i * 8));
+        if (c < 0x20 || c > 0x7E)
+            return false;
+    }
+    return true;
+}
+
+static void FormatFourCC(DWORD t, char out[5])
+{
+    for (int i = 0; i < 4; ++i)
+        out[i] = static_cast<char>(t >> (24 - i * 8));
+    out[4] = '\0';
+}
+
+struct BmffBox {
+    ULONGLONG offset = 0;          // relative to the buffer the box was read from
+    ULONGLONG size = 0;            // whole box including header
+    DWORD headerSize = 0;
+    DWORD type = 0;
+};
+
+// Reads a box header; 'end' bounds the header, not the payload (an mdat may
+// legitimately run past the end of a truncated image).
+static bool ReadBmffBox(const BYTE* base, ULONGLONG offset, ULONGLONG end, BmffBox& box)
+{
+    if (offset + 8 > end)
+        return false;
+    const BYTE* p = base + offset;
+    ULONGLONG size = LoadBE32(p);
+    box.offset = offset;
+    box.type = LoadBE32(p + 4);
+    box.headerSize = 8;
+    if (size == 1)
+    {
+        if (offset + 16 > end)
+            return false;
+        size = LoadBE64(p + 8);
+        box.headerSize = 16;
+    }
+    else if (size == 0)
+    {
+        size = end - offset;  // "extends to end of file"
+    }
+    if (size < box.headerSize || size > ~0ULL - offset || !IsPrintableFourCC(box.type))
+        return false;
+    box.size = size;
+    return true;
+}
+
+static bool FindBmffChild(const BYTE* base, ULONGLONG begin, ULONGLONG end, DWORD type, BmffBox& out)
+{
+    for (ULONGLONG off = begin; off + 8 <= end; )
+    {
+        BmffBox b;
+        if (!ReadBmffBox(base, off, end, b) || off + b.size > end)
+            return false;
+        if (b.type == type)
+        {
+            out = b;
+            return true;
+        }
+        off += b.size;
+    }
+    return false;
+}
+
+static bool IsKnownTopLevelBox(DWORD t)
+{
+    static const char* const kTypes[] = {
+        "ftyp", "moov", "mdat", "free", "skip", "wide", "udta", "uuid", "meta", "pdin", "moof", "mfra", "sidx",
+    };
+    for (const char* k : kTypes)
+    {
+        if (t == FourCC(k))
+            return true;
+    }
+    return false;
+}
+
+enum class Mp4Codec { Other, Avc, Hevc, Gpmf };
+
+struct Mp4Track {
+    DWORD handler = 0;             // 'vide', 'soun', 'meta', ...
+    DWORD sampleEntry = 0;         // first stsd entry: 'avc1', 'hvc1', 'mp4a', 'gpmd', ...
+    Mp4Codec codec = Mp4Codec::Other;
+    DWORD nalLengthSize = 4;
+    DWORD sampleCount = 0;
+    std::vector<ULONGLONG> chunkOffsets;      // file-relative, from stco/co64
+    std::vector<ULONGLONG> chunkBytes;        // total sample bytes per chunk
+    std::vector<DWORD> chunkFirstSample;      // size of the first sample of each chunk
+    std::vector<DWORD> chunkSampleCount;
+    std::vector<DWORD> sampleSizes;           // empty when every sample is fixedSampleSize
+    DWORD fixedSampleSize = 0;                // stsz sample_size, 0: per-sample sizes
+};
+
+static DWORD Mp4SampleSize(const Mp4Track& t, DWORD sample)
+{
+    return t.fixedSampleSize ? t.fixedSampleSize : t.sampleSizes[sample];
+}
+
+struct Mp4Moov {
+    std::vector<Mp4Track> tracks;
+    std::string firmware;          // GoPro udta 'FIRM'
+    bool gpmfUdta = false;         // GoPro udta 'GPMF' (camera settings)
+    ULONGLONG minChunkOffset = ~0ULL;
+    ULONGLONG maxChunkEnd = 0;
+};
+
+static bool ParseMp4Track(const BYTE* b, const BmffBox& trak, Mp4Track& t)
+{
+    const ULONGLONG trakEnd = trak.offset + trak.size;
+    BmffBox mdia, hdlr, minf, stbl, stsd, stsz, stsc, stco;
+    if (!FindBmffChild(b, trak.offset + trak.headerSize, trakEnd, FourCC("mdia"), mdia))
+        return false;
+    const ULONGLONG mdiaEnd = mdia.offset + mdia.size;
+    if (FindBmffChild(b, mdia.offset + mdia.headerSize, mdiaEnd, FourCC("hdlr"), hdlr) && hdlr.size >= hdlr.headerSize + 12)
+        t.handler = LoadBE32(b + hdlr.offset + hdlr.headerSize + 8);
+    if (!FindBmffChild(b, mdia.offset + mdia.headerSize, mdiaEnd, FourCC("minf"), minf)
+        || !FindBmffChild(b, minf.offset + minf.headerSize, minf.offset + minf.size, FourCC("stbl"), stbl))
+        return false;
+
+    const ULONGLONG stblBegin = stbl.offset + stbl.headerSize, stblEnd = stbl.offset + stbl.size;
+    if (FindBmffChild(b, stblBegin, stblEnd, FourCC("stsd"), stsd) && stsd.size >= stsd.headerSize + 16)
+    {
+        BmffBox entry;
+        if (ReadBmffBox(b, stsd.offset + stsd.headerSize + 8, stsd.offset + stsd.size, entry)
+            && entry.offset + entry.size <= stsd.offset + stsd.size)
+        {
+            t.sampleEntry = entry.type;
+            const bool avc = entry.type == FourCC("avc1") || entry.type == FourCC("avc3");
+            const bool hevc = entry.type == FourCC("hvc1") || entry.type == FourCC("hev1");
+            if (entry.type == FourCC("gpmd"))
+                t.codec = Mp4Codec::Gpmf;
+            else if (avc || hevc)
+            {
+                // VisualSampleEntry carries 78 bytes of fixed fields before its children.
+                BmffBox cfg;
+                const ULONGLONG childBegin = entry.offset + entry.headerSize + 78;
+                t.codec = avc ? Mp4Codec::Avc : Mp4Codec::Hevc;
+                if (FindBmffChild(b, childBegin, entry.offset + entry.size, FourCC(avc ? "avcC" : "hvcC"), cfg)
+                    && cfg.size >= cfg.headerSize + (avc ? 5 : 22))
+                {
+                    const BYTE* c = b + cfg.offset + cfg.headerSize;
+                    t.nalLengthSize = (c[avc ? 4 : 21] & 3) + 1;
+                }
+            }
+        }
+    }
+
+    // Chunk offsets
+    const bool have64 = !FindBmffChild(b, stblBegin, stblEnd, FourCC("stco"), stco)
+        && FindBmffChild(b, stblBegin, stblEnd, FourCC("co64"), stco);
+    if (stco.size < stco.headerSize + 8)
+        return false;
+    const BYTE* co = b + stco.offset + stco.headerSize;
+    const DWORD chunkCount = LoadBE32(co + 4);
+    const DWORD entrySize = have64 ? 8 : 4;
+    if (static_cast<ULONGLONG>(chunkCount) * entrySize > stco.size - stco.headerSize - 8)
+        return false;
+    t.chunkOffsets.resize(chunkCount);
+    for (DWORD i = 0; i < chunkCount; ++i)
+        t.chunkOffsets[i] = have64 ? LoadBE64(co + 8 + i * 8ULL) : LoadBE32(co + 8 + i * 4ULL);
+
+    // Sample sizes
+    if (!FindBmffChild(b, stblBegin, stblEnd, FourCC("stsz"), stsz) || stsz.size < stsz.headerSize + 12)
+        return false;
+    const BYTE* sz = b + stsz.offset + stsz.headerSize;
+    // A fixed size is kept as is: its sample count is not backed by a table,
+    // and a corrupt one would otherwise size a vector of up to 2^32 entries.
+    t.fixedSampleSize = LoadBE32(sz + 4);
+    t.sampleCount = LoadBE32(sz + 8);
+    if (t.fixedSampleSize == 0)
+    {
+        if (static_cast<ULONGLONG>(t.sampleCount) * 4 > stsz.size - stsz.headerSize - 12)
+            return false;
+        t.sampleSizes.resize(t.sampleCount);
+        for (DWORD i = 0; i < t.sampleCount; ++i)
+            t.sampleSizes[i] = LoadBE32(sz + 12 + i * 4ULL);
+    }
+
+    // Sample-to-chunk runs give the number of samples in each chunk.
+    if (!FindBmffChild(b, stblBegin, stblEnd, FourCC("stsc"), stsc) || stsc.size < stsc.headerSize + 8)
+        return false;
+    const BYTE* sc = b + stsc.offset + stsc.headerSize;
+    const DWORD runCount = LoadBE32(sc + 4);
+    if (runCount == 0 || static_cast<ULONGLONG>(runCount) * 12 > stsc.size - stsc.headerSize - 8)
+        return false;
+
+    t.chunkBytes.assign(chunkCount, 0);
+    t.chunkFirstSample.assign(chunkCount, 0);
+    t.chunkSampleCount.assign(chunkCount, 0);
+    DWORD sample = 0;
+    for (DWORD r = 0; r < runCount; ++r)
+    {
+        const DWORD first = LoadBE32(sc + 8 + r * 12ULL);
+        const DWORD last = r + 1 < runCount ? LoadBE32(sc + 8 + (r + 1) * 12ULL) : chunkCount + 1;
+        const DWORD perChunk = LoadBE32(sc + 8 + r * 12ULL + 4);
+        if (first == 0 || last < first)
+            return false;
+        for (DWORD c = first; c < last && c <= chunkCount && sample < t.sampleCount; ++c)
+        {
+            const DWORD n = std::min(perChunk, t.sampleCount - sample);
+            if (n == 0)
+                continue;
+            t.chunkFirstSample[c - 1] = Mp4SampleSize(t, sample);
+            if (t.fixedSampleSize)
+                t.chunkBytes[c - 1] += static_cast<ULONGLONG>(n) * t.fixedSampleSize;
+            else
+            {
+                for (DWORD s = 0; s < n; ++s)
+                    t.chunkBytes[c - 1] += t.sampleSizes[sample + s];
+            }
+            t.chunkSampleCount[c - 1] += n;
+            sample += n;
+        }
+    }
+    return true;
+}
+
+static bool ParseMp4Moov(const BYTE* b, ULONGLONG size, Mp4Moov& out)
+{
+    BmffBox moov;
+    if (!ReadBmffBox(b, 0, size, moov) || moov.type != FourCC("moov") || moov.size > size)
+        return false;
+
+    for (ULONGLONG off = moov.headerSize; off + 8 <= moov.size; )
+    {
+        BmffBox child;
+        if (!ReadBmffBox(b, off, moov.size, child) || off + child.size > moov.size)
+            return false;
+        if (child.type == FourCC("trak"))
+        {
+            Mp4Track t;
+            if (ParseMp4Track(b, child, t))
+                out.tracks.push_back(std::move(t));
+        }
+        else if (child.type == FourCC("udta"))
+        {
+            BmffBox firm, gpmf;
+            const ULONGLONG begin = child.offset + child.headerSize, end = child.offset + child.size;
+            if (FindBmffChild(b, begin, end, FourCC("FIRM"), firm))
+            {
+                for (ULONGLONG i = firm.offset + firm.headerSize; i < firm.offset + firm.size && b[i] >= 0x20 && b[i] < 0x7F; ++i)
+                    out.firmware.push_back(static_cast<char>(b[i]));
+            }
+            out.gpmfUdta = FindBmffChild(b, begin, end, FourCC("GPMF"), gpmf);
+        }
+        off += child.size;
+    }
+
+    for (const auto& t : out.tracks)
+    {
+        for (size_t i = 0; i < t.chunkOffsets.size(); ++i)
+        {
+            out.minChunkOffset = std::min(out.minChunkOffset, t.chunkOffsets[i]);
+            out.maxChunkEnd = std::max(out.maxChunkEnd, t.chunkOffsets[i] + t.chunkBytes[i]);
+        }
+    }
+    return !out.tracks.empty() && out.maxChunkEnd > 0;
+}
+
+enum class SampleCheck { Unknown, Valid, Invalid };
+
+// Checks whether the bytes at 'p' can be the first sample of a chunk. Only
+// the bytes up to 'avail' (the end of the current cluster) are trusted,
+// since the next cluster of the file may live elsewhere in the image.
+static SampleCheck CheckMp4Sample(const Mp4Track& t, const BYTE* p, ULONGLONG avail, DWORD sampleSize)
+{
+    if (t.codec == Mp4Codec::Gpmf)
+    {
+        if (avail < 8)
+            return SampleCheck::Unknown;
+        return memcmp(p, "DEVC", 4) == 0 ? SampleCheck::Valid : SampleCheck::Invalid;
+    }
+    if (t.codec != Mp4Codec::Avc && t.codec != Mp4Codec::Hevc)
+        return SampleCheck::Unknown;
+
+    // Length-prefixed NAL units must tile the sample exactly.
+    const DWORD L = t.nalLengthSize;
+    ULONGLONG pos = 0;
+    bool checked = false;
+    while (pos < sampleSize)
+    {
+        if (pos + L + 2 > avail)
+            return checked ? SampleCheck::Valid : SampleCheck::Unknown;
+        ULONGLONG len = 0;
+        for (DWORD i = 0; i < L; ++i)
+            len = (len << 8) | p[pos + i];
+        if (len == 0 || pos + L + len > sampleSize)
+            return SampleCheck::Invalid;
+        const BYTE h0 = p[pos + L], h1 = p[pos + L + 1];
+        if (h0 & 0x80)
+            return SampleCheck::Invalid;  // forbidden_zero_bit
+        if (t.codec == Mp4Codec::Avc)
+        {
+            const BYTE type = h0 & 0x1F;
+            if (type == 0 || type > 23)
+                return SampleCheck::Invalid;
+        }
+        else
+        {
+            const BYTE type = (h0 >> 1) & 0x3F;
+            if (type > 40 || (h1 & 7) == 0 || ((h0 & 1) | (h1 >> 3)) != 0)
+                return SampleCheck::Invalid;
+        }
+        checked = true;
+        pos += L + len;
+    }
+    return pos == sampleSize ? SampleCheck::Valid : SampleCheck::Invalid;
+}
+
+struct Mp4Checkpoint {
+    ULONGLONG fileOffset = 0;
+    const Mp4Track* track = nullptr;
+    DWORD sampleSize = 0;
+};
+
+struct Mp4CarveResult {
+    ULONGLONG imageOffset = 0;     // ftyp hit
+    DWORD majorBrand = 0;
+    ULONGLONG fileSize = 0;
+    ULONGLONG mdatFileOffset = 0;
+    ULONGLONG mdatSize = 0;
+    ULONGLONG moovFileOffset = 0;
+    ULONGLONG moovImageOffset = 0;
+    bool moovRelocated = false;    // moov found away from its contiguous position
+    bool truncated = false;        // file runs past the end of the image
+    Mp4Moov moov;
+    DWORD checkedClusters = 0;
+    DWORD relocatedClusters = 0;   // clusters placed by the fragment search
+    DWORD unresolvedClusters = 0;  // checkpoint failed and no candidate validated
+    DWORD ambiguousClusters = 0;   // between a verified cluster and a relocation; placed as contiguous
+    std::vector<std::pair<ULONGLONG, ULONGLONG>> runs;  // (image offset, length) in file order
+    std::wstring outputPath;
+    std::string error;
+};
+
+static bool IsPlausibleFtyp(const BYTE* p)
+{
+    const DWORD size = LoadBE32(p);
+    return memcmp(p + 4, "ftyp", 4) == 0 && size >= 16 && size <= 256 && (size % 4) == 0
+        && IsPrintableFourCC(LoadBE32(p + 8));
+}
+
+// Looks for the moov that belongs to the file starting at 'hit' when it is not
+// where a contiguous layout puts it. The file offset of the moov is known
+// (end of mdat), so only positions with the same phase within a cluster are
+// probed, and the candidate's chunk table must fit this file's mdat and
+// validate at the first chunk, which lives in the file's first cluster.
+static bool FindRelocatedMoov(const MappedImage& img, ULONGLONG hit, ULONGLONG moovFileOffset,
+    ULONGLONG clusterSize, ULONGLONG mdatBegin, ULONGLONG mdatEnd, Mp4CarveResult& r)
+{
+    const ULONGLONG phase = (hit + moovFileOffset) % clusterSize;
+    const ULONGLONG contiguous = hit + moovFileOffset;
+    bool found = false;
+    ULONGLONG bestDistance = ~0ULL;
+
+    for (ULONGLONG q = phase; q + 8 <= img.size(); q += clusterSize)
+    {
+        const BYTE* p = img.data() + q;
+        if (memcmp(p + 4, "moov", 4) != 0)
+            continue;
+        BmffBox box;
+        if (!ReadBmffBox(p, 0, img.size() - q, box) || q + box.size > img.size())
+            continue;
+        Mp4Moov moov;
+        if (!ParseMp4Moov(p, box.size, moov) || moov.minChunkOffset < mdatBegin || moov.maxChunkEnd > mdatEnd)
+            continue;
+
+        bool firstOk = true;
+        for (const auto& t : moov.tracks)
+        {
+            const ULONGLONG off = t.chunkOffsets.empty() ? ~0ULL : t.chunkOffsets[0];
+            if (off >= clusterSize)
+                continue;
+            if (CheckMp4Sample(t, img.data() + hit + off, std::min(clusterSize - off, img.size() - hit - off),
+                    t.chunkFirstSample[0]) == SampleCheck::Invalid)
+                firstOk = false;
+        }
+        if (!firstOk)
+            continue;
+
+        // Prefer the nearest candidate after the contiguous position; files
+        // are allocated forwards, so a moov before the file is a last resort.
+        const ULONGLONG distance = q >= contiguous ? q - contiguous : (1ULL << 62) + (contiguous - q);
+        if (distance < bestDistance)
+        {
+            bestDistance = distance;
+            r.moov = std::move(moov);
+            r.moovImageOffset = q;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void CarveMp4At(const MappedImage& img, ULONGLONG hit, ULONGLONG clusterSize, Mp4CarveResult& r)
+{
+    r.imageOffset = hit;
+    r.majorBrand = LoadBE32(img.data() + hit + 8);
+
+    // 1. Walk top-level boxes as if the file were contiguous.
+    const BYTE* base = img.data() + hit;
+    const ULONGLONG avail = img.size() - hit;
+    bool haveMdat = false, haveMoov = false;
+    ULONGLONG walkEnd = 0;
+    for (ULONGLONG off = 0; off < avail; )
+    {
+        BmffBox box;
+        if (!ReadBmffBox(base, off, avail, box) || !IsKnownTopLevelBox(box.type))
+            break;
+        if (off > 0 && box.type == FourCC("ftyp"))
+            break;  // next file begins here
+        if (box.type == FourCC("mdat"))
+        {
+            haveMdat = true;
+            r.mdatFileOffset = off;
+            r.mdatSize = box.size;
+        }
+        else if (box.type == FourCC("moov") && off + box.size <= avail && ParseMp4Moov(base + off, box.size, r.moov))
+        {
+            haveMoov = true;
+            r.moovFileOffset = off;
+            r.moovImageOffset = hit + off;
+        }
+        off += box.size;
+        walkEnd = off;
+    }
+
+    if (!haveMdat)
+    {
+        r.error = "no mdat after ftyp";
+        return;
+    }
+    // Every file cluster maps to its own image cluster, so a larger mdat is a
+    // garbage box size; it would size the per-cluster tables below.
+    const ULONGLONG mdatEnd = r.mdatFileOffset + r.mdatSize;
+    if (mdatEnd > img.size())
+    {
+        r.error = "mdat larger than the image";
+        return;
+    }
+    if (!haveMoov)
+    {
+        // GoPro writes moov after mdat; if the walk could not reach it, the
+        // file is fragmented somewhere inside mdat.
+        r.moovFileOffset = mdatEnd;
+        if (!FindRelocatedMoov(img, hit, mdatEnd, clusterSize, r.mdatFileOffset, mdatEnd, r))
+        {
+            r.error = "moov not found (contiguous or cluster-aligned)";
+            return;
+        }
+        r.moovRelocated = r.moovImageOffset != hit + mdatEnd;
+        BmffBox moovBox;
+        ReadBmffBox(img.data() + r.moovImageOffset, 0, img.size() - r.moovImageOffset, moovBox);
+        walkEnd = mdatEnd + moovBox.size;
+    }
+    r.fileSize = std::max(walkEnd, mdatEnd);
+    if (r.fileSize > img.size())
+    {
+        r.error = "file larger than the image";
+        return;
+    }
+
+    // 2. Checkpoints: the first verifiable chunk start in each file cluster.
+    const ULONGLONG clusterCount = (r.fileSize + clusterSize - 1) / clusterSize;
+    std::vector<Mp4Checkpoint> checkpoints;
+    for (const auto& t : r.moov.tracks)
+    {
+        if (t.codec == Mp4Codec::Other)
+            continue;
+        for (size_t i = 0; i < t.chunkOffsets.size(); ++i)
+            checkpoints.push_back({ t.chunkOffsets[i], &t, t.chunkFirstSample[i] });
+    }
+    std::sort(checkpoints.begin(), checkpoints.end(),
+        [](const Mp4Checkpoint& a, const Mp4Checkpoint& b) { return a.fileOffset < b.fileOffset; });
+    std::vector<const Mp4Checkpoint*> clusterCheck(static_cast<size_t>(clusterCount), nullptr);
+    for (const auto& cp : checkpoints)
+    {
+        const size_t k = static_cast<size_t>(cp.fileOffset / clusterSize);
+        if (k < clusterCount && !clusterCheck[k])
+            clusterCheck[k] = &cp;
+    }
+
+    auto check = [&](const Mp4Checkpoint& cp, ULONGLONG clusterImageOffset) {
+        const ULONGLONG inCluster = cp.fileOffset % clusterSize;
+        const ULONGLONG pos = clusterImageOffset + inCluster;
+        if (pos + 8 > img.size())
+            return SampleCheck::Invalid;
+        return CheckMp4Sample(*cp.track, img.data() + pos,
+            std::min(clusterSize - inCluster, img.size() - pos), cp.sampleSize);
+    };
+
+    // 3. Map every file cluster to an image cluster. The first cluster and the
+    //    moov clusters are fixed; the rest continue contiguously until a
+    //    checkpoint fails, at which point every cluster on the same grid is
+    //    tried and the nearest one that validates is taken.
+    std::vector<ULONGLONG> map(static_cast<size_t>(clusterCount), 0);
+    std::vector<BYTE> fixed(static_cast<size_t>(clusterCount), 0);
+    map[0] = hit;
+    fixed[0] = 1;
+    if (r.moovRelocated)
+    {
+        const ULONGLONG moovBase = r.moovImageOffset - r.moovFileOffset % clusterSize;
+        for (ULONGLONG k = r.moovFileOffset / clusterSize; k < clusterCount; ++k)
+        {
+            map[static_cast<size_t>(k)] = moovBase + (k - r.moovFileOffset / clusterSize) * clusterSize;
+            fixed[static_cast<size_t>(k)] = 1;
+        }
+    }
+
+    // Clusters without a checkpoint between the last verified one and a
+    // relocation cannot be placed with certainty: the break may lie anywhere
+    // in that span. They are kept contiguous with the verified cluster and
+    // counted so the report shows how much of the file is a guess.
+    const ULONGLONG gridPhase = hit % clusterSize;
+    size_t lastVerified = 0;
+    for (size_t k = 1; k < map.size(); ++k)
+    {
+        if (fixed[k])
+        {
+            lastVerified = k;
+            continue;
+        }
+        const ULONGLONG guess = map[k - 1] + clusterSize;
+        const Mp4Checkpoint* cp = clusterCheck[k];
+        if (!cp)
+        {
+            map[k] = guess;
+            continue;
+        }
+        ++r.checkedClusters;
+        const SampleCheck atGuess = guess < img.size() ? check(*cp, guess) : SampleCheck::Invalid;
+        if (atGuess != SampleCheck::Invalid)
+        {
+            map[k] = guess;
+            if (atGuess == SampleCheck::Valid)
+                lastVerified = k;
+            continue;
+        }
+
+        ULONGLONG best = ~0ULL, bestDistance = ~0ULL;
+        for (ULONGLONG c = gridPhase; c < img.size(); c += clusterSize)
+        {
+            if (c == guess || check(*cp, c) != SampleCheck::Valid)
+                continue;
+            const ULONGLONG distance = c > map[k - 1] ? c - map[k - 1] : (1ULL << 62) + (map[k - 1] - c);
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                best = c;
+            }
+        }
+        if (best == ~0ULL)
+        {
+            map[k] = guess;
+            ++r.unresolvedClusters;
+        }
+        else
+        {
+            map[k] = best;
+            ++r.relocatedClusters;
+            r.ambiguousClusters += static_cast<DWORD>(k - lastVerified - 1);
+            lastVerified = k;
+        }
+    }
+
+    // 4. Coalesce into runs of adjacent image clusters.
+    for (size_t k = 0; k < map.size(); ++k)
+    {
+        ULONGLONG len = std::min<ULONGLONG>(clusterSize, r.fileSize - k * clusterSize);
+        if (map[k] >= img.size())
+        {
+            r.truncated = true;
+            break;
+        }
+        if (map[k] + len > img.size())
+        {
+            len = img.size() - map[k];
+            r.truncated = true;
+        }
+        if (!r.runs.empty() && r.runs.back().first + r.runs.back().second == map[k])
+            r.runs.back().second += len;
+        else
+            r.runs.emplace_back(map[k], len);
+        if (r.truncated)
+            break;
+    }
+}
+
+// Writes the carved file straight from the mapped image, one WriteFile per
+// contiguous run (split only to fit WriteFile's DWORD length).
+static bool WriteCarvedRuns(const MappedImage& img, const std::wstring& path,
+    const std::vector<std::pair<ULONGLONG, ULONGLONG>>& runs)
+{
+    HandleGuard hOut(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!hOut.valid())
+        return false;
+    for (const auto& run : runs)
+    {
+        for (ULONGLONG done = 0; done < run.second; )
+        {
+            const DWORD piece = static_cast<DWORD>(std::min<ULONGLONG>(run.second - done, 64ULL * 1024 * 1024));
+            DWORD written = 0;
+            if (!WriteFile(hOut.get(), img.data() + run.first + done, piece, &written, nullptr) || written != piece)
+                return false;
+            done += piece;
+        }
+    }
+    return true;
+}
+
+static void PrintMp4CarveResult(size_t index, const Mp4CarveResult& r)
+{
+    char brand[5];
+    FormatFourCC(r.majorBrand, brand);
+    printf("\n  --- MP4 #%zu at image offset 0x%llX (brand '%s') ---\n", index, r.imageOffset, brand);
+    if (!r.error.empty())
+    {
+        printf("  Not carved:         %s\n", r.error.c_str());
+        return;
+    }
+
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(r.fileSize), sizeBuf, sizeof(sizeBuf));
+    printf("  File Size:          %s%s\n", sizeBuf, r.truncated ? "  [TRUNCATED by image end]" : "");
+    printf("  mdat:               file offset 0x%llX, %llu bytes\n", r.mdatFileOffset, r.mdatSize);
+    printf("  moov:               file offset 0x%llX, image offset 0x%llX%s\n",
+        r.moovFileOffset, r.moovImageOffset, r.moovRelocated ? "  [relocated]" : "");
+    for (const auto& t : r.moov.tracks)
+    {
+        char handler[5], entry[5];
+        FormatFourCC(t.handler, handler);
+        FormatFourCC(t.sampleEntry, entry);
+        printf("  Track:              %s/%s, %lu samples in %zu chunks\n",
+            handler, entry, t.sampleCount, t.chunkOffsets.size());
+    }
+    if (!r.moov.firmware.empty() || r.moov.gpmfUdta)
+        printf("  GoPro udta:         firmware \"%s\"%s\n", r.moov.firmware.c_str(),
+            r.moov.gpmfUdta ? ", GPMF settings present" : "");
+    printf("  Fragments:          %zu (%lu clusters checked, %lu relocated, %lu unresolved, %lu ambiguous)\n",
+        r.runs.size(), r.checkedClusters, r.relocatedClusters, r.unresolvedClusters, r.ambiguousClusters);
+    if (!r.outputPath.empty())
+        wprintf(L"  Output:             %s\n", r.outputPath.c_str());
+}
+
+static int CmdMp4Carve(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: mp4carve <image> <output-dir> [cluster-KiB]");
+
+    MappedImage img(argv[0]);
+    const std::wstring outDir = argv[1];
+    const ULONGLONG clusterSize = (argc >= 3 ? _wcstoui64(argv[2], nullptr, 10) : 128) * 1024;
+    if (clusterSize == 0 || !IsPowerOfTwo(clusterSize))
+        FatalErrorMsg("Cluster size must be a power of two (in KiB).");
+    if (!CreateDirectoryW(outDir.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+        FatalError("Failed to create output directory");
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    // Files start on a cluster boundary, which is always sector-aligned.
+    const ULONGLONG sectors = img.size() / 512;
+    std::vector<std::vector<ULONGLONG>> perWorker(WorkerThreadCount());
+    ParallelForRanges(sectors, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        for (ULONGLONG s = begin; s < end; ++s)
+        {
+            if (IsPlausibleFtyp(img.data() + s * 512))
+                perWorker[worker].push_back(s * 512);
+        }
+    });
+    std::vector<ULONGLONG> hits;
+    for (const auto& w : perWorker)
+        hits.insert(hits.end(), w.begin(), w.end());
+    std::sort(hits.begin(), hits.end());
+
+    std::vector<Mp4CarveResult> results(hits.size());
+    ParallelForRanges(hits.size(), [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            Mp4CarveResult& r = results[static_cast<size_t>(i)];
+            CarveMp4At(img, hits[static_cast<size_t>(i)], clusterSize, r);
+            if (!r.error.empty())
+                continue;
+
+            wchar_t name[64];
+            swprintf_s(name, L"\\carved_%012llX", r.imageOffset);
+            const std::wstring path = outDir + name + (r.majorBrand == FourCC("qt  ") ? L".mov" : L".mp4");
+            if (WriteCarvedRuns(img, path, r.runs))
+                r.outputPath = path;
+            else
+                r.error = "failed to write output file";
+        }
+    });
+
+    QueryPerformanceCounter(&now);
+
+    size_t carved = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        PrintMp4CarveResult(i + 1, results[i]);
+        carved += results[i].error.empty() ? 1 : 0;
+    }
+    printf("\n  ftyp hits: %zu, carved: %zu, time: %.2f seconds\n", hits.size(), carved,
+        (double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// ============================================================
+// H.264/HEVC NAL-unit stream detector
+// ============================================================
+
+enum class NalCodec { Avc, Hevc };
+
+// Reads Exp-Golomb coded fields from the first bytes of a NAL payload,
+// dropping emulation-prevention bytes (00 00 03) on the way.
+class RbspReader {
+    BYTE m_buf[64];
+    size_t m_len = 0;
+    size_t m_bit = 0;
+public:
+    RbspReader(const BYTE* p, size_t len)
+    {
+        int zeros = 0;
+        for (size_t i = 0; i < len && m_len < sizeof(m_buf); ++i)
+        {
+            if (zeros >= 2 && p[i] == 0x03)
+            {
+                zeros = 0;
+                continue;
+            }
+            zeros = p[i] == 0 ? zeros + 1 : 0;
+            m_buf[m_len++] = p[i];
+        }
+    }
+
+    bool ok() const { return m_bit <= m_len * 8; }
+
+    DWORD bits(int n)
+    {
+        DWORD v = 0;
+        for (int i = 0; i < n; ++i, ++m_bit)
+        {
+            const DWORD b = m_bit < m_len * 8 ? (m_buf[m_bit / 8] >> (7 - m_bit % 8)) & 1 : 0;
+            v = (v << 1) | b;
+        }
+        return v;
+    }
+
+    DWORD ue()
+    {
+        int zeros = 0;
+        while (bits(1) == 0)
+        {
+            if (++zeros > 31 || !ok())
+                return MAXDWORD;
+        }
+        return zeros ? ((1u << zeros) - 1) + bits(zeros) : 0;
+    }
+};
+
+enum class NalKind { Invalid, Slice, IdrSlice, Sps, Pps, Other };
+
+static bool IsValidNalHeader(NalCodec codec, const BYTE* h)
+{
+    if (h[0] & 0x80)
+        return false;  // forbidden_zero_bit
+    if (codec == NalCodec::Avc)
+    {
+        // Slices, SEI, parameter sets, AUD and end-of-sequence/stream markers;
+        // partition and extension types never appear in camera streams.
+        const BYTE type = h[0] & 0x1F;
+        return type == 1 || (type >= 5 && type <= 12);
+    }
+    const BYTE type = (h[0] >> 1) & 0x3F;
+    const BYTE layer = static_cast<BYTE>(((h[0] & 1) << 5) | (h[1] >> 3));
+    return layer == 0 && (h[1] & 7) != 0 && (type <= 9 || (type >= 16 && type <= 21) || (type >= 32 && type <= 40));
+}
+
+// Classifies one NAL unit and, for parameter sets and slices, checks that
+// the leading header fields are in range.
+static NalKind ClassifyNal(NalCodec codec, const BYTE* nal, size_t len)
+{
+    if (codec == NalCodec::Avc)
+    {
+        const BYTE type = nal[0] & 0x1F;
+        RbspReader r(nal + 1, len - 1);
+        switch (type) {
+        case 1:
+        case 5: {
+            const DWORD firstMb = r.ue();
+            const DWORD sliceType = r.ue();
+            const DWORD ppsId = r.ue();
+            if (firstMb > 139264 || sliceType > 9 || ppsId > 255 || !r.ok())
+                return NalKind::Invalid;
+            if (type == 5 && sliceType % 5 != 2 && sliceType % 5 != 4)
+                return NalKind::Invalid;  // IDR must be I or SI
+            return type == 5 ? NalKind::IdrSlice : NalKind::Slice;
+        }
+        case 7: {
+            static const BYTE kProfiles[] = { 44, 66, 77, 83, 86, 88, 100, 110, 118, 122, 128, 134, 135, 138, 139, 244 };
+            const DWORD profile = r.bits(8);
+            const DWORD constraints = r.bits(8);
+            const DWORD level = r.bits(8);
+            const DWORD spsId = r.ue();
+            if (std::find(std::begin(kProfiles), std::end(kProfiles), profile) == std::end(kProfiles)
+                || (constraints & 0x03) || level < 9 || level > 62 || spsId > 31 || !r.ok())
+                return NalKind::Invalid;
+            return NalKind::Sps;
+        }
+        case 8: {
+            const DWORD ppsId = r.ue();
+            const DWORD spsId = r.ue();
+            return ppsId <= 255 && spsId <= 31 && r.ok() ? NalKind::Pps : NalKind::Invalid;
+        }
+        default:
+            return NalKind::Other;
+        }
+    }
+
+    const BYTE type = (nal[0] >> 1) & 0x3F;
+    RbspReader r(nal + 2, len - 2);
+    if (type <= 9 || (type >= 16 && type <= 21))
+    {
+        r.bits(1);                   // first_slice_segment_in_pic_flag
+        if (type >= 16)
+            r.bits(1);               // no_output_of_prior_pics_flag
+        const DWORD ppsId = r.ue();
+        if (ppsId > 63 || !r.ok())
+            return NalKind::Invalid;
+        return type >= 19 && type <= 20 ? NalKind::IdrSlice : NalKind::Slice;
+    }
+    if (type == 33)
+    {
+        r.bits(4);                   // sps_video_parameter_set_id
+        const DWORD maxSubLayers = r.bits(3);
+        r.bits(1);
+        const DWORD profileSpace = r.bits(2);
+        r.bits(1);                   // general_tier_flag
+        const DWORD profile = r.bits(5);
+        if (maxSubLayers > 6 || profileSpace != 0 || profile < 1 || profile > 11)
+            return NalKind::Invalid;
+        return NalKind::Sps;
+    }
+    if (type == 34)
+    {
+        const DWORD ppsId = r.ue();
+        const DWORD spsId = r.ue();
+        return ppsId <= 63 && spsId <= 15 && r.ok() ? NalKind::Pps : NalKind::Invalid;
+    }
+    return NalKind::Other;
+}
+
+struct VideoExtent {
+    ULONGLONG offset = 0;
+    ULONGLONG length = 0;
+    NalCodec codec = NalCodec::Avc;
+    DWORD nalCount = 0;
+    DWORD sliceCount = 0;
+    DWORD idrCount = 0;
+    DWORD spsCount = 0;
+    DWORD ppsCount = 0;
+};
+
+// Follows 4-byte length-prefixed NAL units from 'p' for as long as every
+// header and slice/parameter-set prefix is valid.
+static void WalkNalChain(const BYTE* base, ULONGLONG size, ULONGLONG p, NalCodec codec, VideoExtent& out)
+{
+    out = VideoExtent();
+    out.offset = p;
+    out.codec = codec;
+    ULONGLONG pos = p;
+    while (pos + 6 <= size)
+    {
+        const ULONGLONG len = LoadBE32(base + pos);
+        if (len < 2 || len > (16u << 20) || pos + 4 + len > size || !IsValidNalHeader(codec, base + pos + 4))
+            break;
+        const NalKind kind = ClassifyNal(codec, base + pos + 4, static_cast<size_t>(len));
+        if (kind == NalKind::Invalid || ((kind == NalKind::Sps || kind == NalKind::Pps) && len > 512))
+            break;
+        ++out.nalCount;
+        out.sliceCount += kind == NalKind::Slice || kind == NalKind::IdrSlice ? 1 : 0;
+        out.idrCount += kind == NalKind::IdrSlice ? 1 : 0;
+        out.spsCount += kind == NalKind::Sps ? 1 : 0;
+        out.ppsCount += kind == NalKind::Pps ? 1 : 0;
+        pos += 4 + len;
+    }
+    out.length = pos - p;
+}
+
+// A lone NAL whose length field happens to land inside the image is common
+// in random data; each further link in the chain cuts the odds by ~1/1000.
+static bool IsConvincingNalChain(const VideoExtent& e, DWORD minNals)
+{
+    return e.nalCount >= minNals || (e.nalCount >= 2 && e.spsCount && e.ppsCount);
+}
+
+// SSE2 fast reject over 16 candidate positions at once: a plausible length
+// prefix starts with 0x00 (NAL < 16 MiB) and the header byte four bytes
+// later is non-zero with the forbidden bit clear. High-entropy payload and
+// erased (0x00/0xFF) areas are discarded without touching the scalar path.
+static DWORD NalCandidateMask(const BYTE* p)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lenHi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i header = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4));
+    const int lenZero = _mm_movemask_epi8(_mm_cmpeq_epi8(lenHi, zero));
+    const int headerHigh = _mm_movemask_epi8(header);
+    const int headerZero = _mm_movemask_epi8(_mm_cmpeq_epi8(header, zero));
+    return static_cast<DWORD>(lenZero & ~headerHigh & ~headerZero) & 0xFFFF;
+}
+
+static void ScanNalStreams(const MappedImage& img, DWORD minNals, std::vector<VideoExtent>& extents)
+{
+    const BYTE* base = img.data();
+    const ULONGLONG size = img.size();
+    const ULONGLONG stripe = 16ULL << 20;
+    const ULONGLONG stripes = (size + stripe - 1) / stripe;
+    std::mutex lock;
+
+    ParallelForRanges(stripes, [&](ULONGLONG sBegin, ULONGLONG sEnd, DWORD) {
+        std::vector<VideoExtent> local;
+        for (ULONGLONG s = sBegin; s < sEnd; ++s)
+        {
+            const ULONGLONG begin = s * stripe;
+            const ULONGLONG end = std::min(size, begin + stripe);
+            ULONGLONG p = begin;
+            while (p < end)
+            {
+                DWORD mask;
+                if (p + 20 <= size)
+                {
+                    mask = NalCandidateMask(base + p);
+                    if (!mask)
+                    {
+                        p += 16;
+                        continue;
+                    }
+                }
+                else
+                    mask = 1;  // tail: fall back to one scalar probe per byte
+
+                // Probe each candidate bit in order; a detected chain may
+                // run past this block and even past the stripe end.
+                ULONGLONG next = p + (p + 20 <= size ? 16 : 1);
+                for (DWORD bit = 0; bit < 16 && mask; ++bit, mask >>= 1)
+                {
+                    const ULONGLONG c = p + bit;
+                    if (!(mask & 1) || c >= end || c + 6 > size)
+                        continue;
+                    VideoExtent best, ext;
+                    WalkNalChain(base, size, c, NalCodec::Avc, best);
+                    WalkNalChain(base, size, c, NalCodec::Hevc, ext);
+                    if (ext.nalCount > best.nalCount)
+                        best = ext;
+                    if (IsConvincingNalChain(best, minNals))
+                    {
+                        local.push_back(best);
+                        next = std::max(next, c + best.length);
+                        break;
+                    }
+                }
+                p = next;
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        extents.insert(extents.end(), local.begin(), local.end());
+    });
+
+    std::sort(extents.begin(), extents.end(),
+        [](const VideoExtent& a, const VideoExtent& b) { return a.offset < b.offset; });
+}
+
+// Joins extents of the same codec separated by small gaps: inside an mdat,
+// video chunks are interleaved with audio and GPMF chunks that carry no NALs.
+static std::vector<VideoExtent> MergeVideoExtents(const std::vector<VideoExtent>& extents, ULONGLONG maxGap)
+{
+    std::vector<VideoExtent> merged;
+    for (const auto& e : extents)
+    {
+        if (!merged.empty() && merged.back().codec == e.codec
+            && e.offset <= merged.back().offset + merged.back().length + maxGap)
+        {
+            VideoExtent& m = merged.back();
+            const ULONGLONG end = std::max(m.offset + m.length, e.offset + e.length);
+            m.length = end - m.offset;
+            m.nalCount += e.nalCount;
+            m.sliceCount += e.sliceCount;
+            m.idrCount += e.idrCount;
+            m.spsCount += e.spsCount;
+            m.ppsCount += e.ppsCount;
+        }
+        else
+            merged.push_back(e);
+    }
+    return merged;
+}
+
+static int CmdNalScan(int argc, wchar_t* argv[])
+{
+    if (argc < 1)
+        FatalErrorMsg("Usage: nalscan <image> [merge-gap-KiB] [min-chain-NALs]");
+
+    MappedImage img(argv[0]);
+    const ULONGLONG mergeGap = (argc >= 2 ? _wcstoui64(argv[1], nullptr, 10) : 256) * 1024;
+    const DWORD minNals = std::max<DWORD>(2, argc >= 3 ? static_cast<DWORD>(_wcstoui64(argv[2], nullptr, 10)) : 3);
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    std::vector<VideoExtent> extents;
+    ScanNalStreams(img, minNals, extents);
+    const std::vector<VideoExtent> regions = MergeVideoExtents(extents, mergeGap);
+
+    QueryPerformanceCounter(&now);
+    const double seconds = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+
+    ULONGLONG videoBytes = 0;
+    for (const auto& e : extents)
+        videoBytes += e.length;
+
+    char sizeBuf[128];
+    printf("\n  --- Video-Bearing Regions (AVCC/HVCC, 4-byte NAL lengths) ---\n");
+    printf("  %-18s %-14s %-5s %8s %8s %6s %4s %4s\n", "Offset", "Length", "Codec", "NALs", "Slices", "IDR", "SPS", "PPS");
+    for (const auto& r : regions)
+    {
+        printf("  0x%016llX %14llu %-5s %8lu %8lu %6lu %4lu %4lu\n", r.offset, r.length,
+            r.codec == NalCodec::Avc ? "H.264" : "HEVC",
+            r.nalCount, r.sliceCount, r.idrCount, r.spsCount, r.ppsCount);
+    }
+
+    FormatBytes(static_cast<LONGLONG>(videoBytes), sizeBuf, sizeof(sizeBuf));
+    printf("\n  NAL chains:         %zu in %zu regions\n", extents.size(), regions.size());
+    printf("  Video Payload:      %s (%.2f%% of image)\n", sizeBuf, 100.0 * videoBytes / img.size());
+    printf("  Scan Rate:          %.1f MB/s (%.2f seconds)\n", img.size() / (1024.0 * 1024.0) / seconds, seconds);
+    return 0;
+}
+
+// ============================================================
+// Headerless MP4 repair (moov rebuild from a reference clip)
+// ============================================================
+
+// Big-endian box serializer for the rebuilt moov.
+class BmffWriter {
+    std::vector<BYTE> m_out;
+public:
+    std::vector<BYTE>& bytes() { return m_out; }
+
+    void u8(BYTE v) { m_out.push_back(v); }
+    void u32(DWORD v)
+    {
+        for (int s = 24; s >= 0; s -= 8)
+            m_out.push_back(static_cast<BYTE>(v >> s));
+    }
+    void u64(ULONGLONG v)
+    {
+        u32(static_cast<DWORD>(v >> 32));
+        u32(static_cast<DWORD>(v));
+    }
+    void raw(const BYTE* p, size_t n) { m_out.insert(m_out.end(), p, p + n); }
+
+    size_t begin(const char* type)
+    {
+        const size_t at = m_out.size();
+        u32(0);
+        raw(reinterpret_cast<const BYTE*>(type), 4);
+        return at;
+    }
+    size_t beginFull(const char* type, DWORD versionFlags)
+    {
+        const size_t at = begin(type);
+        u32(versionFlags);
+        return at;
+    }
+    void end(size_t at)
+    {
+        const DWORD size = static_cast<DWORD>(m_out.size() - at);
+        for (int i = 0; i < 4; ++i)
+            m_out[at + i] = static_cast<BYTE>(size >> (24 - i * 8));
+    }
+    void patch32(size_t at, DWORD v)
+    {
+        for (int i = 0; i < 4; ++i)
+            m_out[at + i] = static_cast<BYTE>(v >> (24 - i * 8));
+    }
+    void patch64(size_t at, ULONGLONG v)
+    {
+        patch32(at, static_cast<DWORD>(v >> 32));
+        patch32(at + 4, static_cast<DWORD>(v));
+    }
+};
+
+// Everything learned from one reference track plus the sample table being
+// rebuilt for the recovered mdat. Memory grows with the sample count only
+// (13 bytes per sample), never with the size of the payload.
+struct Mp4RepairTrack {
+    Mp4Track ref;
+    BmffBox trak;                  // in the reference moov buffer
+    DWORD timescale = 0;           // mdhd
+    DWORD sampleDelta = 0;         // most common stts delta
+    std::vector<DWORD> cttsPattern;   // composition offsets of one reference GOP
+    std::vector<WORD> startSignatures;   // first two NAL bytes seen at reference sample starts
+    DWORD minSampleSize = MAXDWORD;
+    DWORD maxSampleSize = 0;
+
+    std::vector<ULONGLONG> offsets;      // source-relative
+    std::vector<DWORD> sizes;
+    std::vector<DWORD> syncSamples;      // 1-based
+};
+
+static bool IsVclNal(NalCodec codec, BYTE h0)
+{
+    return codec == NalCodec::Avc ? ((h0 & 0x1F) == 1 || (h0 & 0x1F) == 5) : ((h0 >> 1) & 0x3F) < 32;
+}
+
+static bool IsSyncNal(NalCodec codec, BYTE h0)
+{
+    if (codec == NalCodec::Avc)
+        return (h0 & 0x1F) == 5;
+    const BYTE type = (h0 >> 1) & 0x3F;
+    return type >= 16 && type <= 21;
+}
+
+// True if this NAL opens a new access unit when the previous NAL was a slice
+// (H.264 7.4.1.2.3, H.265 7.4.2.4.4, reduced to what cameras emit).
+static bool StartsAccessUnit(NalCodec codec, const BYTE* nal, size_t len)
+{
+    if (codec == NalCodec::Avc)
+    {
+        const BYTE type = nal[0] & 0x1F;
+        if (type == 6 || type == 7 || type == 8 || type == 9)
+            return true;
+        if (type == 1 || type == 5)
+        {
+            RbspReader r(nal + 1, len - 1);
+            return r.ue() == 0;  // first_mb_in_slice
+        }
+        return false;
+    }
+    const BYTE type = (nal[0] >> 1) & 0x3F;
+    if ((type >= 32 && type <= 35) || type == 39)
+        return true;
+    return type < 32 && len > 2 && (nal[2] & 0x80);  // first_slice_segment_in_pic_flag
+}
+
+static bool LoadRepairTables(const BYTE* moov, const BmffBox& trak, Mp4RepairTrack& rt)
+{
+    BmffBox mdia, mdhd, minf, stbl, stts, stss, ctts;
+    if (!FindBmffChild(moov, trak.offset + trak.headerSize, trak.offset + trak.size, FourCC("mdia"), mdia)
+        || !FindBmffChild(moov, mdia.offset + mdia.headerSize, mdia.offset + mdia.size, FourCC("mdhd"), mdhd)
+        || !FindBmffChild(moov, mdia.offset + mdia.headerSize, mdia.offset + mdia.size, FourCC("minf"), minf)
+        || !FindBmffChild(moov, minf.offset + minf.headerSize, minf.offset + minf.size, FourCC("stbl"), stbl))
+        return false;
+
+    const BYTE* h = moov + mdhd.offset + mdhd.headerSize;
+    rt.timescale = LoadBE32(h + (h[0] == 1 ? 20 : 12));
+
+    const ULONGLONG sb = stbl.offset + stbl.headerSize, se = stbl.offset + stbl.size;
+    if (!FindBmffChild(moov, sb, se, FourCC("stts"), stts) || stts.size < stts.headerSize + 16)
+        return false;
+    const BYTE* st = moov + stts.offset + stts.headerSize;
+    const DWORD runs = std::min<DWORD>(LoadBE32(st + 4), static_cast<DWORD>((stts.size - stts.headerSize - 8) / 8));
+    DWORD bestCount = 0;
+    for (DWORD i = 0; i < runs; ++i)
+    {
+        if (LoadBE32(st + 8 + i * 8) > bestCount)
+        {
+            bestCount = LoadBE32(st + 8 + i * 8);
+            rt.sampleDelta = LoadBE32(st + 12 + i * 8);
+        }
+    }
+
+    // One GOP of composition offsets, from the first to the second sync sample.
+    if (FindBmffChild(moov, sb, se, FourCC("ctts"), ctts) && ctts.size >= ctts.headerSize + 8)
+    {
+        std::vector<DWORD> sync;
+        if (FindBmffChild(moov, sb, se, FourCC("stss"), stss) && stss.size >= stss.headerSize + 8)
+        {
+            const BYTE* ss = moov + stss.offset + stss.headerSize;
+            const DWORD n = std::min<DWORD>(LoadBE32(ss + 4), static_cast<DWORD>((stss.size - stss.headerSize - 8) / 4));
+            for (DWORD i = 0; i < n && i < 2; ++i)
+                sync.push_back(LoadBE32(ss + 8 + i * 4));
+        }
+        if (sync.size() == 2 && sync[1] > sync[0])
+        {
+            const BYTE* ct = moov + ctts.offset + ctts.headerSize;
+            const DWORD n = std::min<DWORD>(LoadBE32(ct + 4), static_cast<DWORD>((ctts.size - ctts.headerSize - 8) / 8));
+            DWORD sample = 1;
+            for (DWORD i = 0; i < n && sample < sync[1]; ++i)
+            {
+                for (DWORD k = 0; k < LoadBE32(ct + 8 + i * 8) && sample < sync[1]; ++k, ++sample)
+                {
+                    if (sample >= sync[0])
+                        rt.cttsPattern.push_back(LoadBE32(ct + 12 + i * 8));
+                }
+            }
+        }
+    }
+    return rt.sampleDelta != 0 && rt.timescale != 0;
+}
+
+static void LearnSampleSignatures(const MappedImage& ref, Mp4RepairTrack& rt)
+{
+    const Mp4Track& t = rt.ref;
+    const DWORD L = t.nalLengthSize;
+    DWORD sample = 0;
+    for (size_t c = 0; c < t.chunkOffsets.size(); ++c)
+    {
+        ULONGLONG pos = t.chunkOffsets[c];
+        for (DWORD s = 0; s < t.chunkSampleCount[c]; ++s, ++sample)
+        {
+            const DWORD size = Mp4SampleSize(t, sample);
+            rt.minSampleSize = std::min(rt.minSampleSize, size);
+            rt.maxSampleSize = std::max(rt.maxSampleSize, size);
+            if (const BYTE* p = ref.at(pos, L + 2))
+            {
+                const WORD sig = t.codec == Mp4Codec::Gpmf ? 0 : static_cast<WORD>((p[L] << 8) | p[L + 1]);
+                if (std::find(rt.startSignatures.begin(), rt.startSignatures.end(), sig) == rt.startSignatures.end())
+                    rt.startSignatures.push_back(sig);
+            }
+            pos += size;
+        }
+    }
+}
+
+// A video sample may start here if the first NAL length is within the range
+// the reference camera produces and its first two bytes match a start
+// signature learned from the reference (NAL header plus first slice-header
+// byte, which is practically constant per camera and frame type).
+static bool VideoSampleStartsAt(const BYTE* p, ULONGLONG avail, const Mp4RepairTrack& rt, NalCodec codec)
+{
+    const DWORD L = rt.ref.nalLengthSize;
+    if (avail < L + 2)
+        return false;
+    ULONGLONG len = 0;
+    for (DWORD i = 0; i < L; ++i)
+        len = (len << 8) | p[i];
+    if (len < 2 || len > rt.maxSampleSize || L + len > avail || !IsValidNalHeader(codec, p + L))
+        return false;
+    const WORD sig = static_cast<WORD>((p[L] << 8) | p[L + 1]);
+    return std::find(rt.startSignatures.begin(), rt.startSignatures.end(), sig) != rt.startSignatures.end();
+}
+
+// Consumes one access unit (length-prefixed NALs up to the next AU start).
+static ULONGLONG ConsumeVideoSample(const BYTE* p, ULONGLONG avail, const Mp4RepairTrack& rt, NalCodec codec, bool& sync)
+{
+    const DWORD L = rt.ref.nalLengthSize;
+    ULONGLONG pos = 0;
+    bool sawVcl = false;
+    sync = false;
+    while (pos + L + 2 <= avail)
+    {
+        ULONGLONG len = 0;
+        for (DWORD i = 0; i < L; ++i)
+            len = (len << 8) | p[pos + i];
+        const BYTE* nal = p + pos + L;
+        if (len < 2 || pos + L + len > avail || !IsValidNalHeader(codec, nal))
+            break;
+        if (sawVcl && StartsAccessUnit(codec, nal, static_cast<size_t>(len)))
+            break;
+        if (pos + L + len > rt.maxSampleSize + rt.maxSampleSize / 2)
+            break;  // well beyond anything the camera wrote; treat as end of sample
+        sawVcl = sawVcl || IsVclNal(codec, nal[0]);
+        sync = sync || IsSyncNal(codec, nal[0]);
+        pos += L + len;
+    }
+    return sawVcl ? pos : 0;
+}
+
+// GPMF payload is KLV: a DEVC key with 8-byte header whose struct size times
+// repeat count gives the (32-bit aligned) payload length.
+static ULONGLONG GpmfSampleAt(const BYTE* p, ULONGLONG avail, const Mp4RepairTrack& rt)
+{
+    if (avail < 8 || memcmp(p, "DEVC", 4) != 0 || p[4] != 0)
+        return 0;
+    const ULONGLONG len = 8 + ((static_cast<ULONGLONG>(p[5]) * LoadBE16(p + 6) + 3) & ~3ULL);
+    if (len > avail || len < rt.minSampleSize / 2 || len > rt.maxSampleSize * 2ULL)
+        return 0;
+    return len;
+}
+
+struct Mp4RepairStats {
+    ULONGLONG skippedBytes = 0;    // audio chunks and anything unrecognized
+    DWORD resyncs = 0;
+};
+
+static void WriteRepairStbl(BmffWriter& w, const BYTE* moov, const BmffBox& stbl,
+    const Mp4RepairTrack& rt, ULONGLONG chunkBase)
+{
+    const size_t at = w.begin("stbl");
+    BmffBox stsd;
+    if (FindBmffChild(moov, stbl.offset + stbl.headerSize, stbl.offset + stbl.size, FourCC("stsd"), stsd))
+        w.raw(moov + stsd.offset, static_cast<size_t>(stsd.size));
+
+    const DWORD n = static_cast<DWORD>(rt.sizes.size());
+    size_t box = w.beginFull("stts", 0);
+    w.u32(1);
+    w.u32(n);
+    w.u32(rt.sampleDelta);
+    w.end(box);
+
+    if (!rt.cttsPattern.empty())
+    {
+        box = w.beginFull("ctts", 0);
+        w.u32(n);
+        DWORD lastSync = 1;
+        size_t nextSync = 0;
+        for (DWORD i = 1; i <= n; ++i)
+        {
+            if (nextSync < rt.syncSamples.size() && rt.syncSamples[nextSync] == i)
+            {
+                lastSync = i;
+                ++nextSync;
+            }
+            w.u32(1);
+            w.u32(rt.cttsPattern[(i - lastSync) % rt.cttsPattern.size()]);
+        }
+        w.end(box);
+    }
+
+    if (rt.ref.codec != Mp4Codec::Gpmf)
+    {
+        box = w.beginFull("stss", 0);
+        w.u32(static_cast<DWORD>(rt.syncSamples.size()));
+        for (DWORD s : rt.syncSamples)
+            w.u32(s);
+        w.end(box);
+    }
+
+    box = w.beginFull("stsc", 0);
+    w.u32(1);
+    w.u32(1);   // first chunk
+    w.u32(1);   // one sample per chunk
+    w.u32(1);   // sample description index
+    w.end(box);
+
+    box = w.beginFull("stsz", 0);
+    w.u32(0);
+    w.u32(n);
+    for (DWORD s : rt.sizes)
+        w.u32(s);
+    w.end(box);
+
+    box = w.beginFull("co64", 0);
+    w.u32(n);
+    for (ULONGLONG o : rt.offsets)
+        w.u64(chunkBase + o);
+    w.end(box);
+    w.end(at);
+}
+
+// Copies a reference box, descending into containers that hold a rebuilt
+// track; durations are patched and sample tables replaced. Edit lists and
+// tracks that could not be rebuilt are dropped.
+static void WriteRepairBox(BmffWriter& w, const BYTE* moov, const BmffBox& box,
+    const Mp4RepairTrack* rt, ULONGLONG chunkBase, ULONGLONG movieDuration, DWORD movieTimescale)
+{
+    const BYTE* p = moov + box.offset;
+    if (box.type == FourCC("trak") || box.type == FourCC("mdia") || box.type == FourCC("minf"))
+    {
+        char type[5];
+        FormatFourCC(box.type, type);
+        const size_t at = w.begin(type);
+        for (ULONGLONG off = box.offset + box.headerSize; off + 8 <= box.offset + box.size; )
+        {
+            BmffBox child;
+            if (!ReadBmffBox(moov, off, box.offset + box.size, child))
+                break;
+            WriteRepairBox(w, moov, child, rt, chunkBase, movieDuration, movieTimescale);
+            off += child.size;
+        }
+        w.end(at);
+        return;
+    }
+    if (box.type == FourCC("stbl"))
+    {
+        WriteRepairStbl(w, moov, box, *rt, chunkBase);
+        return;
+    }
+    if (box.type == FourCC("edts"))
+        return;
+
+    const size_t at = w.bytes().size();
+    w.raw(p, static_cast<size_t>(box.size));
+    const size_t payload = at + box.headerSize;
+    const bool v1 = p[box.headerSize] == 1;
+    if (box.type == FourCC("mvhd"))
+    {
+        if (v1) w.patch64(payload + 24, movieDuration);
+        else w.patch32(payload + 16, static_cast<DWORD>(movieDuration));
+    }
+    else if (box.type == FourCC("tkhd") && rt)
+    {
+        const ULONGLONG d = rt->sizes.size() * static_cast<ULONGLONG>(rt->sampleDelta) * movieTimescale / rt->timescale;
+        if (v1) w.patch64(payload + 28, d);
+        else w.patch32(payload + 20, static_cast<DWORD>(d));
+    }
+    else if (box.type == FourCC("mdhd") && rt)
+    {
+        const ULONGLONG d = rt->sizes.size() * static_cast<ULONGLONG>(rt->sampleDelta);
+        if (v1) w.patch64(payload + 24, d);
+        else w.patch32(payload + 16, static_cast<DWORD>(d));
+    }
+}
+
+static int CmdMp4Repair(int argc, wchar_t* argv[])
+{
+    if (argc < 3)
+        FatalErrorMsg("Usage: mp4repair <reference.mp4> <source> <output.mp4> [source-offset] [source-length]");
+
+    // --- Learn from the reference clip ---
+    MappedImage ref(argv[0]);
+    BmffBox refFtyp, refMoov;
+    bool haveFtyp = false, haveMoov = false;
+    for (ULONGLONG off = 0; off < ref.size(); )
+    {
+        BmffBox box;
+        if (!ReadBmffBox(ref.data(), off, ref.size(), box) || !IsKnownTopLevelBox(box.type))
+            break;
+        if (box.type == FourCC("ftyp")) { refFtyp = box; haveFtyp = true; }
+        if (box.type == FourCC("moov") && off + box.size <= ref.size()) { refMoov = box; haveMoov = true; }
+        off += box.size;
+    }
+    if (!haveFtyp || !haveMoov)
+        FatalErrorMsg("Reference file has no ftyp/moov; it must be a playable clip from the same camera.");
+
+    const BYTE* moov = ref.data() + refMoov.offset;
+    Mp4Moov refInfo;
+    if (!ParseMp4Moov(moov, refMoov.size, refInfo))
+        FatalErrorMsg("Reference moov could not be parsed.");
+
+    // The first video track and the first GPMF track are rebuilt; audio and
+    // anything else is left out of the new moov.
+    std::vector<Mp4RepairTrack> tracks;
+    Mp4RepairTrack* video = nullptr;
+    Mp4RepairTrack* gpmf = nullptr;
+    DWORD movieTimescale = 0;
+    bool haveVideo = false, haveGpmf = false;
+    for (ULONGLONG off = refMoov.headerSize; off + 8 <= refMoov.size; )
+    {
+        BmffBox child;
+        if (!ReadBmffBox(moov, off, refMoov.size, child))
+            break;
+        if (child.type == FourCC("mvhd"))
+            movieTimescale = LoadBE32(moov + child.offset + child.headerSize + (moov[child.offset + child.headerSize] == 1 ? 20 : 12));
+        Mp4RepairTrack rt;
+        if (child.type == FourCC("trak") && ParseMp4Track(moov, child, rt.ref))
+        {
+            const bool isVideo = rt.ref.codec == Mp4Codec::Avc || rt.ref.codec == Mp4Codec::Hevc;
+            const bool isGpmf = rt.ref.codec == Mp4Codec::Gpmf;
+            rt.trak = child;
+            if (((isVideo && !haveVideo) || (isGpmf && !haveGpmf)) && LoadRepairTables(moov, child, rt))
+            {
+                haveVideo = haveVideo || isVideo;
+                haveGpmf = haveGpmf || isGpmf;
+                tracks.push_back(std::move(rt));
+            }
+        }
+        off += child.size;
+    }
+    for (auto& rt : tracks)
+    {
+        LearnSampleSignatures(ref, rt);
+        if (rt.ref.codec == Mp4Codec::Gpmf)
+            gpmf = &rt;
+        else
+            video = &rt;
+    }
+    if (!video || movieTimescale == 0)
+        FatalErrorMsg("Reference clip has no usable H.264/HEVC video track.");
+    const NalCodec codec = video->ref.codec == Mp4Codec::Avc ? NalCodec::Avc : NalCodec::Hevc;
+
+    // --- Locate the recovered payload ---
+    MappedImage src(argv[1]);
+    ULONGLONG srcBegin = argc >= 4 ? _wcstoui64(argv[3], nullptr, 0) : 0;
+    ULONGLONG srcEnd = argc >= 5 ? srcBegin + _wcstoui64(argv[4], nullptr, 0) : src.size();
+    if (srcBegin >= src.size() || srcEnd > src.size() || srcEnd <= srcBegin)
+        FatalErrorMsg("Source range is outside the source file.");
+    BmffBox mdatHeader;
+    if (ReadBmffBox(src.data(), srcBegin, srcEnd, mdatHeader) && mdatHeader.type == FourCC("mdat"))
+    {
+        srcEnd = std::min(srcEnd, srcBegin + mdatHeader.size);
+        srcBegin += mdatHeader.headerSize;
+    }
+
+    printf("\n  --- Reference ---\n");
+    for (const auto& rt : tracks)
+    {
+        char handler[5], entry[5];
+        FormatFourCC(rt.ref.handler, handler);
+        FormatFourCC(rt.ref.sampleEntry, entry);
+        printf("  Track:              %s/%s, timescale %lu, delta %lu, %zu start signatures, samples %lu..%lu bytes%s\n",
+            handler, entry, rt.timescale, rt.sampleDelta, rt.startSignatures.size(), rt.minSampleSize, rt.maxSampleSize,
+            rt.cttsPattern.empty() ? "" : ", ctts GOP pattern");
+    }
+    if (!refInfo.firmware.empty())
+        printf("  Firmware:           %s\n", refInfo.firmware.c_str());
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    // --- Stream through the payload, one sample at a time ---
+    Mp4RepairStats stats;
+    const BYTE* base = src.data() + srcBegin;
+    const ULONGLONG total = srcEnd - srcBegin;
+    const ULONGLONG maxGap = std::max<ULONGLONG>(4ULL << 20, video->maxSampleSize * 4ULL);
+    bool inGap = false;
+    for (ULONGLONG pos = 0; pos < total; )
+    {
+        const ULONGLONG avail = total - pos;
+        if (VideoSampleStartsAt(base + pos, avail, *video, codec))
+        {
+            bool sync = false;
+            const ULONGLONG len = ConsumeVideoSample(base + pos, avail, *video, codec, sync);
+            if (len)
+            {
+                video->offsets.push_back(pos);
+                video->sizes.push_back(static_cast<DWORD>(len));
+                if (sync)
+                    video->syncSamples.push_back(static_cast<DWORD>(video->sizes.size()));
+                pos += len;
+                inGap = false;
+                continue;
+            }
+        }
+        if (gpmf)
+        {
+            if (const ULONGLONG len = GpmfSampleAt(base + pos, avail, *gpmf))
+            {
+                gpmf->offsets.push_back(pos);
+                gpmf->sizes.push_back(static_cast<DWORD>(len));
+                pos += len;
+                inGap = false;
+                continue;
+            }
+        }
+        // Audio chunk or damage: skip forward until something recognizable.
+        if (!inGap)
+        {
+            ++stats.resyncs;
+            inGap = true;
+        }
+        ++stats.skippedBytes;
+        ++pos;
+        if (stats.skippedBytes > maxGap && video->sizes.empty())
+            FatalErrorMsg("No video samples matching the reference found at the start of the source.");
+    }
+    if (video->syncSamples.empty() || video->syncSamples[0] != 1)
+        video->syncSamples.insert(video->syncSamples.begin(), 1);
+
+    // --- Write ftyp + mdat (copied straight from the source) + moov ---
+    const ULONGLONG chunkBase = refFtyp.size + 16;
+    ULONGLONG movieDuration = 0;
+    for (const auto& rt : tracks)
+        movieDuration = std::max(movieDuration,
+            rt.sizes.size() * static_cast<ULONGLONG>(rt.sampleDelta) * movieTimescale / rt.timescale);
+
+    BmffWriter w;
+    const size_t moovAt = w.begin("moov");
+    for (ULONGLONG off = refMoov.headerSize; off + 8 <= refMoov.size; )
+    {
+        BmffBox child;
+        if (!ReadBmffBox(moov, off, refMoov.size, child))
+            break;
+        const Mp4RepairTrack* rt = nullptr;
+        for (const auto& t : tracks)
+        {
+            if (t.trak.offset == child.offset && !t.sizes.empty())
+                rt = &t;
+        }
+        if (child.type != FourCC("trak") || rt)
+            WriteRepairBox(w, moov, child, rt, chunkBase, movieDuration, movieTimescale);
+        off += child.size;
+    }
+    w.end(moovAt);
+
+    HandleGuard hOut(CreateFileW(argv[2], GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!hOut.valid())
+        FatalError("Failed to create repaired output file");
+    BmffWriter head;
+    head.raw(ref.data() + refFtyp.offset, static_cast<size_t>(refFtyp.size));
+    head.u32(1);
+    head.raw(reinterpret_cast<const BYTE*>("mdat"), 4);
+    head.u64(16 + total);
+    DWORD written = 0;
+    if (!WriteFile(hOut.get(), head.bytes().data(), static_cast<DWORD>(head.bytes().size()), &written, nullptr))
+        FatalError("WriteFile failed");
+    for (ULONGLONG done = 0; done < total; )
+    {
+        const DWORD piece = static_cast<DWORD>(std::min<ULONGLONG>(total - done, 64ULL * 1024 * 1024));
+        if (!WriteFile(hOut.get(), base + done, piece, &written, nullptr) || written != piece)
+            FatalError("WriteFile failed");
+        done += piece;
+    }
+    if (!WriteFile(hOut.get(), w.bytes().data(), static_cast<DWORD>(w.bytes().size()), &written, nullptr))
+        FatalError("WriteFile failed");
+
+    QueryPerformanceCounter(&now);
+
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(total), sizeBuf, sizeof(sizeBuf));
+    printf("\n  --- Repair ---\n");
+    printf("  Payload:            %s from offset 0x%llX\n", sizeBuf, srcBegin);
+    printf("  Video Samples:      %zu (%zu sync)\n", video->sizes.size(), video->syncSamples.size());
+    if (gpmf)
+        printf("  GPMF Samples:       %zu\n", gpmf->sizes.size());
+    printf("  Skipped Bytes:      %llu in %lu gaps (audio is not indexed: AAC frames carry no length)\n",
+        stats.skippedBytes, stats.resyncs);
+    printf("  Duration:           %.2f seconds\n", movieDuration / static_cast<double>(movieTimescale));
+    printf("  moov:               %zu bytes\n", w.bytes().size());
+    printf("  Time:               %.2f seconds\n", (double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// ============================================================
+// JPEG carver (entropy-coded segment validation, fragment bridging)
+// ============================================================
+
+// The file as a sequence of image clusters. Reads past the last known
+// cluster continue contiguously when 'extend' is set (the working
+// assumption until decoding proves otherwise).
+class ClusterChainStream {
+    const MappedImage& m_img;
+    ULONGLONG m_clusterSize;
+public:
+    std::vector<ULONGLONG> clusters;
+    bool extend = true;
+
+    ClusterChainStream(const MappedImage& img, ULONGLONG clusterSize, ULONGLONG first)
+        : m_img(img), m_clusterSize(clusterSize), clusters(1, first) {}
+
+    ULONGLONG clusterSize() const { return m_clusterSize; }
+
+    // Returns the byte at file offset 'pos', or -1 past the available data.
+    int at(ULONGLONG pos)
+    {
+        const ULONGLONG k = pos / m_clusterSize;
+        while (k >= clusters.size())
+        {
+            if (!extend || clusters.back() + m_clusterSize >= m_img.size())
+                return -1;
+            clusters.push_back(clusters.back() + m_clusterSize);
+        }
+        const ULONGLONG abs = clusters[static_cast<size_t>(k)] + pos % m_clusterSize;
+        return abs < m_img.size() ? m_img.data()[abs] : -1;
+    }
+};
+
+struct JpegHuffman {
+    bool present = false;
+    BYTE values[256] = {};
+    int maxCode[18] = {};
+    int valPtr[17] = {};
+    int minCode[17] = {};
+};
+
+struct JpegScanComponent {
+    int blocksH = 1, blocksV = 1;  // sampling factors
+    int dcTable = 0, acTable = 0;
+};
+
+struct JpegHeader {
+    DWORD width = 0, height = 0;
+    bool progressive = false;
+    bool decodable = false;        // single interleaved baseline scan we can walk
+    DWORD restartInterval = 0;
+    JpegHuffman dc[4], ac[4];
+    JpegScanComponent comps[4];
+    int scanComponents = 0;
+    DWORD totalMcus = 0;
+    ULONGLONG ecsOffset = 0;       // file offset of the first entropy-coded byte
+};
+
+// Builds the canonical decoding tables of ITU-T T.81 Annex F.2.2.3.
+static void BuildJpegHuffman(const BYTE* counts, const BYTE* values, int valueCount, JpegHuffman& h)
+{
+    h.present = true;
+    memcpy(h.values, values, valueCount);
+    int code = 0, k = 0;
+    for (int len = 1; len <= 16; ++len)
+    {
+        h.valPtr[len] = k;
+        h.minCode[len] = code;
+        code += counts[len - 1];
+        k += counts[len - 1];
+        h.maxCode[len] = counts[len - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    h.maxCode[17] = 0x7FFFFFFF;
+}
+
+// Parses marker segments up to the first SOS. Returns false on anything a
+// real encoder would not produce.
+static bool ParseJpegHeader(ClusterChainStream& s, JpegHeader& hdr)
+{
+    if (s.at(0) != 0xFF || s.at(1) != 0xD8)
+        return false;
+    int frameComponents = 0;
+    int sampling[4][2] = {};
+    int componentIds[4] = {};
+    ULONGLONG pos = 2;
+    for (int segments = 0; segments < 64; ++segments)
+    {
+        while (s.at(pos) == 0xFF && s.at(pos + 1) == 0xFF)
+            ++pos;  // fill bytes
+        if (s.at(pos) != 0xFF)
+            return false;
+        const int marker = s.at(pos + 1);
+        const int hi = s.at(pos + 2), lo = s.at(pos + 3);
+        if (marker < 0 || hi < 0 || lo < 0)
+            return false;
+        const DWORD len = static_cast<DWORD>((hi << 8) | lo);
+        if (len < 2)
+            return false;
+
+        std::vector<BYTE> seg(len - 2);
+        for (DWORD i = 0; i + 2 < len; ++i)
+        {
+            const int b = s.at(pos + 4 + i);
+            if (b < 0)
+                return false;
+            seg[i] = static_cast<BYTE>(b);
+        }
+
+        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2)
+        {
+            if (seg.size() < 6)
+                return false;
+            hdr.progressive = marker == 0xC2;
+            hdr.height = LoadBE16(&seg[1]);
+            hdr.width = LoadBE16(&seg[3]);
+            frameComponents = seg[5];
+            if (frameComponents < 1 || frameComponents > 4 || seg.size() < 6 + frameComponents * 3ULL
+                || hdr.width == 0 || hdr.height == 0)
+                return false;
+            for (int c = 0; c < frameComponents; ++c)
+            {
+                componentIds[c] = seg[6 + c * 3];
+                sampling[c][0] = seg[7 + c * 3] >> 4;
+                sampling[c][1] = seg[7 + c * 3] & 0x0F;
+                if (sampling[c][0] < 1 || sampling[c][0] > 4 || sampling[c][1] < 1 || sampling[c][1] > 4)
+                    return false;
+            }
+        }
+        else if (marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            return false;  // lossless/arithmetic/hierarchical: not produced by cameras
+        }
+        else if (marker == 0xC4)
+        {
+            for (size_t i = 0; i < seg.size(); )
+            {
+                if (i + 17 > seg.size())
+                    return false;
+                const int tc = seg[i] >> 4, th = seg[i] & 0x0F;
+                int total = 0;
+                for (int n = 0; n < 16; ++n)
+                    total += seg[i + 1 + n];
+                if (tc > 1 || th > 3 || total > 256 || i + 17 + total > seg.size())
+                    return false;
+                BuildJpegHuffman(&seg[i + 1], &seg[i + 17], total, tc ? hdr.ac[th] : hdr.dc[th]);
+                i += 17 + total;
+            }
+        }
+        else if (marker == 0xDD)
+        {
+            if (seg.size() < 2)
+                return false;
+            hdr.restartInterval = LoadBE16(&seg[0]);
+        }
+        else if (marker == 0xDA)
+        {
+            if (seg.empty() || frameComponents == 0)
+                return false;
+            hdr.scanComponents = seg[0];
+            if (hdr.scanComponents < 1 || hdr.scanComponents > 4 || seg.size() < 1 + hdr.scanComponents * 2ULL + 3)
+                return false;
+            int hMax = 1, vMax = 1;
+            for (int c = 0; c < frameComponents; ++c)
+            {
+                hMax = std::max(hMax, sampling[c][0]);
+                vMax = std::max(vMax, sampling[c][1]);
+            }
+            bool tablesOk = true;
+            for (int c = 0; c < hdr.scanComponents; ++c)
+            {
+                const int id = seg[1 + c * 2];
+                const int f = static_cast<int>(std::find(componentIds, componentIds + frameComponents, id) - componentIds);
+                if (f == frameComponents)
+                    return false;
+                JpegScanComponent& sc = hdr.comps[c];
+                sc.blocksH = hdr.scanComponents == 1 ? 1 : sampling[f][0];
+                sc.blocksV = hdr.scanComponents == 1 ? 1 : sampling[f][1];
+                sc.dcTable = seg[2 + c * 2] >> 4;
+                sc.acTable = seg[2 + c * 2] & 0x0F;
+                tablesOk = tablesOk && sc.dcTable < 4 && sc.acTable < 4
+                    && hdr.dc[sc.dcTable].present && hdr.ac[sc.acTable].present;
+            }
+            // Only a single scan carrying every component can be walked to the
+            // end of the image; anything else is carved but not validated.
+            hdr.decodable = !hdr.progressive && tablesOk && hdr.scanComponents == frameComponents;
+            if (hdr.scanComponents == 1)
+                hdr.totalMcus = ((hdr.width + 7) / 8) * ((hdr.height + 7) / 8);
+            else
+                hdr.totalMcus = ((hdr.width + hMax * 8 - 1) / (hMax * 8)) * ((hdr.height + vMax * 8 - 1) / (vMax * 8));
+            hdr.ecsOffset = pos + 2 + len;
+            return true;
+        }
+        else if (marker == 0xD9 || marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0x00)
+        {
+            return false;
+        }
+        pos += 2 + len;
+    }
+    return false;
+}
+
+enum class JpegDecodeStatus { Complete, Error, OutOfData };
+
+// Resumable decoder state, snapshotted at MCU boundaries.
+struct JpegDecodeState {
+    ULONGLONG pos = 0;             // next byte to load
+    DWORD bitBuf = 0;
+    int bitCount = 0;
+    DWORD mcu = 0;
+    int nextRst = 0;
+};
+
+class JpegEcsWalker {
+    ClusterChainStream& m_s;
+    const JpegHeader& m_h;
+    JpegDecodeState m_st;
+    bool m_outOfData = false;
+
+    bool fill()
+    {
+        const int b = m_s.at(m_st.pos);
+        if (b < 0)
+        {
+            m_outOfData = true;
+            return false;
+        }
+        if (b == 0xFF)
+        {
+            const int next = m_s.at(m_st.pos + 1);
+            if (next < 0)
+            {
+                m_outOfData = true;
+                return false;
+            }
+            if (next != 0x00)
+                return false;  // marker inside an MCU
+            m_st.pos += 2;
+        }
+        else
+            ++m_st.pos;
+        m_st.bitBuf = (m_st.bitBuf << 8) | static_cast<DWORD>(b);
+        m_st.bitCount += 8;
+        return true;
+    }
+
+    int bits(int n)
+    {
+        while (m_st.bitCount < n)
+        {
+            if (!fill())
+                return -1;
+        }
+        m_st.bitCount -= n;
+        return static_cast<int>((m_st.bitBuf >> m_st.bitCount) & ((1u << n) - 1));
+    }
+
+    int decode(const JpegHuffman& t)
+    {
+        int code = 0;
+        for (int len = 1; len <= 16; ++len)
+        {
+            const int b = bits(1);
+            if (b < 0)
+                return -1;
+            code = (code << 1) | b;
+            if (t.maxCode[len] >= 0 && code <= t.maxCode[len] && code >= t.minCode[len])
+                return t.values[t.valPtr[len] + code - t.minCode[len]];
+        }
+        return -2;  // no such code
+    }
+
+    // Walks one 8x8 block's Huffman codes; coefficient values themselves are
+    // not needed to tell valid data from a foreign cluster.
+    bool block(const JpegScanComponent& c)
+    {
+        const int s = decode(m_h.dc[c.dcTable]);
+        if (s < 0 || s > 11)
+            return false;
+        if (s && bits(s) < 0)
+            return false;
+        for (int k = 1; k < 64; )
+        {
+            const int rs = decode(m_h.ac[c.acTable]);
+            if (rs < 0)
+                return false;
+            const int r = rs >> 4, sz = rs & 0x0F;
+            if (sz == 0)
+            {
+                if (r != 15)
+                    break;  // EOB
+                k += 16;
+                continue;
+            }
+            if (sz > 10)
+                return false;
+            k += r;
+            if (k > 63 || bits(sz) < 0)
+                return false;
+            ++k;
+        }
+        return true;
+    }
+
+public:
+    JpegEcsWalker(ClusterChainStream& s, const JpegHeader& h, const JpegDecodeState& start)
+        : m_s(s), m_h(h), m_st(start) {}
+
+    const JpegDecodeState& state() const { return m_st; }
+
+    // Decodes MCUs until the image is complete (EOI follows), decoding fails,
+    // or the stream runs out. 'snapshots[k]' receives the last MCU-boundary
+    // state whose consumed bytes all lie before file cluster k.
+    JpegDecodeStatus run(std::vector<JpegDecodeState>* snapshots, ULONGLONG& endPos)
+    {
+        const ULONGLONG cs = m_s.clusterSize();
+        while (m_st.mcu < m_h.totalMcus)
+        {
+            if (m_h.restartInterval && m_st.mcu && m_st.mcu % m_h.restartInterval == 0)
+            {
+                // Byte-align and expect RSTn in sequence.
+                m_st.bitCount = 0;
+                const int ff = m_s.at(m_st.pos), rst = m_s.at(m_st.pos + 1);
+                if (ff < 0 || rst < 0)
+                    return JpegDecodeStatus::OutOfData;
+                if (ff != 0xFF || rst != 0xD0 + m_st.nextRst)
+                {
+                    endPos = m_st.pos;
+                    return JpegDecodeStatus::Error;
+                }
+                m_st.pos += 2;
+                m_st.nextRst = (m_st.nextRst + 1) & 7;
+            }
+
+            if (snapshots)
+            {
+                const size_t k = static_cast<size_t>(m_st.pos / cs) + 1;
+                if (snapshots->size() <= k)
+                    snapshots->resize(k + 1);
+                (*snapshots)[k] = m_st;
+            }
+
+            m_outOfData = false;
+            for (int c = 0; c < m_h.scanComponents; ++c)
+            {
+                const JpegScanComponent& comp = m_h.comps[c];
+                for (int b = 0; b < comp.blocksH * comp.blocksV; ++b)
+                {
+                    if (!block(comp))
+                    {
+                        endPos = m_st.pos;
+                        return m_outOfData ? JpegDecodeStatus::OutOfData : JpegDecodeStatus::Error;
+                    }
+                }
+            }
+            ++m_st.mcu;
+        }
+
+        // All MCUs decoded: padding bits, then EOI.
+        const int ff = m_s.at(m_st.pos), eoi = m_s.at(m_st.pos + 1);
+        if (ff < 0 || eoi < 0)
+            return JpegDecodeStatus::OutOfData;
+        endPos = m_st.pos;
+        if (ff != 0xFF || eoi != 0xD9)
+            return JpegDecodeStatus::Error;
+        endPos = m_st.pos + 2;
+        return JpegDecodeStatus::Complete;
+    }
+};
+
+// Cheap filter run before a candidate cluster is decoded: entropy-coded data
+// only ever has 0xFF followed by 0x00 (stuffing), RSTn or EOI, and is never a
+// uniform fill.
+static bool IsPlausibleJpegEcsCluster(const BYTE* p, size_t n)
+{
+    if (n < 2 || memcmp(p, p + 1, n - 1) == 0)
+        return false;
+    if (p[0] == 0xFF && p[1] == 0xD8)
+        return false;  // start of another JPEG
+    for (const BYTE* q = p; (q = static_cast<const BYTE*>(memchr(q, 0xFF, p + n - 1 - q))) != nullptr; ++q)
+    {
+        const BYTE next = q[1];
+        if (next != 0x00 && next != 0xD9 && (next < 0xD0 || next > 0xD7))
+            return false;
+    }
+    return true;
+}
+
+struct JpegCarveResult {
+    ULONGLONG imageOffset = 0;
+    DWORD width = 0, height = 0;
+    bool validated = false;        // ECS walked to EOI
+    bool progressive = false;
+    ULONGLONG fileSize = 0;
+    DWORD bridges = 0;
+    std::vector<std::pair<ULONGLONG, ULONGLONG>> runs;
+    std::wstring outputPath;
+    std::string error;
+};
+
+// Tries every cluster on the file's grid as the continuation at boundary
+// 'boundary'. Candidates that pass the byte filter and decode through their
+// whole cluster are then decoded onwards contiguously: foreign entropy-coded
+// data (another photo from the same camera shares its Huffman tables)
+// decodes cleanly for a while but never ends exactly at this image's last
+// MCU. A candidate that completes the image wins; otherwise the one that
+// decodes the most MCUs. Both passes run one candidate per worker.
+static bool BridgeJpegFragment(const MappedImage& img, const JpegHeader& hdr, const ClusterChainStream& base,
+    size_t boundary, const JpegDecodeState& snap, ULONGLONG& chosen)
+{
+    const ULONGLONG cs = base.clusterSize();
+    const ULONGLONG phase = base.clusters[0] % cs;
+    const ULONGLONG gridCount = (img.size() - phase) / cs;
+    const ULONGLONG prev = base.clusters[boundary - 1];
+
+    auto trialStream = [&](ULONGLONG c, bool extend) {
+        ClusterChainStream trial(img, cs, base.clusters[0]);
+        trial.clusters.assign(base.clusters.begin(), base.clusters.begin() + boundary);
+        trial.clusters.push_back(c);
+        trial.extend = extend;
+        return trial;
+    };
+
+    std::mutex lock;
+    std::vector<ULONGLONG> candidates;
+    ParallelForRanges(gridCount, [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+        for (ULONGLONG g = begin; g < end; ++g)
+        {
+            const ULONGLONG c = phase + g * cs;
+            if (std::find(base.clusters.begin(), base.clusters.begin() + boundary, c) != base.clusters.begin() + boundary
+                || !IsPlausibleJpegEcsCluster(img.data() + c, static_cast<size_t>(cs)))
+                continue;
+            ClusterChainStream trial = trialStream(c, false);
+            JpegEcsWalker walker(trial, hdr, snap);
+            ULONGLONG endPos = 0;
+            if (walker.run(nullptr, endPos) == JpegDecodeStatus::Error)
+                continue;
+            std::lock_guard<std::mutex> guard(lock);
+            candidates.push_back(c);
+        }
+    });
+    if (candidates.empty())
+        return false;
+
+    struct Ranked { ULONGLONG cluster; bool complete; DWORD mcus; ULONGLONG distance; };
+    std::vector<Ranked> ranked(candidates.size());
+    ParallelForRanges(candidates.size(), [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            const ULONGLONG c = candidates[static_cast<size_t>(i)];
+            ClusterChainStream trial = trialStream(c, true);
+            JpegEcsWalker walker(trial, hdr, snap);
+            ULONGLONG endPos = 0;
+            const JpegDecodeStatus st = walker.run(nullptr, endPos);
+            ranked[static_cast<size_t>(i)] = { c, st == JpegDecodeStatus::Complete, walker.state().mcu,
+                c > prev ? c - prev : (1ULL << 62) + (prev - c) };
+        }
+    });
+    const Ranked& best = *std::min_element(ranked.begin(), ranked.end(), [](const Ranked& a, const Ranked& b) {
+        if (a.complete != b.complete)
+            return a.complete;
+        if (a.mcus != b.mcus)
+            return a.mcus > b.mcus;
+        return a.distance < b.distance;
+    });
+    chosen = best.cluster;
+    return true;
+}
+
+static void CarveJpegAt(const MappedImage& img, ULONGLONG hit, ULONGLONG clusterSize, JpegCarveResult& r)
+{
+    r.imageOffset = hit;
+    ClusterChainStream s(img, clusterSize, hit);
+    JpegHeader hdr;
+    if (!ParseJpegHeader(s, hdr))
+    {
+        r.error = "marker segments invalid";
+        return;
+    }
+    r.width = hdr.width;
+    r.height = hdr.height;
+    r.progressive = hdr.progressive;
+
+    ULONGLONG endPos = 0;
+    if (!hdr.decodable)
+    {
+        // Not walkable: carve contiguously to the first EOI after the header.
+        ULONGLONG pos = hdr.ecsOffset;
+        for (int b; (b = s.at(pos)) >= 0; ++pos)
+        {
+            if (b == 0xFF && s.at(pos + 1) == 0xD9)
+            {
+                endPos = pos + 2;
+                break;
+            }
+        }
+        if (!endPos)
+        {
+            r.error = "no EOI (progressive or multi-scan, not validated)";
+            return;
+        }
+    }
+    else
+    {
+        std::vector<JpegDecodeState> snapshots;
+        JpegDecodeState st;
+        st.pos = hdr.ecsOffset;
+        size_t lastBridge = 0;
+        for (;;)
+        {
+            JpegEcsWalker walker(s, hdr, st);
+            const JpegDecodeStatus status = walker.run(&snapshots, endPos);
+            if (status == JpegDecodeStatus::Complete)
+                break;
+            if (status == JpegDecodeStatus::OutOfData)
+            {
+                r.error = "image ends before EOI";
+                return;
+            }
+
+            // Decoding broke in cluster e. Errors surface a little after the
+            // real break, so the boundary before e and the one before that
+            // are tried.
+            const size_t e = static_cast<size_t>(endPos / clusterSize);
+            const size_t lowest = lastBridge + 1;
+            bool bridged = false;
+            for (size_t back = 0; back < 3 && e >= lowest + back; ++back)
+            {
+                const size_t b = e - back;
+                if (b >= snapshots.size() || snapshots[b].pos == 0)
+                    continue;  // no MCU starts in the cluster before this boundary
+                ULONGLONG chosen;
+                if (BridgeJpegFragment(img, hdr, s, b, snapshots[b], chosen))
+                {
+                    s.clusters.resize(b);
+                    s.clusters.push_back(chosen);
+                    st = snapshots[b];
+                    snapshots.resize(b + 1);
+                    lastBridge = b;
+                    ++r.bridges;
+                    bridged = true;
+                    break;
+                }
+            }
+            if (!bridged || r.bridges > 64)
+            {
+                r.error = "decoding breaks and no candidate cluster continues it";
+                return;
+            }
+        }
+        r.validated = true;
+    }
+
+    r.fileSize = endPos;
+    for (ULONGLONG k = 0; k * clusterSize < r.fileSize; ++k)
+    {
+        const ULONGLONG len = std::min(clusterSize, r.fileSize - k * clusterSize);
+        const ULONGLONG c = s.clusters[static_cast<size_t>(k)];
+        if (!r.runs.empty() && r.runs.back().first + r.runs.back().second == c)
+            r.runs.back().second += len;
+        else
+            r.runs.emplace_back(c, len);
+    }
+}
+
+static int CmdJpegCarve(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: jpegcarve <image> <output-dir> [cluster-KiB]");
+
+    MappedImage img(argv[0]);
+    const std::wstring outDir = argv[1];
+    const ULONGLONG clusterSize = (argc >= 3 ? _wcstoui64(argv[2], nullptr, 10) : 128) * 1024;
+    if (clusterSize == 0 || !IsPowerOfTwo(clusterSize))
+        FatalErrorMsg("Cluster size must be a power of two (in KiB).");
+    if (!CreateDirectoryW(outDir.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+        FatalError("Failed to create output directory");
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    // JPEG files begin on a cluster boundary; thumbnails embedded in Exif are
+    // skipped with their APP1 segment and never carved separately.
+    const ULONGLONG sectors = img.size() / 512;
+    std::vector<std::vector<ULONGLONG>> perWorker(WorkerThreadCount());
+    ParallelForRanges(sectors, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        for (ULONGLONG s = begin; s < end; ++s)
+        {
+            const BYTE* p = img.data() + s * 512;
+            if (p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF && p[3] >= 0xC0)
+                perWorker[worker].push_back(s * 512);
+        }
+    });
+    std::vector<ULONGLONG> hits;
+    for (const auto& w : perWorker)
+        hits.insert(hits.end(), w.begin(), w.end());
+    std::sort(hits.begin(), hits.end());
+
+    // Files are carved one after another; each bridge search fans out over
+    // all worker threads.
+    std::vector<JpegCarveResult> results(hits.size());
+    size_t carved = 0, validated = 0;
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+        JpegCarveResult& r = results[i];
+        CarveJpegAt(img, hits[i], clusterSize, r);
+        if (!r.error.empty())
+            continue;
+        wchar_t name[64];
+        swprintf_s(name, L"\\carved_%012llX.jpg", r.imageOffset);
+        const std::wstring path = outDir + name;
+        if (WriteCarvedRuns(img, path, r.runs))
+        {
+            r.outputPath = path;
+            ++carved;
+            validated += r.validated ? 1 : 0;
+        }
+        else
+            r.error = "failed to write output file";
+    }
+
+    QueryPerformanceCounter(&now);
+
+    printf("\n  --- JPEG Carving (%llu KiB clusters) ---\n", clusterSize / 1024);
+    printf("  %-16s %-11s %12s %6s %-9s %s\n", "Offset", "Size (px)", "Bytes", "Frags", "Status", "Detail");
+    for (const auto& r : results)
+    {
+        char dims[32];
+        sprintf_s(dims, "%lux%lu", r.width, r.height);
+        if (r.error.empty())
+            printf("  0x%014llX %-11s %12llu %6zu %-9s %s\n", r.imageOffset, dims, r.fileSize, r.runs.size(),
+                r.validated ? "valid" : "unchecked", r.progressive ? "progressive" : "");
+        else
+            printf("  0x%014llX %-11s %12s %6s %-9s %s\n", r.imageOffset, dims, "-", "-", "failed", r.error.c_str());
+    }
+    printf("\n  SOI hits: %zu, carved: %zu (%zu decode-validated), time: %.2f seconds\n",
+        hits.size(), carved, validated, (double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// ============================================================
+// Case report writer (Markdown + JSON)
+// ============================================================
+
+// One value rendered twice: as Markdown table text and as a JSON literal.
+struct ReportValue {
+    std::string text;
+    std::string json;
+};
+
+static std::string JsonQuote(const std::string& s)
+{
+    std::string out = "\"";
+    for (const char ch : s)
+    {
+        const unsigned char c = static_cast<unsigned char>(ch);
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20)
+            {
+                char buf[8];
+                sprintf_s(buf, "\\u%04X", c);
+                out += buf;
+            }
+            else
+                out.push_back(ch);
+        }
+    }
+    out += '"';
+    return out;
+}
+
+// 62921900032 -> "62,921,900,032", the form the hand-written report used.
+static std::string FormatThousands(ULONGLONG v)
+{
+    char digits[32];
+    sprintf_s(digits, "%llu", v);
+    std::string out;
+    const size_t n = strlen(digits);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i && (n - i) % 3 == 0)
+            out += ',';
+        out += digits[i];
+    }
+    return out;
+}
+
+static ReportValue ReportText(const std::string& s)
+{
+    return { s, JsonQuote(s) };
+}
+
+static ReportValue ReportCount(ULONGLONG v)
+{
+    return { FormatThousands(v), std::to_string(v) };
+}
+
+static ReportValue ReportHex(ULONGLONG v, int digits)
+{
+    char buf[32];
+    sprintf_s(buf, "`0x%0*llX`", digits, v);
+    return { buf, std::to_string(v) };
+}
+
+static ReportValue ReportBytes(ULONGLONG v)
+{
+    char buf[128];
+    FormatBytes(static_cast<LONGLONG>(v), buf, sizeof(buf));
+    return { buf, std::to_string(v) };
+}
+
+static ReportValue ReportReal(double v, int decimals)
+{
+    char buf[64];
+    sprintf_s(buf, "%.*f", decimals, v);
+    return { buf, buf };
+}
+
+static ReportValue ReportFlag(bool v)
+{
+    return { v ? "Yes" : "No", v ? "true" : "false" };
+}
+
+// Builds the Markdown and JSON documents side by side so both always carry
+// the same numbers. A section is a "Field | Value" table (one JSON object
+// member per field), optionally followed by record tables (JSON arrays of
+// objects). Free text goes to the Markdown only.
+// Section calls recorded for replay into another report: one array of
+// strings per call ("section", key, title / "field", key, label, text, json /
+// "paragraph", text / "end").
+typedef std::vector<std::vector<std::string>> ReportLog;
+
+class CaseReportWriter {
+    std::string m_md;
+    std::string m_json;
+    ReportLog* m_log = nullptr;
+    std::vector<bool> m_hasMember;         // per open JSON object/array
+    std::vector<std::pair<std::string, std::string>> m_columns;
+    std::string m_tableHead;               // emitted with the first Markdown row
+    int m_sections = 0;
+    int m_subsections = 0;
+    bool m_fieldTable = false;
+
+    static std::string MarkdownCell(const std::string& s)
+    {
+        std::string out;
+        for (const char c : s)
+        {
+            if (c == '|')
+                out += "\\|";
+            else if (c == '\n')
+                out += ' ';
+            else
+                out.push_back(c);
+        }
+        return out;
+    }
+
+    void jsonMember(const char* key)
+    {
+        if (m_hasMember.back())
+            m_json += ',';
+        m_hasMember.back() = true;
+        m_json += '\n';
+        m_json.append(m_hasMember.size() * 2, ' ');
+        if (key)
+            m_json += JsonQuote(key) + ": ";
+    }
+
+    void closeFieldTable()
+    {
+        if (m_fieldTable)
+            m_md += '\n';
+        m_fieldTable = false;
+    }
+
+public:
+    explicit CaseReportWriter(const std::string& title)
+    {
+        m_md = "# " + title + "\n\n";
+        m_json = "{";
+        m_hasMember.push_back(false);
+        jsonMember("title");
+        m_json += JsonQuote(title);
+    }
+
+    // Top-of-document line ("**Label:** value") and top-level JSON member.
+    void header(const char* key, const char* label, const ReportValue& v)
+    {
+        m_md += "**" + std::string(label) + ":** " + v.text + "  \n";
+        jsonMember(key);
+        m_json += v.json;
+    }
+
+    // Logs the section calls from here on (tables are not logged).
+    void recordTo(ReportLog* log) { m_log = log; }
+
+    void beginSection(const char* key, const char* title)
+    {
+        if (m_log)
+            m_log->push_back({ "section", key, title });
+        if (m_md.compare(m_md.size() - 2, 2, "\n\n") != 0)
+            m_md += '\n';
+        m_md += "---\n\n## " + std::to_string(++m_sections) + ". " + title + "\n\n";
+        m_subsections = 0;
+        jsonMember(key);
+        m_json += '{';
+        m_hasMember.push_back(false);
+    }
+
+    void endSection()
+    {
+        if (m_log)
+            m_log->push_back({ "end" });
+        closeFieldTable();
+        const bool any = m_hasMember.back();
+        m_hasMember.pop_back();
+        if (any)
+        {
+            m_json += '\n';
+            m_json.append(m_hasMember.size() * 2, ' ');
+        }
+        m_json += '}';
+    }
+
+    void field(const char* key, const char* label, const ReportValue& v)
+    {
+        if (m_log)
+            m_log->push_back({ "field", key, label, v.text, v.json });
+        if (!m_fieldTable)
+        {
+            m_md += "| Field | Value |\n|---|---|\n";
+            m_fieldTable = true;
+        }
+        m_md += "| **" + std::string(label) + "** | " + MarkdownCell(v.text) + " |\n";
+        jsonMember(key);
+        m_json += v.json;
+    }
+
+    void paragraph(const std::string& text)
+    {
+        if (m_log)
+            m_log->push_back({ "paragraph", text });
+        closeFieldTable();
+        m_md += text + "\n\n";
+    }
+
+    // Columns are (JSON key, Markdown header) pairs.
+    void beginTable(const char* key, const char* title,
+        const std::vector<std::pair<std::string, std::string>>& columns)
+    {
+        closeFieldTable();
+        m_md += "### " + std::to_string(m_sections) + "." + std::to_string(++m_subsections) + " " + title + "\n\n";
+        m_tableHead = "|";
+        for (const auto& c : columns)
+            m_tableHead += " " + c.second + " |";
+        m_tableHead += "\n|";
+        for (size_t i = 0; i < columns.size(); ++i)
+            m_tableHead += "---|";
+        m_tableHead += '\n';
+        m_columns = columns;
+        jsonMember(key);
+        m_json += '[';
+        m_hasMember.push_back(false);
+    }
+
+    // Rows past the Markdown limit of a long table go to the JSON only.
+    void row(const std::vector<ReportValue>& values, bool markdown = true)
+    {
+        jsonMember(nullptr);
+        m_json += '{';
+        for (size_t i = 0; i < values.size() && i < m_columns.size(); ++i)
+            m_json += (i ? ", " : "") + JsonQuote(m_columns[i].first) + ": " + values[i].json;
+        m_json += '}';
+        if (!markdown)
+            return;
+        m_md += m_tableHead;
+        m_tableHead.clear();
+        m_md += '|';
+        for (size_t i = 0; i < values.size() && i < m_columns.size(); ++i)
+            m_md += " " + MarkdownCell(values[i].text) + " |";
+        m_md += '\n';
+    }
+
+    // 'omittedFromMarkdown' rows were written with markdown = false.
+    void endTable(size_t omittedFromMarkdown = 0)
+    {
+        if (!m_tableHead.empty())
+            m_md += "*None.*\n";
+        m_tableHead.clear();
+        if (omittedFromMarkdown)
+            m_md += "\n*" + FormatThousands(omittedFromMarkdown) + " more row(s) in the JSON report.*\n";
+        m_md += '\n';
+        const bool any = m_hasMember.back();
+        m_hasMember.pop_back();
+        if (any)
+        {
+            m_json += '\n';
+            m_json.append(m_hasMember.size() * 2, ' ');
+        }
+        m_json += ']';
+    }
+
+    const std::string& markdown() const { return m_md; }
+    std::string json() const { return m_json + "\n}\n"; }
+};
+
+static bool WriteTextFile(const std::wstring& path, const std::string& text)
+{
+    HandleGuard hOut(CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!hOut.valid())
+        return false;
+    DWORD written = 0;
+    return WriteFile(hOut.get(), text.data(), static_cast<DWORD>(text.size()), &written, nullptr)
+        && written == text.size();
+}
+
+static bool ReadTextFile(const std::wstring& path, std::string& text, ULONGLONG maxBytes)
+{
+    HandleGuard hIn(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr));
+    LARGE_INTEGER size;
+    if (!hIn.valid() || !GetFileSizeEx(hIn.get(), &size) || static_cast<ULONGLONG>(size.QuadPart) > maxBytes)
+        return false;
+    text.resize(static_cast<size_t>(size.QuadPart));
+    DWORD got = 0;
+    return text.empty() || (ReadFile(hIn.get(), &text[0], static_cast<DWORD>(text.size()), &got, nullptr)
+        && got == text.size());
+}
+
+static std::string ReportLogJson(const ReportLog& log)
+{
+    std::string out = "[\n";
+    for (size_t i = 0; i < log.size(); ++i)
+    {
+        out += "  [";
+        for (size_t k = 0; k < log[i].size(); ++k)
+            out += (k ? ", " : "") + JsonQuote(log[i][k]);
+        out += i + 1 < log.size() ? "],\n" : "]\n";
+    }
+    return out + "]\n";
+}
+
+// Parses a JSON string at s[pos] (as JsonQuote writes them, plus \uXXXX
+// outside ASCII).
+static bool ParseJsonString(const std::string& s, size_t& pos, std::string& out)
+{
+    if (pos >= s.size() || s[pos] != '"')
+        return false;
+    out.clear();
+    for (++pos; pos < s.size(); ++pos)
+    {
+        char c = s[pos];
+        if (c == '"')
+        {
+            ++pos;
+            return true;
+        }
+        if (c != '\\')
+        {
+            out.push_back(c);
+            continue;
+        }
+        if (++pos >= s.size())
+            return false;
+        switch (s[pos]) {
+        case '"': case '\\': case '/': out.push_back(s[pos]); break;
+        case 'n': out.push_back('\n'); break;
+        case 'r': out.push_back('\r'); break;
+        case 't': out.push_back('\t'); break;
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'u':
+        {
+            if (pos + 4 >= s.size())
+                return false;
+            const WORD u = static_cast<WORD>(strtoul(s.substr(pos + 1, 4).c_str(), nullptr, 16));
+            out += Utf16ToUtf8(&u, 1);
+            pos += 4;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+// Reads back ReportLogJson: an array of arrays of strings.
+static bool ParseReportLog(const std::string& s, ReportLog& log)
+{
+    size_t pos = 0;
+    auto skip = [&]() { while (pos < s.size() && isspace(static_cast<unsigned char>(s[pos]))) ++pos; };
+    auto expect = [&](char c) { skip(); if (pos < s.size() && s[pos] == c) { ++pos; return true; } return false; };
+    log.clear();
+    if (!expect('['))
+        return false;
+    if (expect(']'))
+        return true;
+    do
+    {
+        if (!expect('['))
+            return false;
+        std::vector<std::string> rec;
+        if (!expect(']'))
+        {
+            do
+            {
+                skip();
+                std::string v;
+                if (!ParseJsonString(s, pos, v))
+                    return false;
+                rec.push_back(v);
+            } while (expect(','));
+            if (!expect(']'))
+                return false;
+        }
+        log.push_back(rec);
+    } while (expect(','));
+    return expect(']');
+}
+
+// A value ReportValue puts in the JSON: a string, a number or a flag.
+static bool IsReportJsonScalar(const std::string& v)
+{
+    if (v.empty())
+        return false;
+    if (v[0] == '"')
+    {
+        size_t pos = 0;
+        std::string out;
+        return ParseJsonString(v, pos, out) && pos == v.size();
+    }
+    if (v == "true" || v == "false")
+        return true;
+    return v.find_first_not_of("-+.0123456789eE") == std::string::npos;
+}
+
+// Replays recorded sections. Malformed records are skipped and an open
+// section is closed, so a damaged log cannot unbalance the report.
+static void ReplayReportLog(CaseReportWriter& w, const ReportLog& log)
+{
+    bool open = false;
+    for (const auto& rec : log)
+    {
+        const std::string op = rec.empty() ? "" : rec[0];
+        if (op == "section" && rec.size() == 3 && !open)
+        {
+            w.beginSection(rec[1].c_str(), rec[2].c_str());
+            open = true;
+        }
+        else if (op == "field" && rec.size() == 5 && open && IsReportJsonScalar(rec[4]))
+            w.field(rec[1].c_str(), rec[2].c_str(), { rec[3], rec[4] });
+        else if (op == "paragraph" && rec.size() == 2 && open)
+            w.paragraph(rec[1]);
+        else if (op == "end" && open)
+        {
+            w.endSection();
+            open = false;
+        }
+    }
+    if (open)
+        w.endSection();
+}
+
+// ============================================================
+// Streaming analysis during acquisition
+// ============================================================
+
+// Analyzers see the image exactly once, as the imaging loop fills its read
+// buffers. Each analyzer runs on its own worker thread and receives the
+// chunks strictly in stream order, so state that straddles a chunk boundary
+// (a signature split across two reads, an open uniform run, a partially
+// filled entropy block) is carried inside the analyzer itself. print() and
+// report() are only called after finish().
+class StreamAnalyzer {
+public:
+    virtual ~StreamAnalyzer() {}
+    virtual const char* name() const = 0;
+    virtual void consume(ULONGLONG offset, const BYTE* data, size_t len) = 0;
+    virtual void finish(ULONGLONG totalBytes) = 0;
+    virtual void print() const = 0;
+    virtual void report(CaseReportWriter& w) const = 0;
+};
+
+// Ring of page-aligned read buffers shared by the imaging loop and the
+// analyzer threads. Buffers are handed out round-robin; acquire() blocks
+// until every analyzer has released the slot it is about to reuse, which
+// throttles the reader to the slowest analyzer instead of queueing memory.
+class AcquisitionPipeline {
+    struct Slot {
+        BYTE* data = nullptr;
+        ULONGLONG offset = 0;
+        size_t length = 0;
+        size_t pending = 0;        // analyzers that have not consumed this slot yet
+    };
+
+    std::vector<std::unique_ptr<StreamAnalyzer>> m_analyzers;
+    std::vector<Slot> m_slots;
+    std::vector<std::thread> m_threads;
+    std::vector<double> m_busySeconds;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    ULONGLONG m_published = 0;
+    ULONGLONG m_totalBytes = 0;
+    ULONGLONG m_readerStalls = 0;
+    bool m_closed = false;
+
+    void run(size_t index)
+    {
+        StreamAnalyzer& analyzer = *m_analyzers[index];
+        LARGE_INTEGER freq, t0, t1;
+        QueryPerformanceFrequency(&freq);
+        for (ULONGLONG seq = 0;; ++seq)
+        {
+            Slot* slot = nullptr;
+            {
+                std::unique_lock<std::mutex> guard(m_lock);
+                m_wake.wait(guard, [&]() { return m_published > seq || m_closed; });
+                if (m_published <= seq)
+                    break;
+                slot = &m_slots[static_cast<size_t>(seq % m_slots.size())];
+            }
+
+            // The slot cannot be recycled while it is pending, so it is read
+            // without holding the lock.
+            QueryPerformanceCounter(&t0);
+            analyzer.consume(slot->offset, slot->data, slot->length);
+            QueryPerformanceCounter(&t1);
+            m_busySeconds[index] += (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (--slot->pending == 0)
+                m_wake.notify_all();
+        }
+
+        QueryPerformanceCounter(&t0);
+        analyzer.finish(m_totalBytes);
+        QueryPerformanceCounter(&t1);
+        m_busySeconds[index] += (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+    }
+
+public:
+    AcquisitionPipeline(std::vector<std::unique_ptr<StreamAnalyzer>> analyzers, DWORD chunkSize, DWORD slotCount)
+        : m_analyzers(std::move(analyzers)), m_slots(slotCount), m_busySeconds(m_analyzers.size(), 0.0)
+    {
+        for (auto& slot : m_slots)
+        {
+            slot.data = static_cast<BYTE*>(VirtualAlloc(nullptr, chunkSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+            if (!slot.data)
+                FatalError("VirtualAlloc failed for acquisition buffer");
+        }
+        for (size_t i = 0; i < m_analyzers.size(); ++i)
+            m_threads.emplace_back([this, i]() { run(i); });
+    }
+    ~AcquisitionPipeline()
+    {
+        if (!m_closed)
+            finish(m_totalBytes);
+        for (auto& slot : m_slots)
+            VirtualFree(slot.data, 0, MEM_RELEASE);
+    }
+    AcquisitionPipeline(const AcquisitionPipeline&) = delete;
+    AcquisitionPipeline& operator=(const AcquisitionPipeline&) = delete;
+
+    // Returns the buffer the next read must go into.
+    BYTE* acquire()
+    {
+        std::unique_lock<std::mutex> guard(m_lock);
+        Slot& slot = m_slots[static_cast<size_t>(m_published % m_slots.size())];
+        if (slot.pending)
+            ++m_readerStalls;
+        m_wake.wait(guard, [&]() { return slot.pending == 0; });
+        return slot.data;
+    }
+
+    // Hands the buffer returned by the last acquire() to every analyzer.
+    void publish(ULONGLONG offset, size_t length)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            Slot& slot = m_slots[static_cast<size_t>(m_published % m_slots.size())];
+            slot.offset = offset;
+            slot.length = length;
+            slot.pending = m_analyzers.size();
+            ++m_published;
+        }
+        m_wake.notify_all();
+    }
+
+    // Signals end of stream and waits for every analyzer to drain and finish.
+    void finish(ULONGLONG totalBytes)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_totalBytes = totalBytes;
+            m_closed = true;
+        }
+        m_wake.notify_all();
+        for (auto& t : m_threads)
+            t.join();
+        m_threads.clear();
+    }
+
+    void printReport() const
+    {
+        printf("\n  --- Streaming Analyzers ---\n");
+        for (size_t i = 0; i < m_analyzers.size(); ++i)
+            printf("  %-20s%.2f seconds busy\n", m_analyzers[i]->name(), m_busySeconds[i]);
+        printf("  Buffers:            %zu, reader waited for a free buffer %llu time(s)\n",
+            m_slots.size(), m_readerStalls);
+        for (const auto& a : m_analyzers)
+            a->print();
+    }
+
+    // The analyzer of type T, for results another section needs.
+    template <typename T>
+    const T* analyzer() const
+    {
+        for (const auto& a : m_analyzers)
+        {
+            if (const T* t = dynamic_cast<const T*>(a.get()))
+                return t;
+        }
+        return nullptr;
+    }
+
+    void writeReport(CaseReportWriter& w) const
+    {
+        w.beginSection("analysis_pass", "Analysis Pass");
+        w.paragraph("All metrics below were computed in one sequential read of the image: every buffer was "
+            "handed to each analyzer on its own thread while the next buffer was being read.");
+        w.field("bytes_analyzed", "Bytes Analyzed", ReportBytes(m_totalBytes));
+        w.field("buffers", "Read Buffers", ReportCount(m_slots.size()));
+        w.field("reader_stalls", "Reader Waited for a Buffer", ReportCount(m_readerStalls));
+        w.beginTable("analyzers", "Analyzers", { { "name", "Analyzer" }, { "busy_seconds", "Busy (s)" } });
+        for (size_t i = 0; i < m_analyzers.size(); ++i)
+            w.row({ ReportText(m_analyzers[i]->name()), ReportReal(m_busySeconds[i], 2) });
+        w.endTable();
+        w.endSection();
+
+        for (const auto& a : m_analyzers)
+            a->report(w);
+    }
+};
+
+// Re-cuts arbitrary stream chunks into whole 512-byte sectors. Chunks from
+// the imaging loop are sector multiples, so the copy path only runs for a
+// sector split across two reads.
+class SectorAssembler {
+    BYTE m_partial[512];
+    size_t m_fill = 0;
+    ULONGLONG m_partialOffset = 0;
+public:
+    template <typename Fn>
+    void feed(ULONGLONG offset, const BYTE* data, size_t len, Fn fn)
+    {
+        size_t i = 0;
+        if (m_fill)
+        {
+            const size_t take = std::min(len, 512 - m_fill);
+            memcpy(m_partial + m_fill, data, take);
+            m_fill += take;
+            i = take;
+            if (m_fill < 512)
+                return;
+            fn(m_partialOffset, static_cast<const BYTE*>(m_partial));
+            m_fill = 0;
+        }
+        for (; i + 512 <= len; i += 512)
+            fn(offset + i, data + i);
+        if (i < len)
+        {
+            m_partialOffset = offset + i;
+            m_fill = len - i;
+            memcpy(m_partial, data + i, m_fill);
+        }
+    }
+};
+
+// --- Signature scan ---
+
+enum class StreamSignature { Jpeg, IsoBmff, Png, Gif, Riff, Pdf, Zip, Count };
+
+static const char* StreamSignatureName(StreamSignature s)
+{
+    switch (s) {
+    case StreamSignature::Jpeg:    return "JPEG";
+    case StreamSignature::IsoBmff: return "MP4/MOV (ftyp)";
+    case StreamSignature::Png:     return "PNG";
+    case StreamSignature::Gif:     return "GIF";
+    case StreamSignature::Riff:    return "RIFF AVI/WAVE";
+    case StreamSignature::Pdf:     return "PDF";
+    case StreamSignature::Zip:     return "ZIP";
+    default:                       return "?";
+    }
+}
+
+// First bytes the signature scan anchors on (see SignatureScanAnalyzer::scan).
+static const BYTE g_streamAnchors[] = { 0xFF, 'f', 0x89, 'G', 'R', '%', 'P' };
+
+// File headers anywhere in the stream plus volume boot records on sector
+// boundaries. Matches are anchored on one byte; the ftyp box is anchored on
+// its type field and looks back at the size, so the scanner keeps a few bytes
+// of look-behind and a boot sector's worth of look-ahead across chunks.
+class SignatureScanAnalyzer : public StreamAnalyzer {
+    static const size_t kBack = 4;
+    static const size_t kAhead = 512;
+
+    bool m_anchor[256] = {};
+    std::vector<BYTE> m_carry;           // tail of the previous chunk (+ head of the current)
+    ULONGLONG m_carryOffset = 0;
+    ULONGLONG m_next = 0;                // first anchor position not scanned yet
+    ULONGLONG m_hits[static_cast<int>(StreamSignature::Count)] = {};
+    std::vector<ULONGLONG> m_aligned[static_cast<int>(StreamSignature::Count)];
+    std::vector<BootSectorHit> m_bootSectors;
+
+    void hit(StreamSignature s, ULONGLONG offset)
+    {
+        ++m_hits[static_cast<int>(s)];
+        if (offset % 512 == 0)
+            m_aligned[static_cast<int>(s)].push_back(offset);
+    }
+
+    // Scans anchors in [m_next, limit) of a buffer starting at stream offset
+    // 'base'. Unless this is the end of the stream, anchors without a full
+    // look-ahead are left for the next call.
+    void scan(const BYTE* buf, ULONGLONG base, size_t n, bool final)
+    {
+        if (!final && n <= kAhead)
+            return;
+        const ULONGLONG limit = final ? base + n : base + n - kAhead;
+        if (m_next >= limit)
+            return;
+        const size_t from = static_cast<size_t>(std::max(m_next, base) - base);
+        const size_t to = static_cast<size_t>(limit - base);
+
+        for (size_t i = from; i < to; ++i)
+        {
+            // SSE2 skip over 16-byte blocks that hold no anchor byte at all.
+            if ((i & 15) == 0 && i + 16 <= to)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+                __m128i any = _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(0xFF)));
+                for (size_t k = 1; k < sizeof(g_streamAnchors); ++k)
+                    any = _mm_or_si128(any, _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(g_streamAnchors[k]))));
+                if (_mm_movemask_epi8(any) == 0)
+                {
+                    i += 15;
+                    continue;
+                }
+            }
+            if (!m_anchor[buf[i]])
+                continue;
+            const BYTE* p = buf + i;
+            const size_t avail = n - i;
+            switch (p[0]) {
+            case 0xFF:
+                if (avail >= 4 && p[1] == 0xD8 && p[2] == 0xFF
+                    && ((p[3] & 0xF0) == 0xE0 || p[3] == 0xDB || p[3] == 0xC4 || p[3] == 0xFE))
+                    hit(StreamSignature::Jpeg, base + i);
+                break;
+            case 'f':
+                if (i >= kBack && avail >= 8 && IsPlausibleFtyp(p - kBack))
+                    hit(StreamSignature::IsoBmff, base + i - kBack);
+                break;
+            case 0x89:
+                if (avail >= 8 && memcmp(p, "\x89PNG\r\n\x1A\n", 8) == 0)
+                    hit(StreamSignature::Png, base + i);
+                break;
+            case 'G':
+                if (avail >= 6 && (memcmp(p, "GIF87a", 6) == 0 || memcmp(p, "GIF89a", 6) == 0))
+                    hit(StreamSignature::Gif, base + i);
+                break;
+            case 'R':
+                if (avail >= 12 && memcmp(p, "RIFF", 4) == 0
+                    && (memcmp(p + 8, "AVI ", 4) == 0 || memcmp(p + 8, "WAVE", 4) == 0))
+                    hit(StreamSignature::Riff, base + i);
+                break;
+            case '%':
+                if (avail >= 5 && memcmp(p, "%PDF-", 5) == 0)
+                    hit(StreamSignature::Pdf, base + i);
+                break;
+            case 'P':
+                if (avail >= 4 && memcmp(p, "PK\x03\x04", 4) == 0)
+                    hit(StreamSignature::Zip, base + i);
+                break;
+            }
+        }
+
+        for (ULONGLONG a = (base + from + 511) / 512 * 512; a < base + to; a += 512)
+        {
+            const BYTE* s = buf + (a - base);
+            BootSectorHit b;
+            if (n - (a - base) >= 512 && s[510] == 0x55 && s[511] == 0xAA && ParseBootSector(s, b.info))
+            {
+                b.offset = a;
+                m_bootSectors.push_back(b);
+            }
+        }
+        m_next = limit;
+    }
+
+public:
+    SignatureScanAnalyzer()
+    {
+        for (BYTE b : g_streamAnchors)
+            m_anchor[b] = true;
+    }
+
+    const char* name() const override { return "Signature scan"; }
+
+    void consume(ULONGLONG offset, const BYTE* data, size_t len) override
+    {
+        const size_t keep = kBack + kAhead;
+        const size_t head = std::min(len, keep);
+        if (!m_carry.empty())
+        {
+            // Anchors just before the boundary need look-ahead from this
+            // chunk: scan them in a small seam buffer.
+            m_carry.insert(m_carry.end(), data, data + head);
+            scan(m_carry.data(), m_carryOffset, m_carry.size(), false);
+        }
+        scan(data, offset, len, false);
+
+        if (len >= keep)
+        {
+            m_carry.assign(data + len - keep, data + len);
+            m_carryOffset = offset + len - keep;
+        }
+        else
+        {
+            if (m_carry.empty())
+            {
+                m_carry.assign(data, data + len);
+                m_carryOffset = offset;
+            }
+            if (m_carry.size() > keep)
+            {
+                const size_t drop = m_carry.size() - keep;
+                m_carry.erase(m_carry.begin(), m_carry.begin() + drop);
+                m_carryOffset += drop;
+            }
+        }
+    }
+
+    void finish(ULONGLONG) override
+    {
+        scan(m_carry.data(), m_carryOffset, m_carry.size(), true);
+        for (auto& hit : m_bootSectors)
+        {
+            for (const auto& other : m_bootSectors)
+            {
+                if (other.info.kind == hit.info.kind && other.info.backupSector != 0
+                    && other.offset + other.info.backupSector * other.info.bytesPerSector == hit.offset)
+                    hit.isBackupCopy = true;
+            }
+        }
+    }
+
+    void print() const override
+    {
+        printf("\n  --- Signature Scan ---\n");
+        printf("  %-16s %10s %10s  %s\n", "Type", "Hits", "Aligned", "First sector-aligned offsets");
+        for (int s = 0; s < static_cast<int>(StreamSignature::Count); ++s)
+        {
+            printf("  %-16s %10llu %10zu ", StreamSignatureName(static_cast<StreamSignature>(s)),
+                m_hits[s], m_aligned[s].size());
+            for (size_t i = 0; i < m_aligned[s].size() && i < 4; ++i)
+                printf(" 0x%llX", m_aligned[s][i]);
+            if (m_aligned[s].size() > 4)
+                printf(" ...");
+            printf("\n");
+        }
+
+        printf("\n  --- Boot Sectors Found by Signature Scan ---\n");
+        if (m_bootSectors.empty())
+            printf("  (None)\n");
+        for (const auto& hit : m_bootSectors)
+        {
+            char sizeBuf[128];
+            FormatBytes(static_cast<LONGLONG>(hit.info.volumeSectors * hit.info.bytesPerSector), sizeBuf, sizeof(sizeBuf));
+            printf("  0x%012llX (LBA %llu): %-5s  %s, cluster %lu B%s\n",
+                hit.offset, hit.offset / 512, BootSectorKindName(hit.info.kind), sizeBuf,
+                hit.info.bytesPerSector * hit.info.sectorsPerCluster, hit.isBackupCopy ? " (backup copy)" : "");
+        }
+    }
+
+    // Boot sectors are reported with the partition tables, where they can be
+    // matched against the current MBR/GPT entries.
+    const std::vector<BootSectorHit>& bootSectors() const { return m_bootSectors; }
+
+    void report(CaseReportWriter& w) const override
+    {
+        w.beginSection("signature_scan", "File Signature Scan");
+        w.paragraph("Every byte offset was tested for the file headers below. Sector-aligned hits start on a "
+            "512-byte boundary, where a file written through a filesystem would begin; unaligned hits are "
+            "usually coincidences inside compressed data.");
+        w.beginTable("signatures", "Header Hits", { { "type", "Signature" }, { "hits", "Hits" },
+            { "aligned", "Sector-Aligned" }, { "aligned_offsets", "First Sector-Aligned Offsets" } });
+        for (int s = 0; s < static_cast<int>(StreamSignature::Count); ++s)
+        {
+            ReportValue offsets;
+            offsets.json = "[";
+            for (size_t i = 0; i < m_aligned[s].size(); ++i)
+            {
+                offsets.json += (i ? ", " : "") + std::to_string(m_aligned[s][i]);
+                if (i < 8)
+                {
+                    char buf[32];
+                    sprintf_s(buf, "%s`0x%llX`", i ? ", " : "", m_aligned[s][i]);
+                    offsets.text += buf;
+                }
+            }
+            offsets.json += "]";
+            if (m_aligned[s].size() > 8)
+                offsets.text += ", ...";
+            w.row({ ReportText(StreamSignatureName(static_cast<StreamSignature>(s))), ReportCount(m_hits[s]),
+                ReportCount(m_aligned[s].size()), offsets });
+        }
+        w.endTable();
+        w.endSection();
+    }
+};
+
+// --- Byte histogram and entropy ---
+
+// Shannon entropy of a byte histogram, in bits per byte.
+static double ShannonEntropy(const ULONGLONG* counts, ULONGLONG total)
+{
+    double h = 0.0;
+    for (int b = 0; b < 256; ++b)
+    {
+        if (counts[b])
+        {
+            const double p = static_cast<double>(counts[b]) / total;
+            h -= p * log2(p);
+        }
+    }
+    return h;
+}
+
+// Shannon entropy per 64 KiB block plus the byte histogram of the whole
+// image. A block that straddles two chunks is completed from the next one.
+class EntropyAnalyzer : public StreamAnalyzer {
+    static const size_t kBlock = 64 * 1024;
+
+    DWORD m_counts[4][256] = {};           // interleaved to break store-to-load chains
+    size_t m_fill = 0;
+    ULONGLONG m_histogram[256] = {};
+    ULONGLONG m_totalBytes = 0;
+    ULONGLONG m_buckets[8] = {};           // blocks by whole bits/byte
+    ULONGLONG m_nearRandom = 0;            // blocks >= 7.9 bits/byte
+    std::vector<BYTE> m_blockEntropy;      // bits/byte * 32 per block
+    std::vector<BYTE> m_blockDominant;     // most frequent byte per block
+    std::vector<DWORD> m_blockDominantCount;
+
+    void topBytes(int* top, int n) const
+    {
+        int order[256];
+        for (int b = 0; b < 256; ++b)
+            order[b] = b;
+        std::partial_sort(order, order + n, order + 256, [&](int x, int y) { return m_histogram[x] > m_histogram[y]; });
+        std::copy(order, order + n, top);
+    }
+
+    static const char* ClassifyEntropy(double h)
+    {
+        if (h < 0.01) return "Uniform fill";
+        if (h < 1.0) return "Nearly uniform";
+        if (h < 5.0) return "Structured (metadata, text, sparse)";
+        if (h < 7.9) return "Mixed / partly compressed";
+        return "Compressed or encrypted";
+    }
+
+    void closeBlock()
+    {
+        ULONGLONG counts[256];
+        for (int b = 0; b < 256; ++b)
+        {
+            counts[b] = static_cast<ULONGLONG>(m_counts[0][b]) + m_counts[1][b] + m_counts[2][b] + m_counts[3][b];
+            m_histogram[b] += counts[b];
+        }
+        const double h = ShannonEntropy(counts, m_fill);
+        const int dominant = static_cast<int>(std::max_element(counts, counts + 256) - counts);
+        m_blockEntropy.push_back(static_cast<BYTE>(std::min(255.0, h * 32.0 + 0.5)));
+        m_blockDominant.push_back(static_cast<BYTE>(dominant));
+        m_blockDominantCount.push_back(static_cast<DWORD>(counts[dominant]));
+        ++m_buckets[std::min(7, static_cast<int>(h))];
+        m_nearRandom += h >= 7.9 ? 1 : 0;
+        memset(m_counts, 0, sizeof(m_counts));
+        m_fill = 0;
+    }
+
+public:
+    const char* name() const override { return "Entropy"; }
+
+    void consume(ULONGLONG, const BYTE* data, size_t len) override
+    {
+        m_totalBytes += len;
+        size_t i = 0;
+        while (i < len)
+        {
+            const size_t take = std::min(len - i, kBlock - m_fill);
+            const BYTE* p = data + i;
+            size_t k = 0;
+            for (; k + 4 <= take; k += 4)
+            {
+                ++m_counts[0][p[k]];
+                ++m_counts[1][p[k + 1]];
+                ++m_counts[2][p[k + 2]];
+                ++m_counts[3][p[k + 3]];
+            }
+            for (; k < take; ++k)
+                ++m_counts[0][p[k]];
+            m_fill += take;
+            i += take;
+            if (m_fill == kBlock)
+                closeBlock();
+        }
+    }
+
+    void finish(ULONGLONG) override
+    {
+        if (m_fill)
+            closeBlock();
+    }
+
+    void print() const override
+    {
+        printf("\n  --- Byte Histogram / Entropy (64 KiB blocks) ---\n");
+        printf("  Whole image:        %.4f bits/byte over %llu bytes\n",
+            ShannonEntropy(m_histogram, std::max<ULONGLONG>(m_totalBytes, 1)), m_totalBytes);
+        int top[3];
+        topBytes(top, 3);
+        printf("  Most common bytes:  0x%02X (%.1f%%), 0x%02X (%.1f%%), 0x%02X (%.1f%%)\n",
+            top[0], 100.0 * m_histogram[top[0]] / std::max<ULONGLONG>(m_totalBytes, 1),
+            top[1], 100.0 * m_histogram[top[1]] / std::max<ULONGLONG>(m_totalBytes, 1),
+            top[2], 100.0 * m_histogram[top[2]] / std::max<ULONGLONG>(m_totalBytes, 1));
+
+        const size_t blocks = m_blockEntropy.size();
+        for (int k = 0; k < 8; ++k)
+        {
+            printf("  %d-%d bits/byte:      %10llu blocks (%5.1f%%)\n", k, k + 1, m_buckets[k],
+                blocks ? 100.0 * m_buckets[k] / blocks : 0.0);
+        }
+        printf("  >= 7.9 bits/byte:   %10llu blocks (compressed or encrypted)\n", m_nearRandom);
+        if (!blocks)
+            return;
+
+        // Map: 64 cells per row, at most 16 rows; each cell shows the mean
+        // entropy of the blocks it covers.
+        static const char kLevels[] = " .:-=+*#";
+        const size_t perCell = std::max<size_t>(1, (blocks + 64 * 16 - 1) / (64 * 16));
+        printf("\n  Entropy map (one cell = %zu KiB; ' '=0 .:-=+*# =7 bits/byte, @ >= 7.9):\n", perCell * kBlock / 1024);
+        for (size_t row = 0; row * 64 * perCell < blocks; ++row)
+        {
+            char line[65] = {};
+            size_t col = 0;
+            for (; col < 64; ++col)
+            {
+                const size_t first = (row * 64 + col) * perCell;
+                if (first >= blocks)
+                    break;
+                const size_t last = std::min(blocks, first + perCell);
+                ULONGLONG sum = 0;
+                for (size_t b = first; b < last; ++b)
+                    sum += m_blockEntropy[b];
+                const double h = static_cast<double>(sum) / (last - first) / 32.0;
+                line[col] = h >= 7.9 ? '@' : kLevels[std::min(7, static_cast<int>(h))];
+            }
+            line[col] = '\0';
+            printf("  0x%012llX |%s|\n", static_cast<ULONGLONG>(row * 64 * perCell * kBlock), line);
+        }
+    }
+
+    void report(CaseReportWriter& w) const override
+    {
+        const ULONGLONG total = std::max<ULONGLONG>(m_totalBytes, 1);
+        const ULONGLONG other = m_totalBytes - m_histogram[0xFF] - m_histogram[0x00];
+        w.beginSection("byte_statistics", "Byte-Level Statistics");
+        w.field("total_bytes", "Total Bytes", ReportCount(m_totalBytes));
+        w.field("bytes_ff", "0xFF Bytes", ReportCount(m_histogram[0xFF]));
+        w.field("percent_ff", "0xFF Percentage", ReportReal(100.0 * m_histogram[0xFF] / total, 4));
+        w.field("bytes_00", "0x00 Bytes", ReportCount(m_histogram[0x00]));
+        w.field("percent_00", "0x00 Percentage", ReportReal(100.0 * m_histogram[0x00] / total, 4));
+        w.field("bytes_other", "Other Bytes", ReportCount(other));
+        w.field("percent_other", "Other Percentage", ReportReal(100.0 * other / total, 4));
+        w.field("entropy", "Whole-Image Entropy (bits/byte)", ReportReal(ShannonEntropy(m_histogram, total), 4));
+        int top[8];
+        topBytes(top, 8);
+        w.beginTable("most_common", "Most Common Byte Values", { { "byte", "Byte" }, { "count", "Count" },
+            { "percent", "Percentage" } });
+        for (int b : top)
+            w.row({ ReportHex(b, 2), ReportCount(m_histogram[b]), ReportReal(100.0 * m_histogram[b] / total, 4) });
+        w.endTable();
+        w.endSection();
+
+        const size_t blocks = m_blockEntropy.size();
+        w.beginSection("entropy", "Entropy Analysis");
+        w.field("block_size", "Block Size", ReportBytes(kBlock));
+        w.field("blocks", "Blocks", ReportCount(blocks));
+        w.field("near_random_blocks", "Blocks >= 7.9 bits/byte", ReportCount(m_nearRandom));
+        w.beginTable("distribution", "Distribution", { { "bits_from", "Bits/Byte From" }, { "bits_to", "To" },
+            { "blocks", "Blocks" }, { "percent", "Percentage" } });
+        for (int k = 0; k < 8; ++k)
+        {
+            w.row({ ReportCount(k), ReportCount(k + 1), ReportCount(m_buckets[k]),
+                ReportReal(blocks ? 100.0 * m_buckets[k] / blocks : 0.0, 2) });
+        }
+        w.endTable();
+
+        // Evenly spaced samples across the image, like the hand-picked
+        // offsets of the original report.
+        const size_t samples = std::min<size_t>(blocks, 16);
+        w.beginTable("samples", "Samples", { { "offset", "Offset" }, { "entropy", "Entropy (bits/byte)" },
+            { "dominant_byte", "Dominant Byte" }, { "dominant_count", "Dominant Count" },
+            { "classification", "Classification" } });
+        for (size_t i = 0; i < samples; ++i)
+        {
+            const size_t b = i * blocks / samples;
+            const double h = m_blockEntropy[b] / 32.0;
+            w.row({ ReportHex(static_cast<ULONGLONG>(b) * kBlock, 12), ReportReal(h, 2),
+                ReportHex(m_blockDominant[b], 2), ReportCount(m_blockDominantCount[b]), ReportText(ClassifyEntropy(h)) });
+        }
+        w.endTable();
+        w.endSection();
+    }
+};
+
+// --- Uniform-region index ---
+
+struct UniformExtent {
+    ULONGLONG offset = 0;
+    ULONGLONG length = 0;
+    BYTE value = 0;
+};
+
+// SSE2 test whether every byte of 'p' equals the first; len must be a
+// multiple of 64.
+static bool IsUniformBlock(const BYTE* p, size_t len, BYTE& value)
+{
+    value = p[0];
+    const __m128i v = _mm_set1_epi8(static_cast<char>(value));
+    for (size_t i = 0; i < len; i += 64)
+    {
+        const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), v);
+        const __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 16)), v);
+        const __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 32)), v);
+        const __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 48)), v);
+        if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))) != 0xFFFF)
+            return false;
+    }
+    return true;
+}
+
+// SSE2 count of bytes in 'p' that differ from 'value'; len must be a
+// multiple of 16.
+static size_t CountBytesNotEqual(const BYTE* p, size_t len, BYTE value)
+{
+    const __m128i v = _mm_set1_epi8(static_cast<char>(value));
+    size_t differ = 0;
+    for (size_t i = 0; i < len; i += 16)
+    {
+        const int eq = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), v));
+        for (unsigned m = ~static_cast<unsigned>(eq) & 0xFFFF; m; m &= m - 1)
+            ++differ;
+    }
+    return differ;
+}
+
+// Stretch of the image holding data other than erased 0xFF; sectors closer
+// than the merge gap belong to the same region.
+struct NonFfRegion {
+    ULONGLONG offset = 0;
+    ULONGLONG length = 0;
+    ULONGLONG nonFfBytes = 0;
+};
+
+// Run-length index of sectors filled with a single byte value (zeroed,
+// erased 0xFF, or any other fill). A run stays open across chunks. Also
+// maps the regions that still hold anything but 0xFF, which on a card the
+// controller has erased is where all recoverable data lives.
+class UniformRegionAnalyzer : public StreamAnalyzer {
+    static const ULONGLONG kNonFfGap = 1024 * 1024;
+
+    SectorAssembler m_sectors;
+    UniformExtent m_open;
+    std::vector<UniformExtent> m_extents;
+    std::vector<NonFfRegion> m_nonFf;
+    ULONGLONG m_zeroBytes = 0, m_ffBytes = 0, m_otherBytes = 0, m_totalBytes = 0;
+
+    void addNonFf(ULONGLONG at, size_t count)
+    {
+        if (!count)
+            return;
+        if (m_nonFf.empty() || at > m_nonFf.back().offset + m_nonFf.back().length + kNonFfGap)
+        {
+            m_nonFf.push_back(NonFfRegion());
+            m_nonFf.back().offset = at;
+        }
+        NonFfRegion& r = m_nonFf.back();
+        r.length = at + 512 - r.offset;
+        r.nonFfBytes += count;
+    }
+
+    void close()
+    {
+        if (!m_open.length)
+            return;
+        if (m_open.value == 0x00) m_zeroBytes += m_open.length;
+        else if (m_open.value == 0xFF) m_ffBytes += m_open.length;
+        else m_otherBytes += m_open.length;
+        m_extents.push_back(m_open);
+        m_open = UniformExtent();
+    }
+
+public:
+    const char* name() const override { return "Uniform regions"; }
+
+    void consume(ULONGLONG offset, const BYTE* data, size_t len) override
+    {
+        m_totalBytes += len;
+        m_sectors.feed(offset, data, len, [&](ULONGLONG at, const BYTE* s) {
+            BYTE value;
+            if (!IsUniformBlock(s, 512, value))
+            {
+                addNonFf(at, CountBytesNotEqual(s, 512, 0xFF));
+                close();
+                return;
+            }
+            if (value != 0xFF)
+                addNonFf(at, 512);
+            if (m_open.length && (m_open.value != value || m_open.offset + m_open.length != at))
+                close();
+            if (!m_open.length)
+            {
+                m_open.offset = at;
+                m_open.value = value;
+            }
+            m_open.length += 512;
+        });
+    }
+
+    void finish(ULONGLONG) override { close(); }
+
+    void print() const override
+    {
+        char buf[128];
+        printf("\n  --- Uniform Regions (512-byte sectors) ---\n");
+        FormatBytes(static_cast<LONGLONG>(m_zeroBytes), buf, sizeof(buf));
+        printf("  Zero-filled:        %s\n", buf);
+        FormatBytes(static_cast<LONGLONG>(m_ffBytes), buf, sizeof(buf));
+        printf("  0xFF-filled:        %s\n", buf);
+        FormatBytes(static_cast<LONGLONG>(m_otherBytes), buf, sizeof(buf));
+        printf("  Other fill byte:    %s\n", buf);
+        FormatBytes(static_cast<LONGLONG>(m_totalBytes - m_zeroBytes - m_ffBytes - m_otherBytes), buf, sizeof(buf));
+        printf("  Non-uniform:        %s\n", buf);
+        printf("  Extents:            %zu\n", m_extents.size());
+
+        std::vector<UniformExtent> largest = m_extents;
+        const size_t shown = std::min<size_t>(largest.size(), 16);
+        std::partial_sort(largest.begin(), largest.begin() + shown, largest.end(),
+            [](const UniformExtent& a, const UniformExtent& b) { return a.length > b.length; });
+        for (size_t i = 0; i < shown; ++i)
+        {
+            FormatBytes(static_cast<LONGLONG>(largest[i].length), buf, sizeof(buf));
+            printf("  0x%012llX - 0x%012llX  fill 0x%02X  %s\n", largest[i].offset,
+                largest[i].offset + largest[i].length, largest[i].value, buf);
+        }
+
+        printf("  Non-0xFF Regions:   %zu (sectors within 1 MiB merged)\n", m_nonFf.size());
+    }
+
+    void report(CaseReportWriter& w) const override
+    {
+        w.beginSection("uniform_regions", "Uniform and Non-0xFF Regions");
+        w.field("zero_filled", "Zero-Filled", ReportBytes(m_zeroBytes));
+        w.field("ff_filled", "0xFF-Filled", ReportBytes(m_ffBytes));
+        w.field("other_fill", "Other Fill Byte", ReportBytes(m_otherBytes));
+        w.field("non_uniform", "Non-Uniform", ReportBytes(m_totalBytes - m_zeroBytes - m_ffBytes - m_otherBytes));
+        w.field("uniform_extents", "Uniform Extents", ReportCount(m_extents.size()));
+        w.field("non_ff_regions", "Non-0xFF Regions", ReportCount(m_nonFf.size()));
+
+        std::vector<UniformExtent> largest = m_extents;
+        const size_t shown = std::min<size_t>(largest.size(), 16);
+        std::partial_sort(largest.begin(), largest.begin() + shown, largest.end(),
+            [](const UniformExtent& a, const UniformExtent& b) { return a.length > b.length; });
+        w.beginTable("largest_uniform_extents", "Largest Uniform Extents", { { "start", "Start" }, { "end", "End" },
+            { "fill", "Fill" }, { "length", "Length" } });
+        for (size_t i = 0; i < shown; ++i)
+        {
+            w.row({ ReportHex(largest[i].offset, 12), ReportHex(largest[i].offset + largest[i].length, 12),
+                ReportHex(largest[i].value, 2), ReportBytes(largest[i].length) });
+        }
+        w.endTable();
+
+        w.paragraph("Sectors holding any byte other than 0xFF, merged when less than 1 MiB apart.");
+        const size_t mdRows = 64;
+        w.beginTable("non_ff", "Non-0xFF Regions", { { "start", "Start" }, { "end", "End" },
+            { "length", "Length" }, { "non_ff_bytes", "Non-0xFF Bytes" } });
+        for (size_t i = 0; i < m_nonFf.size(); ++i)
+        {
+            const NonFfRegion& r = m_nonFf[i];
+            w.row({ ReportHex(r.offset, 12), ReportHex(r.offset + r.length, 12), ReportBytes(r.length),
+                ReportCount(r.nonFfBytes) }, i < mdRows);
+        }
+        w.endTable(m_nonFf.size() > mdRows ? m_nonFf.size() - mdRows : 0);
+        w.endSection();
+    }
+};
+
+// --- exFAT metadata ---
+
+struct ExFatVolume {
+    ULONGLONG volumeOffset = 0;        // byte offset of the VBR in the image
+    BootSectorInfo boot;
+    DWORD bytesPerSector = 0;
+    DWORD clusterSize = 0;
+    DWORD numFats = 0;
+    DWORD activeFat = 0;
+    WORD volumeFlags = 0;
+    DWORD fatLengthSectors = 0;
+    DWORD clusterCount = 0;            // clusters numbered 2 .. clusterCount+1
+    DWORD rootCluster = 0;
+    ULONGLONG fatOffset = 0;           // absolute byte offset of the active FAT
+    ULONGLONG heapOffset = 0;          // absolute byte offset of cluster 2
+    const BYTE* fat = nullptr;         // active FAT, clusterCount + 2 entries
+    std::shared_ptr<std::vector<BYTE>> fatCopy;   // backs 'fat' when the image is not mapped
+};
+
+static bool ParseExFatBootSector(const BYTE* s, ULONGLONG offset, ExFatVolume& vol)
+{
+    vol = ExFatVolume();
+    if (!ParseBootSector(s, vol.boot) || vol.boot.kind != BootSectorKind::ExFat)
+        return false;
+
+    vol.volumeOffset = offset;
+    vol.bytesPerSector = vol.boot.bytesPerSector;
+    vol.clusterSize = vol.boot.bytesPerSector * vol.boot.sectorsPerCluster;
+    const DWORD fatOffsetSectors = LoadLE32(s + 0x50);
+    vol.fatLengthSectors = LoadLE32(s + 0x54);
+    const DWORD heapOffsetSectors = LoadLE32(s + 0x58);
+    vol.clusterCount = LoadLE32(s + 0x5C);
+    vol.rootCluster = LoadLE32(s + 0x60);
+    vol.volumeFlags = LoadLE16(s + 0x6A);
+    vol.numFats = s[0x6E];
+
+    const ULONGLONG bps = vol.bytesPerSector;
+    if (vol.numFats < 1 || vol.numFats > 2 || fatOffsetSectors < 24 || vol.fatLengthSectors == 0
+        || heapOffsetSectors < fatOffsetSectors + static_cast<ULONGLONG>(vol.numFats) * vol.fatLengthSectors
+        || vol.fatLengthSectors * bps < (vol.clusterCount + 2ULL) * 4
+        || vol.rootCluster < 2 || vol.rootCluster >= vol.clusterCount + 2ULL)
+        return false;
+
+    vol.activeFat = (vol.volumeFlags & 1) && vol.numFats == 2 ? 1 : 0;
+    vol.fatOffset = offset + (fatOffsetSectors + static_cast<ULONGLONG>(vol.activeFat) * vol.fatLengthSectors) * bps;
+    vol.heapOffset = offset + heapOffsetSectors * bps;
+    return true;
+}
+
+// Boot checksum over the first 11 sectors of the boot region, skipping
+// VolumeFlags and PercentInUse (exFAT spec 3.4).
+static DWORD ExFatBootChecksum(const BYTE* region, DWORD bytesPerSector)
+{
+    DWORD sum = 0;
+    for (size_t i = 0; i < static_cast<size_t>(bytesPerSector) * 11; ++i)
+    {
+        if (i == 106 || i == 107 || i == 112)
+            continue;
+        sum = ((sum & 1) ? 0x80000000u : 0) + (sum >> 1) + region[i];
+    }
+    return sum;
+}
+
+// Entry-set checksum (exFAT spec 6.3.3). Deleting a file only clears the
+// InUse bit of each entry without updating the checksum, so for a deleted set
+// the bit is put back before summing.
+static WORD ExFatEntrySetChecksum(const BYTE* set, size_t entries, bool restoreInUse)
+{
+    WORD sum = 0;
+    for (size_t i = 0; i < entries * 32; ++i)
+    {
+        if (i == 2 || i == 3)
+            continue;
+        const BYTE b = (restoreInUse && i % 32 == 0) ? static_cast<BYTE>(set[i] | 0x80) : set[i];
+        sum = static_cast<WORD>(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + b);
+    }
+    return sum;
+}
+
+static bool IsExFatDataCluster(const ExFatVolume& vol, DWORD cluster)
+{
+    return cluster >= 2 && cluster < static_cast<ULONGLONG>(vol.clusterCount) + 2;
+}
+
+static ULONGLONG ExFatClusterOffset(const ExFatVolume& vol, DWORD cluster)
+{
+    return vol.heapOffset + static_cast<ULONGLONG>(cluster - 2) * vol.clusterSize;
+}
+
+// Clusters of a stream: consecutive when NoFatChain is set, otherwise the
+// FAT chain. Never longer than 'length' bytes or the cluster count.
+static std::vector<DWORD> ExFatClusterChain(const ExFatVolume& vol, DWORD first, ULONGLONG length, bool noFatChain)
+{
+    std::vector<DWORD> chain;
+    const ULONGLONG want = std::min<ULONGLONG>((length + vol.clusterSize - 1) / vol.clusterSize, vol.clusterCount);
+    DWORD c = first;
+    for (ULONGLONG i = 0; i < want && IsExFatDataCluster(vol, c); ++i)
+    {
+        chain.push_back(c);
+        if (noFatChain)
+            ++c;
+        else if (vol.fat)
+            c = LoadLE32(vol.fat + static_cast<size_t>(c) * 4);
+        else
+            break;
+    }
+    return chain;
+}
+
+// Entry types that may appear in a directory cluster, live or deleted
+// (bit 7 is the InUse flag).
+static bool IsExFatDirEntryType(BYTE t)
+{
+    switch (t & 0x7F) {
+    case 0x00: return t == 0x00;  // 00h ends the directory; 80h is invalid
+    case 0x01: case 0x02: case 0x03: case 0x05:
+    case 0x20: case 0x21: case 0x22:
+    case 0x40: case 0x41:
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct ExFatFileRecord {
+    std::string path;              // UTF-8, '/'-separated
+    WORD attributes = 0;
+    DWORD firstCluster = 0;
+    ULONGLONG dataLength = 0;
+    ULONGLONG validDataLength = 0;
+    DWORD createTime = 0, modifyTime = 0, accessTime = 0;   // DOS date << 16 | time
+    BYTE create10ms = 0, modify10ms = 0;
+    BYTE createUtc = 0, modifyUtc = 0, accessUtc = 0;       // 80h | signed 15-minute offset
+    ULONGLONG entryOffset = 0;     // absolute image offset of the 85h/05h entry
+    bool noFatChain = false;       // data is contiguous; FAT entries not used
+    bool deleted = false;
+    bool checksumValid = true;
+    bool underDeletedParent = false;
+    bool orphan = false;
+};
+
+struct ExFatDirTask {
+    DWORD cluster = 0;
+    ULONGLONG length = 0;
+    bool noFatChain = false;
+    std::string path;
+    bool deletedParent = false;
+    bool orphan = false;
+};
+
+// Parses the file entry sets (85h/C0h/C1h, or 05h/40h/41h once deleted) of
+// one directory. 'dir' is the directory's clusters laid end to end and
+// offsets[i] is the image offset of its i-th cluster.
+static void ParseExFatDirectory(const ExFatVolume& vol, const BYTE* dir, size_t len,
+    const std::vector<ULONGLONG>& offsets, const ExFatDirTask& task,
+    std::vector<ExFatFileRecord>& out, std::vector<ExFatDirTask>& children)
+{
+    for (size_t pos = 0; pos + 32 <= len; pos += 32)
+    {
+        const BYTE* e = dir + pos;
+        if (e[0] == 0x00)
+            return;  // end-of-directory marker
+        if ((e[0] & 0x7F) != 0x05)
+            continue;
+
+        const bool deleted = !(e[0] & 0x80);
+        const size_t secondaries = e[1];
+        const BYTE* stream = e + 32;
+        if (secondaries < 2 || secondaries > 18 || pos + (secondaries + 1) * 32 > len
+            || stream[0] != (deleted ? 0x40 : 0xC0))
+            continue;
+
+        ExFatFileRecord rec;
+        rec.deleted = deleted;
+        rec.underDeletedParent = task.deletedParent;
+        rec.orphan = task.orphan;
+        rec.attributes = LoadLE16(e + 4);
+        rec.createTime = LoadLE32(e + 8);
+        rec.modifyTime = LoadLE32(e + 12);
+        rec.accessTime = LoadLE32(e + 16);
+        rec.create10ms = e[20];
+        rec.modify10ms = e[21];
+        rec.createUtc = e[22];
+        rec.modifyUtc = e[23];
+        rec.accessUtc = e[24];
+        rec.noFatChain = (stream[1] & 0x02) != 0;
+        rec.validDataLength = LoadLE64(stream + 8);
+        rec.firstCluster = LoadLE32(stream + 20);
+        rec.dataLength = LoadLE64(stream + 24);
+        rec.entryOffset = offsets[pos / vol.clusterSize] + pos % vol.clusterSize;
+        rec.checksumValid = ExFatEntrySetChecksum(e, secondaries + 1, deleted) == LoadLE16(e + 2);
+
+        const size_t nameLength = stream[3];
+        std::vector<WORD> name;
+        for (size_t k = 2; k <= secondaries && name.size() < nameLength; ++k)
+        {
+            const BYTE* n = e + k * 32;
+            if ((n[0] & 0x7F) != 0x41)
+                break;
+            for (int c = 0; c < 15 && name.size() < nameLength; ++c)
+                name.push_back(LoadLE16(n + 2 + c * 2));
+        }
+        rec.path = task.path + "/" + Utf16ToUtf8(name.data(), name.size());
+
+        // An entry set whose checksum fails was partly overwritten; its
+        // cluster fields cannot be trusted to lead to a directory.
+        if ((rec.attributes & 0x10) && rec.checksumValid && IsExFatDataCluster(vol, rec.firstCluster))
+        {
+            ExFatDirTask child;
+            child.cluster = rec.firstCluster;
+            child.length = rec.dataLength;
+            child.noFatChain = rec.noFatChain;
+            child.path = rec.path;
+            child.deletedParent = deleted || task.deletedParent;
+            child.orphan = task.orphan;
+            children.push_back(child);
+        }
+        const bool intact = rec.checksumValid;
+        out.push_back(std::move(rec));
+        if (intact)
+            pos += secondaries * 32;
+    }
+}
+
+// Captures exFAT metadata as it streams past: the boot region, the active
+// FAT and every cluster that parses as a directory. The allocation bitmap's
+// location is only known once the root directory has been seen, so the
+// stretch of the cluster heap before the root is buffered (bitmap and up-case
+// table normally live there); a bitmap placed after the root is captured
+// when it arrives. The directory tree is rebuilt from the captured clusters
+// in finish(), with no second read of the device.
+class ExFatCaptureAnalyzer : public StreamAnalyzer {
+    struct Capture {
+        ULONGLONG offset = 0;
+        ULONGLONG length = 0;
+        std::vector<BYTE>* dest = nullptr;
+        size_t destOffset = 0;
+    };
+
+    SectorAssembler m_sectors;
+    bool m_found = false;
+    ExFatVolume m_vol;
+    std::vector<Capture> m_captures;
+    std::vector<BYTE> m_bootRegion;
+    std::vector<BYTE> m_fat;
+    std::vector<BYTE> m_heapWindow;       // cluster heap up to the root directory
+
+    // Directory-candidate state of the cluster currently streaming past.
+    std::vector<BYTE> m_cluster;
+    bool m_clusterViable = false;
+
+    std::vector<DWORD> m_dirClusters;     // ascending: stream order is cluster order
+    std::vector<BYTE> m_dirData;
+
+    DWORD m_bitmapCluster = 0;
+    std::vector<BYTE> m_bitmap;
+    bool m_bitmapSeen = false;
+    bool m_bitmapMissing = false;
+    bool m_bootRegionComplete = false;
+    bool m_fatComplete = false;
+    bool m_bitmapComplete = false;
+
+    // Results, filled by finish().
+    std::string m_label;
+    bool m_bootChecksumValid = false;
+    ULONGLONG m_usedClusters = 0;
+    size_t m_orphanDirs = 0;
+    std::vector<ExFatFileRecord> m_files;
+
+    void addCapture(ULONGLONG offset, ULONGLONG length, std::vector<BYTE>* dest, size_t destOffset)
+    {
+        Capture c;
+        c.offset = offset;
+        c.length = length;
+        c.dest = dest;
+        c.destOffset = destOffset;
+        m_captures.push_back(c);
+    }
+
+    bool capturePending(const std::vector<BYTE>* dest) const
+    {
+        for (const auto& c : m_captures)
+        {
+            if (c.dest == dest)
+                return true;
+        }
+        return false;
+    }
+
+    void applyCaptures(ULONGLONG at, const BYTE* s)
+    {
+        for (size_t i = 0; i < m_captures.size();)
+        {
+            Capture& c = m_captures[i];
+            const ULONGLONG begin = std::max(at, c.offset);
+            const ULONGLONG end = std::min(at + 512, c.offset + c.length);
+            if (begin < end)
+                memcpy(c.dest->data() + c.destOffset + (begin - c.offset), s + (begin - at), static_cast<size_t>(end - begin));
+            if (c.offset + c.length <= at + 512)
+            {
+                m_captures[i] = m_captures.back();
+                m_captures.pop_back();
+            }
+            else
+                ++i;
+        }
+    }
+
+    // Sets up captures for everything the VBR points at.
+    void onVolume(ULONGLONG at, const BYTE* s)
+    {
+        const ULONGLONG bps = m_vol.bytesPerSector;
+        m_bootRegion.assign(static_cast<size_t>(12 * bps), 0);
+        memcpy(m_bootRegion.data(), s, 512);
+        addCapture(at + 512, 12 * bps - 512, &m_bootRegion, 512);
+
+        m_fat.assign((m_vol.clusterCount + 2ULL) * 4, 0);
+        addCapture(m_vol.fatOffset, m_fat.size(), &m_fat, 0);
+
+        const ULONGLONG rootOffset = ExFatClusterOffset(m_vol, m_vol.rootCluster);
+        const ULONGLONG windowLimit = 64ULL * 1024 * 1024;
+        m_heapWindow.assign(static_cast<size_t>(std::min(rootOffset - m_vol.heapOffset, windowLimit)), 0);
+        if (!m_heapWindow.empty())
+            addCapture(m_vol.heapOffset, m_heapWindow.size(), &m_heapWindow, 0);
+    }
+
+    // Called when the root directory's first cluster has streamed past:
+    // locates the allocation bitmap and fetches it from the buffered heap
+    // window or schedules its capture.
+    void onRootCluster(ULONGLONG streamPos)
+    {
+        for (size_t pos = 0; pos + 32 <= m_cluster.size(); pos += 32)
+        {
+            const BYTE* e = m_cluster.data() + pos;
+            if (e[0] == 0x00)
+                break;
+            if (e[0] != 0x81 || (e[1] & 1))
+                continue;
+
+            m_bitmapSeen = true;
+            m_bitmapCluster = LoadLE32(e + 20);
+            const ULONGLONG length = std::min<ULONGLONG>(LoadLE64(e + 24), (m_vol.clusterCount + 7ULL) / 8);
+            m_bitmap.assign(static_cast<size_t>(length), 0);
+
+            ExFatVolume vol = m_vol;
+            vol.fat = m_fat.data();
+            const std::vector<DWORD> chain = ExFatClusterChain(vol, m_bitmapCluster, length, false);
+            if (chain.size() * m_vol.clusterSize < length)
+                m_bitmapMissing = true;
+            for (size_t i = 0; i < chain.size(); ++i)
+            {
+                const ULONGLONG off = ExFatClusterOffset(m_vol, chain[i]);
+                const size_t dst = i * m_vol.clusterSize;
+                const size_t n = static_cast<size_t>(std::min<ULONGLONG>(m_vol.clusterSize, length - dst));
+                if (off >= streamPos)
+                    addCapture(off, n, &m_bitmap, dst);
+                else if (off - m_vol.heapOffset + n <= m_heapWindow.size())
+                    memcpy(m_bitmap.data() + dst, m_heapWindow.data() + (off - m_vol.heapOffset), n);
+                else
+                    m_bitmapMissing = true;
+            }
+            return;
+        }
+    }
+
+    // Accumulates the cluster under 'at' while every entry so far has a
+    // valid type; a cluster that survives and holds at least one file set
+    // or bitmap/label entry is kept as a directory cluster.
+    void onHeapSector(ULONGLONG at, const BYTE* s)
+    {
+        const ULONGLONG rel = at - m_vol.heapOffset;
+        const ULONGLONG index = rel / m_vol.clusterSize;
+        if (index >= m_vol.clusterCount)
+            return;
+        const ULONGLONG pos = rel % m_vol.clusterSize;
+        if (pos == 0)
+        {
+            m_cluster.clear();
+            m_clusterViable = true;
+        }
+        if (!m_clusterViable)
+            return;
+        for (size_t e = 0; e < 512; e += 32)
+        {
+            if (!IsExFatDirEntryType(s[e]))
+            {
+                m_clusterViable = false;
+                return;
+            }
+        }
+        m_cluster.insert(m_cluster.end(), s, s + 512);
+        if (pos + 512 < m_vol.clusterSize)
+            return;
+
+        bool hasSet = false;
+        for (size_t e = 0; e + 32 <= m_cluster.size() && !hasSet; e += 32)
+        {
+            const BYTE t = m_cluster[e];
+            const BYTE next = e + 64 <= m_cluster.size() ? m_cluster[e + 32] : 0;
+            hasSet = (t == 0x85 && next == 0xC0) || (t == 0x05 && next == 0x40) || t == 0x81 || t == 0x83;
+        }
+        if (!hasSet)
+            return;
+
+        const DWORD cluster = static_cast<DWORD>(index + 2);
+        m_dirClusters.push_back(cluster);
+        m_dirData.insert(m_dirData.end(), m_cluster.begin(), m_cluster.end());
+        if (cluster == m_vol.rootCluster)
+            onRootCluster(at + 512);
+    }
+
+    const BYTE* capturedCluster(DWORD cluster, size_t* index) const
+    {
+        const auto it = std::lower_bound(m_dirClusters.begin(), m_dirClusters.end(), cluster);
+        if (it == m_dirClusters.end() || *it != cluster)
+            return nullptr;
+        *index = static_cast<size_t>(it - m_dirClusters.begin());
+        return m_dirData.data() + *index * m_vol.clusterSize;
+    }
+
+    void walk(const ExFatVolume& vol, std::vector<ExFatDirTask>& queue, std::vector<BYTE>& visited)
+    {
+        while (!queue.empty())
+        {
+            const ExFatDirTask task = queue.back();
+            queue.pop_back();
+
+            // Only captured clusters can be read; the directory ends at the
+            // first cluster of its chain that did not parse as one.
+            std::vector<BYTE> bytes;
+            std::vector<ULONGLONG> offsets;
+            for (DWORD c : ExFatClusterChain(vol, task.cluster, task.length, task.noFatChain))
+            {
+                size_t index = 0;
+                const BYTE* data = capturedCluster(c, &index);
+                if (!data || visited[index])
+                    break;
+                visited[index] = 1;
+                bytes.insert(bytes.end(), data, data + vol.clusterSize);
+                offsets.push_back(ExFatClusterOffset(vol, c));
+            }
+            if (bytes.empty())
+                continue;
+
+            if (task.cluster == vol.rootCluster)
+            {
+                for (size_t pos = 0; pos + 32 <= bytes.size() && bytes[pos] != 0x00; pos += 32)
+                {
+                    if (bytes[pos] == 0x83)
+                    {
+                        WORD units[11];
+                        const size_t n = std::min<size_t>(bytes[pos + 1], 11);
+                        for (size_t i = 0; i < n; ++i)
+                            units[i] = LoadLE16(&bytes[pos + 2 + i * 2]);
+                        m_label = Utf16ToUtf8(units, n);
+                    }
+                }
+            }
+
+            std::vector<ExFatDirTask> children;
+            ParseExFatDirectory(vol, bytes.data(), bytes.size(), offsets, task, m_files, children);
+            queue.insert(queue.end(), children.begin(), children.end());
+        }
+    }
+
+public:
+    const char* name() const override { return "exFAT metadata"; }
+
+    void consume(ULONGLONG offset, const BYTE* data, size_t len) override
+    {
+        m_sectors.feed(offset, data, len, [&](ULONGLONG at, const BYTE* s) {
+            if (!m_found)
+            {
+                if (memcmp(s + 3, "EXFAT   ", 8) == 0 && ParseExFatBootSector(s, at, m_vol))
+                {
+                    m_found = true;
+                    onVolume(at, s);
+                }
+                return;
+            }
+            if (!m_captures.empty())
+                applyCaptures(at, s);
+            if (at >= m_vol.heapOffset)
+                onHeapSector(at, s);
+        });
+    }
+
+    void finish(ULONGLONG) override
+    {
+        if (!m_found)
+            return;
+
+        m_bootRegionComplete = !capturePending(&m_bootRegion);
+        m_fatComplete = !capturePending(&m_fat);
+        m_bitmapComplete = m_bitmapSeen && !m_bitmapMissing && !capturePending(&m_bitmap);
+        if (m_bootRegionComplete)
+        {
+            m_bootChecksumValid = ExFatBootChecksum(m_bootRegion.data(), m_vol.bytesPerSector)
+                == LoadLE32(m_bootRegion.data() + 11 * m_vol.bytesPerSector);
+        }
+        if (m_bitmapComplete)
+        {
+            for (DWORD c = 0; c < m_vol.clusterCount; ++c)
+                m_usedClusters += (m_bitmap[c / 8] >> (c % 8)) & 1;
+        }
+
+        ExFatVolume vol = m_vol;
+        vol.fat = m_fatComplete ? m_fat.data() : nullptr;
+        std::vector<BYTE> visited(m_dirClusters.size(), 0);
+        std::vector<ExFatDirTask> queue;
+        ExFatDirTask root;
+        root.cluster = vol.rootCluster;
+        root.length = static_cast<ULONGLONG>(vol.clusterCount) * vol.clusterSize;
+        queue.push_back(root);
+        walk(vol, queue, visited);
+
+        // Directory clusters the tree never reached: parents overwritten or
+        // deleted without a surviving entry set.
+        for (size_t i = 0; i < m_dirClusters.size(); ++i)
+        {
+            if (visited[i])
+                continue;
+            ExFatDirTask t;
+            t.cluster = m_dirClusters[i];
+            t.length = vol.clusterSize;
+            char name[64];
+            sprintf_s(name, "/<orphan@%lu>", t.cluster);
+            t.path = name;
+            t.orphan = true;
+            queue.push_back(t);
+            ++m_orphanDirs;
+            walk(vol, queue, visited);
+        }
+
+        std::sort(m_files.begin(), m_files.end(),
+            [](const ExFatFileRecord& a, const ExFatFileRecord& b) { return a.path < b.path; });
+    }
+
+    void print() const override
+    {
+        printf("\n  --- exFAT Metadata (captured from the stream) ---\n");
+        if (!m_found)
+        {
+            printf("  (No exFAT boot sector seen)\n");
+            return;
+        }
+
+        char sizeBuf[128];
+        FormatBytes(static_cast<LONGLONG>(m_vol.boot.volumeSectors * m_vol.bytesPerSector), sizeBuf, sizeof(sizeBuf));
+        printf("  Volume Offset:      0x%llX\n", m_vol.volumeOffset);
+        printf("  Volume Size:        %s\n", sizeBuf);
+        printf("  Label / Serial:     \"%s\" / %04lX-%04lX\n", m_label.c_str(),
+            (m_vol.boot.serialNumber >> 16) & 0xFFFF, m_vol.boot.serialNumber & 0xFFFF);
+        printf("  Bytes/Sector:       %lu\n", m_vol.bytesPerSector);
+        printf("  Cluster Size:       %lu bytes\n", m_vol.clusterSize);
+        printf("  FATs:               %lu x %lu sectors, active #%lu at 0x%llX%s\n", m_vol.numFats,
+            m_vol.fatLengthSectors, m_vol.activeFat + 1, m_vol.fatOffset, m_fatComplete ? "" : " (NOT captured)");
+        printf("  Cluster Heap:       0x%llX, %lu clusters\n", m_vol.heapOffset, m_vol.clusterCount);
+        printf("  Root Cluster:       %lu\n", m_vol.rootCluster);
+        printf("  Boot Checksum:      %s\n", !m_bootRegionComplete ? "not captured"
+            : m_bootChecksumValid ? "Valid" : "MISMATCH");
+        if (m_bitmapComplete)
+            printf("  Allocation Bitmap:  cluster %lu, used/free clusters: %llu / %llu\n", m_bitmapCluster,
+                m_usedClusters, m_vol.clusterCount - m_usedClusters);
+        else if (m_bitmapSeen)
+            printf("  Allocation Bitmap:  cluster %lu, NOT fully captured\n", m_bitmapCluster);
+        else
+            printf("  Allocation Bitmap:  no bitmap entry in the root directory\n");
+        printf("  Directory Clusters: %zu captured, %zu orphaned\n", m_dirClusters.size(), m_orphanDirs);
+
+        size_t deletedCount = 0;
+        for (const auto& f : m_files)
+            deletedCount += f.deleted || f.underDeletedParent ? 1 : 0;
+        printf("\n  --- exFAT Directory Entries (%zu, %zu deleted) ---\n", m_files.size(), deletedCount);
+        printf("  Flags: D=directory X=deleted P=under deleted parent O=orphan C=contiguous !=set checksum mismatch\n");
+        for (const auto& f : m_files)
+        {
+            char ts[32];
+            FormatFatTimestamp(static_cast<WORD>(f.modifyTime >> 16), static_cast<WORD>(f.modifyTime), ts, sizeof(ts));
+            printf("  %c%c%c%c%c%c %s %14llu  clu %-8lu @0x%010llX  %s\n",
+                (f.attributes & 0x10) ? 'D' : '-',
+                f.deleted ? 'X' : '-',
+                f.underDeletedParent ? 'P' : '-',
+                f.orphan ? 'O' : '-',
+                f.noFatChain ? 'C' : '-',
+                f.checksumValid ? ' ' : '!',
+                ts, f.dataLength, f.firstCluster, f.entryOffset, f.path.c_str());
+        }
+    }
+
+    void report(CaseReportWriter& w) const override
+    {
+        w.beginSection("exfat", "exFAT Volume");
+        w.field("found", "Boot Sector Found", ReportFlag(m_found));
+        if (!m_found)
+        {
+            w.endSection();
+            return;
+        }
+
+        char serial[16];
+        sprintf_s(serial, "%04lX-%04lX", (m_vol.boot.serialNumber >> 16) & 0xFFFF, m_vol.boot.serialNumber & 0xFFFF);
+        w.field("volume_offset", "Volume Offset", ReportHex(m_vol.volumeOffset, 0));
+        w.field("volume_size", "Volume Size", ReportBytes(m_vol.boot.volumeSectors * m_vol.bytesPerSector));
+        w.field("label", "Volume Label", ReportText(m_label));
+        w.field("serial", "Volume Serial", ReportText(serial));
+        w.field("bytes_per_sector", "Bytes/Sector", ReportCount(m_vol.bytesPerSector));
+        w.field("cluster_size", "Cluster Size", ReportBytes(m_vol.clusterSize));
+        w.field("fat_count", "FATs", ReportCount(m_vol.numFats));
+        w.field("active_fat_offset", "Active FAT Offset", ReportHex(m_vol.fatOffset, 0));
+        w.field("fat_captured", "FAT Captured", ReportFlag(m_fatComplete));
+        w.field("heap_offset", "Cluster Heap Offset", ReportHex(m_vol.heapOffset, 0));
+        w.field("cluster_count", "Cluster Count", ReportCount(m_vol.clusterCount));
+        w.field("root_cluster", "Root Directory Cluster", ReportCount(m_vol.rootCluster));
+        w.field("boot_checksum", "Boot Checksum", ReportText(!m_bootRegionComplete ? "not captured"
+            : m_bootChecksumValid ? "Valid" : "MISMATCH"));
+        w.field("bitmap_captured", "Allocation Bitmap Captured", ReportFlag(m_bitmapComplete));
+        if (m_bitmapComplete)
+        {
+            w.field("used_clusters", "Used Clusters", ReportCount(m_usedClusters));
+            w.field("free_clusters", "Free Clusters", ReportCount(m_vol.clusterCount - m_usedClusters));
+        }
+        w.field("directory_clusters", "Directory Clusters", ReportCount(m_dirClusters.size()));
+        w.field("orphan_directories", "Orphaned Directory Clusters", ReportCount(m_orphanDirs));
+
+        const size_t mdRows = 500;
+        w.beginTable("entries", "Directory Entries", { { "path", "Path" }, { "size", "Size" },
+            { "first_cluster", "First Cluster" }, { "entry_offset", "Entry Offset" }, { "modified", "Modified" },
+            { "directory", "Dir" }, { "deleted", "Deleted" }, { "orphan", "Orphan" },
+            { "contiguous", "Contiguous" }, { "checksum_valid", "Checksum OK" } });
+        for (size_t i = 0; i < m_files.size(); ++i)
+        {
+            const ExFatFileRecord& f = m_files[i];
+            char ts[32];
+            FormatFatTimestamp(static_cast<WORD>(f.modifyTime >> 16), static_cast<WORD>(f.modifyTime), ts, sizeof(ts));
+            w.row({ ReportText(f.path), ReportCount(f.dataLength), ReportCount(f.firstCluster),
+                ReportHex(f.entryOffset, 0), ReportText(ts), ReportFlag((f.attributes & 0x10) != 0),
+                ReportFlag(f.deleted || f.underDeletedParent), ReportFlag(f.orphan), ReportFlag(f.noFatChain),
+                ReportFlag(f.checksumValid) }, i < mdRows);
+        }
+        w.endTable(m_files.size() > mdRows ? m_files.size() - mdRows : 0);
+        w.endSection();
+    }
+};
+
+static std::vector<std::unique_ptr<StreamAnalyzer>> CreateStreamAnalyzers()
+{
+    std::vector<std::unique_ptr<StreamAnalyzer>> analyzers;
+    analyzers.emplace_back(new SignatureScanAnalyzer());
+    analyzers.emplace_back(new EntropyAnalyzer());
+    analyzers.emplace_back(new UniformRegionAnalyzer());
+    analyzers.emplace_back(new ExFatCaptureAnalyzer());
+    return analyzers;
+}
+
+// Reads an image sequentially into the pipeline's buffer ring, exactly as
+// the imaging loop feeds it, and waits for the analyzers to finish.
+static ULONGLONG StreamImageThroughPipeline(const wchar_t* path, AcquisitionPipeline& pipeline)
+{
+    HandleGuard file(CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!file.valid())
+    {
+        char msg[512];
+        sprintf_s(msg, "Failed to open image %ls", path);
+        FatalError(msg);
+    }
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(file.get(), &size))
+        FatalError("GetFileSizeEx failed on image");
+
+    char sizeBuf[128];
+    FormatBytes(size.QuadPart, sizeBuf, sizeof(sizeBuf));
+    printf("Image:              %ls\n", path);
+    printf("Image Size:         %s\n", sizeBuf);
+
+    const DWORD chunkSize = 4 * 1024 * 1024;
+    ULONGLONG total = 0;
+    for (;;)
+    {
+        BYTE* buf = pipeline.acquire();
+        DWORD got = 0;
+        if (!ReadFile(file.get(), buf, chunkSize, &got, nullptr))
+            FatalError("ReadFile failed on image");
+        if (got == 0)
+            break;
+        pipeline.publish(total, got);
+        total += got;
+    }
+    pipeline.finish(total);
+    return total;
+}
+
+// Runs the acquisition-time analyzers over an existing image, reading it
+// sequentially through the same buffer ring the imaging loop uses.
+static int CmdAnalyze(int argc, wchar_t* argv[])
+{
+    if (argc < 1)
+        FatalErrorMsg("Usage: analyze <image>");
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    AcquisitionPipeline pipeline(CreateStreamAnalyzers(), 4 * 1024 * 1024, 4);
+    const ULONGLONG total = StreamImageThroughPipeline(argv[0], pipeline);
+
+    QueryPerformanceCounter(&now);
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+    pipeline.printReport();
+    printf("\n  Analyzed %llu bytes in %.2f seconds (%.1f MB/s)\n", total, elapsed,
+        elapsed > 0 ? total / elapsed / (1024.0 * 1024.0) : 0.0);
+    return 0;
+}
+
+// ============================================================
+// Block-level image diff
+// ============================================================
+
+struct ImageDiffExtent {
+    ULONGLONG offset = 0;
+    ULONGLONG length = 0;
+    ULONGLONG bytesDiffering = 0;
+    int classA = -1;               // fill byte if every block is uniform, -1 = data, -2 = absent
+    int classB = -1;
+};
+
+static void FormatUniformClass(int cls, char* buf, size_t bufLen)
+{
+    if (cls == -2) sprintf_s(buf, bufLen, "absent");
+    else if (cls == -1) sprintf_s(buf, bufLen, "data");
+    else if (cls == 0x00) sprintf_s(buf, bufLen, "zero");
+    else if (cls == 0xFF) sprintf_s(buf, bufLen, "0xFF");
+    else sprintf_s(buf, bufLen, "fill 0x%02X", cls);
+}
+
+// SSE2 count of positions where a and b differ; len must be a multiple of 64.
+// Returns 0 as soon as the whole range compares equal, which is the common
+// case, after one pass of 64-byte compares.
+static ULONGLONG CountDifferingBytes(const BYTE* a, const BYTE* b, size_t len)
+{
+    ULONGLONG differ = 0;
+    for (size_t i = 0; i < len; i += 64)
+    {
+        int eq[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + k * 16));
+            const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + k * 16));
+            eq[k] = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        }
+        if ((eq[0] & eq[1] & eq[2] & eq[3]) == 0xFFFF)
+            continue;
+        for (int k = 0; k < 4; ++k)
+        {
+            for (unsigned m = ~static_cast<unsigned>(eq[k]) & 0xFFFF; m; m &= m - 1)
+                ++differ;
+        }
+    }
+    return differ;
+}
+
+// Compares two images block by block across all workers. Each worker emits
+// runs of differing blocks whose uniform classes stay the same on both sides;
+// runs that meet at a worker boundary are joined afterwards. Blocks past the
+// end of the shorter image are reported with class "absent" on that side.
+static std::vector<ImageDiffExtent> DiffImages(const MappedImage& a, const MappedImage& b, ULONGLONG blockSize)
+{
+    const ULONGLONG longer = std::max(a.size(), b.size());
+    const ULONGLONG common = std::min(a.size(), b.size()) / blockSize * blockSize;
+    const ULONGLONG blocks = (longer + blockSize - 1) / blockSize;
+
+    std::vector<std::vector<ImageDiffExtent>> perWorker(WorkerThreadCount());
+    ParallelForRanges(blocks, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        std::vector<ImageDiffExtent>& out = perWorker[worker];
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            const ULONGLONG off = i * blockSize;
+            ImageDiffExtent blk;
+            blk.offset = off;
+            blk.length = std::min(blockSize, longer - off);
+            if (off + blockSize <= common)
+            {
+                const BYTE* pa = a.data() + off;
+                const BYTE* pb = b.data() + off;
+                blk.bytesDiffering = CountDifferingBytes(pa, pb, static_cast<size_t>(blockSize));
+                if (blk.bytesDiffering == 0)
+                    continue;
+                BYTE v;
+                blk.classA = IsUniformBlock(pa, static_cast<size_t>(blockSize), v) ? v : -1;
+                blk.classB = IsUniformBlock(pb, static_cast<size_t>(blockSize), v) ? v : -1;
+            }
+            else
+            {
+                // Tail: the shorter image ends inside or before this block.
+                ULONGLONG same = 0;
+                for (ULONGLONG k = off; k < off + blk.length; ++k)
+                {
+                    if (k < a.size() && k < b.size() && a.data()[k] == b.data()[k])
+                        ++same;
+                }
+                blk.bytesDiffering = blk.length - same;
+                if (blk.bytesDiffering == 0)
+                    continue;
+                auto tailClass = [&](const MappedImage& img) {
+                    const BYTE* p = img.at(off, blk.length);
+                    if (!p)
+                        return off >= img.size() ? -2 : -1;
+                    for (ULONGLONG k = 1; k < blk.length; ++k)
+                    {
+                        if (p[k] != p[0])
+                            return -1;
+                    }
+                    return static_cast<int>(p[0]);
+                };
+                blk.classA = tailClass(a);
+                blk.classB = tailClass(b);
+            }
+
+            if (!out.empty())
+            {
+                ImageDiffExtent& last = out.back();
+                if (last.offset + last.length == off && last.classA == blk.classA && last.classB == blk.classB)
+                {
+                    last.length += blk.length;
+                    last.bytesDiffering += blk.bytesDiffering;
+                    continue;
+                }
+            }
+            out.push_back(blk);
+        }
+    });
+
+    std::vector<ImageDiffExtent> extents;
+    for (const auto& part : perWorker)
+    {
+        for (const auto& e : part)
+        {
+            if (!extents.empty())
+            {
+                ImageDiffExtent& last = extents.back();
+                if (last.offset + last.length == e.offset && last.classA == e.classA && last.classB == e.classB)
+                {
+                    last.length += e.length;
+                    last.bytesDiffering += e.bytesDiffering;
+                    continue;
+                }
+            }
+            extents.push_back(e);
+        }
+    }
+    return extents;
+}
+
+static int CmdImageDiff(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: imgdiff <image-A> <image-B> [block-bytes]");
+
+    ULONGLONG blockSize = 512;
+    if (argc >= 3)
+        blockSize = _wcstoui64(argv[2], nullptr, 0);
+    if (blockSize < 64 || blockSize % 64 != 0)
+        FatalErrorMsg("Block size must be a non-zero multiple of 64 bytes.");
+
+    MappedImage a(argv[0]);
+    MappedImage b(argv[1]);
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(a.size()), sizeBuf, sizeof(sizeBuf));
+    printf("Image A:            %ls (%s)\n", argv[0], sizeBuf);
+    FormatBytes(static_cast<LONGLONG>(b.size()), sizeBuf, sizeof(sizeBuf));
+    printf("Image B:            %ls (%s)\n", argv[1], sizeBuf);
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    const std::vector<ImageDiffExtent> extents = DiffImages(a, b, blockSize);
+
+    QueryPerformanceCounter(&now);
+
+    ULONGLONG extentBytes = 0, differing = 0;
+    printf("\n  --- Differing Extents (%llu-byte blocks) ---\n", blockSize);
+    if (extents.empty())
+        printf("  (None — images are identical)\n");
+    else
+        printf("  %-16s %-16s %14s %14s  %-10s %s\n", "Start", "End", "Length", "Bytes differ", "A", "B");
+    for (const auto& e : extents)
+    {
+        char ca[16], cb[16];
+        FormatUniformClass(e.classA, ca, sizeof(ca));
+        FormatUniformClass(e.classB, cb, sizeof(cb));
+        printf("  0x%014llX 0x%014llX %14llu %14llu  %-10s %s\n",
+            e.offset, e.offset + e.length, e.length, e.bytesDiffering, ca, cb);
+        extentBytes += e.length;
+        differing += e.bytesDiffering;
+    }
+
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+    FormatBytes(static_cast<LONGLONG>(extentBytes), sizeBuf, sizeof(sizeBuf));
+    printf("\n  Extents:            %zu covering %s\n", extents.size(), sizeBuf);
+    printf("  Bytes Differing:    %llu\n", differing);
+    printf("  Compare time:       %.2f seconds (%.1f MB/s)\n", elapsed,
+        elapsed > 0 ? std::max(a.size(), b.size()) / elapsed / (1024.0 * 1024.0) : 0.0);
+    return 0;
+}
+
+// ============================================================
+// Case report
+// ============================================================
+
+// Timing of the live acquisition, for the report of a freshly imaged card.
+struct AcquisitionStats {
+    ULONGLONG bytesRead = 0;
+    double readSeconds = 0.0;
+    double analysisLagSeconds = 0.0;   // analysis finished this long after the last read
+    DWORD chunkSize = 0;
+};
+
+// wchar_t strings are UTF-16 on Windows.
+static std::string WideToUtf8(const std::wstring& w)
+{
+    return Utf16ToUtf8(reinterpret_cast<const WORD*>(w.data()), w.size());
+}
+
+static void ReportDrive(CaseReportWriter& w, const PhysicalDriveInfo& d)
+{
+    char buf[128];
+    w.beginSection("drive", "Source Drive");
+    sprintf_s(buf, "\\\\.\\PhysicalDrive%lu", d.driveIndex);
+    w.field("device_path", "Device", ReportText(buf));
+    w.field("classification", "Classification", ReportText(ClassifyDrive(d)));
+    w.field("friendly_name", "Friendly Name", ReportText(WideToUtf8(d.friendlyName)));
+    w.field("bus_type", "Bus Type", ReportText(BusTypeName(d.device.busType)));
+    w.field("adapter_bus_type", "Adapter Bus Type", ReportText(BusTypeName(d.adapter.busType)));
+    w.field("removable_media", "Removable Media", ReportFlag(d.device.removableMedia != FALSE));
+    w.field("vendor_id", "Vendor ID", ReportText(d.device.vendorId));
+    w.field("product_id", "Product ID", ReportText(d.device.productId));
+    w.field("product_revision", "Product Revision", ReportText(d.device.productRevision));
+    w.field("serial_number", "Serial Number", ReportText(d.device.serialNumber));
+    w.field("max_transfer", "Max Transfer Size", ReportBytes(d.adapter.maxTransferLength));
+    w.field("alignment_mask", "Alignment Mask", ReportHex(d.adapter.alignmentMask, 8));
+    w.field("disk_size", "Disk Size", ReportBytes(static_cast<ULONGLONG>(d.geometry.diskSizeBytes)));
+    w.field("bytes_per_sector", "Bytes/Sector", ReportCount(d.geometry.bytesPerSector));
+    w.field("media_type", "Media Type", ReportText(MediaTypeName(d.geometry.mediaType)));
+    w.field("hardware_ids", "Hardware IDs", ReportText(WideToUtf8(d.hardwareIds)));
+    w.field("sd_registers_read", "SD Registers Read", ReportFlag(d.hasSDRegisters));
+    if (!d.hasSDRegisters)
+    {
+        w.paragraph("The SD card registers (CID, CSD, SCR, OCR) could not be read: the reader's driver does not "
+            "implement the SFFDISK interface (bus type " + std::string(BusTypeName(d.device.busType))
+            + "). Identify the card from its label.");
+        w.endSection();
+        return;
+    }
+
+    const SD_CID_Register& cid = d.sdCID;
+    w.field("cid_manufacturer_id", "CID Manufacturer ID", ReportHex(cid.mid, 2));
+    w.field("cid_oem_id", "CID OEM ID", ReportText(cid.oid));
+    w.field("cid_product_name", "CID Product Name", ReportText(cid.pnm));
+    sprintf_s(buf, "%u.%u", cid.prv_major, cid.prv_minor);
+    w.field("cid_product_revision", "CID Product Revision", ReportText(buf));
+    w.field("cid_serial", "CID Serial Number", ReportHex(cid.psn, 8));
+    sprintf_s(buf, "%04u-%02u", cid.mdt_year, cid.mdt_month);
+    w.field("cid_manufactured", "CID Manufacturing Date", ReportText(buf));
+    w.field("csd_capacity", "CSD Capacity", ReportBytes(d.sdCSD.computedCapacityBytes));
+    w.field("speed_class", "Speed Class (SD Status)", ReportCount(d.sdStatus.speedClass));
+    w.field("uhs_speed_grade", "UHS Speed Grade", ReportCount(d.sdStatus.uhsSpeedGrade));
+    w.field("video_speed_class", "Video Speed Class", ReportCount(d.sdStatus.videoSpeedClass));
+    w.endSection();
+}
+
+static void ReportAcquisition(CaseReportWriter& w, const AcquisitionStats& acq)
+{
+    w.beginSection("acquisition", "Raw Image Acquisition");
+    w.field("bytes_read", "Bytes Read", ReportCount(acq.bytesRead));
+    w.field("read_seconds", "Read Time (s)", ReportReal(acq.readSeconds, 1));
+    w.field("throughput_mb_s", "Average Throughput (MB/s)",
+        ReportReal(acq.readSeconds > 0 ? acq.bytesRead / acq.readSeconds / (1024.0 * 1024.0) : 0.0, 1));
+    w.field("chunk_size", "Read Chunk Size", ReportBytes(acq.chunkSize));
+    w.field("analysis_lag_seconds", "Analysis Ready After Last Read (s)", ReportReal(acq.analysisLagSeconds, 2));
+    w.endSection();
+}
+
+// Partition structures from the mapped image; boot sectors come from the
+// streaming signature scan, which saw every sector of the image.
+static void ReportPartitions(CaseReportWriter& w, const RawPartitionTable& table)
+{
+    w.beginSection("partition_table", "Partition Table");
+    w.field("mbr_signature", "MBR Signature 55 AA", ReportFlag(table.mbrSignatureValid));
+    w.field("mbr_disk_signature", "MBR Disk Signature", ReportHex(table.mbrDiskSignature, 8));
+    w.field("mbr_boot_code_empty", "MBR Boot Code All Zeros", ReportFlag(table.mbrBootCodeEmpty));
+    w.field("protective_mbr", "Protective MBR (0xEE)", ReportFlag(table.protectiveMbr));
+    w.field("gpt_primary", "Primary GPT Header", ReportText(!table.gptPrimary.present ? "absent"
+        : table.gptPrimary.headerCrcValid ? "valid" : "CRC mismatch"));
+    w.field("gpt_backup", "Backup GPT Header", ReportText(!table.gptBackup.present ? "absent"
+        : table.gptBackup.headerCrcValid ? "valid" : "CRC mismatch"));
+    if (table.gptPrimary.present && table.gptBackup.present)
+        w.field("gpt_copies_match", "GPT Copies Match", ReportFlag(table.gptCopiesMatch));
+
+    w.beginTable("partitions", "Partition Entries", { { "source", "Source" }, { "index", "#" },
+        { "start_lba", "Start LBA" }, { "sectors", "Sectors" }, { "size", "Size" }, { "type", "Type" },
+        { "status", "Status / Name" } });
+    for (const auto& p : table.partitions)
+    {
+        char type[96], guid[64];
+        std::string status;
+        if (p.source == RawPartitionSource::Mbr || p.source == RawPartitionSource::Ebr)
+        {
+            sprintf_s(type, "0x%02X (%s)", p.mbrType, MbrPartitionTypeName(p.mbrType));
+            status = p.mbrStatus == 0x80 ? "Active" : "Inactive";
+        }
+        else
+        {
+            FormatGUID(p.gptType, guid, sizeof(guid));
+            sprintf_s(type, "%s", guid);
+            status = WideToUtf8(p.gptName);
+        }
+        w.row({ ReportText(RawPartitionSourceName(p.source)), ReportCount(p.index), ReportCount(p.firstLba),
+            ReportCount(p.sectorCount), ReportBytes(p.sectorCount * table.sectorSize), ReportText(type),
+            ReportText(status) });
+    }
+    w.endTable();
+
+    w.beginTable("boot_sectors", "Volume Boot Records", { { "offset", "Offset" }, { "lba", "LBA" },
+        { "kind", "Type" }, { "volume_size", "Volume Size" }, { "cluster_size", "Cluster" },
+        { "serial", "Serial" }, { "label", "Label" }, { "status", "Status" } });
+    for (const auto& hit : table.bootSectors)
+    {
+        char serial[16];
+        sprintf_s(serial, "%04lX-%04lX", (hit.info.serialNumber >> 16) & 0xFFFF, hit.info.serialNumber & 0xFFFF);
+        const char* status = hit.matchesCurrentTable ? "current"
+            : hit.isBackupCopy ? "backup copy"
+            : "stale (not referenced by any table)";
+        w.row({ ReportHex(hit.offset, 12), ReportCount(hit.offset / 512), ReportText(BootSectorKindName(hit.info.kind)),
+            ReportBytes(hit.info.volumeSectors * hit.info.bytesPerSector),
+            ReportBytes(hit.info.bytesPerSector * hit.info.sectorsPerCluster), ReportText(serial),
+            ReportText(hit.info.label), ReportText(status) });
+    }
+    w.endTable();
+
+    w.beginTable("warnings", "Consistency Warnings", { { "message", "Warning" } });
+    for (const auto& msg : table.warnings)
+        w.row({ ReportText(msg) });
+    w.endTable();
+    w.endSection();
+}
+
+// Saved next to the image by the acquisition, for a later 'report <image>'.
+static std::wstring AcquisitionLogPath(const std::wstring& imagePath)
+{
+    return imagePath + L".acq.json";
+}
+
+static bool WriteAcquisitionLog(const std::wstring& imagePath, const PhysicalDriveInfo& drive,
+    const AcquisitionStats& acq)
+{
+    ReportLog log;
+    CaseReportWriter w("Acquisition");
+    w.recordTo(&log);
+    ReportDrive(w, drive);
+    ReportAcquisition(w, acq);
+    return WriteTextFile(AcquisitionLogPath(imagePath), ReportLogJson(log));
+}
+
+// Assembles the report from one finished analysis pass. 'drive' and 'acq'
+// are only available when the report is produced right after imaging;
+// otherwise their sections come from the acquisition log, if there is one.
+static void BuildCaseReport(CaseReportWriter& w, const std::wstring& imagePath, ImageReader& img,
+    const PhysicalDriveInfo* drive, const AcquisitionStats* acq, const AcquisitionPipeline& pipeline)
+{
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    char date[32];
+    sprintf_s(date, "%04u-%02u-%02u %02u:%02u", now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute);
+    w.header("generated", "Generated", ReportText(date));
+    w.header("image_file", "Image File", ReportText("`" + WideToUtf8(imagePath) + "`"));
+    w.header("image_size", "Image Size", ReportBytes(img.size()));
+
+    if (drive)
+        ReportDrive(w, *drive);
+    if (acq)
+        ReportAcquisition(w, *acq);
+    if (!drive && !acq)
+    {
+        std::string text;
+        ReportLog log;
+        if (ReadTextFile(AcquisitionLogPath(imagePath), text, 1024 * 1024) && ParseReportLog(text, log))
+            ReplayReportLog(w, log);
+    }
+
+    RawPartitionTable table;
+    ParsePartitionStructures(img, table);
+    if (const SignatureScanAnalyzer* scan = pipeline.analyzer<SignatureScanAnalyzer>())
+    {
+        table.bootSectors = scan->bootSectors();
+        ClassifyBootSectors(table);
+    }
+    ReportPartitions(w, table);
+
+    pipeline.writeReport(w);
+}
+
+// Writes <outBase>.md and <outBase>.json for an image whose analysis pass
+// has finished.
+static bool WriteCaseReport(const std::wstring& imagePath, const std::wstring& outBase,
+    const PhysicalDriveInfo* drive, const AcquisitionStats* acq, const AcquisitionPipeline& pipeline)
+{
+    std::unique_ptr<ImageReader> img = ImageReader::Open(imagePath.c_str());
+    CaseReportWriter w("SD Card Forensic Analysis Report");
+    BuildCaseReport(w, imagePath, *img, drive, acq, pipeline);
+
+    const std::wstring mdPath = outBase + L".md";
+    const std::wstring jsonPath = outBase + L".json";
+    if (!WriteTextFile(mdPath, w.markdown()) || !WriteTextFile(jsonPath, w.json()))
+    {
+        printf("  WARNING: failed to write the case report (Win32 error %lu)\n", GetLastError());
+        return false;
+    }
+    printf("\n  Case report:        %ls\n", mdPath.c_str());
+    printf("                      %ls\n", jsonPath.c_str());
+    return true;
+}
+
+static int CmdReport(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: report <image> <out-base>");
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    AcquisitionPipeline pipeline(CreateStreamAnalyzers(), 4 * 1024 * 1024, 4);
+    const ULONGLONG total = StreamImageThroughPipeline(argv[0], pipeline);
+
+    QueryPerformanceCounter(&now);
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+    printf("  Analyzed %llu bytes in %.2f seconds (%.1f MB/s)\n", total, elapsed,
+        elapsed > 0 ? total / elapsed / (1024.0 * 1024.0) : 0.0);
+    return WriteCaseReport(argv[0], argv[1], nullptr, nullptr, pipeline) ? 0 : 1;
+}
+
+// ============================================================
+// Known-file block-hash database
+// ============================================================
+
+// Reference clips from the same camera (or copies that survived on a phone)
+// are cut into fixed blocks whose hashes go into an open-addressing table
+// stored as a flat file, so the scanner maps it and probes it in place.
+// Block hashes are built from 512-byte sector hashes with a polynomial that
+// can be rolled one sector at a time: every sector of the image is hashed
+// once no matter how large the block is, and a block is tried at every
+// sector offset because a filesystem may place a file on any sector.
+
+struct BlockHashDbHeader {
+    char magic[8];                 // "BLKHSHDB"
+    DWORD version;
+    DWORD blockSize;               // multiple of 512
+    ULONGLONG slotCount;           // power of two
+    ULONGLONG entryCount;
+    ULONGLONG fileCount;
+    ULONGLONG filesOffset;         // BlockHashDbFile[fileCount]
+    ULONGLONG namesOffset;         // NUL-terminated UTF-8 names
+    ULONGLONG slotsOffset;         // BlockHashSlot[slotCount], 64-byte aligned
+};
+
+struct BlockHashDbFile {
+    ULONGLONG size;
+    ULONGLONG nameOffset;          // relative to namesOffset
+};
+
+// 16 bytes: four slots per cache line, so a probe sequence rarely leaves
+// the line it started in at the table's 50% load factor.
+struct BlockHashSlot {
+    ULONGLONG hash;                // 0 = empty
+    DWORD file;
+    DWORD block;
+};
+
+static_assert(sizeof(BlockHashDbHeader) == 64, "database header layout");
+static_assert(sizeof(BlockHashSlot) == 16, "database slot layout");
+
+static const DWORD g_blockHashDbVersion = 1;
+static const ULONGLONG g_blockHashMultiplier = 0x9E3779B97F4A7C15ULL;
+
+static ULONGLONG Rotl64(ULONGLONG x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// xxHash64-style four-lane hash of one 512-byte sector.
+static ULONGLONG SectorHash64(const BYTE* p)
+{
+    const ULONGLONG p1 = 0x9E3779B185EBCA87ULL, p2 = 0xC2B2AE3D27D4EB4FULL, p3 = 0x165667B19E3779F9ULL;
+    ULONGLONG v[4] = { p1 + p2, p2, 0, 0 - p1 };
+    for (size_t i = 0; i < 512; i += 32)
+    {
+        for (int k = 0; k < 4; ++k)
+            v[k] = Rotl64(v[k] + LoadLE64(p + i + k * 8) * p2, 31) * p1;
+    }
+    ULONGLONG h = Rotl64(v[0], 1) + Rotl64(v[1], 7) + Rotl64(v[2], 12) + Rotl64(v[3], 18);
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Final mix of the rolling polynomial; never 0, which marks an empty slot.
+static ULONGLONG FinishBlockHash(ULONGLONG poly)
+{
+    poly ^= poly >> 33;
+    poly *= 0xFF51AFD7ED558CCDULL;
+    poly ^= poly >> 33;
+    poly *= 0xC4CEB9FE1A85EC53ULL;
+    poly ^= poly >> 33;
+    return poly ? poly : 1;
+}
+
+// Hash of 'sectors' consecutive sectors, identical to what the rolling scan
+// computes for the same bytes.
+static ULONGLONG BlockHash(const BYTE* p, DWORD sectors)
+{
+    ULONGLONG poly = 0;
+    for (DWORD i = 0; i < sectors; ++i)
+        poly = poly * g_blockHashMultiplier + SectorHash64(p + i * 512);
+    return FinishBlockHash(poly);
+}
+
+static ULONGLONG NextPowerOfTwo(ULONGLONG v)
+{
+    ULONGLONG p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+static void WriteFileFully(HANDLE h, const void* data, size_t len, const char* what)
+{
+    const BYTE* p = static_cast<const BYTE*>(data);
+    for (size_t done = 0; done < len; )
+    {
+        const DWORD piece = static_cast<DWORD>(std::min<size_t>(len - done, 64 * 1024 * 1024));
+        DWORD written = 0;
+        if (!WriteFile(h, p + done, piece, &written, nullptr) || written != piece)
+        {
+            char msg[256];
+            sprintf_s(msg, "WriteFile to %s failed", what);
+            FatalError(msg);
+        }
+        done += piece;
+    }
+}
+
+static int CmdHashDb(int argc, wchar_t* argv[])
+{
+    if (argc < 3)
+        FatalErrorMsg("Usage: hashdb <out.db> <block-bytes> <reference-file>...");
+
+    const ULONGLONG blockSize = _wcstoui64(argv[1], nullptr, 0);
+    if (blockSize < 512 || blockSize % 512 != 0 || blockSize > 1024 * 1024)
+        FatalErrorMsg("Block size must be a multiple of 512 bytes, at most 1 MiB.");
+    const DWORD sectorsPerBlock = static_cast<DWORD>(blockSize / 512);
+
+    // Hash every full block of every reference in parallel. Uniform blocks
+    // (zero or 0xFF padding) would match all over the image and are left out,
+    // as is the partial block at the end of each file.
+    struct PendingEntry { ULONGLONG hash; DWORD file; DWORD block; };
+    std::vector<PendingEntry> entries;
+    std::vector<BlockHashDbFile> files;
+    std::string names;
+    ULONGLONG skippedUniform = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        MappedImage ref(argv[i]);
+        const ULONGLONG blocks = ref.size() / blockSize;
+        if (blocks > 0xFFFFFFFFULL)
+            FatalErrorMsg("Reference file has too many blocks for the database format.");
+
+        std::vector<ULONGLONG> hashes(static_cast<size_t>(blocks), 0);
+        ParallelForRanges(blocks, [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+            for (ULONGLONG b = begin; b < end; ++b)
+            {
+                const BYTE* p = ref.data() + b * blockSize;
+                BYTE fill;
+                if (!IsUniformBlock(p, static_cast<size_t>(blockSize), fill))
+                    hashes[static_cast<size_t>(b)] = BlockHash(p, sectorsPerBlock);
+            }
+        });
+
+        const DWORD fileIndex = static_cast<DWORD>(files.size());
+        for (ULONGLONG b = 0; b < blocks; ++b)
+        {
+            if (hashes[static_cast<size_t>(b)])
+                entries.push_back({ hashes[static_cast<size_t>(b)], fileIndex, static_cast<DWORD>(b) });
+            else
+                ++skippedUniform;
+        }
+
+        BlockHashDbFile f;
+        f.size = ref.size();
+        f.nameOffset = names.size();
+        files.push_back(f);
+        names += WideToUtf8(argv[i]);
+        names += '\0';
+        printf("  %-60ls %10llu blocks\n", argv[i], blocks);
+    }
+
+    const ULONGLONG slotCount = NextPowerOfTwo(std::max<ULONGLONG>(entries.size() * 2, 1024));
+    const ULONGLONG mask = slotCount - 1;
+
+    BlockHashDbHeader hdr = {};
+    memcpy(hdr.magic, "BLKHSHDB", 8);
+    hdr.version = g_blockHashDbVersion;
+    hdr.blockSize = static_cast<DWORD>(blockSize);
+    hdr.slotCount = slotCount;
+    hdr.entryCount = entries.size();
+    hdr.fileCount = files.size();
+    hdr.filesOffset = sizeof(BlockHashDbHeader);
+    hdr.namesOffset = hdr.filesOffset + files.size() * sizeof(BlockHashDbFile);
+    hdr.slotsOffset = (hdr.namesOffset + names.size() + 63) / 64 * 64;
+
+    std::vector<BYTE> db(static_cast<size_t>(hdr.slotsOffset + slotCount * sizeof(BlockHashSlot)), 0);
+    memcpy(db.data(), &hdr, sizeof(hdr));
+    if (!files.empty())
+        memcpy(db.data() + hdr.filesOffset, files.data(), files.size() * sizeof(BlockHashDbFile));
+    memcpy(db.data() + hdr.namesOffset, names.data(), names.size());
+    BlockHashSlot* slots = reinterpret_cast<BlockHashSlot*>(db.data() + hdr.slotsOffset);
+    for (const auto& e : entries)
+    {
+        ULONGLONG s = e.hash & mask;
+        while (slots[s].hash)
+            s = (s + 1) & mask;
+        slots[s].hash = e.hash;
+        slots[s].file = e.file;
+        slots[s].block = e.block;
+    }
+
+    HandleGuard hOut(CreateFileW(argv[0], GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!hOut.valid())
+        FatalError("Failed to create hash database");
+    WriteFileFully(hOut.get(), db.data(), db.size(), "hash database");
+
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(db.size()), sizeBuf, sizeof(sizeBuf));
+    printf("\n  Database:           %ls (%s)\n", argv[0], sizeBuf);
+    printf("  Block Size:         %llu bytes\n", blockSize);
+    printf("  Entries:            %zu from %zu file(s), %llu uniform block(s) skipped\n",
+        entries.size(), files.size(), skippedUniform);
+    printf("  Slots:              %llu (load %.1f%%)\n", slotCount, 100.0 * entries.size() / slotCount);
+    return 0;
+}
+
+struct BlockHashMatch {
+    ULONGLONG imageOffset = 0;
+    DWORD file = 0;
+    DWORD block = 0;
+};
+
+// A view over a mapped database file, validated once on open.
+class BlockHashDb {
+    const MappedImage& m_map;
+    const BlockHashDbHeader* m_hdr = nullptr;
+    const BlockHashSlot* m_slots = nullptr;
+    ULONGLONG m_mask = 0;
+public:
+    explicit BlockHashDb(const MappedImage& map) : m_map(map)
+    {
+        if (map.size() < sizeof(BlockHashDbHeader))
+            FatalErrorMsg("Hash database is truncated.");
+        m_hdr = reinterpret_cast<const BlockHashDbHeader*>(map.data());
+        if (memcmp(m_hdr->magic, "BLKHSHDB", 8) != 0 || m_hdr->version != g_blockHashDbVersion)
+            FatalErrorMsg("Not a block-hash database (bad magic or version).");
+        if (m_hdr->blockSize < 512 || m_hdr->blockSize % 512 != 0 || !IsPowerOfTwo(m_hdr->slotCount)
+            || m_hdr->slotCount > map.size() / sizeof(BlockHashSlot)
+            || m_hdr->fileCount > map.size() / sizeof(BlockHashDbFile)
+            || m_hdr->filesOffset > map.size() || m_hdr->slotsOffset > map.size()
+            || m_hdr->slotsOffset % 64 != 0 || m_hdr->slotsOffset + m_hdr->slotCount * sizeof(BlockHashSlot) > map.size()
+            || m_hdr->filesOffset + m_hdr->fileCount * sizeof(BlockHashDbFile) > m_hdr->namesOffset
+            || m_hdr->namesOffset > m_hdr->slotsOffset)
+            FatalErrorMsg("Hash database header is inconsistent.");
+        m_slots = reinterpret_cast<const BlockHashSlot*>(map.data() + m_hdr->slotsOffset);
+        m_mask = m_hdr->slotCount - 1;
+
+        // Matches index the file table by the slot's file id
+        for (ULONGLONG s = 0; s < m_hdr->slotCount; ++s)
+        {
+            if (m_slots[s].hash && m_slots[s].file >= m_hdr->fileCount)
+                FatalErrorMsg("Hash database has an entry for a file it does not list.");
+        }
+    }
+
+    DWORD blockSize() const { return m_hdr->blockSize; }
+    ULONGLONG entryCount() const { return m_hdr->entryCount; }
+    ULONGLONG fileCount() const { return m_hdr->fileCount; }
+    const BlockHashDbFile& file(size_t i) const
+    {
+        return reinterpret_cast<const BlockHashDbFile*>(m_map.data() + m_hdr->filesOffset)[i];
+    }
+    const char* fileName(size_t i) const
+    {
+        const ULONGLONG off = m_hdr->namesOffset + file(i).nameOffset;
+        return off < m_hdr->slotsOffset ? reinterpret_cast<const char*>(m_map.data() + off) : "?";
+    }
+
+    void prefetch(ULONGLONG hash) const
+    {
+        _mm_prefetch(reinterpret_cast<const char*>(m_slots + (hash & m_mask)), _MM_HINT_T0);
+    }
+
+    template <typename Fn>
+    void lookup(ULONGLONG hash, Fn fn) const
+    {
+        for (ULONGLONG s = hash & m_mask; m_slots[s].hash; s = (s + 1) & m_mask)
+        {
+            if (m_slots[s].hash == hash)
+                fn(m_slots[s]);
+        }
+    }
+};
+
+// Rolls the block hash across every sector offset of the image, one
+// contiguous range per worker. Probes are issued a few windows behind the
+// hash computation so the table lines are already in cache when read.
+static std::vector<BlockHashMatch> ScanBlockHashes(const MappedImage& img, const BlockHashDb& db)
+{
+    const DWORD k = db.blockSize() / 512;
+    const ULONGLONG sectors = img.size() / 512;
+    const ULONGLONG windows = sectors >= k ? sectors - k + 1 : 0;
+
+    ULONGLONG topPower = 1;          // multiplier^(k-1): weight of the oldest sector
+    for (DWORD i = 1; i < k; ++i)
+        topPower *= g_blockHashMultiplier;
+
+    std::vector<std::vector<BlockHashMatch>> perWorker(WorkerThreadCount());
+    ParallelForRanges(windows, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        if (begin >= end)
+            return;
+        const size_t kDepth = 8;
+        ULONGLONG pending[kDepth];
+        std::vector<BlockHashMatch>& out = perWorker[worker];
+        auto probe = [&](ULONGLONG window, ULONGLONG hash) {
+            db.lookup(hash, [&](const BlockHashSlot& slot) {
+                BlockHashMatch m;
+                m.imageOffset = window * 512;
+                m.file = slot.file;
+                m.block = slot.block;
+                out.push_back(m);
+            });
+        };
+
+        std::vector<ULONGLONG> ring(k);
+        ULONGLONG poly = 0;
+        for (DWORD j = 0; j < k; ++j)
+        {
+            ring[j] = SectorHash64(img.data() + (begin + j) * 512);
+            poly = poly * g_blockHashMultiplier + ring[j];
+        }
+        for (ULONGLONG w = begin; w < end; ++w)
+        {
+            const ULONGLONG hash = FinishBlockHash(poly);
+            db.prefetch(hash);
+            if (w - begin >= kDepth)
+                probe(w - kDepth, pending[w % kDepth]);
+            pending[w % kDepth] = hash;
+
+            if (w + 1 < end)
+            {
+                // Drop sector w, append sector w + k.
+                const size_t slot = static_cast<size_t>((w - begin) % k);
+                const ULONGLONG incoming = SectorHash64(img.data() + (w + k) * 512);
+                poly = (poly - ring[slot] * topPower) * g_blockHashMultiplier + incoming;
+                ring[slot] = incoming;
+            }
+        }
+        for (ULONGLONG w = std::max(begin, end >= kDepth ? end - kDepth : 0); w < end; ++w)
+            probe(w, pending[w % kDepth]);
+    });
+
+    std::vector<BlockHashMatch> matches;
+    for (const auto& part : perWorker)
+        matches.insert(matches.end(), part.begin(), part.end());
+    return matches;
+}
+
+struct BlockHashRun {
+    ULONGLONG imageOffset = 0;
+    DWORD file = 0;
+    DWORD firstBlock = 0;
+    DWORD blocks = 0;
+};
+
+// Joins matches that continue the same file at the next block and the next
+// block-sized step in the image: one run per contiguous fragment.
+static std::vector<BlockHashRun> CoalesceBlockHashMatches(std::vector<BlockHashMatch>& matches, DWORD blockSize)
+{
+    // Sort by file, then by the image offset the file would start at, so the
+    // blocks of one fragment are adjacent.
+    auto origin = [&](const BlockHashMatch& m) { return m.imageOffset - static_cast<ULONGLONG>(m.block) * blockSize; };
+    std::sort(matches.begin(), matches.end(), [&](const BlockHashMatch& a, const BlockHashMatch& b) {
+        if (a.file != b.file) return a.file < b.file;
+        if (origin(a) != origin(b)) return origin(a) < origin(b);
+        return a.block < b.block;
+    });
+
+    std::vector<BlockHashRun> runs;
+    for (const auto& m : matches)
+    {
+        if (!runs.empty())
+        {
+            BlockHashRun& r = runs.back();
+            if (r.file == m.file && r.firstBlock + r.blocks == m.block
+                && r.imageOffset + static_cast<ULONGLONG>(r.blocks) * blockSize == m.imageOffset)
+            {
+                ++r.blocks;
+                continue;
+            }
+        }
+        BlockHashRun r;
+        r.imageOffset = m.imageOffset;
+        r.file = m.file;
+        r.firstBlock = m.block;
+        r.blocks = 1;
+        runs.push_back(r);
+    }
+    std::sort(runs.begin(), runs.end(),
+        [](const BlockHashRun& a, const BlockHashRun& b) { return a.imageOffset < b.imageOffset; });
+    return runs;
+}
+
+static int CmdHashScan(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: hashscan <db> <image> [min-run-blocks]");
+
+    DWORD minRun = 1;
+    if (argc >= 3)
+        minRun = std::max<DWORD>(1, wcstoul(argv[2], nullptr, 10));
+
+    MappedImage dbMap(argv[0]);
+    const BlockHashDb db(dbMap);
+    MappedImage img(argv[1]);
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(img.size()), sizeBuf, sizeof(sizeBuf));
+    printf("Database:           %ls (%llu blocks of %lu bytes from %llu file(s))\n",
+        argv[0], db.entryCount(), db.blockSize(), db.fileCount());
+    printf("Image:              %ls (%s)\n", argv[1], sizeBuf);
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    std::vector<BlockHashMatch> matches = ScanBlockHashes(img, db);
+    const size_t matchCount = matches.size();
+    const std::vector<BlockHashRun> runs = CoalesceBlockHashMatches(matches, db.blockSize());
+
+    QueryPerformanceCounter(&now);
+
+    std::vector<std::vector<bool>> covered(static_cast<size_t>(db.fileCount()));
+    for (size_t f = 0; f < covered.size(); ++f)
+        covered[f].assign(static_cast<size_t>(db.file(f).size / db.blockSize()), false);
+
+    printf("\n  --- Matching Runs (>= %lu block(s)) ---\n", minRun);
+    printf("  %-16s %-16s %8s %-14s %s\n", "Image start", "Image end", "Blocks", "File offset", "File");
+    size_t shown = 0;
+    for (const auto& r : runs)
+    {
+        for (DWORD b = r.firstBlock; b < r.firstBlock + r.blocks && b < covered[r.file].size(); ++b)
+            covered[r.file][b] = true;
+        if (r.blocks < minRun)
+            continue;
+        ++shown;
+        const ULONGLONG length = static_cast<ULONGLONG>(r.blocks) * db.blockSize();
+        printf("  0x%014llX 0x%014llX %8lu 0x%012llX %s\n", r.imageOffset, r.imageOffset + length,
+            r.blocks, static_cast<ULONGLONG>(r.firstBlock) * db.blockSize(), db.fileName(r.file));
+    }
+    if (!shown)
+        printf("  (None)\n");
+
+    printf("\n  --- Per-File Coverage ---\n");
+    for (size_t f = 0; f < covered.size(); ++f)
+    {
+        const size_t found = static_cast<size_t>(std::count(covered[f].begin(), covered[f].end(), true));
+        printf("  %6zu / %-6zu blocks (%5.1f%%)  %s\n", found, covered[f].size(),
+            covered[f].empty() ? 0.0 : 100.0 * found / covered[f].size(), db.fileName(f));
+    }
+
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+    printf("\n  Matches:            %zu in %zu run(s)\n", matchCount, runs.size());
+    printf("  Scan time:          %.2f seconds (%.1f MB/s, one probe per sector)\n", elapsed,
+        elapsed > 0 ? img.size() / elapsed / (1024.0 * 1024.0) : 0.0);
+    return 0;
+}
+
+// ============================================================
+// Strings extraction and trigram index
+// ============================================================
+
+// ASCII and UTF-16LE strings are pulled out of the image in one parallel
+// pass and written with a trigram index: for every case-folded trigram of
+// printable ASCII, the sorted list of strings that contain it. A query
+// intersects the lists of its trigrams and only reads those candidate
+// strings, so repeated searches never go back to the image.
+
+struct StringIndexHeader {
+    char magic[8];                 // "STRIDX01"
+    DWORD version;
+    DWORD minLength;
+    ULONGLONG imageSize;
+    ULONGLONG recordCount;
+    ULONGLONG recordsOffset;       // StringRecord[recordCount], by image offset
+    ULONGLONG textOffset;          // concatenated string bytes
+    ULONGLONG textBytes;
+    ULONGLONG trigramOffset;       // ULONGLONG[kTrigramCount + 1] posting starts
+    ULONGLONG postingsOffset;      // DWORD record indices
+};
+
+struct StringRecord {
+    ULONGLONG imageOffset;
+    ULONGLONG textOffset;          // relative to textOffset
+    DWORD length;                  // characters
+    DWORD utf16;                   // 1 = UTF-16LE in the image
+};
+
+static_assert(sizeof(StringIndexHeader) == 72, "string index header layout");
+static_assert(sizeof(StringRecord) == 24, "string record layout");
+
+static const DWORD g_stringIndexVersion = 1;
+static const ULONGLONG g_trigramCount = 95ULL * 95 * 95;   // printable ASCII, case-folded
+
+static ULONGLONG TrigramCode(const char* s)
+{
+    auto code = [](char c) { return static_cast<ULONGLONG>(tolower(static_cast<unsigned char>(c)) - 0x20); };
+    return (code(s[0]) * 95 + code(s[1])) * 95 + code(s[2]);
+}
+
+// Bit i set where p[i] is printable ASCII (0x20-0x7E). Bytes >= 0x80 are
+// negative as signed chars and fail the first compare.
+static unsigned PrintableMask16(const BYTE* p)
+{
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i ge = _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F));
+    const __m128i le = _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(ge, le)));
+}
+
+static unsigned ZeroMask16(const BYTE* p)
+{
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())));
+}
+
+// Gathers the even bits of a 16-bit mask into the low 8 bits.
+static unsigned CompactEvenBits(unsigned x)
+{
+    x &= 0x5555;
+    x = (x | (x >> 1)) & 0x3333;
+    x = (x | (x >> 2)) & 0x0F0F;
+    x = (x | (x >> 4)) & 0x00FF;
+    return x;
+}
+
+// Follows runs of set bits through consecutive masks of 'width' units, so
+// a run costs a couple of bit scans instead of a test per byte.
+class MaskRunTracker {
+    ULONGLONG m_start = 0;
+    ULONGLONG m_length = 0;            // 0 = no open run
+public:
+    bool open() const { return m_length != 0; }
+
+    // 'base' is the unit index of bit 0; emit(start, length) is called for
+    // every run that ends inside this mask.
+    template <typename Fn>
+    void feed(ULONGLONG base, unsigned mask, unsigned width, Fn emit)
+    {
+        const unsigned full = (1u << width) - 1;
+        unsigned rest = mask & full;
+        if (m_length)
+        {
+            if (rest == full)
+            {
+                m_length += width;
+                return;
+            }
+            unsigned long end;
+            _BitScanForward(&end, ~rest);
+            m_length += end;
+            emit(m_start, m_length);
+            m_length = 0;
+            rest &= ~((1u << end) - 1);
+        }
+        while (rest)
+        {
+            unsigned long s, len;
+            _BitScanForward(&s, rest);
+            _BitScanForward(&len, ~(rest >> s));
+            if (s + len >= width)
+            {
+                m_start = base + s;
+                m_length = width - s;
+                return;
+            }
+            emit(base + s, static_cast<ULONGLONG>(len));
+            rest &= ~((1u << (s + len)) - 1);
+        }
+    }
+
+    template <typename Fn>
+    void flush(Fn emit)
+    {
+        if (m_length)
+            emit(m_start, m_length);
+        m_length = 0;
+    }
+};
+
+struct ExtractedStrings {
+    std::vector<StringRecord> records;
+    std::string text;
+};
+
+// Long runs (text files, logs) are stored as overlapping pieces so that the
+// trigram lists stay selective; a query up to the overlap length never
+// straddles two pieces without being wholly inside one of them.
+static const ULONGLONG g_stringPieceChars = 4096;
+static const ULONGLONG g_stringPieceOverlap = 256;
+
+static void ExtractStrings(const MappedImage& img, DWORD minLength, ExtractedStrings& out)
+{
+    const BYTE* d = img.data();
+    const ULONGLONG size = img.size();
+    const ULONGLONG blocks = (size + 15) / 16;
+    auto isUtf16Char = [&](ULONGLONG pos) {
+        return pos + 1 < size && d[pos] >= 0x20 && d[pos] <= 0x7E && d[pos + 1] == 0;
+    };
+
+    std::vector<ExtractedStrings> perWorker(WorkerThreadCount());
+    ParallelForRanges(blocks, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        if (begin >= end)
+            return;
+        ExtractedStrings& local = perWorker[worker];
+        const ULONGLONG rangeBegin = begin * 16, rangeEnd = std::min(size, end * 16);
+
+        auto record = [&](ULONGLONG pos, ULONGLONG chars, bool utf16) {
+            if (chars < minLength || pos < rangeBegin || pos >= rangeEnd)
+                return;
+            const ULONGLONG stride = utf16 ? 2 : 1;
+            for (ULONGLONG first = 0;; first += g_stringPieceChars - g_stringPieceOverlap)
+            {
+                const ULONGLONG n = std::min(g_stringPieceChars, chars - first);
+                StringRecord r;
+                r.imageOffset = pos + first * stride;
+                r.textOffset = local.text.size();
+                r.length = static_cast<DWORD>(n);
+                r.utf16 = utf16 ? 1 : 0;
+                for (ULONGLONG c = 0; c < n; ++c)
+                    local.text.push_back(static_cast<char>(d[r.imageOffset + c * stride]));
+                local.records.push_back(r);
+                if (first + n >= chars)
+                    break;
+            }
+        };
+
+        // A run already open at the start of the range belongs to the
+        // previous worker, which follows it past its own end.
+        const ULONGLONG skipAscii = rangeBegin > 0 && d[rangeBegin - 1] >= 0x20 && d[rangeBegin - 1] <= 0x7E
+            ? rangeBegin : ~0ULL;
+        ULONGLONG skipUtf16[2];
+        for (int q = 0; q < 2; ++q)
+            skipUtf16[q] = rangeBegin + q >= 2 && isUtf16Char(rangeBegin + q - 2) ? rangeBegin + q : ~0ULL;
+
+        MaskRunTracker ascii, utf16[2];
+        auto emitAscii = [&](ULONGLONG start, ULONGLONG len) {
+            if (start != skipAscii)
+                record(start, len, false);
+        };
+        auto emitUtf16 = [&](int q) {
+            return [&, q](ULONGLONG unit, ULONGLONG len) {
+                const ULONGLONG pos = unit * 2 + q;
+                if (pos != skipUtf16[q])
+                    record(pos, len, true);
+            };
+        };
+
+        BYTE tail[32];
+        for (ULONGLONG b = begin; b < blocks; ++b)
+        {
+            const bool inRange = b < end;
+            if (!inRange && !ascii.open() && !utf16[0].open() && !utf16[1].open())
+                break;
+
+            const ULONGLONG pos = b * 16;
+            const BYTE* p = d + pos;
+            if (pos + 17 > size)
+            {
+                // Pad the last block with a byte that is neither printable
+                // nor zero.
+                memset(tail, 0xFF, sizeof(tail));
+                memcpy(tail, p, static_cast<size_t>(size - pos));
+                p = tail;
+            }
+            const unsigned printable = PrintableMask16(p);
+            if (inRange || ascii.open())
+                ascii.feed(pos, printable, 16, emitAscii);
+
+            // UTF-16LE code unit at byte j: printable low byte, zero high byte.
+            const unsigned zero = ZeroMask16(p) | (p[16] == 0 ? 0x10000u : 0u);
+            const unsigned chars = printable & (zero >> 1);
+            if (inRange || utf16[0].open())
+                utf16[0].feed(pos / 2, CompactEvenBits(chars), 8, emitUtf16(0));
+            if (inRange || utf16[1].open())
+                utf16[1].feed(pos / 2, CompactEvenBits(chars >> 1), 8, emitUtf16(1));
+        }
+        // Runs still open reach the end of the image, whichever worker
+        // followed them there; record() keeps those that start in range.
+        ascii.flush(emitAscii);
+        utf16[0].flush(emitUtf16(0));
+        utf16[1].flush(emitUtf16(1));
+    });
+
+    for (auto& part : perWorker)
+    {
+        const ULONGLONG base = out.text.size();
+        for (auto& r : part.records)
+        {
+            r.textOffset += base;
+            out.records.push_back(r);
+        }
+        out.text += part.text;
+        std::string().swap(part.text);
+    }
+    std::sort(out.records.begin(), out.records.end(),
+        [](const StringRecord& a, const StringRecord& b) { return a.imageOffset < b.imageOffset; });
+}
+
+// Distinct trigram codes of one string, sorted.
+static void StringTrigrams(const char* s, size_t len, std::vector<ULONGLONG>& codes)
+{
+    codes.clear();
+    for (size_t i = 0; i + 3 <= len; ++i)
+        codes.push_back(TrigramCode(s + i));
+    std::sort(codes.begin(), codes.end());
+    codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+}
+
+static int CmdStrings(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: strings <image> <out.idx> [min-length]");
+
+    DWORD minLength = 8;
+    if (argc >= 3)
+        minLength = wcstoul(argv[2], nullptr, 10);
+    if (minLength < 3)
+        FatalErrorMsg("Minimum string length must be at least 3 (the trigram length).");
+
+    MappedImage img(argv[0]);
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(img.size()), sizeBuf, sizeof(sizeBuf));
+    printf("Image:              %ls (%s)\n", argv[0], sizeBuf);
+
+    LARGE_INTEGER freq, start, extracted, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    ExtractedStrings strings;
+    ExtractStrings(img, minLength, strings);
+    if (strings.records.size() > 0xFFFFFFFFULL)
+        FatalErrorMsg("Too many strings for the index format; raise the minimum length.");
+    QueryPerformanceCounter(&extracted);
+
+    // Counting sort of (trigram, record) pairs: count, prefix-sum, fill.
+    // Record indices go in ascending order, so every list comes out sorted.
+    std::vector<ULONGLONG> listStart(static_cast<size_t>(g_trigramCount + 1), 0);
+    std::vector<ULONGLONG> codes;
+    for (const auto& r : strings.records)
+    {
+        StringTrigrams(&strings.text[static_cast<size_t>(r.textOffset)], r.length, codes);
+        for (ULONGLONG c : codes)
+            ++listStart[static_cast<size_t>(c + 1)];
+    }
+    for (size_t t = 1; t < listStart.size(); ++t)
+        listStart[t] += listStart[t - 1];
+    std::vector<DWORD> postings(static_cast<size_t>(listStart.back()));
+    std::vector<ULONGLONG> fill(listStart.begin(), listStart.end() - 1);
+    for (size_t i = 0; i < strings.records.size(); ++i)
+    {
+        const StringRecord& r = strings.records[i];
+        StringTrigrams(&strings.text[static_cast<size_t>(r.textOffset)], r.length, codes);
+        for (ULONGLONG c : codes)
+            postings[static_cast<size_t>(fill[static_cast<size_t>(c)]++)] = static_cast<DWORD>(i);
+    }
+
+    StringIndexHeader hdr = {};
+    memcpy(hdr.magic, "STRIDX01", 8);
+    hdr.version = g_stringIndexVersion;
+    hdr.minLength = minLength;
+    hdr.imageSize = img.size();
+    hdr.recordCount = strings.records.size();
+    hdr.recordsOffset = sizeof(StringIndexHeader);
+    hdr.textOffset = hdr.recordsOffset + strings.records.size() * sizeof(StringRecord);
+    hdr.textBytes = strings.text.size();
+    hdr.trigramOffset = (hdr.textOffset + hdr.textBytes + 7) / 8 * 8;
+    hdr.postingsOffset = hdr.trigramOffset + listStart.size() * sizeof(ULONGLONG);
+
+    HandleGuard hOut(CreateFileW(argv[1], GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!hOut.valid())
+        FatalError("Failed to create string index");
+    const BYTE pad[8] = {};
+    WriteFileFully(hOut.get(), &hdr, sizeof(hdr), "string index");
+    WriteFileFully(hOut.get(), strings.records.data(), strings.records.size() * sizeof(StringRecord), "string index");
+    WriteFileFully(hOut.get(), strings.text.data(), strings.text.size(), "string index");
+    WriteFileFully(hOut.get(), pad, static_cast<size_t>(hdr.trigramOffset - hdr.textOffset - hdr.textBytes), "string index");
+    WriteFileFully(hOut.get(), listStart.data(), listStart.size() * sizeof(ULONGLONG), "string index");
+    WriteFileFully(hOut.get(), postings.data(), postings.size() * sizeof(DWORD), "string index");
+    QueryPerformanceCounter(&now);
+
+    size_t utf16Count = 0;
+    for (const auto& r : strings.records)
+        utf16Count += r.utf16;
+    const double extractSeconds = (double)(extracted.QuadPart - start.QuadPart) / freq.QuadPart;
+    FormatBytes(static_cast<LONGLONG>(hdr.postingsOffset + postings.size() * sizeof(DWORD)), sizeBuf, sizeof(sizeBuf));
+    printf("\n  Strings:            %zu (%zu ASCII, %zu UTF-16LE), >= %lu characters\n",
+        strings.records.size(), strings.records.size() - utf16Count, utf16Count, minLength);
+    printf("  Text:               %llu bytes\n", hdr.textBytes);
+    printf("  Postings:           %zu\n", postings.size());
+    printf("  Index:              %ls (%s)\n", argv[1], sizeBuf);
+    printf("  Extraction:         %.2f seconds (%.1f MB/s)\n", extractSeconds,
+        extractSeconds > 0 ? img.size() / extractSeconds / (1024.0 * 1024.0) : 0.0);
+    printf("  Total:              %.2f seconds\n", (double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// Case-insensitive search of 'needle' (already lower-case) in s[0, len).
+static bool ContainsFolded(const char* s, size_t len, const std::string& needle)
+{
+    if (needle.size() > len)
+        return false;
+    for (size_t i = 0; i + needle.size() <= len; ++i)
+    {
+        size_t k = 0;
+        while (k < needle.size() && tolower(static_cast<unsigned char>(s[i + k])) == needle[k])
+            ++k;
+        if (k == needle.size())
+            return true;
+    }
+    return false;
+}
+
+static int CmdStrFind(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: strfind <index> <text> [max-results]");
+
+    size_t maxResults = 200;
+    if (argc >= 3)
+        maxResults = static_cast<size_t>(_wcstoui64(argv[2], nullptr, 10));
+
+    std::string needle;
+    for (const wchar_t* w = argv[1]; *w; ++w)
+    {
+        if (*w < 0x20 || *w > 0x7E)
+            FatalErrorMsg("Queries are limited to printable ASCII (the index folds case over 0x20-0x7E).");
+        needle.push_back(static_cast<char>(tolower(static_cast<int>(*w))));
+    }
+    if (needle.empty())
+        FatalErrorMsg("Empty query.");
+
+    MappedImage idx(argv[0]);
+    if (idx.size() < sizeof(StringIndexHeader))
+        FatalErrorMsg("String index is truncated.");
+    const StringIndexHeader* hdr = reinterpret_cast<const StringIndexHeader*>(idx.data());
+    if (memcmp(hdr->magic, "STRIDX01", 8) != 0 || hdr->version != g_stringIndexVersion)
+        FatalErrorMsg("Not a string index (bad magic or version).");
+    if (hdr->recordsOffset + hdr->recordCount * sizeof(StringRecord) > hdr->textOffset
+        || hdr->textOffset + hdr->textBytes > hdr->trigramOffset
+        || hdr->trigramOffset + (g_trigramCount + 1) * sizeof(ULONGLONG) > hdr->postingsOffset
+        || hdr->postingsOffset > idx.size())
+        FatalErrorMsg("String index header is inconsistent.");
+    const StringRecord* records = reinterpret_cast<const StringRecord*>(idx.data() + hdr->recordsOffset);
+    const char* text = reinterpret_cast<const char*>(idx.data() + hdr->textOffset);
+    const ULONGLONG* listStart = reinterpret_cast<const ULONGLONG*>(idx.data() + hdr->trigramOffset);
+    const DWORD* postings = reinterpret_cast<const DWORD*>(idx.data() + hdr->postingsOffset);
+    const ULONGLONG postingCount = (idx.size() - hdr->postingsOffset) / sizeof(DWORD);
+    if (listStart[g_trigramCount] > postingCount)
+        FatalErrorMsg("String index postings are truncated.");
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    // Candidates: intersection of the query's trigram lists, smallest list
+    // first. Queries shorter than a trigram check every string.
+    std::vector<DWORD> candidates;
+    bool allRecords = needle.size() < 3;
+    if (!allRecords)
+    {
+        std::vector<ULONGLONG> codes;
+        StringTrigrams(needle.data(), needle.size(), codes);
+        std::sort(codes.begin(), codes.end(), [&](ULONGLONG a, ULONGLONG b) {
+            return listStart[a + 1] - listStart[a] < listStart[b + 1] - listStart[b];
+        });
+        candidates.assign(postings + listStart[codes[0]], postings + listStart[codes[0] + 1]);
+        for (size_t i = 1; i < codes.size() && !candidates.empty(); ++i)
+        {
+            const DWORD* first = postings + listStart[codes[i]];
+            const DWORD* last = postings + listStart[codes[i] + 1];
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                [&](DWORD id) { return !std::binary_search(first, last, id); }), candidates.end());
+        }
+    }
+
+    const size_t candidateCount = allRecords ? static_cast<size_t>(hdr->recordCount) : candidates.size();
+    std::vector<DWORD> hits;
+    for (size_t i = 0; i < candidateCount; ++i)
+    {
+        const DWORD id = allRecords ? static_cast<DWORD>(i) : candidates[i];
+        const StringRecord& r = records[id];
+        if (r.textOffset + r.length <= hdr->textBytes && ContainsFolded(text + r.textOffset, r.length, needle))
+            hits.push_back(id);
+    }
+    QueryPerformanceCounter(&now);
+
+    printf("Index:              %ls (%llu strings)\n", argv[0], hdr->recordCount);
+    printf("Query:              \"%s\" (case-insensitive)\n\n", needle.c_str());
+    for (size_t i = 0; i < hits.size() && i < maxResults; ++i)
+    {
+        const StringRecord& r = records[hits[i]];
+        const int shown = static_cast<int>(std::min<DWORD>(r.length, 120));
+        printf("  0x%012llX  %-8s %.*s%s\n", r.imageOffset, r.utf16 ? "UTF-16LE" : "ASCII",
+            shown, text + r.textOffset, r.length > 120 ? "..." : "");
+    }
+    if (hits.size() > maxResults)
+        printf("  ... %zu more\n", hits.size() - maxResults);
+
+    printf("\n  Matches:            %zu of %zu candidate string(s)\n", hits.size(), candidateCount);
+    printf("  Query time:         %.2f ms\n", 1000.0 * (now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// ============================================================
+// Fragment classifier
+// ============================================================
+
+// Labels fixed-size chunks by what they most likely hold, so that carving
+// and repair can be pointed at promising regions instead of whole images.
+// All features come from one vectorized pass over each chunk; the rules are
+// deliberately simple thresholds that can be read off the feature table.
+
+enum class FragmentClass { Erased, Zero, Text, Jpeg, Video, Compressed, Whitened, Binary };
+
+static const char* FragmentClassName(FragmentClass c)
+{
+    switch (c) {
+    case FragmentClass::Erased:     return "Erased (0xFF)";
+    case FragmentClass::Zero:       return "Zero fill";
+    case FragmentClass::Text:       return "Text";
+    case FragmentClass::Jpeg:       return "JPEG scan data";
+    case FragmentClass::Video:      return "H.264/HEVC video";
+    case FragmentClass::Compressed: return "Compressed / encrypted";
+    case FragmentClass::Whitened:   return "Whitened (periodic high-entropy)";
+    default:                        return "Binary / structured";
+    }
+}
+
+// Where to go next with a region of this class.
+static const char* FragmentClassTool(FragmentClass c)
+{
+    switch (c) {
+    case FragmentClass::Text:       return "strings";
+    case FragmentClass::Jpeg:       return "jpegcarve";
+    case FragmentClass::Video:      return "nalscan, mp4carve, mp4repair";
+    case FragmentClass::Whitened:   return "descramble first";
+    default:                        return "-";
+    }
+}
+
+struct ChunkFeatures {
+    double entropy = 0.0;          // bits/byte
+    double printable = 0.0;        // printable ASCII, tab, CR, LF
+    double ff = 0.0;
+    double zero = 0.0;
+    double repeat = 0.0;           // equal bytes 1, 2 or 4 apart, whichever is most
+    double duplicate = 0.0;        // 16-byte blocks seen earlier in the chunk
+    DWORD ffMarkers = 0;           // 0xFF bytes with a following byte
+    DWORD ffStuffed = 0;           // ... followed by 0x00 or RSTn (JPEG ECS)
+    DWORD nalChains = 0;           // convincing length-prefixed NAL chains
+};
+
+static unsigned PopCount16(unsigned x)
+{
+    x = x - ((x >> 1) & 0x5555);
+    x = (x & 0x3333) + ((x >> 2) & 0x3333);
+    x = (x + (x >> 4)) & 0x0F0F;
+    return (x + (x >> 8)) & 0x1F;
+}
+
+// 'table' is per-worker scratch for the duplicate-block count.
+static void ComputeChunkFeatures(const BYTE* base, ULONGLONG size, ULONGLONG offset, size_t len,
+    std::vector<DWORD>& table, ChunkFeatures& f)
+{
+    const BYTE* p = base + offset;
+    DWORD counts[4][256] = {};             // interleaved to break store-to-load chains
+    ULONGLONG printable = 0, repeat[3] = {}, ffMarkers = 0, ffStuffed = 0;
+
+    const __m128i ff = _mm_set1_epi8(static_cast<char>(0xFF));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rstMask = _mm_set1_epi8(static_cast<char>(0xF8));
+    const __m128i rst = _mm_set1_epi8(static_cast<char>(0xD0));
+    size_t i = 0;
+    for (; i + 20 <= len; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1));
+        const __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+        printable += PopCount16(PrintableMask16(p + i) | static_cast<unsigned>(_mm_movemask_epi8(space)));
+        repeat[0] += PopCount16(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, n))));
+        repeat[1] += PopCount16(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 2))))));
+        repeat[2] += PopCount16(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 4))))));
+        const unsigned ffMask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, ff)));
+        if (ffMask)
+        {
+            const __m128i stuffed = _mm_or_si128(_mm_cmpeq_epi8(n, zero),
+                _mm_cmpeq_epi8(_mm_and_si128(n, rstMask), rst));
+            ffMarkers += PopCount16(ffMask);
+            ffStuffed += PopCount16(ffMask & static_cast<unsigned>(_mm_movemask_epi8(stuffed)));
+        }
+        for (int k = 0; k < 16; k += 4)
+        {
+            ++counts[0][p[i + k]];
+            ++counts[1][p[i + k + 1]];
+            ++counts[2][p[i + k + 2]];
+            ++counts[3][p[i + k + 3]];
+        }
+    }
+    for (; i < len; ++i)
+    {
+        const BYTE c = p[i];
+        ++counts[0][c];
+        printable += (c >= 0x20 && c <= 0x7E) || c == '\t' || c == '\n' || c == '\r';
+        repeat[1] += i + 2 < len && c == p[i + 2];
+        repeat[2] += i + 4 < len && c == p[i + 4];
+        if (i + 1 < len)
+        {
+            repeat[0] += c == p[i + 1];
+            ffMarkers += c == 0xFF;
+            ffStuffed += c == 0xFF && (p[i + 1] == 0x00 || (p[i + 1] & 0xF8) == 0xD0);
+        }
+    }
+
+    ULONGLONG histogram[256];
+    for (int b = 0; b < 256; ++b)
+        histogram[b] = static_cast<ULONGLONG>(counts[0][b]) + counts[1][b] + counts[2][b] + counts[3][b];
+    const double total = static_cast<double>(std::max<size_t>(len, 1));
+    f.entropy = ShannonEntropy(histogram, std::max<size_t>(len, 1));
+    f.printable = printable / total;
+    f.ff = histogram[0xFF] / total;
+    f.zero = histogram[0x00] / total;
+    f.repeat = static_cast<double>(*std::max_element(repeat, repeat + 3)) / total;
+    f.ffMarkers = static_cast<DWORD>(ffMarkers);
+    f.ffStuffed = static_cast<DWORD>(ffStuffed);
+
+    // Only high-entropy chunks can be JPEG, video, compressed or whitened;
+    // the remaining features are not needed for the rest.
+    if (f.entropy < 6.5)
+        return;
+
+    // Duplicate 16-byte blocks: compressed, encrypted and coded media never
+    // repeat a block, a scrambled fill repeats at the scrambler's period.
+    const size_t blocks = len / 16;
+    const size_t mask = table.size() - 1;
+    std::fill(table.begin(), table.end(), 0);
+    size_t duplicates = 0;
+    for (size_t b = 0; b < blocks; ++b)
+    {
+        const BYTE* blk = p + b * 16;
+        const ULONGLONG key = LoadLE64(blk) * 0x9E3779B97F4A7C15ULL ^ LoadLE64(blk + 8);
+        size_t s = static_cast<size_t>(key ^ (key >> 29)) & mask;
+        for (;; s = (s + 1) & mask)
+        {
+            if (!table[s])
+            {
+                table[s] = static_cast<DWORD>(b + 1);
+                break;
+            }
+            if (memcmp(p + (table[s] - 1) * 16ULL, blk, 16) == 0)
+            {
+                ++duplicates;
+                break;
+            }
+        }
+    }
+    f.duplicate = blocks ? static_cast<double>(duplicates) / blocks : 0.0;
+
+    // NAL chains starting in this chunk (they may run past its end).
+    for (size_t j = 0; j + 20 <= len && offset + j + 20 <= size; )
+    {
+        DWORD cand = NalCandidateMask(p + j);
+        size_t next = j + 16;
+        for (DWORD bit = 0; cand; ++bit, cand >>= 1)
+        {
+            if (!(cand & 1))
+                continue;
+            VideoExtent avc, hevc;
+            WalkNalChain(base, size, offset + j + bit, NalCodec::Avc, avc);
+            WalkNalChain(base, size, offset + j + bit, NalCodec::Hevc, hevc);
+            const VideoExtent& best = hevc.nalCount > avc.nalCount ? hevc : avc;
+            if (IsConvincingNalChain(best, 3))
+            {
+                ++f.nalChains;
+                next = std::max<size_t>(next, static_cast<size_t>(std::min<ULONGLONG>(len, j + bit + best.length)));
+                break;
+            }
+        }
+        j = next;
+    }
+}
+
+static FragmentClass ClassifyChunk(const ChunkFeatures& f, double& confidence)
+{
+    if (f.ff >= 0.99)
+    {
+        confidence = f.ff;
+        return FragmentClass::Erased;
+    }
+    if (f.zero >= 0.99)
+    {
+        confidence = f.zero;
+        return FragmentClass::Zero;
+    }
+    if (f.printable >= 0.90 && f.entropy < 6.5)
+    {
+        confidence = f.printable;
+        return FragmentClass::Text;
+    }
+    if (f.entropy >= 6.5)
+    {
+        if (f.nalChains)
+        {
+            confidence = std::min(0.99, 0.7 + 0.1 * f.nalChains);
+            return FragmentClass::Video;
+        }
+        // Random data has FF 00 / FF Dn after ~9 of 256 0xFF bytes; JPEG
+        // entropy-coded data after all of them.
+        if (f.ffMarkers >= 4 && f.ffStuffed >= 0.9 * f.ffMarkers)
+        {
+            confidence = static_cast<double>(f.ffStuffed) / f.ffMarkers;
+            return FragmentClass::Jpeg;
+        }
+        if (f.duplicate >= 0.25)
+        {
+            confidence = std::min(0.99, 0.5 + f.duplicate / 2);
+            return FragmentClass::Whitened;
+        }
+        // Uncompressed media (PCM audio, raw bitmaps) can reach 7.5 bits/byte
+        // but keeps neighbouring bytes or samples correlated.
+        if (f.entropy >= 7.5 && f.repeat < 3.0 / 256)
+        {
+            confidence = std::max(0.5, std::min(0.99, (f.entropy - 7.5) * 2));
+            return FragmentClass::Compressed;
+        }
+    }
+    confidence = 0.5;
+    return FragmentClass::Binary;
+}
+
+struct ChunkClass {
+    FragmentClass label = FragmentClass::Binary;
+    float confidence = 0.0f;
+};
+
+struct FragmentRegion {
+    FragmentClass label = FragmentClass::Binary;
+    ULONGLONG offset = 0;
+    ULONGLONG length = 0;
+    ULONGLONG chunks = 0;
+    double confidence = 0.0;       // mean over the chunks
+};
+
+static void ClassifyChunks(const MappedImage& img, size_t chunkSize, std::vector<ChunkClass>& out)
+{
+    const ULONGLONG chunks = (img.size() + chunkSize - 1) / chunkSize;
+    out.assign(static_cast<size_t>(chunks), ChunkClass());
+    ParallelForRanges(chunks, [&](ULONGLONG begin, ULONGLONG end, DWORD) {
+        std::vector<DWORD> table(NextPowerOfTwo(std::max<ULONGLONG>(chunkSize / 8, 16)));
+        for (ULONGLONG c = begin; c < end; ++c)
+        {
+            const ULONGLONG offset = c * chunkSize;
+            const size_t len = static_cast<size_t>(std::min<ULONGLONG>(chunkSize, img.size() - offset));
+            ChunkFeatures f;
+            ComputeChunkFeatures(img.data(), img.size(), offset, len, table, f);
+            double confidence;
+            out[static_cast<size_t>(c)].label = ClassifyChunk(f, confidence);
+            out[static_cast<size_t>(c)].confidence = static_cast<float>(confidence);
+        }
+    });
+
+    // A large I-frame or JPEG scan spans several chunks with no NAL start or
+    // marker of its own; short compressed gaps between two chunks of the
+    // same media class take that class at reduced confidence.
+    const size_t maxBridge = std::max<size_t>(1, (1024 * 1024) / chunkSize);
+    for (size_t c = 1; c < out.size(); )
+    {
+        const FragmentClass before = out[c - 1].label;
+        if (out[c].label != FragmentClass::Compressed || (before != FragmentClass::Video && before != FragmentClass::Jpeg))
+        {
+            ++c;
+            continue;
+        }
+        size_t e = c;
+        while (e < out.size() && out[e].label == FragmentClass::Compressed)
+            ++e;
+        if (e < out.size() && out[e].label == before && e - c <= maxBridge)
+        {
+            for (size_t k = c; k < e; ++k)
+            {
+                out[k].label = before;
+                out[k].confidence = 0.6f;
+            }
+        }
+        c = e;
+    }
+}
+
+static std::vector<FragmentRegion> CoalesceChunkClasses(const std::vector<ChunkClass>& chunks, size_t chunkSize,
+    ULONGLONG imageSize)
+{
+    std::vector<FragmentRegion> regions;
+    for (size_t c = 0; c < chunks.size(); ++c)
+    {
+        const ULONGLONG offset = static_cast<ULONGLONG>(c) * chunkSize;
+        const ULONGLONG len = std::min<ULONGLONG>(chunkSize, imageSize - offset);
+        if (regions.empty() || regions.back().label != chunks[c].label)
+        {
+            FragmentRegion r;
+            r.label = chunks[c].label;
+            r.offset = offset;
+            regions.push_back(r);
+        }
+        FragmentRegion& r = regions.back();
+        r.length += len;
+        ++r.chunks;
+        r.confidence += chunks[c].confidence;
+    }
+    for (auto& r : regions)
+        r.confidence /= r.chunks;
+    return regions;
+}
+
+static int CmdClassify(int argc, wchar_t* argv[])
+{
+    if (argc < 1)
+        FatalErrorMsg("Usage: classify <image> [chunk-KiB] [out-base]");
+
+    ULONGLONG chunkKiB = 64;
+    if (argc >= 2)
+        chunkKiB = _wcstoui64(argv[1], nullptr, 10);
+    if (chunkKiB < 1 || chunkKiB > 64 * 1024)
+        FatalErrorMsg("Chunk size must be between 1 KiB and 64 MiB.");
+    const size_t chunkSize = static_cast<size_t>(chunkKiB * 1024);
+
+    MappedImage img(argv[0]);
+    char sizeBuf[128];
+    FormatBytes(static_cast<LONGLONG>(img.size()), sizeBuf, sizeof(sizeBuf));
+    printf("Image:              %ls (%s)\n", argv[0], sizeBuf);
+    printf("Chunk size:         %llu KiB\n", chunkKiB);
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    std::vector<ChunkClass> chunks;
+    ClassifyChunks(img, chunkSize, chunks);
+    const std::vector<FragmentRegion> regions = CoalesceChunkClasses(chunks, chunkSize, img.size());
+    QueryPerformanceCounter(&now);
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+
+    const int classCount = static_cast<int>(FragmentClass::Binary) + 1;
+    ULONGLONG classBytes[classCount] = {}, classRegions[classCount] = {};
+    for (const auto& r : regions)
+    {
+        classBytes[static_cast<int>(r.label)] += r.length;
+        ++classRegions[static_cast<int>(r.label)];
+    }
+
+    printf("\n  --- Regions ---\n");
+    const size_t maxPrinted = 200;
+    for (size_t i = 0; i < regions.size() && i < maxPrinted; ++i)
+    {
+        const FragmentRegion& r = regions[i];
+        FormatBytes(static_cast<LONGLONG>(r.length), sizeBuf, sizeof(sizeBuf));
+        printf("  0x%012llX  %-34s %-28s conf %.2f\n", r.offset, FragmentClassName(r.label), sizeBuf, r.confidence);
+    }
+    if (regions.size() > maxPrinted)
+        printf("  ... %zu more region(s)\n", regions.size() - maxPrinted);
+
+    printf("\n  --- Classes ---\n");
+    for (int c = 0; c < classCount; ++c)
+    {
+        if (!classBytes[c])
+            continue;
+        FormatBytes(static_cast<LONGLONG>(classBytes[c]), sizeBuf, sizeof(sizeBuf));
+        printf("  %-34s %6.2f%%  %-28s %llu region(s)   next: %s\n", FragmentClassName(static_cast<FragmentClass>(c)),
+            100.0 * classBytes[c] / std::max<ULONGLONG>(img.size(), 1), sizeBuf, classRegions[c],
+            FragmentClassTool(static_cast<FragmentClass>(c)));
+    }
+    printf("\n  Chunks:             %zu in %.2f seconds (%.1f MB/s)\n", chunks.size(), elapsed,
+        elapsed > 0 ? img.size() / elapsed / (1024.0 * 1024.0) : 0.0);
+
+    if (argc < 3)
+        return 0;
+
+    CaseReportWriter w("Fragment Classification Report");
+    w.header("image_file", "Image File", ReportText("`" + WideToUtf8(argv[0]) + "`"));
+    w.header("image_size", "Image Size", ReportBytes(img.size()));
+    w.header("chunk_size", "Chunk Size", ReportBytes(chunkSize));
+    w.beginSection("classes", "Classes");
+    w.beginTable("classes", "Bytes per Class", { { "class", "Class" }, { "bytes", "Bytes" },
+        { "percent", "% of Image" }, { "regions", "Regions" }, { "next_tool", "Next Tool" } });
+    for (int c = 0; c < classCount; ++c)
+    {
+        if (classBytes[c])
+            w.row({ ReportText(FragmentClassName(static_cast<FragmentClass>(c))), ReportBytes(classBytes[c]),
+                ReportReal(100.0 * classBytes[c] / std::max<ULONGLONG>(img.size(), 1), 2), ReportCount(classRegions[c]),
+                ReportText(FragmentClassTool(static_cast<FragmentClass>(c))) });
+    }
+    w.endTable();
+    w.endSection();
+
+    w.beginSection("regions", "Regions");
+    w.beginTable("regions", "Classified Regions", { { "offset", "Offset" }, { "length", "Length" },
+        { "class", "Class" }, { "chunks", "Chunks" }, { "confidence", "Confidence" } });
+    const size_t markdownRows = 500;
+    for (size_t i = 0; i < regions.size(); ++i)
+    {
+        const FragmentRegion& r = regions[i];
+        w.row({ ReportHex(r.offset, 12), ReportBytes(r.length), ReportText(FragmentClassName(r.label)),
+            ReportCount(r.chunks), ReportReal(r.confidence, 2) }, i < markdownRows);
+    }
+    w.endTable(regions.size() > markdownRows ? regions.size() - markdownRows : 0);
+    w.endSection();
+
+    const std::wstring outBase = argv[2];
+    if (!WriteTextFile(outBase + L".md", w.markdown()) || !WriteTextFile(outBase + L".json", w.json()))
+        FatalError("Failed to write the classification report");
+    printf("  Report:             %ls.md, %ls.json\n", argv[2], argv[2]);
+    return 0;
+}
+
+// ============================================================
+// exFAT allocation bitmap vs. content
+// ============================================================
+
+// Walks the allocation bitmap and the cluster heap side by side and checks
+// each cluster's content against its bitmap bit. On a trimmed card a freed
+// cluster reads back as 0x00 or 0xFF once the controller has erased it, so
+// the anomalies worth a look are free clusters that still hold data (not
+// yet erased, or never trimmed) and allocated clusters that read as 0xFF
+// (file data the controller no longer has).
+
+static bool OpenExFatVolume(ImageReader& img, ULONGLONG offset, ExFatVolume& vol)
+{
+    BYTE s[512];
+    if (img.read(offset, s, sizeof(s)) != sizeof(s) || !ParseExFatBootSector(s, offset, vol))
+        return false;
+    vol.fatCopy = std::make_shared<std::vector<BYTE>>();
+    vol.fat = img.span(vol.fatOffset, (vol.clusterCount + 2ULL) * 4, *vol.fatCopy);
+    return vol.fat != nullptr && vol.heapOffset < img.size();
+}
+
+static bool FindExFatVolume(ImageReader& img, ExFatVolume& vol)
+{
+    RawPartitionTable table;
+    ParseRawPartitionTable(img, table, 64ULL * 1024 * 1024);
+    for (const auto& p : table.partitions)
+    {
+        if (OpenExFatVolume(img, p.firstLba * table.sectorSize, vol))
+            return true;
+    }
+    for (const auto& hit : table.bootSectors)
+    {
+        if (!hit.isBackupCopy && OpenExFatVolume(img, hit.offset, vol))
+            return true;
+    }
+    return OpenExFatVolume(img, 0, vol);  // superfloppy: no partition table
+}
+
+// Reads the allocation bitmap named by the root directory's 81h entry. With
+// two FATs (TexFAT) the bitmap whose flag matches the active FAT is used.
+static bool LoadExFatBitmap(ImageReader& img, const ExFatVolume& vol, DWORD& firstCluster,
+    std::vector<BYTE>& bitmap)
+{
+    const std::vector<DWORD> root = ExFatClusterChain(vol, vol.rootCluster,
+        256ULL * vol.clusterSize, false);
+    std::vector<BYTE> copy;
+    for (DWORD c : root)
+    {
+        const BYTE* dir = img.span(ExFatClusterOffset(vol, c), vol.clusterSize, copy);
+        if (!dir)
+            return false;
+        for (size_t pos = 0; pos + 32 <= vol.clusterSize; pos += 32)
+        {
+            const BYTE* e = dir + pos;
+            if (e[0] == 0x00)
+                return false;
+            if (e[0] != 0x81 || (e[1] & 1) != vol.activeFat)
+                continue;
+
+            firstCluster = LoadLE32(e + 20);
+            const ULONGLONG length = std::min<ULONGLONG>(LoadLE64(e + 24), (vol.clusterCount + 7ULL) / 8);
+            bitmap.assign(static_cast<size_t>(length), 0);
+            const std::vector<DWORD> chain = ExFatClusterChain(vol, firstCluster, length, false);
+            for (size_t i = 0; i < chain.size(); ++i)
+            {
+                const size_t dst = i * vol.clusterSize;
+                const size_t n = static_cast<size_t>(std::min<ULONGLONG>(vol.clusterSize, length - dst));
+                if (img.read(ExFatClusterOffset(vol, chain[i]), bitmap.data() + dst, n) != n)
+                    return false;
+            }
+            return chain.size() * static_cast<ULONGLONG>(vol.clusterSize) >= length;
+        }
+    }
+    return false;
+}
+
+enum class ClusterContent { Data, Zero, Erased, Missing };
+
+// Runs of consecutive clusters with the same allocation state and content.
+struct AllocationExtent {
+    DWORD firstCluster = 0;
+    DWORD clusters = 0;
+    bool allocated = false;
+    ClusterContent content = ClusterContent::Data;
+};
+
+struct AllocationCheckResult {
+    ULONGLONG counts[2][4] = {};           // [allocated][ClusterContent]
+    std::vector<AllocationExtent> freeWithData;
+    std::vector<AllocationExtent> allocatedErased;
+};
+
+static void CheckExFatAllocation(ImageReader& img, const ExFatVolume& vol, const std::vector<BYTE>& bitmap,
+    AllocationCheckResult& result)
+{
+    struct WorkerResult {
+        ULONGLONG counts[2][4] = {};
+        std::vector<AllocationExtent> extents;   // mismatches only, ascending
+    };
+    std::vector<WorkerResult> perWorker(WorkerThreadCount());
+    const DWORD clusterSize = vol.clusterSize;
+
+    ParallelForRanges(vol.clusterCount, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        WorkerResult& local = perWorker[worker];
+        std::vector<BYTE> copy;
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            const DWORD cluster = static_cast<DWORD>(i + 2);
+            if ((i - begin) % 256 == 0)
+                img.prefetch(ExFatClusterOffset(vol, cluster + 256), 256ULL * clusterSize);
+            const bool allocated = i / 8 < bitmap.size() && ((bitmap[static_cast<size_t>(i / 8)] >> (i % 8)) & 1);
+            const BYTE* p = img.span(ExFatClusterOffset(vol, cluster), clusterSize, copy);
+            ClusterContent content = ClusterContent::Missing;
+            BYTE value;
+            if (p)
+                content = !IsUniformBlock(p, clusterSize, value) ? ClusterContent::Data
+                    : value == 0x00 ? ClusterContent::Zero
+                    : value == 0xFF ? ClusterContent::Erased
+                    : ClusterContent::Data;
+            ++local.counts[allocated][static_cast<int>(content)];
+
+            const bool mismatch = allocated ? content == ClusterContent::Erased : content == ClusterContent::Data;
+            if (!mismatch)
+                continue;
+            if (!local.extents.empty())
+            {
+                AllocationExtent& last = local.extents.back();
+                if (last.allocated == allocated && last.firstCluster + last.clusters == cluster)
+                {
+                    ++last.clusters;
+                    continue;
+                }
+            }
+            AllocationExtent e;
+            e.firstCluster = cluster;
+            e.clusters = 1;
+            e.allocated = allocated;
+            e.content = content;
+            local.extents.push_back(e);
+        }
+    });
+
+    // Worker ranges are consecutive, so extents only need joining at the
+    // seams.
+    for (const auto& w : perWorker)
+    {
+        for (int a = 0; a < 2; ++a)
+            for (int c = 0; c < 4; ++c)
+                result.counts[a][c] += w.counts[a][c];
+        for (const auto& e : w.extents)
+        {
+            std::vector<AllocationExtent>& list = e.allocated ? result.allocatedErased : result.freeWithData;
+            if (!list.empty() && list.back().firstCluster + list.back().clusters == e.firstCluster)
+                list.back().clusters += e.clusters;
+            else
+                list.push_back(e);
+        }
+    }
+}
+
+static void PrintAllocationExtents(const ExFatVolume& vol, const std::vector<AllocationExtent>& extents,
+    size_t maxPrinted)
+{
+    char sizeBuf[128];
+    for (size_t i = 0; i < extents.size() && i < maxPrinted; ++i)
+    {
+        const AllocationExtent& e = extents[i];
+        FormatBytes(static_cast<LONGLONG>(static_cast<ULONGLONG>(e.clusters) * vol.clusterSize), sizeBuf, sizeof(sizeBuf));
+        printf("  clusters %10lu - %-10lu  offset 0x%012llX  %s\n", e.firstCluster, e.firstCluster + e.clusters - 1,
+            ExFatClusterOffset(vol, e.firstCluster), sizeBuf);
+    }
+    if (extents.size() > maxPrinted)
+        printf("  ... %zu more extent(s)\n", extents.size() - maxPrinted);
+    if (extents.empty())
+        printf("  (none)\n");
+}
+
+static int CmdExFatCheck(int argc, wchar_t* argv[])
+{
+    if (argc < 1)
+        FatalErrorMsg("Usage: exfatcheck <image> [volume-offset-bytes]");
+
+    std::unique_ptr<ImageReader> img = ImageReader::Open(argv[0]);
+    ExFatVolume vol;
+    if (argc >= 2)
+    {
+        const ULONGLONG offset = _wcstoui64(argv[1], nullptr, 0);
+        if (!OpenExFatVolume(*img, offset, vol))
+        {
+            char msg[256];
+            sprintf_s(msg, "No valid exFAT boot sector at offset 0x%llX", offset);
+            FatalErrorMsg(msg);
+        }
+    }
+    else if (!FindExFatVolume(*img, vol))
+    {
+        FatalErrorMsg("No exFAT volume found in the image.");
+    }
+    if (vol.clusterSize % 64 != 0)
+        FatalErrorMsg("Cluster size is not a multiple of 64 bytes.");
+
+    DWORD bitmapCluster = 0;
+    std::vector<BYTE> bitmap;
+    if (!LoadExFatBitmap(*img, vol, bitmapCluster, bitmap))
+        FatalErrorMsg("The allocation bitmap could not be read (no 81h entry in the root directory, or its chain leaves the image).");
+
+    char sizeBuf[128];
+    printf("Volume:             offset 0x%llX, %lu clusters of %lu bytes\n", vol.volumeOffset, vol.clusterCount,
+        vol.clusterSize);
+    printf("Allocation Bitmap:  cluster %lu, %zu bytes\n", bitmapCluster, bitmap.size());
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    AllocationCheckResult result;
+    CheckExFatAllocation(*img, vol, bitmap, result);
+    QueryPerformanceCounter(&now);
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+
+    printf("\n  --- Clusters ---\n");
+    printf("  %-10s %14s %14s %14s %14s\n", "", "data", "0x00", "0xFF", "past image end");
+    for (int a = 1; a >= 0; --a)
+        printf("  %-10s %14llu %14llu %14llu %14llu\n", a ? "Allocated" : "Free", result.counts[a][0],
+            result.counts[a][1], result.counts[a][2], result.counts[a][3]);
+
+    const ULONGLONG freeData = result.counts[0][static_cast<int>(ClusterContent::Data)];
+    const ULONGLONG allocErased = result.counts[1][static_cast<int>(ClusterContent::Erased)];
+    FormatBytes(static_cast<LONGLONG>(freeData * vol.clusterSize), sizeBuf, sizeof(sizeBuf));
+    printf("\n  --- Free clusters holding data: %llu (%s), %zu extent(s) ---\n", freeData, sizeBuf,
+        result.freeWithData.size());
+    PrintAllocationExtents(vol, result.freeWithData, 100);
+    FormatBytes(static_cast<LONGLONG>(allocErased * vol.clusterSize), sizeBuf, sizeof(sizeBuf));
+    printf("\n  --- Allocated clusters reading 0xFF: %llu (%s), %zu extent(s) ---\n", allocErased, sizeBuf,
+        result.allocatedErased.size());
+    PrintAllocationExtents(vol, result.allocatedErased, 100);
+
+    const ULONGLONG heapBytes = static_cast<ULONGLONG>(vol.clusterCount) * vol.clusterSize;
+    printf("\n  Check time:         %.2f seconds (%.1f MB/s of cluster heap)\n", elapsed,
+        elapsed > 0 ? heapBytes / elapsed / (1024.0 * 1024.0) : 0.0);
+    return 0;
+}
+
+// ============================================================
+// exFAT timeline
+// ============================================================
+
+// Every create/modify/access time held by an exFAT file entry set, from the
+// live tree, from deleted sets still in their directories, and from sets the
+// tree no longer reaches (stale directory clusters left by earlier use or an
+// earlier format). The whole cluster heap is scanned for checksum-valid entry
+// sets in parallel; the sorted result is written as a flat, memory-mappable
+// file so that any time window is a binary search away.
+
+struct TimelineHeader {
+    char magic[8];                 // "EXFTL001"
+    DWORD version;
+    DWORD reserved;
+    ULONGLONG volumeOffset;
+    ULONGLONG eventCount;
+    ULONGLONG eventsOffset;        // TimelineEvent[eventCount], by key
+    ULONGLONG namesOffset;         // NUL-terminated UTF-8 paths
+    ULONGLONG namesBytes;
+};
+
+enum class TimelineKind : BYTE { Created, Modified, Accessed };
+enum class TimelineStatus : BYTE { Live, Deleted, Orphaned, OrphanedDeleted };
+
+struct TimelineEvent {
+    LONGLONG key;                  // 10 ms units since 1980-01-01, UTC when the entry carries an offset
+    ULONGLONG entryOffset;         // image offset of the 85h/05h entry
+    ULONGLONG dataLength;
+    DWORD dosTime;                 // DOS date << 16 | time, as stored
+    DWORD nameOffset;
+    WORD attributes;
+    BYTE tenMs;
+    BYTE utcOffset;                // 80h | signed 15-minute units, as stored
+    TimelineKind kind;
+    TimelineStatus status;
+    BYTE checksumValid;
+    BYTE reserved;
+};
+
+static_assert(sizeof(TimelineHeader) == 56, "timeline header layout");
+static_assert(sizeof(TimelineEvent) == 40, "timeline event layout");
+
+static const DWORD g_timelineVersion = 1;
+
+static const char* TimelineKindName(TimelineKind k)
+{
+    switch (k) {
+    case TimelineKind::Created:  return "Created";
+    case TimelineKind::Modified: return "Modified";
+    default:                     return "Accessed";
+    }
+}
+
+static const char* TimelineStatusName(TimelineStatus s)
+{
+    switch (s) {
+    case TimelineStatus::Live:     return "live";
+    case TimelineStatus::Deleted:  return "deleted";
+    case TimelineStatus::Orphaned: return "orphaned";
+    default:                       return "orphaned, deleted";
+    }
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date.
+static LONGLONG DaysFromCivil(int y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const int era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097LL + static_cast<LONGLONG>(doe) - 719468;
+}
+
+static LONGLONG TimelineKey(int y, unsigned mo, unsigned d, unsigned h, unsigned mi, unsigned s, unsigned cs)
+{
+    const LONGLONG days = DaysFromCivil(y, mo, d) - DaysFromCivil(1980, 1, 1);
+    return (days * 86400 + h * 3600 + mi * 60 + s) * 100 + cs;
+}
+
+static int ExFatUtcOffsetMinutes(BYTE utc)
+{
+    const int units = utc & 0x7F;
+    return (units >= 64 ? units - 128 : units) * 15;
+}
+
+static LONGLONG ExFatTimestampKey(DWORD dos, BYTE tenMs, BYTE utc)
+{
+    const WORD date = static_cast<WORD>(dos >> 16), time = static_cast<WORD>(dos);
+    LONGLONG key = TimelineKey(1980 + (date >> 9), (date >> 5) & 0x0F, date & 0x1F,
+        time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2, tenMs);
+    if (utc & 0x80)
+        key -= ExFatUtcOffsetMinutes(utc) * 60LL * 100;
+    return key;
+}
+
+// Stored local time with hundredths and the entry's UTC offset.
+static void FormatExFatTimestamp(DWORD dos, BYTE tenMs, BYTE utc, char* buf, size_t bufLen)
+{
+    char base[32];
+    FormatFatTimestamp(static_cast<WORD>(dos >> 16), static_cast<WORD>(dos), base, sizeof(base));
+    // The 10 ms field counts 0-199 on top of the 2-second time field.
+    const WORD time = static_cast<WORD>(dos);
+    const unsigned seconds = (time & 0x1F) * 2 + tenMs / 100;
+    base[17] = static_cast<char>('0' + seconds / 10 % 10);
+    base[18] = static_cast<char>('0' + seconds % 10);
+    if (utc & 0x80)
+    {
+        const int m = ExFatUtcOffsetMinutes(utc);
+        sprintf_s(buf, bufLen, "%s.%02u %c%02d:%02d", base, tenMs % 100, m < 0 ? '-' : '+', abs(m) / 60, abs(m) % 60);
+    }
+    else
+        sprintf_s(buf, bufLen, "%s.%02u (local)", base, tenMs % 100);
+}
+
+// Live tree from the root directory, read straight from the image.
+static void WalkExFatTree(ImageReader& img, const ExFatVolume& vol, std::vector<ExFatFileRecord>& files)
+{
+    std::vector<BYTE> visited(vol.clusterCount + 2ULL, 0);
+    std::vector<ExFatDirTask> queue;
+    ExFatDirTask root;
+    root.cluster = vol.rootCluster;
+    root.length = static_cast<ULONGLONG>(vol.clusterCount) * vol.clusterSize;
+    queue.push_back(root);
+    while (!queue.empty())
+    {
+        const ExFatDirTask task = queue.back();
+        queue.pop_back();
+        std::vector<BYTE> bytes;
+        std::vector<ULONGLONG> offsets;
+        for (DWORD c : ExFatClusterChain(vol, task.cluster, task.length, task.noFatChain))
+        {
+            if (visited[c])
+                break;
+            const size_t used = bytes.size();
+            bytes.resize(used + vol.clusterSize);
+            if (img.read(ExFatClusterOffset(vol, c), bytes.data() + used, vol.clusterSize) != vol.clusterSize)
+            {
+                bytes.resize(used);
+                break;
+            }
+            visited[c] = 1;
+            offsets.push_back(ExFatClusterOffset(vol, c));
+        }
+        if (!bytes.empty())
+            ParseExFatDirectory(vol, bytes.data(), bytes.size(), offsets, task, files, queue);
+    }
+}
+
+struct TimelineRun {
+    std::vector<TimelineEvent> events;
+    std::string names;
+};
+
+static bool TimelineEventLess(const TimelineEvent& a, const TimelineEvent& b)
+{
+    if (a.key != b.key)
+        return a.key < b.key;
+    if (a.entryOffset != b.entryOffset)
+        return a.entryOffset < b.entryOffset;
+    return a.kind < b.kind;
+}
+
+static void AddTimelineEvents(const ExFatFileRecord& rec, TimelineStatus status, TimelineRun& run)
+{
+    const DWORD nameOffset = static_cast<DWORD>(run.names.size());
+    run.names += rec.path;
+    run.names.push_back('\0');
+
+    const struct { TimelineKind kind; DWORD dos; BYTE tenMs; BYTE utc; } stamps[] = {
+        { TimelineKind::Created, rec.createTime, rec.create10ms, rec.createUtc },
+        { TimelineKind::Modified, rec.modifyTime, rec.modify10ms, rec.modifyUtc },
+        { TimelineKind::Accessed, rec.accessTime, 0, rec.accessUtc },
+    };
+    for (const auto& s : stamps)
+    {
+        const WORD date = static_cast<WORD>(s.dos >> 16);
+        if (date == 0 || ((date >> 5) & 0x0F) == 0 || ((date >> 5) & 0x0F) > 12 || (date & 0x1F) == 0)
+            continue;
+        TimelineEvent ev = {};
+        ev.key = ExFatTimestampKey(s.dos, s.tenMs, s.utc);
+        ev.entryOffset = rec.entryOffset;
+        ev.dataLength = rec.dataLength;
+        ev.dosTime = s.dos;
+        ev.nameOffset = nameOffset;
+        ev.attributes = rec.attributes;
+        ev.tenMs = s.tenMs;
+        ev.utcOffset = s.utc;
+        ev.kind = s.kind;
+        ev.status = status;
+        ev.checksumValid = rec.checksumValid ? 1 : 0;
+        run.events.push_back(ev);
+    }
+}
+
+// Live and deleted sets come from the directory tree with full paths; every
+// other checksum-valid set in the heap is orphaned and keeps only its name.
+static void BuildExFatTimeline(ImageReader& img, const ExFatVolume& vol, TimelineRun& out)
+{
+    std::vector<ExFatFileRecord> tree;
+    WalkExFatTree(img, vol, tree);
+    std::vector<ULONGLONG> treeOffsets;
+    for (const auto& r : tree)
+        treeOffsets.push_back(r.entryOffset);
+    std::sort(treeOffsets.begin(), treeOffsets.end());
+
+    std::vector<TimelineRun> runs(WorkerThreadCount() + 1);
+    TimelineRun& treeRun = runs.back();
+    for (const auto& r : tree)
+        AddTimelineEvents(r, r.deleted || r.underDeletedParent ? TimelineStatus::Deleted : TimelineStatus::Live, treeRun);
+    std::sort(treeRun.events.begin(), treeRun.events.end(), TimelineEventLess);
+
+    ParallelForRanges(vol.clusterCount, [&](ULONGLONG begin, ULONGLONG end, DWORD worker) {
+        TimelineRun& run = runs[worker];
+        ExFatDirTask task;
+        task.orphan = true;
+        std::vector<ExFatFileRecord> records;
+        std::vector<ExFatDirTask> children;
+        std::vector<BYTE> clusterCopy, setCopy;
+        for (ULONGLONG i = begin; i < end; ++i)
+        {
+            const ULONGLONG base = ExFatClusterOffset(vol, static_cast<DWORD>(i + 2));
+            if ((i - begin) % 256 == 0)
+                img.prefetch(base + 256ULL * vol.clusterSize, 256ULL * vol.clusterSize);
+            const BYTE* p = img.span(base, vol.clusterSize, clusterCopy);
+            if (!p)
+                break;
+            char path[64];
+            sprintf_s(path, "/<orphan@%llu>", i + 2);
+            task.path = path;
+            for (size_t pos = 0; pos < vol.clusterSize; pos += 32)
+            {
+                const BYTE t = p[pos];
+                if (t != 0x85 && t != 0x05)
+                    continue;
+                // A set may run into the next cluster; the heap is read as
+                // laid out, which holds for contiguous directories.
+                BYTE e[64];
+                if (img.read(base + pos, e, sizeof(e)) != sizeof(e)
+                    || e[32] != (t == 0x85 ? 0xC0 : 0x40) || e[1] < 2 || e[1] > 18)
+                    continue;
+                const size_t setLength = (e[1] + 1) * 32;
+                const BYTE* set = img.span(base + pos, setLength, setCopy);
+                if (!set || ExFatEntrySetChecksum(set, e[1] + 1, t == 0x05) != LoadLE16(set + 2)
+                    || std::binary_search(treeOffsets.begin(), treeOffsets.end(), base + pos))
+                    continue;
+                records.clear();
+                children.clear();
+                ParseExFatDirectory(vol, set, setLength, std::vector<ULONGLONG>(1, base + pos), task, records, children);
+                for (const auto& r : records)
+                    AddTimelineEvents(r, r.deleted ? TimelineStatus::OrphanedDeleted : TimelineStatus::Orphaned, run);
+            }
+        }
+        std::sort(run.events.begin(), run.events.end(), TimelineEventLess);
+    });
+
+    // Concatenate the sorted runs, then merge neighbours pairwise.
+    std::vector<size_t> bounds(1, 0);
+    for (auto& run : runs)
+    {
+        const DWORD base = static_cast<DWORD>(out.names.size());
+        for (auto& ev : run.events)
+        {
+            ev.nameOffset += base;
+            out.events.push_back(ev);
+        }
+        out.names += run.names;
+        bounds.push_back(out.events.size());
+    }
+    for (size_t width = 1; width + 1 < bounds.size(); width *= 2)
+    {
+        for (size_t i = 0; i + width < bounds.size() - 1; i += 2 * width)
+        {
+            const size_t mid = bounds[i + width];
+            const size_t last = bounds[std::min(i + 2 * width, bounds.size() - 1)];
+            std::inplace_merge(out.events.begin() + bounds[i], out.events.begin() + mid,
+                out.events.begin() + last, TimelineEventLess);
+        }
+    }
+}
+
+static void PrintTimelineEvent(const TimelineEvent& ev, const char* names)
+{
+    char ts[64], sizeBuf[128];
+    FormatExFatTimestamp(ev.dosTime, ev.tenMs, ev.utcOffset, ts, sizeof(ts));
+    if (ev.attributes & 0x10)
+        sprintf_s(sizeBuf, "<DIR>");
+    else
+        FormatBytes(static_cast<LONGLONG>(ev.dataLength), sizeBuf, sizeof(sizeBuf));
+    printf("  %-31s %-9s %-18s %-26s %s%s\n", ts, TimelineKindName(ev.kind), TimelineStatusName(ev.status),
+        sizeBuf, names + ev.nameOffset, ev.checksumValid ? "" : " [checksum mismatch]");
+}
+
+static int CmdTimeline(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: timeline <image> <out.tl> [volume-offset-bytes]");
+
+    std::unique_ptr<ImageReader> img = ImageReader::Open(argv[0]);
+    ExFatVolume vol;
+    if (argc >= 3)
+    {
+        const ULONGLONG offset = _wcstoui64(argv[2], nullptr, 0);
+        if (!OpenExFatVolume(*img, offset, vol))
+        {
+            char msg[256];
+            sprintf_s(msg, "No valid exFAT boot sector at offset 0x%llX", offset);
+            FatalErrorMsg(msg);
+        }
+    }
+    else if (!FindExFatVolume(*img, vol))
+    {
+        FatalErrorMsg("No exFAT volume found in the image.");
+    }
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    TimelineRun timeline;
+    BuildExFatTimeline(*img, vol, timeline);
+
+    TimelineHeader hdr = {};
+    memcpy(hdr.magic, "EXFTL001", 8);
+    hdr.version = g_timelineVersion;
+    hdr.volumeOffset = vol.volumeOffset;
+    hdr.eventCount = timeline.events.size();
+    hdr.eventsOffset = sizeof(TimelineHeader);
+    hdr.namesOffset = hdr.eventsOffset + timeline.events.size() * sizeof(TimelineEvent);
+    hdr.namesBytes = timeline.names.size();
+
+    HandleGuard hOut(CreateFileW(argv[1], GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (!hOut.valid())
+        FatalError("Failed to create timeline file");
+    WriteFileFully(hOut.get(), &hdr, sizeof(hdr), "timeline file");
+    WriteFileFully(hOut.get(), timeline.events.data(), timeline.events.size() * sizeof(TimelineEvent), "timeline file");
+    WriteFileFully(hOut.get(), timeline.names.data(), timeline.names.size(), "timeline file");
+    QueryPerformanceCounter(&now);
+    const double elapsed = (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+
+    ULONGLONG byStatus[4] = {};
+    for (const auto& ev : timeline.events)
+        ++byStatus[static_cast<int>(ev.status)];
+
+    printf("Volume:             offset 0x%llX, %lu clusters of %lu bytes\n", vol.volumeOffset, vol.clusterCount,
+        vol.clusterSize);
+    printf("\n  --- Timeline (UTC where the entry records an offset, otherwise local) ---\n");
+    const size_t maxPrinted = 100;
+    for (size_t i = 0; i < timeline.events.size() && i < maxPrinted; ++i)
+        PrintTimelineEvent(timeline.events[i], timeline.names.c_str());
+    if (timeline.events.size() > maxPrinted)
+        printf("  ... %zu more event(s); use tlquery for a time window\n", timeline.events.size() - maxPrinted);
+
+    printf("\n  Events:             %zu (%llu live, %llu deleted, %llu orphaned, %llu orphaned and deleted)\n",
+        timeline.events.size(), byStatus[0], byStatus[1], byStatus[2], byStatus[3]);
+    printf("  Timeline:           %ls\n", argv[1]);
+    printf("  Build time:         %.2f seconds (%.1f MB/s of cluster heap)\n", elapsed,
+        elapsed > 0 ? static_cast<double>(vol.clusterCount) * vol.clusterSize / elapsed / (1024.0 * 1024.0) : 0.0);
+    return 0;
+}
+
+// "YYYY-MM-DD[ HH:MM[:SS]]" (or 'T' between); missing fields take the start
+// of the period, or its end when 'end' is set.
+static bool ParseTimelineTime(const wchar_t* s, bool end, LONGLONG& key)
+{
+    unsigned v[6] = {};
+    const unsigned last[6] = { 0, 12, 31, 23, 59, 59 };
+    int n = 0;
+    const wchar_t* p = s;
+    while (n < 6 && *p)
+    {
+        wchar_t* next;
+        v[n++] = static_cast<unsigned>(wcstoul(p, &next, 10));
+        if (next == p)
+            return false;
+        p = next;
+        if (*p == L'-' || *p == L':' || *p == L'T' || *p == L' ')
+            ++p;
+    }
+    if (n < 3 || *p || v[1] < 1 || v[1] > 12 || v[2] < 1 || v[2] > 31)
+        return false;
+    for (int i = n; i < 6; ++i)
+        v[i] = end ? last[i] : 0;
+    key = TimelineKey(static_cast<int>(v[0]), v[1], v[2], v[3], v[4], v[5], end ? 99 : 0);
+    return true;
+}
+
+static int CmdTimelineQuery(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+        FatalErrorMsg("Usage: tlquery <timeline> <from> [to]   (YYYY-MM-DD[THH:MM[:SS]], UTC)");
+
+    LONGLONG from, to;
+    if (!ParseTimelineTime(argv[1], false, from) || !ParseTimelineTime(argc >= 3 ? argv[2] : argv[1], true, to))
+        FatalErrorMsg("Times are YYYY-MM-DD, YYYY-MM-DDTHH:MM or YYYY-MM-DDTHH:MM:SS.");
+
+    MappedImage tl(argv[0]);
+    if (tl.size() < sizeof(TimelineHeader))
+        FatalErrorMsg("Timeline file is truncated.");
+    const TimelineHeader* hdr = reinterpret_cast<const TimelineHeader*>(tl.data());
+    if (memcmp(hdr->magic, "EXFTL001", 8) != 0 || hdr->version != g_timelineVersion)
+        FatalErrorMsg("Not a timeline file (bad magic or version).");
+    if (hdr->eventsOffset + hdr->eventCount * sizeof(TimelineEvent) > hdr->namesOffset
+        || hdr->namesOffset + hdr->namesBytes > tl.size() || hdr->namesBytes == 0 || tl.data()[tl.size() - 1] != 0)
+        FatalErrorMsg("Timeline file header is inconsistent.");
+    const TimelineEvent* events = reinterpret_cast<const TimelineEvent*>(tl.data() + hdr->eventsOffset);
+    const TimelineEvent* eventsEnd = events + hdr->eventCount;
+    const char* names = reinterpret_cast<const char*>(tl.data() + hdr->namesOffset);
+
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    const TimelineEvent* first = std::lower_bound(events, eventsEnd, from,
+        [](const TimelineEvent& ev, LONGLONG k) { return ev.key < k; });
+    const TimelineEvent* last = std::upper_bound(first, eventsEnd, to,
+        [](LONGLONG k, const TimelineEvent& ev) { return k < ev.key; });
+    QueryPerformanceCounter(&now);
+
+    printf("Timeline:           %ls (%llu events, volume at 0x%llX)\n\n", argv[0], hdr->eventCount, hdr->volumeOffset);
+    for (const TimelineEvent* ev = first; ev != last; ++ev)
+    {
+        if (ev->nameOffset < hdr->namesBytes)
+            PrintTimelineEvent(*ev, names);
+    }
+    printf("\n  Events in window:   %zu\n", static_cast<size_t>(last - first));
+    printf("  Lookup time:        %.3f ms\n", 1000.0 * (now.QuadPart - start.QuadPart) / freq.QuadPart);
+    return 0;
+}
+
+// ============================================================
+// Image analysis commands
+// ============================================================
+
+struct ImageCommand {
+    const wchar_t* name;
+    const char* usage;
+    int (*run)(int argc, wchar_t* argv[]);
+};
+
+static const ImageCommand g_imageCommands[] = {
+    { L"partitions", "partitions <image> [scan-limit-MiB]   MBR/EBR/GPT tables and stale boot sectors", CmdPartitions },
+    { L"fat",        "fat <image> [volume-offset-bytes]      FAT12/16/32 tree, LFNs, deleted and orphaned entries", CmdFat },
+    { L"mp4carve",   "mp4carve <image> <out-dir> [cluster-KiB]  structure-validated MP4/MOV carving (default 128 KiB clusters)", CmdMp4Carve },
+    { L"nalscan",    "nalscan <image> [merge-gap-KiB] [min-chain-NALs]  map H.264/HEVC NAL streams in headerless data", CmdNalScan },
+    { L"mp4repair",  "mp4repair <reference.mp4> <source> <out.mp4> [offset] [length]  rebuild moov for a headerless mdat", CmdMp4Repair },
+    { L"jpegcarve",  "jpegcarve <image> <out-dir> [cluster-KiB]  Huffman-validated JPEG carving with fragment bridging", CmdJpegCarve },
+    { L"analyze",    "analyze <image>                        one-pass signature/entropy/uniform-region/exFAT analysis", CmdAnalyze },
+    { L"imgdiff",    "imgdiff <image-A> <image-B> [block-bytes]  SIMD block diff: differing extents with uniform class per side", CmdImageDiff },
+    { L"report",     "report <image> <out-base>              one-pass case report: <out-base>.md and <out-base>.json", CmdReport },
+    { L"hashdb",     "hashdb <out.db> <block-bytes> <reference-file>...  block-hash database of known files (512 or 4096 typical)", CmdHashDb },
+    { L"hashscan",   "hashscan <db> <image> [min-run-blocks]  locate blocks of the known files at every sector offset", CmdHashScan },
+    { L"strings",    "strings <image> <out.idx> [min-length]  ASCII/UTF-16LE strings with an on-disk trigram index (default 8)", CmdStrings },
+    { L"strfind",    "strfind <index> <text> [max-results]   case-insensitive substring search through a strings index", CmdStrFind },
+    { L"classify",   "classify <image> [chunk-KiB] [out-base]  label chunks: video/JPEG/compressed/text/erased/whitened (default 64 KiB)", CmdClassify },
+    { L"exfatcheck", "exfatcheck <image> [volume-offset-bytes]  allocation bitmap vs. content: free clusters with data, allocated 0xFF", CmdExFatCheck },
+    { L"timeline",   "timeline <image> <out.tl> [volume-offset-bytes]  sorted exFAT timeline: live, deleted and orphaned entry sets", CmdTimeline },
+    { L"tlquery",    "tlquery <timeline> <from> [to]         events in a UTC window (YYYY-MM-DD[THH:MM[:SS]])", CmdTimelineQuery },
+    { L"hexdump",    "hexdump <image|\\\\.\\PhysicalDriveN|list.extents> <offset> [length]  bytes through the cached random-access reader", CmdHexDump },
+};
+
+static void PrintImageCommandUsage()
+{
+    printf("Usage:\n");
+    printf("  recover_data_from_sd_card.exe              Enumerate drives and image SD card candidates\n");
+    for (const auto& cmd : g_imageCommands)
+        printf("  recover_data_from_sd_card.exe %s\n", cmd.usage);
+    printf("\n  partitions, fat, exfatcheck, timeline and hexdump also read \\\\.\\PhysicalDriveN or a\n"
+        "  *.extents list in place of <image>.\n");
+}
+
+// Offline analysis of a previously captured image. Returns -1 if argv[1] is
+// not a known command.
+static int RunImageCommand(int argc, wchar_t* argv[])
+{
+    for (const auto& cmd : g_imageCommands)
+    {
+        if (_wcsicmp(argv[1], cmd.name) == 0)
+            return cmd.run(argc - 2, argv + 2);
+    }
+    return -1;
+}
+
 // ============================================================
 // Main
 // ============================================================
@@ -2382,11 +11114,23 @@ static void RequireAdministrator()
             "  or launch from an elevated command prompt.");
 }
 
-int wmain()
+int wmain(int argc, wchar_t* argv[])
 {
     printf("SD Card Data Extraction Tool for Windows\n");
     printf("==========================================\n\n");
 
+    // Offline image analysis does not touch any device and needs no elevation.
+    if (argc >= 2)
+    {
+        const int rc = RunImageCommand(argc, argv);
+        if (rc < 0)
+        {
+            PrintImageCommandUsage();
+            return 1;
+        }
+        return rc;
+    }
+
     RequireAdministrator();
     printf("Running as Administrator.\n\n");
 
@@ -2693,12 +11437,11 @@ int wmain()
         if (!hOutput.valid())
             FatalError("Failed to create output image file");
 
-        // Allocate aligned buffer (VirtualAlloc returns page-aligned memory)
+        // Read buffers come from the analysis pipeline (VirtualAlloc, page-aligned).
+        // Analyzers consume each buffer while the next one is being read, so the
+        // report is ready when the last sector lands.
         const DWORD chunkSize = 4 * 1024 * 1024; // 4 MB
-        LPVOID readBuf = VirtualAlloc(nullptr, chunkSize,
-            MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-        if (!readBuf)
-            FatalError("VirtualAlloc failed for read buffer");
+        AcquisitionPipeline pipeline(CreateStreamAnalyzers(), chunkSize, 4);
 
         const LONGLONG totalBytes = sdDrive.geometry.diskSizeBytes;
         LONGLONG bytesRemaining = totalBytes;
@@ -2724,6 +11467,7 @@ int wmain()
             if (sectorSize == 0) sectorSize = 512;
             toRead = ((toRead + sectorSize - 1) / sectorSize) * sectorSize;
 
+            BYTE* readBuf = pipeline.acquire();
             DWORD bytesRead = 0;
             if (!ReadFile(hRawDrive.get(), readBuf, toRead, &bytesRead, nullptr))
             {
@@ -2741,6 +11485,7 @@ int wmain()
             if (bytesWritten != bytesRead)
                 FatalErrorMsg("WriteFile wrote fewer bytes than expected");
 
+            pipeline.publish(totalBytesRead, bytesRead);
             totalBytesRead += bytesRead;
             bytesRemaining -= bytesRead;
 
@@ -2757,8 +11502,6 @@ int wmain()
             }
         }
 
-        VirtualFree(readBuf, 0, MEM_RELEASE);
-
         QueryPerformanceCounter(&now);
         double elapsed = (double)(now.QuadPart - startTime.QuadPart) / perfFreq.QuadPart;
         double speed = (elapsed > 0) ? totalBytesRead / elapsed / (1024.0 * 1024.0) : 0.0;
@@ -2766,6 +11509,31 @@ int wmain()
         printf("\n  Completed: %lld bytes read in %.1f seconds (%.1f MB/s)\n",
             totalBytesRead, elapsed, speed);
 
+        LARGE_INTEGER analysisDone;
+        pipeline.finish(static_cast<ULONGLONG>(totalBytesRead));
+        QueryPerformanceCounter(&analysisDone);
+        printf("  Analysis ready %.2f seconds after the last read.\n",
+            (double)(analysisDone.QuadPart - now.QuadPart) / perfFreq.QuadPart);
+        pipeline.printReport();
+
+        // Case report from the same pass. The image is closed first so it can
+        // be mapped for the partition structures.
+        hOutput = HandleGuard();
+        AcquisitionStats acq;
+        acq.bytesRead = static_cast<ULONGLONG>(totalBytesRead);
+        acq.readSeconds = elapsed;
+        acq.analysisLagSeconds = (double)(analysisDone.QuadPart - now.QuadPart) / perfFreq.QuadPart;
+        acq.chunkSize = chunkSize;
+        WCHAR imagePath[256], reportBase[256];
+        swprintf_s(imagePath, L"%hs", outputPath);
+        swprintf_s(reportBase, L"sd_card_PhysicalDrive%lu_report", sdDrive.driveIndex);
+        if (totalBytesRead > 0)
+        {
+            if (WriteAcquisitionLog(imagePath, sdDrive, acq))
+                printf("\n  Acquisition log:    %ls\n", AcquisitionLogPath(imagePath).c_str());
+            WriteCaseReport(imagePath, reportBase, &sdDrive, &acq, pipeline);
+        }
+
         // lockedVolumes goes out of scope here, releasing all locks via RAII
     }
 